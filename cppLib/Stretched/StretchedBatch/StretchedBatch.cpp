@@ -0,0 +1,355 @@
+// Headless batch runner for design parameter sweeps.
+//
+// Usage: StretchedBatch <variants file> <output directory> [thread count]
+//
+// Every non empty line of the variants file that does not start with '#' is one variant:
+//   <name> [key=value ...]
+// The keys are the fields of StretchedGridFabricBuilder (gridDim, spacing, hydrogelColumns,
+// layerHeight, structuralStiffnessX/Y, bendStiffnessX/Y, shearStiffnessXY/YX, hydrogelStiffnessZ/XY,
+// shrinkRatioZ/XY, biasOffset, fabricMass, hydrogelMass) and the simulation settings: steps, timeStep,
+// integrator (verlet, symplectic, implicit, projective or equilibrium), gravity, floor,
+// selfIntersections, continuousCollisions and sleeping (0 or 1). Anything not given keeps the config.js default.
+// With integrator=equilibrium, levels=<n> first solves n - 1 coarser grids (spacing doubled at each
+// level, same extent) and prolongs each result to the next finer one as its starting shape.
+// record=<n> also writes every n-th step of a time stepped variant to <output directory>/<name>.sttr
+// (see StretchedTrajectoryRecorder), and profile=1 writes the per phase timings and solver counters of
+// the steps to <name>_profile.json and <name>_profile.csv (see StretchedProfiler).
+//
+// The variants run on a thread pool, one variant per worker at a time, each simulation single
+// threaded. The final particle positions of a variant are written to <output directory>/<name>.obj
+// (fabric triangles included) and the timings of all the variants to <output directory>/timings.csv.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "StretchedGridFabricBuilder.h"
+#include "StretchedMultiresolutionSolver.h"
+#include "StretchedParticleSystem.h"
+#include "StretchedThreadPool.h"
+#include "StretchedTrajectoryRecorder.h"
+
+
+struct StretchedBatchVariant {
+	std::string name;
+	StretchedGridFabricBuilder fabric;
+	StretchedIntegrationType integrationType = VERLET;
+	// Minimize the spring energy directly instead of time stepping
+	bool solveEquilibrium = false;
+	// Grids in the coarse-to-fine equilibrium solve (1 solves the fine grid only)
+	int levels = 1;
+	int steps = 1000;
+	// Record a trajectory frame every this many steps (0 records nothing)
+	int recordInterval = 0;
+	double timeStep = DELTA_T;
+	bool useGravity = false;
+	bool useFloorConstraint = true;
+	bool avoidSelfIntersections = false;
+	bool useContinuousCollisions = false;
+	bool useSleeping = false;
+	bool profile = false;
+};
+
+struct StretchedBatchResult {
+	bool succeeded = false;
+	int particleCount = 0;
+	int springCount = 0;
+	// Time steps taken, or solver iterations for the equilibrium solve
+	int iterations = 0;
+	double buildMilliseconds = 0;
+	double simulateMilliseconds = 0;
+	double writeMilliseconds = 0;
+};
+
+static double millisecondsSince(const std::chrono::steady_clock::time_point &start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool parseIntegrator(const std::string &value, StretchedBatchVariant &variant) {
+	variant.solveEquilibrium = false;
+	if (value == "verlet") {
+		variant.integrationType = VERLET;
+	} else if (value == "symplectic") {
+		variant.integrationType = SYMPLECTIC_EULER;
+	} else if (value == "implicit") {
+		variant.integrationType = IMPLICIT_EULER;
+	} else if (value == "projective") {
+		variant.integrationType = PROJECTIVE_DYNAMICS;
+	} else if (value == "equilibrium") {
+		variant.solveEquilibrium = true;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Sets one key=value of a variant, returns false for an unknown key or a bad value
+static bool setVariantParameter(StretchedBatchVariant &variant, const std::string &key, const std::string &value) {
+	if (key == "integrator") {
+		return parseIntegrator(value, variant);
+	}
+
+	char *end = NULL;
+	double number = strtod(value.c_str(), &end);
+	if (value.empty() || *end != '\0') {
+		return false;
+	}
+
+	StretchedGridFabricBuilder &fabric = variant.fabric;
+	struct {
+		const char *key;
+		double *target;
+	} doubleParameters[] = {
+		{ "spacing", &fabric.spacing },
+		{ "fabricMass", &fabric.fabricMass },
+		{ "hydrogelMass", &fabric.hydrogelMass },
+		{ "structuralStiffnessX", &fabric.structuralStiffnessX },
+		{ "structuralStiffnessY", &fabric.structuralStiffnessY },
+		{ "bendStiffnessX", &fabric.bendStiffnessX },
+		{ "bendStiffnessY", &fabric.bendStiffnessY },
+		{ "shearStiffnessXY", &fabric.shearStiffnessXY },
+		{ "shearStiffnessYX", &fabric.shearStiffnessYX },
+		{ "layerHeight", &fabric.layerHeight },
+		{ "hydrogelStiffnessZ", &fabric.hydrogelStiffnessZ },
+		{ "hydrogelStiffnessXY", &fabric.hydrogelStiffnessXY },
+		{ "shrinkRatioZ", &fabric.shrinkRatioZ },
+		{ "shrinkRatioXY", &fabric.shrinkRatioXY },
+		{ "biasOffset", &fabric.biasOffset },
+		{ "timeStep", &variant.timeStep },
+	};
+	for (int i = 0; i < (int)(sizeof(doubleParameters) / sizeof(doubleParameters[0])); i++) {
+		if (key == doubleParameters[i].key) {
+			*doubleParameters[i].target = number;
+			return true;
+		}
+	}
+
+	struct {
+		const char *key;
+		int *target;
+	} intParameters[] = {
+		{ "gridDim", &fabric.gridDim },
+		{ "hydrogelColumns", &fabric.hydrogelColumns },
+		{ "steps", &variant.steps },
+		{ "levels", &variant.levels },
+		{ "record", &variant.recordInterval },
+	};
+	for (int i = 0; i < (int)(sizeof(intParameters) / sizeof(intParameters[0])); i++) {
+		if (key == intParameters[i].key) {
+			*intParameters[i].target = (int)number;
+			return true;
+		}
+	}
+
+	struct {
+		const char *key;
+		bool *target;
+	} boolParameters[] = {
+		{ "gravity", &variant.useGravity },
+		{ "floor", &variant.useFloorConstraint },
+		{ "selfIntersections", &variant.avoidSelfIntersections },
+		{ "continuousCollisions", &variant.useContinuousCollisions },
+		{ "sleeping", &variant.useSleeping },
+		{ "profile", &variant.profile },
+	};
+	for (int i = 0; i < (int)(sizeof(boolParameters) / sizeof(boolParameters[0])); i++) {
+		if (key == boolParameters[i].key) {
+			*boolParameters[i].target = number != 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool readVariants(const char *fileName, std::vector<StretchedBatchVariant> &variants) {
+	FILE *file = fopen(fileName, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open variants file '%s'\n", fileName);
+		return false;
+	}
+	bool succeeded = true;
+	char line[4096];
+	int lineNumber = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		lineNumber++;
+		std::istringstream tokens(line);
+		std::string token;
+		if (!(tokens >> token) || token[0] == '#') {
+			continue;
+		}
+		StretchedBatchVariant variant;
+		variant.name = token;
+		while (tokens >> token) {
+			size_t separator = token.find('=');
+			if (separator == std::string::npos || !setVariantParameter(variant, token.substr(0, separator), token.substr(separator + 1))) {
+				fprintf(stderr, "%s:%d: bad parameter '%s'\n", fileName, lineNumber, token.c_str());
+				succeeded = false;
+			}
+		}
+		variants.push_back(variant);
+	}
+	fclose(file);
+	return succeeded;
+}
+
+static bool writePositions(const std::string &fileName, const StretchedParticleSystem &system) {
+	FILE *file = fopen(fileName.c_str(), "w");
+	if (file == NULL) {
+		return false;
+	}
+	int n = system.getParticleCount();
+	for (int i = 0; i < n; i++) {
+		fprintf(file, "v %.9g %.9g %.9g\n", system.positions.x[i], system.positions.y[i], system.positions.z[i]);
+	}
+	const std::vector<int> &triangles = system.triangleIndices;
+	for (int i = 0; i + 2 < (int)triangles.size(); i += 3) {
+		fprintf(file, "f %d %d %d\n", triangles[i] + 1, triangles[i + 1] + 1, triangles[i + 2] + 1);
+	}
+	bool succeeded = ferror(file) == 0;
+	fclose(file);
+	return succeeded;
+}
+
+// Applies the simulation settings of a variant to one of its systems (the fine one or a coarse level)
+static void applySettings(const StretchedBatchVariant &variant, StretchedThreadPool &threadPool, StretchedParticleSystem &system) {
+	// The variants already keep every core busy, so each simulation runs on its own thread only
+	system.constraintSolver.threadPool = &threadPool;
+	system.springForceKernel.threadPool = &threadPool;
+	system.integrationType = variant.integrationType;
+	system.useGravity = variant.useGravity;
+	system.useFloorConstraint = variant.useFloorConstraint;
+	system.avoidSelfIntersections = variant.avoidSelfIntersections;
+	system.useContinuousCollisions = variant.useContinuousCollisions;
+	system.useSleeping = variant.useSleeping;
+}
+
+static void runVariant(const StretchedBatchVariant &variant, const std::string &outputDirectory, StretchedThreadPool &threadPool, StretchedBatchResult &result) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	StretchedParticleSystem system;
+	applySettings(variant, threadPool, system);
+	system.profiler.enabled = variant.profile;
+	variant.fabric.build(system);
+	// Coarser grids over (at least) the same extent, coarsest first, for the multiresolution solve
+	std::vector<StretchedParticleSystem> coarseSystems(variant.solveEquilibrium ? std::max(0, variant.levels - 1) : 0);
+	for (int l = 0; l < (int)coarseSystems.size(); l++) {
+		applySettings(variant, threadPool, coarseSystems[l]);
+		variant.fabric.coarsen(1 << ((int)coarseSystems.size() - l)).build(coarseSystems[l]);
+	}
+	result.particleCount = system.getParticleCount();
+	result.springCount = system.getSpringCount();
+	result.buildMilliseconds = millisecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	if (variant.solveEquilibrium && !coarseSystems.empty()) {
+		std::vector<StretchedParticleSystem *> levels;
+		for (int l = 0; l < (int)coarseSystems.size(); l++) {
+			levels.push_back(&coarseSystems[l]);
+		}
+		levels.push_back(&system);
+		StretchedMultiresolutionSolver multiresolutionSolver;
+		multiresolutionSolver.solve(levels);
+		// The coarse levels are cheap, only the fine iterations are comparable with a plain solve
+		result.iterations = multiresolutionSolver.getLevelIterations().back();
+	} else if (variant.solveEquilibrium) {
+		result.iterations = system.equilibriumSolver.solve(system);
+	} else {
+		StretchedTrajectoryRecorder recorder;
+		// Dropping frames would make the recordings depend on the load of the machine
+		recorder.blockWhenBehind = true;
+		if (variant.recordInterval > 0 && recorder.begin((outputDirectory + "/" + variant.name + "." + STRETCHED_TRAJECTORY_EXTENSION).c_str(), system.positions)) {
+			recorder.record(system.positions, 0);
+		}
+		for (int i = 0; i < variant.steps; i++) {
+			system.step(variant.timeStep);
+			if (recorder.isRecording() && (i + 1) % variant.recordInterval == 0) {
+				recorder.record(system.positions, (i + 1) * variant.timeStep);
+			}
+		}
+		if (recorder.isRecording() && !recorder.end()) {
+			fprintf(stderr, "Could not write the trajectory of variant '%s'\n", variant.name.c_str());
+		}
+		result.iterations = variant.steps;
+	}
+	result.simulateMilliseconds = millisecondsSince(start);
+	if (variant.profile) {
+		std::string profileName = outputDirectory + "/" + variant.name + "_profile";
+		if (!system.profiler.writeJson((profileName + ".json").c_str()) || !system.profiler.writeCsv((profileName + ".csv").c_str())) {
+			fprintf(stderr, "Could not write the profile of variant '%s'\n", variant.name.c_str());
+		}
+	}
+
+	start = std::chrono::steady_clock::now();
+	result.succeeded = writePositions(outputDirectory + "/" + variant.name + ".obj", system);
+	result.writeMilliseconds = millisecondsSince(start);
+}
+
+static bool writeTimings(const std::string &fileName, const std::vector<StretchedBatchVariant> &variants, const std::vector<StretchedBatchResult> &results) {
+	FILE *file = fopen(fileName.c_str(), "w");
+	if (file == NULL) {
+		return false;
+	}
+	fprintf(file, "name,succeeded,particles,springs,iterations,build_ms,simulate_ms,ms_per_iteration,write_ms\n");
+	for (int i = 0; i < (int)variants.size(); i++) {
+		const StretchedBatchResult &result = results[i];
+		fprintf(file, "%s,%d,%d,%d,%d,%.3f,%.3f,%.6f,%.3f\n", variants[i].name.c_str(), result.succeeded ? 1 : 0,
+			result.particleCount, result.springCount, result.iterations, result.buildMilliseconds, result.simulateMilliseconds,
+			result.iterations > 0 ? result.simulateMilliseconds / result.iterations : 0.0, result.writeMilliseconds);
+	}
+	bool succeeded = ferror(file) == 0;
+	fclose(file);
+	return succeeded;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <variants file> <output directory> [thread count]\n", argv[0]);
+		return 1;
+	}
+	std::vector<StretchedBatchVariant> variants;
+	if (!readVariants(argv[1], variants)) {
+		return 1;
+	}
+	std::string outputDirectory = argv[2];
+	int threadCount = argc > 3 ? atoi(argv[3]) : 0;
+
+	StretchedThreadPool pool(threadCount);
+	std::vector<StretchedBatchResult> results(variants.size());
+	std::atomic<int> nextVariant(0);
+	int variantCount = (int)variants.size();
+	printf("Running %d variants on %d threads\n", variantCount, pool.getThreadCount());
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	// Workers take the next variant as soon as they finish one, so uneven variants still keep every thread busy
+	pool.runOnAllThreads([&](int) {
+		StretchedThreadPool serialPool(1);
+		while (true) {
+			int v = nextVariant++;
+			if (v >= variantCount) {
+				break;
+			}
+			runVariant(variants[v], outputDirectory, serialPool, results[v]);
+			printf("[%d/%d] %s: %d particles, %.1f ms\n", v + 1, variantCount, variants[v].name.c_str(), results[v].particleCount, results[v].simulateMilliseconds);
+		}
+	});
+	double totalMilliseconds = millisecondsSince(start);
+
+	int failures = 0;
+	for (int i = 0; i < variantCount; i++) {
+		if (!results[i].succeeded) {
+			fprintf(stderr, "Could not write the positions of variant '%s'\n", variants[i].name.c_str());
+			failures++;
+		}
+	}
+	if (!writeTimings(outputDirectory + "/timings.csv", variants, results)) {
+		fprintf(stderr, "Could not write %s/timings.csv\n", outputDirectory.c_str());
+		failures++;
+	}
+	printf("Finished %d variants in %.1f ms\n", variantCount, totalMilliseconds);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,339 @@
+// Throughput benchmark of the native fabric simulation.
+//
+// Usage: StretchedBenchmark [key=value ...]
+//   frames=<n>        timed steps per configuration (default 100)
+//   warmup=<n>        untimed steps before them, so caches and factorizations are built (default 5)
+//   minGridDim=<n>    smallest grid (default 15)
+//   maxGridDim=<n>    largest grid (default 1024); the grids are minGridDim, then the powers of two up to maxGridDim
+//   maxThreads=<n>    largest thread count (default: one per core); thread counts are 1, 2, 4, ... and maxThreads
+//   integrator=<name> verlet, symplectic, implicit or projective (default verlet)
+//   sleeping=<0|1>    per tile sleeping (default 0)
+//   core=<precision>  step through StretchedSimCore in double or float instead of StretchedParticleSystem::step
+//                     (verlet, symplectic, or implicit for its linearized backward Euler; single threaded)
+//   decomposed=<0|1>  step through StretchedDomainDecomposition, one subdomain per thread (verlet or symplectic)
+//   csv=<file>        also write the results to a CSV file
+//
+// Every grid is built twice by StretchedGridFabricBuilder (as makeParticlesTest in HydrogelParticleSystem.js
+// does): without hydrogel, and with the config.js hydrogel columns. Each one is stepped for the same number
+// of frames with the simulation threads (the pool of the constraint solver) set to every thread count.
+// Reported per configuration:
+//   particle_steps_per_s  particles x frames / wall seconds of the timed steps
+//   springs_per_s         springs evaluated per second (from the profiler, so sleeping and the Newton
+//                         iterations of the implicit integrator are accounted for)
+//   ms_per_step           mean wall time of a step
+//   memory_mb             growth of the process memory while building and stepping the system
+//   speedup               ms_per_step of 1 thread / ms_per_step of this thread count
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#endif
+
+#include "StretchedDomainDecomposition.h"
+#include "StretchedGridFabricBuilder.h"
+#include "StretchedParticleSystem.h"
+#include "StretchedSimCore.h"
+#include "StretchedThreadPool.h"
+
+
+struct StretchedBenchmarkSettings {
+	int frames = 100;
+	int warmup = 5;
+	int minGridDim = 15;
+	int maxGridDim = 1024;
+	int maxThreads = 0;
+	StretchedIntegrationType integrationType = VERLET;
+	bool useSleeping = false;
+	// Empty, "double" or "float"
+	std::string core;
+	bool decomposed = false;
+	std::string csvFileName;
+};
+
+struct StretchedBenchmarkResult {
+	int gridDim = 0;
+	bool hydrogel = false;
+	int threads = 1;
+	int particleCount = 0;
+	int springCount = 0;
+	double buildMilliseconds = 0;
+	double millisecondsPerStep = 0;
+	double particleStepsPerSecond = 0;
+	double springsPerSecond = 0;
+	double memoryMegabytes = 0;
+	double speedup = 1;
+};
+
+static double millisecondsSince(const std::chrono::steady_clock::time_point &start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Memory committed to the process (private bytes on Windows, resident set elsewhere), 0 if unknown
+static double processMegabytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS_EX counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *)&counters, sizeof(counters))) {
+		return counters.PrivateUsage / (1024.0 * 1024.0);
+	}
+	return 0;
+#else
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (file == NULL) {
+		return 0;
+	}
+	long pages = 0, residentPages = 0;
+	int read = fscanf(file, "%ld %ld", &pages, &residentPages);
+	fclose(file);
+	return read == 2 ? residentPages * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0) : 0;
+#endif
+}
+
+static bool parseSetting(StretchedBenchmarkSettings &settings, const std::string &key, const std::string &value) {
+	if (key == "csv") {
+		settings.csvFileName = value;
+		return true;
+	}
+	if (key == "core") {
+		settings.core = value;
+		return value == "double" || value == "float";
+	}
+	if (key == "integrator") {
+		if (value == "verlet") {
+			settings.integrationType = VERLET;
+		} else if (value == "symplectic") {
+			settings.integrationType = SYMPLECTIC_EULER;
+		} else if (value == "implicit") {
+			settings.integrationType = IMPLICIT_EULER;
+		} else if (value == "projective") {
+			settings.integrationType = PROJECTIVE_DYNAMICS;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	char *end = NULL;
+	long number = strtol(value.c_str(), &end, 10);
+	if (value.empty() || *end != '\0') {
+		return false;
+	}
+	struct {
+		const char *key;
+		int *target;
+	} intSettings[] = {
+		{ "frames", &settings.frames },
+		{ "warmup", &settings.warmup },
+		{ "minGridDim", &settings.minGridDim },
+		{ "maxGridDim", &settings.maxGridDim },
+		{ "maxThreads", &settings.maxThreads },
+	};
+	for (int i = 0; i < (int)(sizeof(intSettings) / sizeof(intSettings[0])); i++) {
+		if (key == intSettings[i].key) {
+			*intSettings[i].target = (int)number;
+			return true;
+		}
+	}
+	if (key == "sleeping") {
+		settings.useSleeping = number != 0;
+		return true;
+	}
+	if (key == "decomposed") {
+		settings.decomposed = number != 0;
+		return true;
+	}
+	return false;
+}
+
+// Warms up and times the steps of the system loaded in a simulation core, returns the seconds taken
+template <class Core>
+static double runCore(const StretchedBenchmarkSettings &settings, StretchedParticleSystem &system) {
+	Core core;
+	if (!core.load(system)) {
+		return 0;
+	}
+	core.steps(settings.warmup, (typename Core::ScalarType)DELTA_T);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	core.steps(settings.frames, (typename Core::ScalarType)DELTA_T);
+	double seconds = millisecondsSince(start) * 1e-3;
+	core.store(system);
+	return seconds;
+}
+
+// Warms up and times the steps of the system split into one subdomain per thread, returns the seconds taken
+static double runDecomposed(const StretchedBenchmarkSettings &settings, StretchedParticleSystem &system, int threads) {
+	StretchedDomainDecomposition decomposition;
+	decomposition.domainCount = threads;
+	if (!decomposition.load(system)) {
+		return 0;
+	}
+	decomposition.steps(settings.warmup);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	decomposition.steps(settings.frames);
+	double seconds = millisecondsSince(start) * 1e-3;
+	decomposition.store(system);
+	return seconds;
+}
+
+// Picks the integrator policy once, outside the timed steps
+template <class Scalar>
+static double runCorePolicy(const StretchedBenchmarkSettings &settings, StretchedParticleSystem &system) {
+	switch (settings.integrationType) {
+		case SYMPLECTIC_EULER:
+			return runCore<StretchedSimCore<Scalar, StretchedSymplecticEulerPolicy> >(settings, system);
+		case IMPLICIT_EULER:
+			return runCore<StretchedSimCore<Scalar, StretchedLinearImplicitEulerPolicy> >(settings, system);
+		default:
+			return runCore<StretchedSimCore<Scalar, StretchedVerletPolicy> >(settings, system);
+	}
+}
+
+static void runConfiguration(const StretchedBenchmarkSettings &settings, int gridDim, bool hydrogel, StretchedThreadPool &threadPool, StretchedBenchmarkResult &result) {
+	result.gridDim = gridDim;
+	result.hydrogel = hydrogel;
+	result.threads = threadPool.getThreadCount();
+
+	double startMegabytes = processMegabytes();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	StretchedParticleSystem system;
+	system.constraintSolver.threadPool = &threadPool;
+	system.springForceKernel.threadPool = &threadPool;
+	system.integrationType = settings.integrationType;
+	system.useSleeping = settings.useSleeping;
+	StretchedGridFabricBuilder fabric;
+	fabric.gridDim = gridDim;
+	if (!hydrogel) {
+		fabric.hydrogelColumns = 0;
+	}
+	fabric.build(system);
+	result.particleCount = system.getParticleCount();
+	result.springCount = system.getSpringCount();
+	result.buildMilliseconds = millisecondsSince(start);
+
+	double seconds = 0;
+	if (!settings.core.empty()) {
+		seconds = settings.core == "float" ? runCorePolicy<float>(settings, system) : runCorePolicy<double>(settings, system);
+	} else if (settings.decomposed) {
+		seconds = runDecomposed(settings, system, threadPool.getThreadCount());
+	} else {
+		for (int i = 0; i < settings.warmup; i++) {
+			system.step();
+		}
+		system.profiler.enabled = true;
+		system.profiler.historyLength = 0;
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < settings.frames; i++) {
+			system.step();
+		}
+		seconds = millisecondsSince(start) * 1e-3;
+	}
+	result.memoryMegabytes = std::max(0.0, processMegabytes() - startMegabytes);
+
+	int frames = std::max(1, settings.frames);
+	result.millisecondsPerStep = seconds * 1e3 / frames;
+	result.particleStepsPerSecond = seconds > 0 ? (double)result.particleCount * settings.frames / seconds : 0;
+	if (settings.core.empty() && !settings.decomposed) {
+		result.springsPerSecond = seconds > 0 ? system.profiler.getTotalCount(PROFILE_SPRINGS_EVALUATED) / seconds : 0;
+	} else {
+		// The explicit cores evaluate every spring once per step (the implicit one once more per CG iteration)
+		result.springsPerSecond = seconds > 0 ? (double)result.springCount * settings.frames / seconds : 0;
+	}
+}
+
+static bool writeResults(const std::string &fileName, const std::vector<StretchedBenchmarkResult> &results) {
+	FILE *file = fopen(fileName.c_str(), "w");
+	if (file == NULL) {
+		return false;
+	}
+	fprintf(file, "grid_dim,hydrogel,threads,particles,springs,build_ms,ms_per_step,particle_steps_per_s,springs_per_s,memory_mb,speedup\n");
+	for (int i = 0; i < (int)results.size(); i++) {
+		const StretchedBenchmarkResult &result = results[i];
+		fprintf(file, "%d,%d,%d,%d,%d,%.3f,%.6f,%.0f,%.0f,%.2f,%.3f\n", result.gridDim, result.hydrogel ? 1 : 0, result.threads,
+			result.particleCount, result.springCount, result.buildMilliseconds, result.millisecondsPerStep, result.particleStepsPerSecond,
+			result.springsPerSecond, result.memoryMegabytes, result.speedup);
+	}
+	bool succeeded = ferror(file) == 0;
+	fclose(file);
+	return succeeded;
+}
+
+int main(int argc, char *argv[]) {
+	StretchedBenchmarkSettings settings;
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		size_t separator = argument.find('=');
+		if (separator == std::string::npos || !parseSetting(settings, argument.substr(0, separator), argument.substr(separator + 1))) {
+			fprintf(stderr, "Bad argument '%s'\n", argv[i]);
+			fprintf(stderr, "Usage: %s [frames=<n>] [warmup=<n>] [minGridDim=<n>] [maxGridDim=<n>] [maxThreads=<n>] [integrator=<name>] [sleeping=<0|1>] [core=<double|float>] [decomposed=<0|1>] [csv=<file>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<int> gridDims;
+	for (int gridDim = settings.minGridDim; gridDim <= settings.maxGridDim; ) {
+		gridDims.push_back(gridDim);
+		// Powers of two after the first grid, at least doubling
+		int next = 1;
+		while (next < 2 * gridDim) {
+			next *= 2;
+		}
+		gridDim = next;
+	}
+	if (!settings.core.empty() && settings.integrationType == PROJECTIVE_DYNAMICS) {
+		fprintf(stderr, "The simulation cores have no projective dynamics integrator\n");
+		return 1;
+	}
+	if (settings.decomposed && (settings.integrationType == IMPLICIT_EULER || settings.integrationType == PROJECTIVE_DYNAMICS || settings.useSleeping || !settings.core.empty())) {
+		fprintf(stderr, "The domain decomposition only steps the verlet and symplectic integrators, without sleeping or a core\n");
+		return 1;
+	}
+	int maxThreads = settings.maxThreads > 0 ? settings.maxThreads : std::max(1, (int)std::thread::hardware_concurrency());
+	if (!settings.core.empty()) {
+		maxThreads = 1;
+	}
+	std::vector<int> threadCounts;
+	for (int threads = 1; threads < maxThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	printf("%8s %8s %7s %10s %10s %12s %16s %16s %10s %8s\n", "gridDim", "hydrogel", "threads", "particles", "springs",
+		"ms/step", "particle-steps/s", "springs/s", "memory MB", "speedup");
+	std::vector<StretchedBenchmarkResult> results;
+	for (int g = 0; g < (int)gridDims.size(); g++) {
+		for (int h = 0; h < 2; h++) {
+			double serialMilliseconds = 0;
+			for (int t = 0; t < (int)threadCounts.size(); t++) {
+				StretchedThreadPool threadPool(threadCounts[t]);
+				StretchedBenchmarkResult result;
+				runConfiguration(settings, gridDims[g], h == 1, threadPool, result);
+				if (t == 0) {
+					serialMilliseconds = result.millisecondsPerStep;
+				}
+				result.speedup = result.millisecondsPerStep > 0 ? serialMilliseconds / result.millisecondsPerStep : 1;
+				results.push_back(result);
+				printf("%8d %8s %7d %10d %10d %12.3f %16.0f %16.0f %10.1f %8.2f\n", result.gridDim, result.hydrogel ? "yes" : "no",
+					result.threads, result.particleCount, result.springCount, result.millisecondsPerStep, result.particleStepsPerSecond,
+					result.springsPerSecond, result.memoryMegabytes, result.speedup);
+				fflush(stdout);
+			}
+		}
+	}
+
+	if (!settings.csvFileName.empty() && !writeResults(settings.csvFileName, results)) {
+		fprintf(stderr, "Could not write %s\n", settings.csvFileName.c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1434 @@
+// Regression checks of the native fabric simulation.
+//
+// Usage: StretchedChecks [name ...]
+//   Runs the named checks, or all of them. Prints PASS or FAIL (with what differed) per check and
+//   returns the number of failed checks.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "StretchedCheckpoint.h"
+#include "StretchedDesignFabric.h"
+#include "StretchedDomainDecomposition.h"
+#include "StretchedExtrusionIndex.h"
+#include "StretchedGridFabricBuilder.h"
+#include "StretchedHessianAssembler.h"
+#include "StretchedHydrogelLayerBuilder.h"
+#include "StretchedMultiresolutionSolver.h"
+#include "StretchedParticleReordering.h"
+#include "StretchedParticleSystem.h"
+#include "StretchedProfiler.h"
+#include "StretchedSimCore.h"
+#include "StretchedSpatialHash.h"
+#include "StretchedSprings.h"
+#include "StretchedTrajectoryPlayer.h"
+#include "StretchedTriangle.h"
+
+
+// Two free particles on a stretched spring oscillate about their center of mass, which stays put, between
+// the starting stretch and the same compression, with no damping
+static bool checkSpringPairOscillatesAboutCenter() {
+	StretchedParticleSystem system;
+	system.useFloorConstraint = false;
+	system.useVelocityDamping = false;
+	int a = system.addParticle(P3D(0, 1, 0), 1);
+	int b = system.addParticle(P3D(1.5, 1, 0), 1);
+	system.addSpringWithRestLength(a, b, 1, 10, FABRIC_SPRING_STRUCTURAL);
+
+	double shortest = 1.5, longest = 0, centerDrift = 0;
+	for (int k = 0; k < 1000; k++) {
+		system.step();
+		P3D pa = system.getParticlePosition(a), pb = system.getParticlePosition(b);
+		double distance = (pb - pa).length();
+		shortest = std::min(shortest, distance);
+		longest = std::max(longest, distance);
+		centerDrift = std::max(centerDrift, (P3D(0.75, 1, 0) - P3D((pa[0] + pb[0]) / 2, (pa[1] + pb[1]) / 2, (pa[2] + pb[2]) / 2)).length());
+	}
+	if (centerDrift > 1e-12 || fabs(shortest - 0.5) > 0.01 || longest > 1.51) {
+		printf("  center moved by %g, distance between %g and %g (expected 0.5 to 1.5)\n", centerDrift, shortest, longest);
+		return false;
+	}
+	return true;
+}
+
+// Backward Euler only removes energy: a spring far too stiff for an explicit step at DELTA_T loses energy
+// every step instead of blowing up
+static bool checkImplicitEulerStiffSpringLosesEnergy() {
+	StretchedParticleSystem system;
+	system.integrationType = IMPLICIT_EULER;
+	system.useFloorConstraint = false;
+	system.useVelocityDamping = false;
+	int a = system.addParticle(P3D(0, 1, 0), 1);
+	int b = system.addParticle(P3D(1.5, 1, 0), 1);
+	double stiffness = 1e5;
+	system.addSpringWithRestLength(a, b, 1, stiffness, FABRIC_SPRING_STRUCTURAL);
+
+	double energy = 0.5 * stiffness * 0.25;
+	for (int k = 0; k < 200; k++) {
+		system.step();
+		double stretch = (system.getParticlePosition(b) - system.getParticlePosition(a)).length() - 1;
+		double kineticEnergy = 0;
+		for (int i = 0; i < 2; i++) {
+			kineticEnergy += 0.5 * system.masses[i] * (system.velocities.x[i] * system.velocities.x[i] + system.velocities.y[i] * system.velocities.y[i] + system.velocities.z[i] * system.velocities.z[i]);
+		}
+		double nextEnergy = kineticEnergy + 0.5 * stiffness * stretch * stretch;
+		if (!(nextEnergy <= energy)) {
+			printf("  energy rose from %g to %g at step %d\n", energy, nextEnergy, k);
+			return false;
+		}
+		energy = nextEnergy;
+	}
+	return true;
+}
+
+// Projective dynamics factors its matrix once and reuses it until the system is edited, and brings a
+// stretched spring pair to rest at its rest length
+static bool checkProjectiveDynamicsReusesFactorization() {
+	StretchedParticleSystem system;
+	system.integrationType = PROJECTIVE_DYNAMICS;
+	system.useFloorConstraint = false;
+	int a = system.addParticle(P3D(0, 1, 0), 1);
+	int b = system.addParticle(P3D(1.5, 1, 0), 1);
+	system.addSpringWithRestLength(a, b, 1, 100, FABRIC_SPRING_STRUCTURAL);
+	for (int k = 0; k < 500; k++) {
+		system.step();
+	}
+	const StretchedProjectiveDynamicsSolver &solver = system.projectiveDynamicsSolver;
+	double distance = (system.getParticlePosition(b) - system.getParticlePosition(a)).length();
+	if (solver.getAnalyzeCount() != 1 || solver.getFactorizationCount() != 1 || fabs(distance - 1) > 1e-3) {
+		printf("  %d analyses, %d factorizations for 500 steps, spring length %g (rest length 1)\n", solver.getAnalyzeCount(), solver.getFactorizationCount(), distance);
+		return false;
+	}
+
+	// Edits that keep the counts need topologyChanged, fixing a particle refactors by itself
+	system.springs.stiffnesses[0] = 200;
+	system.topologyChanged();
+	system.step();
+	system.pinParticle(a);
+	system.step();
+	system.step();
+	if (solver.getAnalyzeCount() != 3 || solver.getFactorizationCount() != 3) {
+		printf("  %d analyses, %d factorizations after two edits (expected 3 and 3)\n", solver.getAnalyzeCount(), solver.getFactorizationCount());
+		return false;
+	}
+	return true;
+}
+
+// Every SIMD level this CPU runs gives the spring forces of the scalar kernel bit for bit
+static bool checkSimdSpringForcesMatchScalar() {
+	StretchedGridFabricBuilder builder;
+	StretchedParticleSystem system;
+	builder.build(system);
+	for (int i = 0; i < system.getParticleCount(); i++) {
+		system.positions.x[i] += 0.05 * sin(i * 78.233);
+		system.positions.y[i] += 0.05 * sin(i * 12.9898);
+	}
+
+	StretchedVectorArray reference;
+	reference.resize(system.getParticleCount());
+	StretchedSpringForceKernel kernel;
+	kernel.simdLevel = SIMD_SCALAR;
+	kernel.accumulateForces(system.springs, system.positions, reference);
+	StretchedSimdLevel best = StretchedSpringForceKernel::detectSimdLevel();
+	for (int level = SIMD_SSE2; level <= best; level++) {
+		StretchedVectorArray forces;
+		forces.resize(system.getParticleCount());
+		kernel.simdLevel = (StretchedSimdLevel)level;
+		kernel.accumulateForces(system.springs, system.positions, forces);
+		if (forces.x != reference.x || forces.y != reference.y || forces.z != reference.z) {
+			printf("  %s forces differ from the scalar ones\n", StretchedSpringForceKernel::getSimdLevelName((StretchedSimdLevel)level));
+			return false;
+		}
+	}
+	return true;
+}
+
+// Sum over the area constraints of |area - rest area|
+static double computeAreaError(const StretchedParticleSystem &system) {
+	double error = 0;
+	const std::vector<StretchedTriangleAreaConstraint> &constraints = system.constraintSolver.getTriangleAreaConstraints();
+	for (int c = 0; c < (int)constraints.size(); c++) {
+		const StretchedTriangleAreaConstraint &constraint = constraints[c];
+		error += fabs(StretchedTriangle::calculateArea(system.getParticlePosition(constraint.a), system.getParticlePosition(constraint.b),
+			system.getParticlePosition(constraint.c)) - constraint.area);
+	}
+	return error;
+}
+
+// No two constraints of a color share a particle, so projecting the colors in parallel gives the same
+// positions for any thread count; the projection brings disturbed triangles back towards their rest areas
+static bool checkColoredConstraintsMatchAcrossThreadCounts() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 61;
+	StretchedThreadPool serialPool(1), parallelPool(4);
+	StretchedParticleSystem serial, parallel;
+	StretchedParticleSystem *systems[2] = { &serial, &parallel };
+	StretchedThreadPool *pools[2] = { &serialPool, &parallelPool };
+	double disturbedError = 0;
+	for (int s = 0; s < 2; s++) {
+		StretchedParticleSystem &system = *systems[s];
+		builder.build(system);
+		system.constraintSolver.threadPool = pools[s];
+		for (int t = 0; t + 2 < (int)system.triangleIndices.size(); t += 3) {
+			system.addBendConstraint(system.triangleIndices[t], system.triangleIndices[t + 1], system.triangleIndices[t + 2], 0.5);
+		}
+		system.createTriangleAreaConstraints(1);
+		for (int i = 0; i < system.getParticleCount(); i++) {
+			system.positions.y[i] += 0.2 * sin(i * 12.9898);
+		}
+		disturbedError = computeAreaError(system);
+		system.constraintSolver.project(system);
+	}
+
+	if (serial.constraintSolver.getColorCount() < 2) {
+		printf("  %d colors\n", serial.constraintSolver.getColorCount());
+		return false;
+	}
+	if (serial.positions.x != parallel.positions.x || serial.positions.y != parallel.positions.y || serial.positions.z != parallel.positions.z) {
+		printf("  1 and 4 threads project to different positions\n");
+		return false;
+	}
+	double projectedError = computeAreaError(serial);
+	if (!(projectedError < disturbedError)) {
+		printf("  area error %g before the projection, %g after\n", disturbedError, projectedError);
+		return false;
+	}
+	return true;
+}
+
+// The hash finds the pairs a brute force search finds, and diverged (NaN or huge) points do not break it
+static bool checkSpatialHashPairsMatchBruteForce() {
+	StretchedVectorArray points;
+	points.resize(500);
+	for (int i = 0; i < points.size(); i++) {
+		points.x[i] = fmod(fabs(sin(i * 78.233) * 43758.5453), 1.0);
+		points.y[i] = fmod(fabs(sin(i * 12.9898) * 43758.5453), 1.0);
+		points.z[i] = fmod(fabs(sin(i * 37.719) * 43758.5453), 1.0);
+	}
+	points.x[7] = sqrt(-1.0);
+	points.y[11] = 1e300;
+	points.z[13] = -1e300;
+	double radius = 0.05;
+
+	std::vector<int> expectedA, expectedB;
+	for (int a = 0; a < points.size(); a++) {
+		for (int b = a + 1; b < points.size(); b++) {
+			double dx = points.x[a] - points.x[b], dy = points.y[a] - points.y[b], dz = points.z[a] - points.z[b];
+			if (dx * dx + dy * dy + dz * dz < radius * radius) {
+				expectedA.push_back(a);
+				expectedB.push_back(b);
+			}
+		}
+	}
+	StretchedSpatialHash hash;
+	hash.build(points, 2 * radius);
+	std::vector<int> pairsA, pairsB;
+	hash.findPairs(points, radius, pairsA, pairsB);
+	if (expectedA.empty() || pairsA != expectedA || pairsB != expectedB) {
+		printf("  %d pairs found, %d expected\n", (int)pairsA.size(), (int)expectedA.size());
+		return false;
+	}
+	return true;
+}
+
+// A triangle falling through a fixed one over a step is stopped above it
+static bool checkContinuousCollisionStopsFallingTriangle() {
+	StretchedParticleSystem system;
+	double corners[3][2] = { { -1, -1 }, { 1, -1 }, { 0, 1 } };
+	for (int layer = 0; layer < 2; layer++) {
+		for (int c = 0; c < 3; c++) {
+			system.addParticle(P3D(corners[c][0], 0, corners[c][1]), 1);
+			system.triangleIndices.push_back(system.getParticleCount() - 1);
+		}
+	}
+	for (int i = 0; i < 3; i++) {
+		system.pinParticle(i);
+	}
+	system.previousPositions = system.positions;
+	for (int i = 3; i < 6; i++) {
+		system.previousPositions.y[i] = 0.1;
+		system.positions.y[i] = -0.1;
+	}
+
+	int collidingCount = system.collisionSolver.resolve(system, 0.01);
+	if (collidingCount == 0) {
+		printf("  no collision found\n");
+		return false;
+	}
+	for (int i = 3; i < 6; i++) {
+		if (!(system.positions.y[i] > 0)) {
+			printf("  particle %d ends at height %g\n", i, system.positions.y[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+// The coarse levels of a multiresolution solve cover the whole fine fabric, with at most one coarse
+// spacing to spare
+static bool checkCoarseFabricCoversFineExtent() {
+	for (int gridDim = 2; gridDim <= 40; gridDim++) {
+		StretchedGridFabricBuilder fine;
+		fine.gridDim = gridDim;
+		for (int scale = 2; scale <= 8; scale *= 2) {
+			StretchedGridFabricBuilder coarse = fine.coarsen(scale);
+			StretchedParticleSystem fineSystem, coarseSystem;
+			fine.build(fineSystem);
+			coarse.build(coarseSystem);
+			double fineExtent = 0, coarseExtent = 0;
+			for (int i = 0; i < fineSystem.getParticleCount(); i++) {
+				fineExtent = std::max(fineExtent, std::max(fineSystem.positions.x[i], fineSystem.positions.z[i]));
+			}
+			for (int i = 0; i < coarseSystem.getParticleCount(); i++) {
+				coarseExtent = std::max(coarseExtent, std::max(coarseSystem.positions.x[i], coarseSystem.positions.z[i]));
+			}
+			if (coarseExtent < fineExtent - 1e-9 || coarseExtent >= fineExtent + coarse.spacing) {
+				printf("  gridDim %d at scale %d: coarse extent %g, fine extent %g\n", gridDim, scale, coarseExtent, fineExtent);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Sum of 1/2 |x_i - target_i|^2, the unweighted shape matching loss of computeShapeGradient
+static double computeShapeLoss(const StretchedParticleSystem &system, const StretchedVectorArray &target) {
+	double loss = 0;
+	for (int i = 0; i < target.size(); i++) {
+		P3D d = system.getParticlePosition(i) - target.getPoint(i);
+		loss += 0.5 * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+	return loss;
+}
+
+// The adjoint derivative of the shape loss by the rest length ratios agrees with central differences of
+// re-solved equilibria, on the springs the loss depends on most. The springs of the hydrogel rows sit at
+// their rest lengths along soft modes, where the differences swing with the step, so they are not used.
+static bool checkShapeGradientMatchesFiniteDifferences() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 5;
+	builder.hydrogelColumns = 2;
+	StretchedParticleSystem system;
+	builder.build(system);
+	StretchedVectorArray target = system.positions;
+	for (int i = 0; i < 2 * builder.gridDim; i++) {
+		system.pinParticle(i);
+	}
+	system.useFloorConstraint = false;
+	system.equilibriumSolver.tolerance = 1e-10;
+	system.solveEquilibrium();
+	if (!system.equilibriumSolver.hasConverged()) {
+		printf("  no convergence after %d iterations\n", system.equilibriumSolver.getLastIterations());
+		return false;
+	}
+	StretchedVectorArray solved = system.positions;
+	std::vector<double> weights, ratioGradient, stiffnessGradient;
+	if (system.equilibriumSolver.computeShapeGradient(system, target, weights, ratioGradient, stiffnessGradient) < 0) {
+		printf("  shape gradient failed\n");
+		return false;
+	}
+
+	std::vector<int> order((int)ratioGradient.size());
+	for (int s = 0; s < (int)order.size(); s++) {
+		order[s] = s;
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return fabs(ratioGradient[a]) > fabs(ratioGradient[b]); });
+	const double h = 1e-4;
+	for (int k = 0; k < 6; k++) {
+		int s = order[k];
+		double restLength = system.springs.restLengths[s];
+		double ratio = system.springs.restLengthRatios[s];
+		double losses[2];
+		for (int side = 0; side < 2; side++) {
+			double perturbed = side == 0 ? ratio + h : ratio - h;
+			system.springs.restLengthRatios[s] = perturbed;
+			system.springs.restLengths[s] = restLength * perturbed / ratio;
+			system.positions = solved;
+			system.previousPositions = solved;
+			system.solveEquilibrium();
+			losses[side] = computeShapeLoss(system, target);
+		}
+		system.springs.restLengthRatios[s] = ratio;
+		system.springs.restLengths[s] = restLength;
+		double difference = (losses[0] - losses[1]) / (2 * h);
+		if (fabs(difference - ratioGradient[s]) > 1e-2 * fabs(ratioGradient[s])) {
+			printf("  spring %d: adjoint %.6g, central difference %.6g\n", s, ratioGradient[s], difference);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Warm starting the rest shape solve from coarser grids of the same fabric leaves fewer iterations on the
+// fine grid than solving it from flat
+static bool checkMultiresolutionSavesFineIterations() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 21;
+	StretchedParticleSystem single;
+	builder.build(single);
+	int singleIterations = single.solveEquilibrium();
+	for (int count = 2; count <= 3; count++) {
+		std::vector<StretchedParticleSystem> systems(count);
+		std::vector<StretchedParticleSystem *> levels;
+		for (int l = 0; l < count; l++) {
+			builder.coarsen(1 << (count - 1 - l)).build(systems[l]);
+			levels.push_back(&systems[l]);
+		}
+		StretchedMultiresolutionSolver multiresolutionSolver;
+		int fineIterations = multiresolutionSolver.solve(levels);
+		if (!systems.back().equilibriumSolver.hasConverged() || fineIterations >= singleIterations) {
+			printf("  %d levels: %d fine iterations (converged %d), %d from flat\n", count, fineIterations, systems.back().equilibriumSolver.hasConverged(), singleIterations);
+			return false;
+		}
+	}
+	return true;
+}
+
+// A flat fabric with one corner lifted: the far tiles fall asleep while the corner drops, are woken by their
+// neighbours as the disturbance reaches them, and once the fabric settles every tile sleeps, no spring is
+// evaluated, and the fabric is where it comes to rest without sleeping
+static bool checkSleepingTilesWakeAndSettle() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 32;
+	builder.hydrogelColumns = 0;
+	builder.biasOffset = 0;
+	StretchedParticleSystem plain, sleeping;
+	builder.build(plain);
+	builder.build(sleeping);
+	sleeping.useSleeping = true;
+	for (StretchedParticleSystem *system : { &plain, &sleeping }) {
+		P3D corner = system->getParticlePosition(0);
+		corner[system->upAxis] += 0.5;
+		system->positions.set(0, corner);
+		system->previousPositions.set(0, corner);
+	}
+
+	bool wokenByNeighbours = false;
+	int previousSleeping = 0;
+	int steps = 0;
+	// The tiles are built by the first step
+	while (steps == 0 || (steps < 20000 && sleeping.sleepTracker.getSleepingTileCount() < sleeping.sleepTracker.getTileCount())) {
+		plain.step();
+		sleeping.step();
+		steps++;
+		int sleepingTiles = sleeping.sleepTracker.getSleepingTileCount();
+		wokenByNeighbours |= sleepingTiles < previousSleeping;
+		previousSleeping = sleepingTiles;
+	}
+	if (!wokenByNeighbours) {
+		printf("  no sleeping tile was woken by its neighbours\n");
+		return false;
+	}
+	// The active springs are gathered at the start of a step
+	plain.step();
+	sleeping.step();
+	if (sleeping.sleepTracker.getSleepingTileCount() < sleeping.sleepTracker.getTileCount() || sleeping.sleepTracker.getActiveSpringCount() != 0) {
+		printf("  %d of %d tiles asleep and %d springs evaluated after %d steps\n", sleeping.sleepTracker.getSleepingTileCount(), sleeping.sleepTracker.getTileCount(),
+			sleeping.sleepTracker.getActiveSpringCount(), steps);
+		return false;
+	}
+	double largestDifference = 0;
+	for (int i = 0; i < plain.getParticleCount(); i++) {
+		largestDifference = std::max(largestDifference, (plain.getParticlePosition(i) - sleeping.getParticlePosition(i)).length());
+	}
+	if (largestDifference > 1e-2 * builder.spacing) {
+		printf("  asleep %g away from the fabric without sleeping after %d steps\n", largestDifference, steps);
+		return false;
+	}
+	return true;
+}
+
+// A system restored from a checkpoint written mid-run continues bit for bit like the original, and a
+// truncated checkpoint is rejected
+static bool checkCheckpointRestoresExactly() {
+	const char *fileName = "StretchedChecks.stck";
+	const char *truncatedName = "StretchedChecksTruncated.stck";
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 9;
+	builder.hydrogelColumns = 3;
+	StretchedParticleSystem original;
+	builder.build(original);
+	original.addZeroLengthSpring(0);
+	original.createTriangleAreaConstraints(0.01);
+	for (int k = 0; k < 300; k++) {
+		original.step();
+	}
+	if (!StretchedCheckpoint::write(original, fileName, 1.5)) {
+		printf("  could not write %s\n", fileName);
+		return false;
+	}
+
+	StretchedParticleSystem restored;
+	StretchedCheckpoint checkpoint;
+	bool restoredOk = checkpoint.open(fileName) && checkpoint.getHeader().time == 1.5 && checkpoint.restore(restored);
+	uint64_t fileSize = checkpoint.isOpen() ? checkpoint.getHeader().fileSize : 0;
+	checkpoint.close();
+	if (!restoredOk) {
+		printf("  could not restore %s\n", fileName);
+		remove(fileName);
+		return false;
+	}
+	for (int k = 0; k < 300; k++) {
+		original.step();
+		restored.step();
+	}
+	bool identical = restored.getParticleCount() == original.getParticleCount();
+	for (int i = 0; identical && i < original.getParticleCount(); i++) {
+		identical = restored.positions.x[i] == original.positions.x[i] && restored.positions.y[i] == original.positions.y[i] && restored.positions.z[i] == original.positions.z[i];
+	}
+	if (!identical) {
+		printf("  the restored system went its own way\n");
+		remove(fileName);
+		return false;
+	}
+
+	std::vector<char> bytes((size_t)fileSize);
+	FILE *file = fopen(fileName, "rb");
+	size_t read = file != NULL ? fread(bytes.data(), 1, bytes.size(), file) : 0;
+	if (file != NULL) {
+		fclose(file);
+	}
+	file = fopen(truncatedName, "wb");
+	if (file != NULL) {
+		fwrite(bytes.data(), 1, read / 2, file);
+		fclose(file);
+	}
+	bool truncatedOpened = checkpoint.open(truncatedName);
+	checkpoint.close();
+	remove(fileName);
+	remove(truncatedName);
+	if (read != bytes.size() || truncatedOpened) {
+		printf("  read %d of %d bytes, truncated checkpoint opened %d\n", (int)read, (int)bytes.size(), truncatedOpened);
+		return false;
+	}
+	return true;
+}
+
+// A settling fabric plays back within half a quantization step of every recorded position, whether the
+// frames are read forward or seeking backwards from the keyframes, and records to a tenth of the raw size
+static bool checkTrajectoryPlaysBackQuantized() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 9;
+	builder.hydrogelColumns = 3;
+	StretchedParticleSystem system;
+	builder.build(system);
+	std::vector<char> bytes;
+	StretchedVectorSink sink(&bytes);
+	StretchedTrajectoryRecorder recorder;
+	recorder.keyframeInterval = 30;
+	recorder.blockWhenBehind = true;
+	std::vector<StretchedVectorArray> recorded;
+	// Recorded while it settles, past the first violent buckling
+	for (int k = 0; k < 10000; k++) {
+		system.step();
+	}
+	recorder.begin(&sink, system.positions);
+	for (int frame = 0; frame < 200; frame++) {
+		for (int k = 0; k < 10; k++) {
+			system.step();
+		}
+		recorded.push_back(system.positions);
+		recorder.record(system.positions, frame);
+	}
+	if (!recorder.end() || recorder.getRecordedFrameCount() != (int)recorded.size() || recorder.getWrittenBytes() * 10 > recorder.getRawBytes()) {
+		printf("  recorded %d of %d frames in %d bytes, %d raw\n", recorder.getRecordedFrameCount(), (int)recorded.size(), (int)recorder.getWrittenBytes(),
+			(int)recorder.getRawBytes());
+		return false;
+	}
+
+	StretchedTrajectoryPlayer player;
+	if (!player.open(bytes.data(), bytes.size()) || player.getFrameCount() != (int)recorded.size()) {
+		printf("  could not open the recording\n");
+		return false;
+	}
+	double tolerance = 0.5 * player.getHeader().step * (1 + 1e-9);
+	StretchedVectorArray positions;
+	for (int pass = 0; pass < 2; pass++) {
+		for (int k = 0; k < (int)recorded.size(); k++) {
+			int frame = pass == 0 ? k : (int)recorded.size() - 1 - k;
+			if (!player.readFrame(frame, positions) || player.getFrameTime(frame) != frame) {
+				printf("  could not read frame %d\n", frame);
+				return false;
+			}
+			for (int i = 0; i < system.getParticleCount(); i++) {
+				if (fabs(positions.x[i] - recorded[frame].x[i]) > tolerance || fabs(positions.y[i] - recorded[frame].y[i]) > tolerance
+					|| fabs(positions.z[i] - recorded[frame].z[i]) > tolerance) {
+					printf("  particle %d of frame %d is more than %g off\n", i, frame, tolerance);
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// Percentiles are the step times themselves, of the kept steps only: steps taking 1..100 us in shuffled
+// order have a median of 50 us and a p99 of 99 us, and 75 us and 100 us when only the last 50 are kept
+static bool checkProfilerPercentilesAreStepTimes() {
+	for (int kept = 100; kept >= 50; kept -= 50) {
+		StretchedProfiler profiler;
+		profiler.enabled = true;
+		profiler.historyLength = kept;
+		for (int k = 0; k < 100; k++) {
+			// Ascending in the last 50 steps, shuffled before
+			int microseconds = k < 50 ? 1 + (k * 37) % 50 : k + 1;
+			profiler.beginStep();
+			profiler.addTime(PROFILE_STEP, microseconds * 1000);
+			profiler.endStep();
+		}
+		double median = profiler.getPercentileSeconds(PROFILE_STEP, 0.5) * 1e6;
+		double p99 = profiler.getPercentileSeconds(PROFILE_STEP, 0.99) * 1e6;
+		double expectedMedian = kept == 100 ? 50 : 75;
+		double expectedP99 = kept == 100 ? 99 : 100;
+		if (fabs(median - expectedMedian) > 1e-9 || fabs(p99 - expectedP99) > 1e-9) {
+			printf("  %d steps kept: median %g us (expected %g), p99 %g us (expected %g)\n", kept, median, expectedMedian, p99, expectedP99);
+			return false;
+		}
+	}
+	return true;
+}
+
+// The benchmark's spring throughput comes from the profiler: an explicit step evaluates every spring once,
+// an implicit one once per Newton iteration, and a fabric whose tiles all sleep none
+static bool checkProfilerCountsEvaluatedSprings() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 9;
+	const StretchedIntegrationType integrators[] = { VERLET, SYMPLECTIC_EULER, IMPLICIT_EULER };
+	for (int k = 0; k < 3; k++) {
+		StretchedParticleSystem system;
+		builder.build(system);
+		system.integrationType = integrators[k];
+		system.profiler.enabled = true;
+		system.step();
+		int64_t expected = (int64_t)system.getSpringCount();
+		if (integrators[k] == IMPLICIT_EULER) {
+			expected *= system.implicitIntegrator.getLastNewtonIterations();
+		}
+		int64_t counted = system.profiler.getLastCount(PROFILE_SPRINGS_EVALUATED);
+		if (counted != expected || expected == 0 || system.profiler.getLastSeconds(PROFILE_STEP) <= 0) {
+			printf("  integrator %d: %lld springs counted, %lld evaluated\n", (int)integrators[k], (long long)counted, (long long)expected);
+			return false;
+		}
+	}
+
+	// A flat fabric without hydrogel lies still on the floor and falls asleep
+	builder.hydrogelColumns = 0;
+	builder.biasOffset = 0;
+	StretchedParticleSystem system;
+	builder.build(system);
+	system.useSleeping = true;
+	system.profiler.enabled = true;
+	for (int k = 0; k < 100; k++) {
+		system.step();
+	}
+	int64_t counted = system.profiler.getLastCount(PROFILE_SPRINGS_EVALUATED);
+	if (system.sleepTracker.getSleepingTileCount() != system.sleepTracker.getTileCount() || counted != 0) {
+		printf("  %d of %d tiles asleep, %lld springs counted\n", system.sleepTracker.getSleepingTileCount(), system.sleepTracker.getTileCount(), (long long)counted);
+		return false;
+	}
+	return true;
+}
+
+// Largest distance between the particles of the core, stored into a copy of its system, and the system run
+// by StretchedParticleSystem::step
+template <class Core>
+static double runCoreAgainstStep(const StretchedGridFabricBuilder &builder, StretchedIntegrationType integrationType, int stepCount) {
+	StretchedParticleSystem reference, stored;
+	builder.build(reference);
+	reference.addZeroLengthSpring(0);
+	reference.integrationType = integrationType;
+	builder.build(stored);
+	stored.addZeroLengthSpring(0);
+	Core core;
+	if (!core.load(reference)) {
+		return -1;
+	}
+	for (int k = 0; k < stepCount; k++) {
+		reference.step();
+	}
+	core.steps(stepCount, (typename Core::ScalarType)DELTA_T);
+	core.store(stored);
+	double largest = 0;
+	for (int i = 0; i < reference.getParticleCount(); i++) {
+		largest = std::max(largest, (reference.getParticlePosition(i) - stored.getParticlePosition(i)).length());
+	}
+	return largest;
+}
+
+// The templated core runs the loops of StretchedParticleSystem::step: in double it steps a pinned fabric
+// with hydrogel bit for bit like it, in float close to it until the fabric buckles (which amplifies any
+// rounding difference into a different fold), and it refuses a system with constraints
+static bool checkSimCoreMatchesStep() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 9;
+	builder.hydrogelColumns = 3;
+	double verlet = runCoreAgainstStep<StretchedSimCoreVerletDouble>(builder, VERLET, 300);
+	double symplectic = runCoreAgainstStep<StretchedSimCoreSymplecticDouble>(builder, SYMPLECTIC_EULER, 300);
+	if (verlet != 0 || symplectic != 0) {
+		printf("  double core differs from the step by %g (Verlet), %g (symplectic Euler)\n", verlet, symplectic);
+		return false;
+	}
+	double single = runCoreAgainstStep<StretchedSimCoreVerletFloat>(builder, VERLET, 30);
+	if (single < 0 || single > 1e-3 * builder.spacing) {
+		printf("  float core differs from the step by %g\n", single);
+		return false;
+	}
+
+	StretchedParticleSystem constrained;
+	builder.build(constrained);
+	constrained.createTriangleAreaConstraints(0.01);
+	StretchedSimCoreVerletDouble core;
+	if (core.load(constrained)) {
+		printf("  core loaded a system with area constraints\n");
+		return false;
+	}
+	return true;
+}
+
+// Springs added in mixed type order and removed at random stay grouped by type, every spring keeps its
+// values, and the reported moves say where each one went. The rest length identifies the spring.
+static bool checkSpringTableKeepsTypesGrouped() {
+	StretchedSpringTable table;
+	// Rest length of the spring at each index, maintained through the reported moves only
+	std::vector<double> tracked;
+	unsigned int random = 12345;
+	int nextId = 1;
+	for (int k = 0; k < 2000; k++) {
+		random = random * 1664525u + 1013904223u;
+		std::vector<int> moves;
+		if (table.size() > 0 && (random >> 16) % 3 == 0) {
+			int s = (int)((random >> 8) % (unsigned int)table.size());
+			table.remove(s, &moves);
+			for (int m = 0; m < (int)moves.size(); m += 2) {
+				tracked[moves[m + 1]] = tracked[moves[m]];
+			}
+			tracked.pop_back();
+		} else {
+			StretchedSpringType type = (StretchedSpringType)(FABRIC_SPRING_STRUCTURAL + (random >> 20) % SPRING_TABLE_TYPE_COUNT);
+			int id = nextId++;
+			tracked.push_back(0);
+			int s = table.add(id, id + 1, id, 1.0, type, 1.0, &moves);
+			for (int m = 0; m < (int)moves.size(); m += 2) {
+				tracked[moves[m + 1]] = tracked[moves[m]];
+			}
+			tracked[s] = id;
+		}
+
+		for (int t = 0; t < SPRING_TABLE_TYPE_COUNT; t++) {
+			StretchedSpringType type = (StretchedSpringType)(FABRIC_SPRING_STRUCTURAL + t);
+			int expectedStart = t == 0 ? 0 : table.getTypeEnd((StretchedSpringType)(type - 1));
+			if (table.getTypeStart(type) != expectedStart || table.getTypeEnd(type) < expectedStart) {
+				printf("  operation %d: range of type %d is [%d, %d)\n", k, (int)type, table.getTypeStart(type), table.getTypeEnd(type));
+				return false;
+			}
+			for (int s = table.getTypeStart(type); s < table.getTypeEnd(type); s++) {
+				if (table.types[s] != type) {
+					printf("  operation %d: spring %d of type %d in the range of type %d\n", k, s, (int)table.types[s], (int)type);
+					return false;
+				}
+			}
+		}
+		if (table.getTypeEnd(HYDROGEL_TO_HYDROGEL_SPRING) != table.size() || (int)tracked.size() != table.size()) {
+			printf("  operation %d: %d springs, ranges end at %d\n", k, table.size(), table.getTypeEnd(HYDROGEL_TO_HYDROGEL_SPRING));
+			return false;
+		}
+		for (int s = 0; s < table.size(); s++) {
+			if (tracked[s] != table.restLengths[s] || table.indicesA[s] != (int)table.restLengths[s] || table.indicesB[s] != table.indicesA[s] + 1) {
+				printf("  operation %d: spring %d is %g, moves say %g\n", k, s, table.restLengths[s], tracked[s]);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Outline of an extrusion: count points on a circle, each nudged along it so no four are cocircular
+static std::vector<P3D> makeCircleOutline(double centerX, double centerZ, double radius, int count, unsigned int &random) {
+	std::vector<P3D> points;
+	const double turn = 2 * acos(-1.0);
+	for (int i = 0; i < count; i++) {
+		random = random * 1664525u + 1013904223u;
+		double angle = turn * (i + 0.2 * (random >> 8) / 16777216.0) / count;
+		points.push_back(P3D(centerX + radius * cos(angle), 0, centerZ + radius * sin(angle)));
+	}
+	return points;
+}
+
+// Lower end, higher end and type of every spring, sorted, with the rest lengths in the same order
+static void getSortedSprings(const StretchedParticleSystem &system, std::vector<std::vector<int> > &ends, std::vector<double> &restLengths) {
+	std::vector<int> order(system.springs.size());
+	for (int s = 0; s < (int)order.size(); s++) {
+		order[s] = s;
+	}
+	const StretchedSpringTable &springs = system.springs;
+	auto key = [&](int s) {
+		return std::vector<int>{ std::min(springs.indicesA[s], springs.indicesB[s]), std::max(springs.indicesA[s], springs.indicesB[s]), (int)springs.types[s] };
+	};
+	std::sort(order.begin(), order.end(), [&](int r, int s) { return key(r) < key(s); });
+	ends.clear();
+	restLengths.clear();
+	for (int s : order) {
+		ends.push_back(key(s));
+		restLengths.push_back(springs.restLengths[s]);
+	}
+}
+
+// The triangles of the system, each rotated to start at its lowest particle, sorted
+static std::vector<std::vector<int> > getSortedTriangles(const StretchedParticleSystem &system) {
+	std::vector<std::vector<int> > triangles;
+	for (int t = 0; t + 2 < (int)system.triangleIndices.size(); t += 3) {
+		std::vector<int> triangle(system.triangleIndices.begin() + t, system.triangleIndices.begin() + t + 3);
+		std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+		triangles.push_back(triangle);
+	}
+	std::sort(triangles.begin(), triangles.end());
+	return triangles;
+}
+
+// The attached system has the particles, triangles and springs a full rebuild from the design
+// triangulation makes
+static bool matchesFullRebuild(const StretchedDesignFabric &fabric, const StretchedParticleSystem &system) {
+	DelaunayTriangulation triangulation = fabric.getTriangulation();
+	StretchedParticleSystem rebuilt;
+	rebuilt.makeParticles(triangulation.getTriangulationPts(), triangulation.getTriangulationIndices());
+	rebuilt.createFabricSprings();
+	if (system.getParticleCount() != rebuilt.getParticleCount() || getSortedTriangles(system) != getSortedTriangles(rebuilt)) {
+		printf("  %d particles, %d rebuilt; the triangles %s\n", system.getParticleCount(), rebuilt.getParticleCount(),
+			getSortedTriangles(system) == getSortedTriangles(rebuilt) ? "match" : "differ");
+		return false;
+	}
+	for (int i = 0; i < system.getParticleCount(); i++) {
+		if ((system.getParticlePosition(i) - rebuilt.getParticlePosition(i)).length() > 0) {
+			printf("  particle %d is not on its design point\n", i);
+			return false;
+		}
+	}
+	std::vector<std::vector<int> > ends, rebuiltEnds;
+	std::vector<double> restLengths, rebuiltRestLengths;
+	getSortedSprings(system, ends, restLengths);
+	getSortedSprings(rebuilt, rebuiltEnds, rebuiltRestLengths);
+	if (ends != rebuiltEnds) {
+		printf("  %d springs, %d rebuilt\n", (int)ends.size(), (int)rebuiltEnds.size());
+		return false;
+	}
+	for (int s = 0; s < (int)restLengths.size(); s++) {
+		if (fabs(restLengths[s] - rebuiltRestLengths[s]) > 1e-9) {
+			printf("  spring %d-%d rests at %g, rebuilt at %g\n", ends[s][0], ends[s][1], restLengths[s], rebuiltRestLengths[s]);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Adding, moving and removing extrusions of an attached design patches the system into what a full rebuild
+// makes, and a single edit on a large design replaces a small part of its triangles
+static bool checkDesignFabricPatchesLikeRebuild() {
+	unsigned int random = 777;
+	auto next = [&](double range) {
+		random = random * 1664525u + 1013904223u;
+		return range * (random >> 8) / 16777216.0;
+	};
+	StretchedDesignFabric fabric;
+	StretchedParticleSystem system;
+	std::vector<int> extrusions;
+	for (int i = 0; i < 6; i++) {
+		extrusions.push_back(fabric.addExtrusion(makeCircleOutline(next(4) - 2, next(4) - 2, 0.3 + next(1), 12, random)));
+	}
+	fabric.attach(&system);
+	if (!matchesFullRebuild(fabric, system)) {
+		return false;
+	}
+	for (int edit = 0; edit < 60; edit++) {
+		int operation = (int)next(3);
+		if (operation == 0 || extrusions.empty()) {
+			extrusions.push_back(fabric.addExtrusion(makeCircleOutline(next(6) - 3, next(6) - 3, 0.2 + next(1), 3 + (int)next(17), random)));
+		} else if (operation == 1) {
+			int k = (int)next((double)extrusions.size());
+			fabric.removeExtrusion(extrusions[k]);
+			extrusions.erase(extrusions.begin() + k);
+		} else {
+			int k = (int)next((double)extrusions.size());
+			fabric.moveExtrusion(extrusions[k], makeCircleOutline(next(6) - 3, next(6) - 3, 0.2 + next(1), 3 + (int)next(17), random));
+		}
+		if (!matchesFullRebuild(fabric, system)) {
+			printf("  after edit %d (operation %d)\n", edit, operation);
+			return false;
+		}
+	}
+
+	StretchedDesignFabric large;
+	StretchedParticleSystem largeSystem;
+	for (int i = 0; i < 400; i++) {
+		large.addExtrusion(makeCircleOutline((i % 20) * 0.5, (i / 20) * 0.5, 0.15, 10, random));
+	}
+	large.attach(&largeSystem);
+	large.moveExtrusion(210, makeCircleOutline(2.2, 7.3, 0.1, 10, random));
+	if (large.getLastChangedTriangleCount() == 0 || large.getLastChangedTriangleCount() > large.getTriangleCount() / 10 || !matchesFullRebuild(large, largeSystem)) {
+		printf("  moving one extrusion replaced %d of %d triangles\n", large.getLastChangedTriangleCount(), large.getTriangleCount());
+		return false;
+	}
+	return true;
+}
+
+// Assembles the spring Hessian of the implicit step (mass diagonal, spring blocks, pins) into the assembler,
+// and the same entries as triplets, the way the integrator built it before the assembler. Returns whether
+// the assembler rebuilt its pattern.
+static bool assembleSpringHessian(const StretchedParticleSystem &system, StretchedHessianAssembler &assembler, StretchedSparseMatrix &reference) {
+	int n = system.getParticleCount();
+	std::vector<StretchedSparseTriplet> triplets;
+	bool rebuilt = assembler.begin(system);
+	for (int i = 0; i < n; i++) {
+		double m = system.inverseMasses[i] == 0 ? 1.0 : system.masses[i] / (DELTA_T * DELTA_T);
+		assembler.setDiagonal(i, m);
+		for (int c = 0; c < 3; c++) {
+			triplets.push_back(StretchedSparseTriplet(3 * i + c, 3 * i + c, m));
+		}
+	}
+	const StretchedSpringTable &springs = system.springs;
+	for (int s = 0; s < springs.size(); s++) {
+		int a = springs.indicesA[s], b = springs.indicesB[s];
+		V3D d = system.getParticlePosition(a) - system.getParticlePosition(b);
+		double length = d.length();
+		double u[3] = { d[0] / length, d[1] / length, d[2] / length };
+		double c = std::max(0.0, 1 - springs.restLengths[s] / length);
+		double k = springs.stiffnesses[s];
+		bool aFree = system.inverseMasses[a] != 0, bFree = system.inverseMasses[b] != 0;
+		assembler.addSpring(s, a, b, u, k, c, aFree, bFree);
+		int blocks[4][3] = { { a, a, aFree }, { b, b, bFree }, { a, b, aFree && bFree }, { b, a, aFree && bFree } };
+		for (int q = 0; q < 4; q++) {
+			if (!blocks[q][2]) {
+				continue;
+			}
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 3; j++) {
+					double value = k * ((1 - c) * u[i] * u[j] + (i == j ? c : 0));
+					triplets.push_back(StretchedSparseTriplet(3 * blocks[q][0] + i, 3 * blocks[q][1] + j, q < 2 ? value : -value));
+				}
+			}
+		}
+	}
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	for (int s = 0; s < pins.size(); s++) {
+		int a = pins.indices[s];
+		if (system.inverseMasses[a] == 0) {
+			continue;
+		}
+		assembler.addToDiagonal(a, pins.stiffnesses[s]);
+		for (int c = 0; c < 3; c++) {
+			triplets.push_back(StretchedSparseTriplet(3 * a + c, 3 * a + c, pins.stiffnesses[s]));
+		}
+	}
+	reference.setFromTriplets(3 * n, 3 * n, triplets);
+	return rebuilt;
+}
+
+// Largest difference between the entries of two matrices of the same size, over the entries of either
+static double getLargestEntryDifference(const StretchedSparseMatrix &a, const StretchedSparseMatrix &b) {
+	double largest = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		const StretchedSparseMatrix &m = pass == 0 ? a : b;
+		for (int row = 0; row < m.getRowCount(); row++) {
+			for (int e = m.rowStarts[row]; e < m.rowStarts[row + 1]; e++) {
+				largest = std::max(largest, fabs(a.getValue(row, m.columnIndices[e]) - b.getValue(row, m.columnIndices[e])));
+			}
+		}
+	}
+	return largest;
+}
+
+// The assembled Hessian has the entries of the triplet assembly (up to the order the duplicates are summed
+// in). The pattern is built once and kept while
+// the particles move or get pinned, and rebuilt when a spring is added.
+static bool checkHessianPatternIsReused() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 5;
+	builder.hydrogelColumns = 2;
+	StretchedParticleSystem system;
+	builder.build(system);
+	system.addZeroLengthSpring(6);
+	system.pinParticle(12);
+	for (int k = 0; k < 20; k++) {
+		system.step();
+	}
+
+	StretchedHessianAssembler assembler;
+	StretchedSparseMatrix reference;
+	const char *stages[] = { "first assembly", "after stepping", "after pinning", "after adding a spring" };
+	for (int stage = 0; stage < 4; stage++) {
+		if (stage == 1) {
+			system.step();
+		} else if (stage == 2) {
+			system.pinParticle(3);
+		} else if (stage == 3) {
+			system.addSpring(0, system.getParticleCount() - 1, 1.0, FABRIC_SPRING_BEND);
+		}
+		bool rebuilt = assembleSpringHessian(system, assembler, reference);
+		double difference = getLargestEntryDifference(assembler.getMatrix(), reference);
+		double largestEntry = 0;
+		for (double value : reference.values) {
+			largestEntry = std::max(largestEntry, fabs(value));
+		}
+		bool expectRebuild = stage == 0 || stage == 3;
+		if (rebuilt != expectRebuild || difference > 1e-14 * largestEntry || assembler.getMatrix().getRowCount() != reference.getRowCount()) {
+			printf("  %s: pattern %s, entries differ by %g\n", stages[stage], rebuilt ? "rebuilt" : "kept", difference);
+			return false;
+		}
+	}
+	return true;
+}
+
+// The spring forces split over any number of threads, and computed with any of the SIMD levels, step a
+// fabric bit for bit like a single thread of scalar code
+static bool checkSpringForcesIgnoreThreadCount() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 40;
+	builder.hydrogelColumns = 6;
+	StretchedThreadPool single(1);
+	StretchedParticleSystem reference;
+	builder.build(reference);
+	reference.springForceKernel.threadPool = &single;
+	reference.springForceKernel.simdLevel = SIMD_SCALAR;
+	for (int k = 0; k < 30; k++) {
+		reference.step();
+	}
+
+	const int threadCounts[] = { 2, 3, 5 };
+	for (int t = 0; t < 3; t++) {
+		StretchedThreadPool pool(threadCounts[t]);
+		for (int level = SIMD_SCALAR; level <= StretchedSpringForceKernel::detectSimdLevel(); level++) {
+			StretchedParticleSystem system;
+			builder.build(system);
+			system.springForceKernel.threadPool = &pool;
+			system.springForceKernel.simdLevel = (StretchedSimdLevel)level;
+			for (int k = 0; k < 30; k++) {
+				system.step();
+			}
+			for (int i = 0; i < system.getParticleCount(); i++) {
+				if ((system.getParticlePosition(i) - reference.getParticlePosition(i)).length() != 0) {
+					printf("  %d threads, %s: particle %d differs by %g\n", threadCounts[t], StretchedSpringForceKernel::getSimdLevelName((StretchedSimdLevel)level),
+						i, (system.getParticlePosition(i) - reference.getParticlePosition(i)).length());
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// Split into any number of subdomains, a pinned fabric with hydrogel steps bit for bit like
+// StretchedParticleSystem::step, exchanging the ends of the cut springs through the halos, and an implicit
+// system is refused
+static bool checkDomainDecompositionMatchesStep() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 24;
+	builder.hydrogelColumns = 4;
+	const StretchedIntegrationType integrators[] = { VERLET, SYMPLECTIC_EULER };
+	for (int k = 0; k < 2; k++) {
+		StretchedParticleSystem reference;
+		builder.build(reference);
+		reference.addZeroLengthSpring(0);
+		reference.integrationType = integrators[k];
+		for (int domainCount = 1; domainCount <= 4; domainCount++) {
+			StretchedParticleSystem system;
+			builder.build(system);
+			system.addZeroLengthSpring(0);
+			system.integrationType = integrators[k];
+			StretchedDomainDecomposition decomposition;
+			decomposition.domainCount = domainCount;
+			decomposition.pinThreads = false;
+			if (!decomposition.load(system)) {
+				printf("  integrator %d, %d domains: not loaded\n", (int)integrators[k], domainCount);
+				return false;
+			}
+			if (domainCount > 1 && (decomposition.getHaloParticleCount() == 0 || decomposition.getCutSpringCount() == 0)) {
+				printf("  %d domains with no halo\n", domainCount);
+				return false;
+			}
+			decomposition.steps(100);
+			decomposition.store(system);
+			if (domainCount == 1) {
+				for (int s = 0; s < 100; s++) {
+					reference.step();
+				}
+			}
+			for (int i = 0; i < system.getParticleCount(); i++) {
+				double difference = (system.getParticlePosition(i) - reference.getParticlePosition(i)).length();
+				if (difference != 0) {
+					printf("  integrator %d, %d domains: particle %d differs by %g\n", (int)integrators[k], domainCount, i, difference);
+					return false;
+				}
+			}
+		}
+	}
+
+	StretchedParticleSystem implicit;
+	builder.build(implicit);
+	implicit.integrationType = IMPLICIT_EULER;
+	StretchedDomainDecomposition decomposition;
+	decomposition.domainCount = 2;
+	decomposition.pinThreads = false;
+	if (decomposition.load(implicit)) {
+		printf("  an implicit system was loaded\n");
+		return false;
+	}
+	return true;
+}
+
+// A triangulated grid whose points come in shuffled order
+static void makeShuffledGridFabric(StretchedParticleSystem &system, int gridDim) {
+	std::vector<int> slots(gridDim * gridDim);
+	for (int i = 0; i < (int)slots.size(); i++) {
+		slots[i] = i;
+	}
+	unsigned int random = 4242;
+	for (int i = (int)slots.size() - 1; i > 0; i--) {
+		random = random * 1664525u + 1013904223u;
+		std::swap(slots[i], slots[(random >> 8) % (unsigned int)(i + 1)]);
+	}
+	std::vector<P3D> points(slots.size());
+	for (int i = 0; i < (int)slots.size(); i++) {
+		points[slots[i]] = P3D((i % gridDim) * FABRIC_PARTICLE_SPACING, 0, (i / gridDim) * FABRIC_PARTICLE_SPACING);
+	}
+	std::vector<int> indices;
+	for (int row = 0; row + 1 < gridDim; row++) {
+		for (int col = 0; col + 1 < gridDim; col++) {
+			int corner = row * gridDim + col;
+			int triangles[6] = { corner, corner + gridDim, corner + 1, corner + 1, corner + gridDim, corner + gridDim + 1 };
+			for (int k = 0; k < 6; k++) {
+				indices.push_back(slots[triangles[k]]);
+			}
+		}
+	}
+	system.makeParticles(points, indices);
+	system.createFabricSprings();
+	system.addZeroLengthSpring(slots[0]);
+	system.createTriangleAreaConstraints(0.01);
+}
+
+// Area constraints of a system, as sorted (a, b, c) triples in the original numbering
+static std::vector<std::vector<int> > getOriginalAreaConstraints(const StretchedParticleSystem &system, const StretchedParticleReordering &reordering) {
+	std::vector<std::vector<int> > triples;
+	for (const StretchedTriangleAreaConstraint &constraint : system.constraintSolver.getTriangleAreaConstraints()) {
+		std::vector<int> triple = { reordering.getOriginalIndex(constraint.a), reordering.getOriginalIndex(constraint.b), reordering.getOriginalIndex(constraint.c) };
+		std::rotate(triple.begin(), std::min_element(triple.begin(), triple.end()), triple.end());
+		triples.push_back(triple);
+	}
+	std::sort(triples.begin(), triples.end());
+	return triples;
+}
+
+// Reverse Cuthill-McKee renumbering of a shuffled fabric narrows its springs to a small band, keeps the
+// spring types sorted by particle and renames the constraints, and the mapping brings a run of the
+// renumbered fabric back to the original order where it matches the run of the shuffled one up to the
+// order the forces are summed in
+static bool checkReorderingNarrowsBandAndMapsBack() {
+	const int gridDim = 20;
+	StretchedParticleSystem original, reordered;
+	makeShuffledGridFabric(original, gridDim);
+	makeShuffledGridFabric(reordered, gridDim);
+	for (StretchedParticleSystem *system : { &original, &reordered }) {
+		int last = system->getParticleCount() - 1;
+		P3D corner = system->getParticlePosition(last);
+		corner[system->upAxis] += 0.5;
+		system->positions.set(last, corner);
+		system->previousPositions.set(last, corner);
+	}
+	StretchedParticleReordering reordering;
+	reordering.apply(reordered);
+	if (reordering.getBandwidthAfter() > 2 * gridDim || reordering.getBandwidthBefore() < 4 * reordering.getBandwidthAfter()) {
+		printf("  bandwidth %d before, %d after\n", reordering.getBandwidthBefore(), reordering.getBandwidthAfter());
+		return false;
+	}
+	for (int i = 0; i < reordered.getParticleCount(); i++) {
+		if (reordering.getNewIndex(reordering.getOriginalIndex(i)) != i) {
+			printf("  particle %d does not map back to itself\n", i);
+			return false;
+		}
+	}
+	const StretchedSpringTable &springs = reordered.springs;
+	for (int t = FABRIC_SPRING_STRUCTURAL; t <= HYDROGEL_TO_HYDROGEL_SPRING; t++) {
+		StretchedSpringType type = (StretchedSpringType)t;
+		for (int s = springs.getTypeStart(type) + 1; s < springs.getTypeEnd(type); s++) {
+			if (std::min(springs.indicesA[s - 1], springs.indicesB[s - 1]) > std::min(springs.indicesA[s], springs.indicesB[s])) {
+				printf("  springs %d and %d of type %d are out of order\n", s - 1, s, t);
+				return false;
+			}
+		}
+	}
+	StretchedParticleReordering identity;
+	if (getOriginalAreaConstraints(reordered, reordering) != getOriginalAreaConstraints(original, identity)) {
+		printf("  the area constraints were not renamed with the particles\n");
+		return false;
+	}
+
+	// The constraints are colored again from the new order, and projecting them in another order changes
+	// more than rounding, so the runs are compared on the springs
+	original.constraintSolver.clear();
+	reordered.constraintSolver.clear();
+	// Bend springs across every edge make a triangulated fabric stiffer than a grid one: half the time step
+	// keeps the lifted corner stable
+	for (int k = 0; k < 200; k++) {
+		original.step(DELTA_T / 2);
+		reordered.step(DELTA_T / 2);
+	}
+	StretchedVectorArray mapped;
+	reordering.toOriginalOrder(reordered.positions, mapped);
+	double largest = 0;
+	for (int i = 0; i < original.getParticleCount(); i++) {
+		largest = std::max(largest, (mapped.getPoint(i) - original.getParticlePosition(i)).length());
+	}
+	if (largest > 1e-9) {
+		printf("  the renumbered run differs by %g in the original order\n", largest);
+		return false;
+	}
+	return true;
+}
+
+// On a triangulated 11x11 grid, an open extrusion along a row and a closed square outline get hydrogel one
+// layer above their points and the inside of the square. Every hydrogel spring is shrunk from the length it
+// was made at; the row's hydrogel is tied down to its neighbours off the row and joined along it to the
+// next and the one after, and a vertex inside the square, with no neighbour outside it, to all of them.
+static bool checkHydrogelLayerFollowsExtrusions() {
+	const int gridDim = 11;
+	std::vector<P3D> points;
+	std::vector<int> indices;
+	for (int i = 0; i < gridDim * gridDim; i++) {
+		points.push_back(P3D(i % gridDim, 0, i / gridDim));
+	}
+	for (int row = 0; row + 1 < gridDim; row++) {
+		for (int col = 0; col + 1 < gridDim; col++) {
+			int corner = row * gridDim + col;
+			int triangles[6] = { corner, corner + gridDim, corner + 1, corner + 1, corner + gridDim, corner + gridDim + 1 };
+			indices.insert(indices.end(), triangles, triangles + 6);
+		}
+	}
+	StretchedExtrusion line, square;
+	for (int x = 1; x <= 8; x++) {
+		line.addPoint(P3D(x, 0, 2));
+	}
+	const int corners[5][2] = { { 2, 5 }, { 6, 5 }, { 6, 9 }, { 2, 9 }, { 2, 5 } };
+	for (int side = 0; side < 4; side++) {
+		for (int k = 0; k < 4; k++) {
+			square.addPoint(P3D(corners[side][0] + (corners[side + 1][0] - corners[side][0]) * k / 4, 0, corners[side][1] + (corners[side + 1][1] - corners[side][1]) * k / 4));
+		}
+	}
+	square.addPoint(P3D(corners[0][0], 0, corners[0][1]));
+	auto onLine = [](const P3D &p) { return p[2] == 2 && p[0] >= 1 && p[0] <= 8; };
+
+	StretchedHydrogelLayerBuilder builder;
+	StretchedParticleSystem system;
+	int hydrogelCount = builder.build(DelaunayTriangulation(points, indices), { &line, &square }, system);
+	int fabricCount = gridDim * gridDim;
+	if (hydrogelCount != 8 + 16 + 9 || system.getParticleCount() != fabricCount + hydrogelCount) {
+		printf("  %d hydrogel particles, expected 33\n", hydrogelCount);
+		return false;
+	}
+	// Fabric vertex under each hydrogel particle
+	std::vector<int> vertexBelow(system.getParticleCount(), -1);
+	for (int h = fabricCount; h < system.getParticleCount(); h++) {
+		P3D p = system.getParticlePosition(h);
+		int v = (int)p[2] * gridDim + (int)p[0];
+		if ((system.getParticlePosition(v) + V3D(0, builder.layerHeight, 0) - p).length() > 1e-12) {
+			printf("  hydrogel particle %d is not a layer above a vertex\n", h);
+			return false;
+		}
+		vertexBelow[h] = v;
+	}
+
+	const StretchedSpringTable &springs = system.springs;
+	int lineHydrogelSprings = 0, insideFabricSprings = 0;
+	const int inside = 7 * gridDim + 4;
+	for (int s = springs.getTypeStart(HYDROGEL_TO_FABRIC_SPRING); s < springs.getTypeEnd(HYDROGEL_TO_HYDROGEL_SPRING); s++) {
+		int a = springs.indicesA[s], b = springs.indicesB[s];
+		double length = (system.getParticlePosition(a) - system.getParticlePosition(b)).length();
+		double ratio = springs.types[s] == HYDROGEL_TO_FABRIC_SPRING ? builder.shrinkRatioZ : builder.shrinkRatioXY;
+		if (fabs(springs.restLengths[s] - ratio * length) > 1e-12) {
+			printf("  hydrogel spring %d-%d rests at %g of %g\n", a, b, springs.restLengths[s], length);
+			return false;
+		}
+		if (springs.types[s] == HYDROGEL_TO_FABRIC_SPRING) {
+			int hydrogel = a < fabricCount ? b : a, fabric = a < fabricCount ? a : b;
+			if (onLine(system.getParticlePosition(vertexBelow[hydrogel])) && onLine(system.getParticlePosition(fabric))) {
+				printf("  hydrogel of the row is tied to the row at %d\n", fabric);
+				return false;
+			}
+			insideFabricSprings += vertexBelow[hydrogel] == inside ? 1 : 0;
+		} else if (onLine(system.getParticlePosition(vertexBelow[a]))) {
+			lineHydrogelSprings++;
+		}
+	}
+	// 7 steps along the row and 6 skipping a point; 6 neighbours in this triangulation
+	if (lineHydrogelSprings != 7 + 6 || insideFabricSprings != 6) {
+		printf("  %d hydrogel springs along the row, %d fabric springs inside the square\n", lineHydrogelSprings, insideFabricSprings);
+		return false;
+	}
+	return true;
+}
+
+// Self intersections push the fabric apart, never the hydrogel printed a layer height above it
+static bool checkSelfIntersectionsKeepHydrogelHeight() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 15;
+	StretchedParticleSystem withAvoidance, without;
+	builder.build(withAvoidance);
+	builder.build(without);
+	withAvoidance.avoidSelfIntersections = true;
+	withAvoidance.step();
+	without.step();
+
+	int fabricCount = builder.getFabricParticleCount();
+	int up = withAvoidance.upAxis;
+	double largestChange = 0;
+	for (int i = fabricCount; i < withAvoidance.getParticleCount(); i++) {
+		largestChange = std::max(largestChange, fabs(withAvoidance.getParticlePosition(i)[up] - without.getParticlePosition(i)[up]));
+	}
+	if (largestChange > 0) {
+		printf("  hydrogel height moved by %g after one step\n", largestChange);
+		return false;
+	}
+	return true;
+}
+
+// Winding number of a closed outline (u along Z, v along X) by the usual crossing number test
+static int crossingTestWinding(const std::vector<P3D> &outline, double u, double v) {
+	int winding = 0;
+	for (int k = 0; k + 1 < (int)outline.size(); k++) {
+		double au = outline[k][2], av = outline[k][0], bu = outline[k + 1][2], bv = outline[k + 1][0];
+		double side = (bu - au) * (v - av) - (u - au) * (bv - av);
+		if (av <= v) {
+			winding += bv > v && side > 0 ? 1 : 0;
+		} else {
+			winding -= bv <= v && side < 0 ? 1 : 0;
+		}
+	}
+	return winding;
+}
+
+// The extrusion index agrees with the crossing test on a lattice that puts queries on the outlines and
+// in line with their corners
+static bool checkExtrusionIndexOnLattice() {
+	std::vector<StretchedExtrusion *> extrusions;
+	for (int i = 0; i < 60; i++) {
+		double x = (i * 7 % 40) * 0.5, z = (i * 13 % 40) * 0.5, w = 1 + (i % 5) * 0.5, h = 1 + (i % 7) * 0.5;
+		// Rectangles and diamonds, alternately clockwise
+		double rectangle[4][2] = { { x, z }, { x + w, z }, { x + w, z + h }, { x, z + h } };
+		double diamond[4][2] = { { x, z + h }, { x + w, z }, { x + 2 * w, z + h }, { x + w, z + 2 * h } };
+		double (*corners)[2] = i % 2 == 0 ? rectangle : diamond;
+		StretchedExtrusion *extrusion = new StretchedExtrusion();
+		for (int k = 0; k <= 4; k++) {
+			int corner = (i / 2) % 2 == 0 ? k % 4 : (4 - k) % 4;
+			extrusion->addPoint(P3D(corners[corner][0], 0, corners[corner][1]));
+		}
+		extrusions.push_back(extrusion);
+	}
+	StretchedExtrusionIndex index;
+	index.build(extrusions);
+
+	int wrongWindings = 0, wrongExtrusions = 0;
+	for (double x = -1; x <= 30; x += 0.25) {
+		for (double z = -1; z <= 30; z += 0.25) {
+			P3D point(x, 0, z);
+			int expected = -1;
+			for (int e = 0; e < (int)extrusions.size(); e++) {
+				int winding = crossingTestWinding(extrusions[e]->points, z, x);
+				wrongWindings += winding != index.getWindingNumber(point, e) ? 1 : 0;
+				expected = expected < 0 && winding != 0 ? e : expected;
+			}
+			wrongExtrusions += expected != index.findExtrusion(point) ? 1 : 0;
+		}
+	}
+	for (int e = 0; e < (int)extrusions.size(); e++) {
+		delete extrusions[e];
+	}
+	if (wrongWindings > 0 || wrongExtrusions > 0) {
+		printf("  %d wrong winding numbers, %d wrong extrusions\n", wrongWindings, wrongExtrusions);
+		return false;
+	}
+	return true;
+}
+
+// The equilibrium solve from the flat fabric, without settling, reaches the minimum a long damped dynamic
+// run comes to rest in. The soft bending modes leave the rest shapes free to differ by far more than the
+// tolerance at (almost) the same energy, so the energies are compared, the dynamic one by polishing the
+// dynamic rest with the same solver.
+static bool checkEquilibriumMatchesDynamicRest() {
+	StretchedGridFabricBuilder builder;
+	builder.gridDim = 7;
+	builder.hydrogelColumns = 2;
+	StretchedParticleSystem solved, dynamic;
+	builder.build(solved);
+	builder.build(dynamic);
+	solved.equilibriumSolver.settleSteps = 0;
+	solved.solveEquilibrium();
+	if (!solved.equilibriumSolver.hasConverged()) {
+		printf("  no convergence from the flat fabric after %d iterations\n", solved.equilibriumSolver.getLastIterations());
+		return false;
+	}
+
+	for (int k = 0; k < 40000; k++) {
+		dynamic.step();
+	}
+	dynamic.equilibriumSolver.settleSteps = 0;
+	dynamic.solveEquilibrium();
+	double solvedEnergy = solved.equilibriumSolver.getLastEnergy();
+	double dynamicEnergy = dynamic.equilibriumSolver.getLastEnergy();
+	if (fabs(solvedEnergy - dynamicEnergy) > 1e-5 * dynamicEnergy) {
+		printf("  energy %.9g from the flat fabric, %.9g at the dynamic rest\n", solvedEnergy, dynamicEnergy);
+		return false;
+	}
+	return true;
+}
+
+struct StretchedCheck {
+	const char *name;
+	bool (*run)();
+};
+
+static const StretchedCheck checks[] = {
+	{ "springPairOscillatesAboutCenter", checkSpringPairOscillatesAboutCenter },
+	{ "implicitEulerStiffSpringLosesEnergy", checkImplicitEulerStiffSpringLosesEnergy },
+	{ "coloredConstraintsMatchAcrossThreadCounts", checkColoredConstraintsMatchAcrossThreadCounts },
+	{ "projectiveDynamicsReusesFactorization", checkProjectiveDynamicsReusesFactorization },
+	{ "simdSpringForcesMatchScalar", checkSimdSpringForcesMatchScalar },
+	{ "spatialHashPairsMatchBruteForce", checkSpatialHashPairsMatchBruteForce },
+	{ "continuousCollisionStopsFallingTriangle", checkContinuousCollisionStopsFallingTriangle },
+	{ "selfIntersectionsKeepHydrogelHeight", checkSelfIntersectionsKeepHydrogelHeight },
+	{ "extrusionIndexOnLattice", checkExtrusionIndexOnLattice },
+	{ "equilibriumMatchesDynamicRest", checkEquilibriumMatchesDynamicRest },
+	{ "coarseFabricCoversFineExtent", checkCoarseFabricCoversFineExtent },
+	{ "shapeGradientMatchesFiniteDifferences", checkShapeGradientMatchesFiniteDifferences },
+	{ "multiresolutionSavesFineIterations", checkMultiresolutionSavesFineIterations },
+	{ "sleepingTilesWakeAndSettle", checkSleepingTilesWakeAndSettle },
+	{ "checkpointRestoresExactly", checkCheckpointRestoresExactly },
+	{ "trajectoryPlaysBackQuantized", checkTrajectoryPlaysBackQuantized },
+	{ "profilerPercentilesAreStepTimes", checkProfilerPercentilesAreStepTimes },
+	{ "profilerCountsEvaluatedSprings", checkProfilerCountsEvaluatedSprings },
+	{ "simCoreMatchesStep", checkSimCoreMatchesStep },
+	{ "springTableKeepsTypesGrouped", checkSpringTableKeepsTypesGrouped },
+	{ "designFabricPatchesLikeRebuild", checkDesignFabricPatchesLikeRebuild },
+	{ "hessianPatternIsReused", checkHessianPatternIsReused },
+	{ "springForcesIgnoreThreadCount", checkSpringForcesIgnoreThreadCount },
+	{ "domainDecompositionMatchesStep", checkDomainDecompositionMatchesStep },
+	{ "reorderingNarrowsBandAndMapsBack", checkReorderingNarrowsBandAndMapsBack },
+	{ "hydrogelLayerFollowsExtrusions", checkHydrogelLayerFollowsExtrusions },
+};
+
+int main(int argc, char **argv) {
+	int failures = 0;
+	for (int c = 0; c < (int)(sizeof(checks) / sizeof(checks[0])); c++) {
+		bool selected = argc < 2;
+		for (int a = 1; a < argc; a++) {
+			selected |= strcmp(argv[a], checks[c].name) == 0;
+		}
+		if (!selected) {
+			continue;
+		}
+		bool passed = checks[c].run();
+		printf("%s %s\n", passed ? "PASS" : "FAIL", checks[c].name);
+		failures += passed ? 0 : 1;
+	}
+	return failures;
+}
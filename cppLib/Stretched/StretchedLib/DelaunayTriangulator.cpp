@@ -193,7 +193,7 @@ DelaunayTriangulator::~DelaunayTriangulator() {
 	// Nothing to see here
 }
 
-DelaunayTriangulation DelaunayTriangulator::triangulatePoints(std::vector<P3D> pts, DelaunayTriangulatorPlane2DType planeType) {
+DelaunayTriangulation DelaunayTriangulator::triangulatePoints(std::vector<P3D> pts, DelaunayTriangulatorPlane2DType planeType, double maxTriangleArea) {
 	if (pts.size() == 0) {
 		return DelaunayTriangulation();
 	}
@@ -259,7 +259,12 @@ DelaunayTriangulation DelaunayTriangulator::triangulatePoints(std::vector<P3D> p
 	Logger::consolePrint("Starting Delaunay Triangulation");
 	// Best So far : triangulate("qDYzeX", &in, &mid, NULL);
 	// Removed the XsD //pjYq30zsCVL
-	triangulate("pcq28.6zOXYeD", &in, &mid, NULL);
+	char switches[64] = "pcq28.6zOXYeD";
+	if (maxTriangleArea > 0) {
+		// Maximum triangle area constraint (a), for the coarser and finer levels of a hierarchy
+		sprintf(switches, "pcq28.6zOXYeDa%.17g", maxTriangleArea * ERROR_MULTIPLIER * ERROR_MULTIPLIER);
+	}
+	triangulate(switches, &in, &mid, NULL);
 	Logger::consolePrint("Finished Delaunay Triangulation");
 	Logger::consolePrint("Converting of 2D -> 3D Points in Plane");
 	P3D firstPt = pts[0];
@@ -357,3 +362,13 @@ DelaunayTriangulation DelaunayTriangulator::triangulatePoints(std::vector<P3D> p
 	// Now finish and return our triangulation
 	return output;
 }
+
+std::vector<DelaunayTriangulation> DelaunayTriangulator::triangulateHierarchy(std::vector<P3D> pts, DelaunayTriangulatorPlane2DType planeType, const std::vector<double> &maxTriangleAreas) {
+	std::vector<DelaunayTriangulation> levels = std::vector<DelaunayTriangulation>();
+	levels.reserve(maxTriangleAreas.size());
+	for (int i = 0; i < (int) maxTriangleAreas.size(); i++) {
+		Logger::consolePrint("Triangulating level %d of %d (max triangle area %lf)", i + 1, (int) maxTriangleAreas.size(), maxTriangleAreas[i]);
+		levels.push_back(triangulatePoints(pts, planeType, maxTriangleAreas[i]));
+	}
+	return levels;
+}
@@ -18,7 +18,12 @@ public:
 	~DelaunayTriangulator();
 
 	// take a list of points and returns a delaunay triangulation of those points, SUP.
-	DelaunayTriangulation triangulatePoints(std::vector<P3D> points, DelaunayTriangulatorPlane2DType planeType);
+	// A positive maxTriangleArea adds Steiner points until no triangle is larger than that.
+	DelaunayTriangulation triangulatePoints(std::vector<P3D> points, DelaunayTriangulatorPlane2DType planeType, double maxTriangleArea = 0);
+
+	// Triangulates the same points once per area bound (ordered coarse to fine, i.e. decreasing areas),
+	// for solving on a coarse level first and prolonging the result to the finer ones.
+	std::vector<DelaunayTriangulation> triangulateHierarchy(std::vector<P3D> points, DelaunayTriangulatorPlane2DType planeType, const std::vector<double> &maxTriangleAreas);
 
 };
 
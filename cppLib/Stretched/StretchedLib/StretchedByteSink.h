@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <cstdio>
+#include <vector>
+
+// Destination for appending bytes, after the ByteSinkInterface of the utf8 mesh converter
+// (v0/utils/converters/utf8/src/stream.h). None of the implementations own what they write to.
+class StretchedByteSink {
+
+public:
+	virtual ~StretchedByteSink() {
+		// Nothing to see here
+	}
+
+	virtual void put(char c) = 0;
+	// Returns the number of bytes actually written
+	virtual size_t putN(const char *data, size_t length) = 0;
+	virtual void flush() {
+		// Nothing to see here
+	}
+
+	StretchedByteSink(const StretchedByteSink &) = delete;
+	StretchedByteSink &operator=(const StretchedByteSink &) = delete;
+
+protected:
+	StretchedByteSink() {
+		// Nothing to see here
+	}
+};
+
+class StretchedFileSink : public StretchedByteSink {
+
+public:
+	// file is not owned and must not be NULL
+	explicit StretchedFileSink(FILE *file) : file(file) {
+		// Nothing to see here
+	}
+
+	virtual void put(char c) {
+		fputc(c, file);
+	}
+
+	virtual size_t putN(const char *data, size_t length) {
+		return fwrite(data, 1, length, file);
+	}
+
+	virtual void flush() {
+		fflush(file);
+	}
+
+private:
+	FILE *file;
+};
+
+class StretchedVectorSink : public StretchedByteSink {
+
+public:
+	// bytes is not owned and must not be NULL
+	explicit StretchedVectorSink(std::vector<char> *bytes) : bytes(bytes) {
+		// Nothing to see here
+	}
+
+	virtual void put(char c) {
+		bytes->push_back(c);
+	}
+
+	virtual size_t putN(const char *data, size_t length) {
+		bytes->insert(bytes->end(), data, data + length);
+		return length;
+	}
+
+private:
+	std::vector<char> *bytes;
+};
@@ -0,0 +1,466 @@
+#include "StretchedCheckpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Utils/Logger.h"
+
+#include "StretchedParticleSystem.h"
+
+
+static const uint32_t CHECKPOINT_BYTE_ORDER_MARK = 0x01020304;
+
+// Bits of StretchedCheckpointHeader::flags
+static const uint32_t CHECKPOINT_USE_GRAVITY = 1 << 0;
+static const uint32_t CHECKPOINT_USE_VELOCITY_DAMPING = 1 << 1;
+static const uint32_t CHECKPOINT_USE_DRAG_FORCE = 1 << 2;
+static const uint32_t CHECKPOINT_USE_FLOOR_CONSTRAINT = 1 << 3;
+static const uint32_t CHECKPOINT_AVOID_SELF_INTERSECTIONS = 1 << 4;
+static const uint32_t CHECKPOINT_USE_CONTINUOUS_COLLISIONS = 1 << 5;
+static const uint32_t CHECKPOINT_USE_SLEEPING = 1 << 6;
+
+static uint64_t alignOffset(uint64_t offset) {
+	return (offset + STRETCHED_CHECKPOINT_ALIGNMENT - 1) / STRETCHED_CHECKPOINT_ALIGNMENT * STRETCHED_CHECKPOINT_ALIGNMENT;
+}
+
+// Source of one section while writing
+struct StretchedCheckpointSource {
+	const void *data;
+	uint32_t elementSize;
+	uint64_t count;
+};
+
+template <class T>
+static StretchedCheckpointSource sourceOf(const std::vector<T> &values) {
+	StretchedCheckpointSource source;
+	source.data = values.empty() ? NULL : values.data();
+	source.elementSize = sizeof(T);
+	source.count = values.size();
+	return source;
+}
+
+// Copies a section of the open checkpoint into values, which is resized to fit
+template <class T>
+static bool readSection(const StretchedCheckpoint &checkpoint, StretchedCheckpointSectionId id, std::vector<T> &values) {
+	uint64_t count = 0;
+	const void *data = checkpoint.getSection(id, sizeof(T), count);
+	if (data == NULL) {
+		Logger::consolePrint("Checkpoint section %d is missing or has the wrong element size", (int)id);
+		return false;
+	}
+	values.resize((size_t)count);
+	if (count > 0) {
+		memcpy(values.data(), data, (size_t)count * sizeof(T));
+	}
+	return true;
+}
+
+StretchedCheckpoint::StretchedCheckpoint() {
+	// Nothing to see here
+}
+
+StretchedCheckpoint::~StretchedCheckpoint() {
+	close();
+}
+
+bool StretchedCheckpoint::write(const StretchedParticleSystem &system, const char *fileName, double time) {
+	const StretchedSpringTable &springs = system.springs;
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	// The spring types are stored as int32 so the enum size does not matter
+	std::vector<int32_t> springTypes(springs.types.begin(), springs.types.end());
+
+	StretchedCheckpointSource sources[CHECKPOINT_SECTION_COUNT];
+	sources[CHECKPOINT_POSITIONS_X] = sourceOf(system.positions.x);
+	sources[CHECKPOINT_POSITIONS_Y] = sourceOf(system.positions.y);
+	sources[CHECKPOINT_POSITIONS_Z] = sourceOf(system.positions.z);
+	sources[CHECKPOINT_PREVIOUS_POSITIONS_X] = sourceOf(system.previousPositions.x);
+	sources[CHECKPOINT_PREVIOUS_POSITIONS_Y] = sourceOf(system.previousPositions.y);
+	sources[CHECKPOINT_PREVIOUS_POSITIONS_Z] = sourceOf(system.previousPositions.z);
+	sources[CHECKPOINT_VELOCITIES_X] = sourceOf(system.velocities.x);
+	sources[CHECKPOINT_VELOCITIES_Y] = sourceOf(system.velocities.y);
+	sources[CHECKPOINT_VELOCITIES_Z] = sourceOf(system.velocities.z);
+	sources[CHECKPOINT_MASSES] = sourceOf(system.masses);
+	sources[CHECKPOINT_INVERSE_MASSES] = sourceOf(system.inverseMasses);
+	sources[CHECKPOINT_SPRING_INDICES_A] = sourceOf(springs.indicesA);
+	sources[CHECKPOINT_SPRING_INDICES_B] = sourceOf(springs.indicesB);
+	sources[CHECKPOINT_SPRING_REST_LENGTHS] = sourceOf(springs.restLengths);
+	sources[CHECKPOINT_SPRING_STIFFNESSES] = sourceOf(springs.stiffnesses);
+	sources[CHECKPOINT_SPRING_TYPES] = sourceOf(springTypes);
+	sources[CHECKPOINT_SPRING_REST_LENGTH_RATIOS] = sourceOf(springs.restLengthRatios);
+	sources[CHECKPOINT_PIN_INDICES] = sourceOf(pins.indices);
+	sources[CHECKPOINT_PIN_REST_POSITIONS_X] = sourceOf(pins.restPositions.x);
+	sources[CHECKPOINT_PIN_REST_POSITIONS_Y] = sourceOf(pins.restPositions.y);
+	sources[CHECKPOINT_PIN_REST_POSITIONS_Z] = sourceOf(pins.restPositions.z);
+	sources[CHECKPOINT_PIN_STIFFNESSES] = sourceOf(pins.stiffnesses);
+	sources[CHECKPOINT_TRIANGLE_INDICES] = sourceOf(system.triangleIndices);
+	sources[CHECKPOINT_BEND_CONSTRAINTS] = sourceOf(system.constraintSolver.getBendConstraints());
+	sources[CHECKPOINT_AREA_CONSTRAINTS] = sourceOf(system.constraintSolver.getTriangleAreaConstraints());
+
+	StretchedCheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, STRETCHED_CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = STRETCHED_CHECKPOINT_VERSION;
+	header.byteOrderMark = CHECKPOINT_BYTE_ORDER_MARK;
+	header.sectionCount = CHECKPOINT_SECTION_COUNT;
+	header.particleCount = system.getParticleCount();
+	header.integrationType = system.integrationType;
+	header.upAxis = system.upAxis;
+	header.flags = (system.useGravity ? CHECKPOINT_USE_GRAVITY : 0)
+		| (system.useVelocityDamping ? CHECKPOINT_USE_VELOCITY_DAMPING : 0)
+		| (system.useDragForce ? CHECKPOINT_USE_DRAG_FORCE : 0)
+		| (system.useFloorConstraint ? CHECKPOINT_USE_FLOOR_CONSTRAINT : 0)
+		| (system.avoidSelfIntersections ? CHECKPOINT_AVOID_SELF_INTERSECTIONS : 0)
+		| (system.useContinuousCollisions ? CHECKPOINT_USE_CONTINUOUS_COLLISIONS : 0)
+		| (system.useSleeping ? CHECKPOINT_USE_SLEEPING : 0);
+	header.constraintIterations = system.constraintSolver.iterations;
+	header.velocityDampingConstant = system.velocityDampingConstant;
+	header.coefficientOfDrag = system.coefficientOfDrag;
+	header.particleArea = system.particleArea;
+	header.floorHeight = system.floorHeight;
+	header.selfIntersectionMinDistance = system.selfIntersectionMinDistance;
+	header.time = time;
+
+	// Lay out the section table, then each section on its own aligned offset
+	StretchedCheckpointSection sections[CHECKPOINT_SECTION_COUNT];
+	uint64_t offset = alignOffset(sizeof(header) + sizeof(sections));
+	for (int i = 0; i < CHECKPOINT_SECTION_COUNT; i++) {
+		sections[i].id = i;
+		sections[i].elementSize = sources[i].elementSize;
+		sections[i].count = sources[i].count;
+		sections[i].offset = offset;
+		offset = alignOffset(offset + sources[i].count * sources[i].elementSize);
+	}
+	header.fileSize = offset;
+
+	std::vector<char> buffer((size_t)offset, 0);
+	memcpy(buffer.data(), &header, sizeof(header));
+	memcpy(buffer.data() + sizeof(header), sections, sizeof(sections));
+	for (int i = 0; i < CHECKPOINT_SECTION_COUNT; i++) {
+		if (sources[i].count > 0) {
+			memcpy(buffer.data() + sections[i].offset, sources[i].data, (size_t)(sources[i].count * sources[i].elementSize));
+		}
+	}
+
+	FILE *file = fopen(fileName, "wb");
+	if (file == NULL) {
+		Logger::consolePrint("Could not open checkpoint file '%s' for writing", fileName);
+		return false;
+	}
+	bool succeeded = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	succeeded = fclose(file) == 0 && succeeded;
+	if (!succeeded) {
+		Logger::consolePrint("Could not write checkpoint file '%s'", fileName);
+	}
+	return succeeded;
+}
+
+bool StretchedCheckpoint::open(const char *fileName) {
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		Logger::consolePrint("Could not open checkpoint file '%s'", fileName);
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	if (mapping == NULL) {
+		CloseHandle(file);
+		Logger::consolePrint("Could not map checkpoint file '%s'", fileName);
+		return false;
+	}
+	fileHandle = file;
+	mappingHandle = mapping;
+	data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	size = (uint64_t)fileSize.QuadPart;
+#else
+	int file = ::open(fileName, O_RDONLY);
+	if (file < 0) {
+		Logger::consolePrint("Could not open checkpoint file '%s'", fileName);
+		return false;
+	}
+	fileDescriptor = file;
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size > 0) {
+		void *mapped = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (mapped != MAP_FAILED) {
+			data = (const char *)mapped;
+			size = (uint64_t)status.st_size;
+		}
+	}
+#endif
+	if (data == NULL) {
+		close();
+		Logger::consolePrint("Could not map checkpoint file '%s'", fileName);
+		return false;
+	}
+
+	// Validate everything restore and getSection rely on, so they can trust the offsets
+	const StretchedCheckpointHeader &header = getHeader();
+	const char *error = NULL;
+	if (size < sizeof(StretchedCheckpointHeader) || memcmp(header.magic, STRETCHED_CHECKPOINT_MAGIC, sizeof(header.magic)) != 0) {
+		error = "not a checkpoint";
+	} else if (header.byteOrderMark != CHECKPOINT_BYTE_ORDER_MARK) {
+		error = "written on a machine with a different byte order";
+	} else if (header.version != STRETCHED_CHECKPOINT_VERSION) {
+		error = "unsupported version";
+	} else if (header.fileSize != size || header.sectionCount > CHECKPOINT_SECTION_COUNT
+		|| sizeof(StretchedCheckpointHeader) + (uint64_t)header.sectionCount * sizeof(StretchedCheckpointSection) > size) {
+		error = "truncated or corrupt";
+	} else {
+		const StretchedCheckpointSection *sections = (const StretchedCheckpointSection *)(data + sizeof(StretchedCheckpointHeader));
+		for (uint32_t i = 0; i < header.sectionCount && error == NULL; i++) {
+			const StretchedCheckpointSection &section = sections[i];
+			if (section.offset % STRETCHED_CHECKPOINT_ALIGNMENT != 0 || section.offset > size
+				|| (section.elementSize > 0 && section.count > (size - section.offset) / section.elementSize)) {
+				error = "section out of bounds";
+			}
+		}
+	}
+	if (error != NULL) {
+		Logger::consolePrint("Checkpoint file '%s' is %s", fileName, error);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void StretchedCheckpoint::close() {
+#ifdef _WIN32
+	if (data != NULL) {
+		UnmapViewOfFile(data);
+	}
+	if (mappingHandle != NULL) {
+		CloseHandle((HANDLE)mappingHandle);
+	}
+	if (fileHandle != NULL) {
+		CloseHandle((HANDLE)fileHandle);
+	}
+	mappingHandle = NULL;
+	fileHandle = NULL;
+#else
+	if (data != NULL) {
+		munmap((void *)data, (size_t)size);
+	}
+	if (fileDescriptor >= 0) {
+		::close(fileDescriptor);
+	}
+	fileDescriptor = -1;
+#endif
+	data = NULL;
+	size = 0;
+}
+
+bool StretchedCheckpoint::isConsistent() const {
+	// Every section present with the element size of this build, and the arrays of a table the same length
+	static const struct {
+		StretchedCheckpointSectionId first;
+		StretchedCheckpointSectionId last;
+		uint32_t elementSize;
+	} groups[] = {
+		{ CHECKPOINT_POSITIONS_X, CHECKPOINT_INVERSE_MASSES, sizeof(double) },
+		{ CHECKPOINT_SPRING_INDICES_A, CHECKPOINT_SPRING_INDICES_B, sizeof(int) },
+		{ CHECKPOINT_SPRING_REST_LENGTHS, CHECKPOINT_SPRING_STIFFNESSES, sizeof(double) },
+		{ CHECKPOINT_SPRING_TYPES, CHECKPOINT_SPRING_TYPES, sizeof(int32_t) },
+		{ CHECKPOINT_SPRING_REST_LENGTH_RATIOS, CHECKPOINT_SPRING_REST_LENGTH_RATIOS, sizeof(double) },
+		{ CHECKPOINT_PIN_INDICES, CHECKPOINT_PIN_INDICES, sizeof(int) },
+		{ CHECKPOINT_PIN_REST_POSITIONS_X, CHECKPOINT_PIN_STIFFNESSES, sizeof(double) },
+		{ CHECKPOINT_TRIANGLE_INDICES, CHECKPOINT_TRIANGLE_INDICES, sizeof(int) },
+		{ CHECKPOINT_BEND_CONSTRAINTS, CHECKPOINT_BEND_CONSTRAINTS, sizeof(StretchedBendConstraint) },
+		{ CHECKPOINT_AREA_CONSTRAINTS, CHECKPOINT_AREA_CONSTRAINTS, sizeof(StretchedTriangleAreaConstraint) },
+	};
+	uint64_t counts[CHECKPOINT_SECTION_COUNT];
+	for (int g = 0; g < (int)(sizeof(groups) / sizeof(groups[0])); g++) {
+		for (int id = groups[g].first; id <= groups[g].last; id++) {
+			if (getSection((StretchedCheckpointSectionId)id, groups[g].elementSize, counts[id]) == NULL) {
+				Logger::consolePrint("Checkpoint section %d is missing or has the wrong element size", id);
+				return false;
+			}
+		}
+	}
+	uint64_t particleCount = counts[CHECKPOINT_POSITIONS_X];
+	uint64_t springCount = counts[CHECKPOINT_SPRING_INDICES_A];
+	uint64_t pinCount = counts[CHECKPOINT_PIN_INDICES];
+	for (int id = 0; id < CHECKPOINT_SECTION_COUNT; id++) {
+		uint64_t expected = id <= CHECKPOINT_INVERSE_MASSES ? particleCount
+			: (id <= CHECKPOINT_SPRING_REST_LENGTH_RATIOS ? springCount
+			: (id <= CHECKPOINT_PIN_STIFFNESSES ? pinCount : counts[id]));
+		if (counts[id] != expected) {
+			Logger::consolePrint("Checkpoint section %d has %d entries instead of %d", id, (int)counts[id], (int)expected);
+			return false;
+		}
+	}
+
+	// Particle indices must be in range, the tables are used without bounds checks
+	const int *indexSections[] = {
+		(const int *)getSection(CHECKPOINT_SPRING_INDICES_A, sizeof(int), counts[0]),
+		(const int *)getSection(CHECKPOINT_SPRING_INDICES_B, sizeof(int), counts[1]),
+		(const int *)getSection(CHECKPOINT_PIN_INDICES, sizeof(int), counts[2]),
+		(const int *)getSection(CHECKPOINT_TRIANGLE_INDICES, sizeof(int), counts[3]),
+	};
+	for (int k = 0; k < 4; k++) {
+		for (uint64_t i = 0; i < counts[k]; i++) {
+			if (indexSections[k][i] < 0 || (uint64_t)indexSections[k][i] >= particleCount) {
+				Logger::consolePrint("Checkpoint has a particle index out of range");
+				return false;
+			}
+		}
+	}
+	// So are the ranges of the spring types
+	uint64_t typeCount = 0;
+	const int32_t *types = (const int32_t *)getSection(CHECKPOINT_SPRING_TYPES, sizeof(int32_t), typeCount);
+	for (uint64_t i = 0; i < typeCount; i++) {
+		if (types[i] < FABRIC_SPRING_STRUCTURAL || types[i] >= FABRIC_SPRING_STRUCTURAL + SPRING_TABLE_TYPE_COUNT) {
+			Logger::consolePrint("Checkpoint has an unknown spring type");
+			return false;
+		}
+	}
+	// and the particles of the bend and area constraints
+	uint64_t bendCount = 0, areaCount = 0;
+	const StretchedBendConstraint *bends = (const StretchedBendConstraint *)getSection(CHECKPOINT_BEND_CONSTRAINTS, sizeof(StretchedBendConstraint), bendCount);
+	const StretchedTriangleAreaConstraint *areas = (const StretchedTriangleAreaConstraint *)getSection(CHECKPOINT_AREA_CONSTRAINTS, sizeof(StretchedTriangleAreaConstraint), areaCount);
+	auto inRange = [&](int a, int b, int c) {
+		return a >= 0 && b >= 0 && c >= 0 && (uint64_t)a < particleCount && (uint64_t)b < particleCount && (uint64_t)c < particleCount;
+	};
+	for (uint64_t i = 0; i < bendCount; i++) {
+		if (!inRange(bends[i].a, bends[i].b, bends[i].c)) {
+			Logger::consolePrint("Checkpoint has a bend constraint particle out of range");
+			return false;
+		}
+	}
+	for (uint64_t i = 0; i < areaCount; i++) {
+		if (!inRange(areas[i].a, areas[i].b, areas[i].c)) {
+			Logger::consolePrint("Checkpoint has an area constraint particle out of range");
+			return false;
+		}
+	}
+
+	// The options are used as array indices and switch cases too
+	const StretchedCheckpointHeader &header = getHeader();
+	if (header.particleCount < 0 || (uint64_t)header.particleCount != particleCount) {
+		Logger::consolePrint("Checkpoint header has %d particles instead of %d", header.particleCount, (int)particleCount);
+		return false;
+	}
+	if (header.upAxis < 0 || header.upAxis > 2) {
+		Logger::consolePrint("Checkpoint has an invalid up axis %d", header.upAxis);
+		return false;
+	}
+	if (header.integrationType < SYMPLECTIC_EULER || header.integrationType > PROJECTIVE_DYNAMICS) {
+		Logger::consolePrint("Checkpoint has an unknown integration type %d", header.integrationType);
+		return false;
+	}
+	return true;
+}
+
+bool StretchedCheckpoint::isOpen() const {
+	return data != NULL;
+}
+
+const StretchedCheckpointHeader &StretchedCheckpoint::getHeader() const {
+	return *(const StretchedCheckpointHeader *)data;
+}
+
+const void *StretchedCheckpoint::getSection(StretchedCheckpointSectionId id, uint32_t elementSize, uint64_t &count) const {
+	count = 0;
+	if (data == NULL || (uint32_t)id >= getHeader().sectionCount) {
+		return NULL;
+	}
+	const StretchedCheckpointSection &section = ((const StretchedCheckpointSection *)(data + sizeof(StretchedCheckpointHeader)))[id];
+	if (section.id != (uint32_t)id || section.elementSize != elementSize) {
+		return NULL;
+	}
+	count = section.count;
+	return data + section.offset;
+}
+
+bool StretchedCheckpoint::restore(StretchedParticleSystem &system) const {
+	if (data == NULL || !isConsistent()) {
+		return false;
+	}
+	std::vector<int32_t> springTypes;
+	std::vector<StretchedBendConstraint> bendConstraints;
+	std::vector<StretchedTriangleAreaConstraint> areaConstraints;
+	StretchedSpringTable &springs = system.springs;
+	StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	bool succeeded = readSection(*this, CHECKPOINT_POSITIONS_X, system.positions.x)
+		&& readSection(*this, CHECKPOINT_POSITIONS_Y, system.positions.y)
+		&& readSection(*this, CHECKPOINT_POSITIONS_Z, system.positions.z)
+		&& readSection(*this, CHECKPOINT_PREVIOUS_POSITIONS_X, system.previousPositions.x)
+		&& readSection(*this, CHECKPOINT_PREVIOUS_POSITIONS_Y, system.previousPositions.y)
+		&& readSection(*this, CHECKPOINT_PREVIOUS_POSITIONS_Z, system.previousPositions.z)
+		&& readSection(*this, CHECKPOINT_VELOCITIES_X, system.velocities.x)
+		&& readSection(*this, CHECKPOINT_VELOCITIES_Y, system.velocities.y)
+		&& readSection(*this, CHECKPOINT_VELOCITIES_Z, system.velocities.z)
+		&& readSection(*this, CHECKPOINT_MASSES, system.masses)
+		&& readSection(*this, CHECKPOINT_INVERSE_MASSES, system.inverseMasses)
+		&& readSection(*this, CHECKPOINT_SPRING_INDICES_A, springs.indicesA)
+		&& readSection(*this, CHECKPOINT_SPRING_INDICES_B, springs.indicesB)
+		&& readSection(*this, CHECKPOINT_SPRING_REST_LENGTHS, springs.restLengths)
+		&& readSection(*this, CHECKPOINT_SPRING_STIFFNESSES, springs.stiffnesses)
+		&& readSection(*this, CHECKPOINT_SPRING_TYPES, springTypes)
+		&& readSection(*this, CHECKPOINT_SPRING_REST_LENGTH_RATIOS, springs.restLengthRatios)
+		&& readSection(*this, CHECKPOINT_PIN_INDICES, pins.indices)
+		&& readSection(*this, CHECKPOINT_PIN_REST_POSITIONS_X, pins.restPositions.x)
+		&& readSection(*this, CHECKPOINT_PIN_REST_POSITIONS_Y, pins.restPositions.y)
+		&& readSection(*this, CHECKPOINT_PIN_REST_POSITIONS_Z, pins.restPositions.z)
+		&& readSection(*this, CHECKPOINT_PIN_STIFFNESSES, pins.stiffnesses)
+		&& readSection(*this, CHECKPOINT_TRIANGLE_INDICES, system.triangleIndices)
+		&& readSection(*this, CHECKPOINT_BEND_CONSTRAINTS, bendConstraints)
+		&& readSection(*this, CHECKPOINT_AREA_CONSTRAINTS, areaConstraints);
+	if (!succeeded) {
+		return false;
+	}
+	springs.types.resize(springTypes.size());
+	for (int s = 0; s < (int)springTypes.size(); s++) {
+		springs.types[s] = (StretchedSpringType)springTypes[s];
+	}
+	// Checkpoints written before the table kept its types grouped may interleave them
+	springs.groupByType();
+	// Forces are recomputed at the start of every step
+	system.forces.resize(system.positions.size());
+	system.forces.setZero();
+
+	StretchedConstraintSolver &constraintSolver = system.constraintSolver;
+	constraintSolver.clear();
+	for (int i = 0; i < (int)bendConstraints.size(); i++) {
+		constraintSolver.addBendConstraint(bendConstraints[i]);
+	}
+	for (int i = 0; i < (int)areaConstraints.size(); i++) {
+		constraintSolver.addTriangleAreaConstraint(areaConstraints[i]);
+	}
+
+	const StretchedCheckpointHeader &header = getHeader();
+	system.integrationType = (StretchedIntegrationType)header.integrationType;
+	system.upAxis = header.upAxis;
+	system.useGravity = (header.flags & CHECKPOINT_USE_GRAVITY) != 0;
+	system.useVelocityDamping = (header.flags & CHECKPOINT_USE_VELOCITY_DAMPING) != 0;
+	system.useDragForce = (header.flags & CHECKPOINT_USE_DRAG_FORCE) != 0;
+	system.useFloorConstraint = (header.flags & CHECKPOINT_USE_FLOOR_CONSTRAINT) != 0;
+	system.avoidSelfIntersections = (header.flags & CHECKPOINT_AVOID_SELF_INTERSECTIONS) != 0;
+	system.useContinuousCollisions = (header.flags & CHECKPOINT_USE_CONTINUOUS_COLLISIONS) != 0;
+	system.useSleeping = (header.flags & CHECKPOINT_USE_SLEEPING) != 0;
+	constraintSolver.iterations = header.constraintIterations;
+	system.velocityDampingConstant = header.velocityDampingConstant;
+	system.coefficientOfDrag = header.coefficientOfDrag;
+	system.particleArea = header.particleArea;
+	system.floorHeight = header.floorHeight;
+	system.selfIntersectionMinDistance = header.selfIntersectionMinDistance;
+
+	// The counts may match the old ones, so drop every cache built from the previous topology
+	system.topologyChanged();
+	return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+class StretchedParticleSystem;
+
+static const char STRETCHED_CHECKPOINT_MAGIC[8] = { 'S', 'T', 'R', 'C', 'H', 'K', 'P', 'T' };
+// Bump whenever the header, a section or one of the constraint structs changes layout
+static const uint32_t STRETCHED_CHECKPOINT_VERSION = 1;
+static const char *const STRETCHED_CHECKPOINT_EXTENSION = "stck";
+// Every section starts on a cache line
+static const uint64_t STRETCHED_CHECKPOINT_ALIGNMENT = 64;
+
+// Arrays stored in a checkpoint, one section each
+enum StretchedCheckpointSectionId {
+	CHECKPOINT_POSITIONS_X, CHECKPOINT_POSITIONS_Y, CHECKPOINT_POSITIONS_Z,
+	CHECKPOINT_PREVIOUS_POSITIONS_X, CHECKPOINT_PREVIOUS_POSITIONS_Y, CHECKPOINT_PREVIOUS_POSITIONS_Z,
+	CHECKPOINT_VELOCITIES_X, CHECKPOINT_VELOCITIES_Y, CHECKPOINT_VELOCITIES_Z,
+	CHECKPOINT_MASSES,
+	CHECKPOINT_INVERSE_MASSES,
+	CHECKPOINT_SPRING_INDICES_A,
+	CHECKPOINT_SPRING_INDICES_B,
+	CHECKPOINT_SPRING_REST_LENGTHS,
+	CHECKPOINT_SPRING_STIFFNESSES,
+	CHECKPOINT_SPRING_TYPES,
+	CHECKPOINT_SPRING_REST_LENGTH_RATIOS,
+	CHECKPOINT_PIN_INDICES,
+	CHECKPOINT_PIN_REST_POSITIONS_X, CHECKPOINT_PIN_REST_POSITIONS_Y, CHECKPOINT_PIN_REST_POSITIONS_Z,
+	CHECKPOINT_PIN_STIFFNESSES,
+	CHECKPOINT_TRIANGLE_INDICES,
+	CHECKPOINT_BEND_CONSTRAINTS,
+	CHECKPOINT_AREA_CONSTRAINTS,
+	CHECKPOINT_SECTION_COUNT
+};
+
+struct StretchedCheckpointSection {
+	uint32_t id;
+	uint32_t elementSize;
+	uint64_t count;
+	// From the start of the file, a multiple of STRETCHED_CHECKPOINT_ALIGNMENT
+	uint64_t offset;
+};
+
+// Fixed size header at the start of the file, followed by the section table and the section data
+struct StretchedCheckpointHeader {
+	char magic[8];
+	uint32_t version;
+	// 0x01020304 as written, to reject files from a machine of the other byte order
+	uint32_t byteOrderMark;
+	uint64_t fileSize;
+	uint32_t sectionCount;
+	int32_t particleCount;
+
+	// Simulation options of the particle system
+	int32_t integrationType;
+	int32_t upAxis;
+	uint32_t flags;
+	int32_t constraintIterations;
+	double velocityDampingConstant;
+	double coefficientOfDrag;
+	double particleArea;
+	double floorHeight;
+	double selfIntersectionMinDistance;
+	// Simulated time when the checkpoint was written (kept for the caller, the system has no clock)
+	double time;
+};
+
+// Versioned binary snapshot of a StretchedParticleSystem: the particle SoA arrays, the spring, pin,
+// triangle and bend/area constraint tables, and the options. The previous positions and velocities are
+// all the integrators carry from one step to the next, so a restored system continues exactly where it
+// stopped; factorizations, incidence lists and other caches are rebuilt on the first step.
+// The checkpoint is assembled in memory and written with a single fwrite. Loading maps the file
+// (MapViewOfFile on Windows, mmap elsewhere), checks the header and section table and then copies each
+// section straight into its array - there is no parsing, and the sections are aligned so they can also
+// be read in place through getSection.
+class StretchedCheckpoint {
+
+public:
+	StretchedCheckpoint();
+	~StretchedCheckpoint();
+
+	// Writes a checkpoint of the system, returns false if the file could not be written
+	static bool write(const StretchedParticleSystem &system, const char *fileName, double time = 0);
+
+	// Maps a checkpoint file, returns false (and logs why) if it is missing or not a valid checkpoint
+	bool open(const char *fileName);
+	void close();
+	bool isOpen() const;
+
+	const StretchedCheckpointHeader &getHeader() const;
+	// Section data in the mapped file, NULL if the section is missing or its elements are not elementSize bytes
+	const void *getSection(StretchedCheckpointSectionId id, uint32_t elementSize, uint64_t &count) const;
+
+	// Replaces the particles, springs, triangles, constraints and options of the system with the
+	// ones of the open checkpoint. Returns false if no checkpoint is open or a section is missing.
+	bool restore(StretchedParticleSystem &system) const;
+	// True if every section has the element size of this build, the arrays of each table agree in length
+	// and the particle indices and options are in range (restore checks this before touching the system)
+	bool isConsistent() const;
+
+	StretchedCheckpoint(const StretchedCheckpoint &) = delete;
+	StretchedCheckpoint &operator=(const StretchedCheckpoint &) = delete;
+
+private:
+	const char *data = NULL;
+	uint64_t size = 0;
+#ifdef _WIN32
+	void *fileHandle = NULL;
+	void *mappingHandle = NULL;
+#else
+	int fileDescriptor = -1;
+#endif
+};
@@ -0,0 +1,146 @@
+#include "StretchedConjugateGradientSolver.h"
+
+#include <cmath>
+
+
+static double dot(const std::vector<double> &a, const std::vector<double> &b) {
+	double sum = 0;
+	int n = (int)a.size();
+	for (int i = 0; i < n; i++) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+StretchedConjugateGradientSolver::StretchedConjugateGradientSolver() {
+	// Nothing to see here
+}
+
+StretchedConjugateGradientSolver::~StretchedConjugateGradientSolver() {
+	// Nothing to see here
+}
+
+int StretchedConjugateGradientSolver::solve(const StretchedSparseMatrix &A, const std::vector<double> &b, std::vector<double> &x) {
+	int n = A.getRowCount();
+	x.resize(n, 0.0);
+	r.resize(n);
+	z.resize(n);
+	p.resize(n);
+	Ap.resize(n);
+
+	inverseDiagonal = A.getDiagonal();
+	for (int i = 0; i < n; i++) {
+		inverseDiagonal[i] = inverseDiagonal[i] != 0 ? 1.0 / inverseDiagonal[i] : 1.0;
+	}
+
+	double bNorm = sqrt(dot(b, b));
+	if (bNorm == 0) {
+		x.assign(n, 0.0);
+		lastResidual = 0;
+		return 0;
+	}
+
+	// r = b - A x, z = M^-1 r, p = z
+	A.multiply(x, Ap);
+	for (int i = 0; i < n; i++) {
+		r[i] = b[i] - Ap[i];
+		z[i] = inverseDiagonal[i] * r[i];
+		p[i] = z[i];
+	}
+	double rz = dot(r, z);
+	double threshold = tolerance * bNorm;
+
+	int iteration = 0;
+	lastResidual = sqrt(dot(r, r)) / bNorm;
+	while (iteration < maxIterations && lastResidual * bNorm > threshold) {
+		A.multiply(p, Ap);
+		double pAp = dot(p, Ap);
+		if (pAp <= 0) {
+			// The matrix is not positive definite along p - keep what we have
+			break;
+		}
+		double alpha = rz / pAp;
+		for (int i = 0; i < n; i++) {
+			x[i] += alpha * p[i];
+			r[i] -= alpha * Ap[i];
+			z[i] = inverseDiagonal[i] * r[i];
+		}
+		double rzNew = dot(r, z);
+		double beta = rzNew / rz;
+		rz = rzNew;
+		for (int i = 0; i < n; i++) {
+			p[i] = z[i] + beta * p[i];
+		}
+		iteration++;
+		lastResidual = sqrt(dot(r, r)) / bNorm;
+	}
+	return iteration;
+}
+
+int StretchedConjugateGradientSolver::solveTruncated(const StretchedSparseMatrix &A, const std::vector<double> &b, const std::vector<double> &weights,
+	std::vector<double> &x) {
+	int n = A.getRowCount();
+	x.assign(n, 0.0);
+	r.resize(n);
+	z.resize(n);
+	p.resize(n);
+	Ap.resize(n);
+
+	// r = b (x = 0), z = M^-1 r, p = z
+	inverseDiagonal.resize(n);
+	for (int i = 0; i < n; i++) {
+		inverseDiagonal[i] = weights[i] > 0 ? 1.0 / weights[i] : 0.0;
+		r[i] = weights[i] > 0 ? b[i] : 0.0;
+		z[i] = inverseDiagonal[i] * r[i];
+		p[i] = z[i];
+	}
+	double bNorm = sqrt(dot(r, r));
+	lastResidual = 0;
+	if (bNorm == 0) {
+		return 0;
+	}
+	double rz = dot(r, z);
+	double threshold = tolerance * bNorm;
+
+	int iteration = 0;
+	lastResidual = 1;
+	while (iteration < maxIterations) {
+		A.multiply(p, Ap);
+		double pAp = 0;
+		for (int i = 0; i < n; i++) {
+			if (weights[i] == 0) {
+				Ap[i] = 0;
+			}
+			pAp += p[i] * Ap[i];
+		}
+		if (!(pAp > 0)) {
+			// Negative curvature: keep what we have, or go downhill along the preconditioned b
+			if (iteration == 0) {
+				x = z;
+			}
+			break;
+		}
+		double alpha = rz / pAp;
+		for (int i = 0; i < n; i++) {
+			x[i] += alpha * p[i];
+			r[i] -= alpha * Ap[i];
+			z[i] = inverseDiagonal[i] * r[i];
+		}
+		iteration++;
+		lastResidual = sqrt(dot(r, r)) / bNorm;
+		if (lastResidual * bNorm <= threshold) {
+			break;
+		}
+		double rzNew = dot(r, z);
+		double beta = rzNew / rz;
+		rz = rzNew;
+		for (int i = 0; i < n; i++) {
+			p[i] = z[i] + beta * p[i];
+		}
+	}
+	return iteration;
+}
+
+double StretchedConjugateGradientSolver::getLastResidual() const {
+	return lastResidual;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedSparseMatrix.h"
+
+// Jacobi (diagonal) preconditioned conjugate gradient for symmetric positive definite systems, and truncated
+// Newton steps of indefinite ones
+class StretchedConjugateGradientSolver {
+
+public:
+	StretchedConjugateGradientSolver();
+	~StretchedConjugateGradientSolver();
+
+	// Stop once |r| <= tolerance * |b|
+	double tolerance = 1e-4;
+	int maxIterations = 500;
+
+	// Solves A x = b using x as the initial guess. Returns the number of iterations used.
+	int solve(const StretchedSparseMatrix &A, const std::vector<double> &b, std::vector<double> &x);
+
+	// Truncated Newton step for a symmetric A which may be indefinite: approximately solves A x = b from x = 0,
+	// preconditioned by the diagonal weights (rows with weight 0 are held at 0). Also stops where A has negative
+	// curvature along a search direction, keeping the iterate so far (the preconditioned b on the first
+	// iteration), so x always descends 1/2 x^T A x - b^T x. Returns the number of iterations used.
+	int solveTruncated(const StretchedSparseMatrix &A, const std::vector<double> &b, const std::vector<double> &weights, std::vector<double> &x);
+
+	// Relative residual reached by the last solve
+	double getLastResidual() const;
+
+private:
+	double lastResidual = 0;
+
+	// Scratch buffers reused between solves
+	std::vector<double> r;
+	std::vector<double> z;
+	std::vector<double> p;
+	std::vector<double> Ap;
+	std::vector<double> inverseDiagonal;
+};
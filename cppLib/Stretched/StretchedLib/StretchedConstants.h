@@ -43,4 +43,29 @@ static const GLfloat DEFAULT_GL_LINE_WIDTH = 1;
 
 #define VSICOSITY 0.05
 #define BALL_FRICTION 0.5
-#define BALL_TEXTURE_NUM 9
\ No newline at end of file
+#define BALL_TEXTURE_NUM 9
+
+// Fabric + hydrogel particle system defaults (mirrors the simulation section of src/js/data/config.js)
+#define GRAVITY -9.81
+#define FABRIC_PARTICLE_MASS 1
+#define HYDROGEL_PARTICLE_MASS 1
+#define FABRIC_STRUCTURAL_SPRING_STIFFNESS 956
+#define FABRIC_STRUCTURAL_SPRING_STIFFNESS_Y 873
+#define FABRIC_BEND_SPRING_STIFFNESS 1664
+#define FABRIC_BEND_SPRING_STIFFNESS_Y 1876
+#define FABRIC_SHEAR_SPRING_STIFFNESS 1168
+#define FABRIC_SHEAR_SPRING_STIFFNESS_YX 885
+#define HYDROGEL_SPRING_STIFFNESS_Z 1027
+#define HYDROGEL_SPRING_STIFFNESS_XY 1983
+#define HYDROGEL_SPRING_SHRINK_RATIO_Z 0.69
+#define HYDROGEL_SPRING_SHRINK_RATIO_XY 0.98
+#define HYDROGEL_LAYER_HEIGHT 0.2
+#define HYDROGEL_COLUMNS 8
+#define VELOCITY_DAMPING_CONSTANT 0.002
+#define COEFFICIENT_OF_DRAG 1.28
+#define FABRIC_SELF_INTERSECTIONS_MIN_DIST 0.5
+#define FABRIC_GRID_DIM 31
+#define FABRIC_PARTICLE_SPACING 1
+#define FABRIC_BIAS_OFFSET 4.1
+// An edge must be this much longer than the other edges of a triangle to count as its shear diagonal
+#define SHEAR_EDGE_LENGTH_TOLERANCE 1e-6
\ No newline at end of file
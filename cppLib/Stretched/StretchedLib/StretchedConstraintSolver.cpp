@@ -0,0 +1,256 @@
+#include "StretchedConstraintSolver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "StretchedParticleSystem.h"
+
+
+// Greedy coloring tracks the colors used at each particle in a 64 bit mask. Constraints that
+// cannot get one of those colors go to one extra color that is projected serially.
+static const int MAX_PARALLEL_COLORS = 64;
+static const int MIN_CONSTRAINTS_PER_THREAD = 128;
+static const double MIN_GRADIENT_LENGTH = 1e-10;
+
+// Colors the constraints (any type with particle indices a, b, c), then reorders them so that each
+// color is contiguous. Returns the start of each color in colorStarts.
+template <typename Constraint>
+static void colorAndSortConstraints(std::vector<Constraint> &constraints, int particleCount, std::vector<int> &colorStarts) {
+	int constraintCount = (int)constraints.size();
+	std::vector<unsigned long long> usedColors(particleCount, 0);
+	std::vector<int> colors(constraintCount);
+	int colorCount = 0;
+	for (int i = 0; i < constraintCount; i++) {
+		const Constraint &constraint = constraints[i];
+		unsigned long long used = usedColors[constraint.a] | usedColors[constraint.b] | usedColors[constraint.c];
+		int color = 0;
+		while (color < MAX_PARALLEL_COLORS && (used & (1ULL << color))) {
+			color++;
+		}
+		if (color < MAX_PARALLEL_COLORS) {
+			unsigned long long bit = 1ULL << color;
+			usedColors[constraint.a] |= bit;
+			usedColors[constraint.b] |= bit;
+			usedColors[constraint.c] |= bit;
+		}
+		colors[i] = color;
+		colorCount = std::max(colorCount, color + 1);
+	}
+
+	// Counting sort by color (stable, so the original order is kept within each color)
+	colorStarts.assign(colorCount + 1, 0);
+	for (int i = 0; i < constraintCount; i++) {
+		colorStarts[colors[i] + 1]++;
+	}
+	for (int c = 0; c < colorCount; c++) {
+		colorStarts[c + 1] += colorStarts[c];
+	}
+	std::vector<int> next(colorStarts.begin(), colorStarts.end() - 1);
+	std::vector<Constraint> sorted(constraintCount);
+	for (int i = 0; i < constraintCount; i++) {
+		sorted[next[colors[i]]++] = constraints[i];
+	}
+	constraints.swap(sorted);
+}
+
+// Renames the particles of the constraints and sorts them by their lowest particle (stable)
+template <typename Constraint>
+static void remapAndSortConstraints(std::vector<Constraint> &constraints, const std::vector<int> &newIndices) {
+	for (int i = 0; i < (int)constraints.size(); i++) {
+		constraints[i].a = newIndices[constraints[i].a];
+		constraints[i].b = newIndices[constraints[i].b];
+		constraints[i].c = newIndices[constraints[i].c];
+	}
+	std::stable_sort(constraints.begin(), constraints.end(), [](const Constraint &first, const Constraint &second) {
+		return std::min(first.a, std::min(first.b, first.c)) < std::min(second.a, std::min(second.b, second.c));
+	});
+}
+
+// C = angle(a - b, c - b) - theta
+static void projectBendConstraint(const StretchedBendConstraint &constraint, double *px, double *py, double *pz, const double *w) {
+	int a = constraint.a, b = constraint.b, c = constraint.c;
+	double wSum = w[a] + w[b] + w[c];
+	if (wSum == 0) {
+		return;
+	}
+	double ux = px[a] - px[b], uy = py[a] - py[b], uz = pz[a] - pz[b];
+	double vx = px[c] - px[b], vy = py[c] - py[b], vz = pz[c] - pz[b];
+	double uLength = sqrt(ux * ux + uy * uy + uz * uz);
+	double vLength = sqrt(vx * vx + vy * vy + vz * vz);
+	if (uLength < MIN_GRADIENT_LENGTH || vLength < MIN_GRADIENT_LENGTH) {
+		return;
+	}
+	ux /= uLength; uy /= uLength; uz /= uLength;
+	vx /= vLength; vy /= vLength; vz /= vLength;
+	double cosAngle = std::max(-1.0, std::min(1.0, ux * vx + uy * vy + uz * vz));
+	double sinAngle = sqrt(1 - cosAngle * cosAngle);
+	if (sinAngle < MIN_GRADIENT_LENGTH) {
+		// Straight or folded - the angle gradient is undefined here
+		return;
+	}
+	double C = acos(cosAngle) - constraint.theta;
+
+	// d(angle)/da = -(v - cos u) / (sin |a - b|), d(angle)/dc = -(u - cos v) / (sin |c - b|)
+	double sa = -1.0 / (sinAngle * uLength);
+	double sc = -1.0 / (sinAngle * vLength);
+	double gax = sa * (vx - cosAngle * ux), gay = sa * (vy - cosAngle * uy), gaz = sa * (vz - cosAngle * uz);
+	double gcx = sc * (ux - cosAngle * vx), gcy = sc * (uy - cosAngle * vy), gcz = sc * (uz - cosAngle * vz);
+	double gbx = -gax - gcx, gby = -gay - gcy, gbz = -gaz - gcz;
+
+	double denominator = w[a] * (gax * gax + gay * gay + gaz * gaz)
+		+ w[b] * (gbx * gbx + gby * gby + gbz * gbz)
+		+ w[c] * (gcx * gcx + gcy * gcy + gcz * gcz);
+	if (denominator < MIN_GRADIENT_LENGTH) {
+		return;
+	}
+	double lambda = -std::max(0.0, std::min(1.0, constraint.k)) * C / denominator;
+	px[a] += lambda * w[a] * gax; py[a] += lambda * w[a] * gay; pz[a] += lambda * w[a] * gaz;
+	px[b] += lambda * w[b] * gbx; py[b] += lambda * w[b] * gby; pz[b] += lambda * w[b] * gbz;
+	px[c] += lambda * w[c] * gcx; py[c] += lambda * w[c] * gcy; pz[c] += lambda * w[c] * gcz;
+}
+
+// C = |(b - a) x (c - a)| / 2 - area
+static void projectTriangleAreaConstraint(const StretchedTriangleAreaConstraint &constraint, double *px, double *py, double *pz, const double *w) {
+	int a = constraint.a, b = constraint.b, c = constraint.c;
+	double wSum = w[a] + w[b] + w[c];
+	if (wSum == 0) {
+		return;
+	}
+	double e1x = px[b] - px[a], e1y = py[b] - py[a], e1z = pz[b] - pz[a];
+	double e2x = px[c] - px[a], e2y = py[c] - py[a], e2z = pz[c] - pz[a];
+	double nx = e1y * e2z - e1z * e2y;
+	double ny = e1z * e2x - e1x * e2z;
+	double nz = e1x * e2y - e1y * e2x;
+	double nLength = sqrt(nx * nx + ny * ny + nz * nz);
+	if (nLength < MIN_GRADIENT_LENGTH) {
+		return;
+	}
+	nx /= nLength; ny /= nLength; nz /= nLength;
+	double C = 0.5 * nLength - constraint.area;
+
+	// d(area)/db = (e2 x n) / 2, d(area)/dc = (n x e1) / 2, d(area)/da = -(d(area)/db + d(area)/dc)
+	double gbx = 0.5 * (e2y * nz - e2z * ny), gby = 0.5 * (e2z * nx - e2x * nz), gbz = 0.5 * (e2x * ny - e2y * nx);
+	double gcx = 0.5 * (ny * e1z - nz * e1y), gcy = 0.5 * (nz * e1x - nx * e1z), gcz = 0.5 * (nx * e1y - ny * e1x);
+	double gax = -gbx - gcx, gay = -gby - gcy, gaz = -gbz - gcz;
+
+	double denominator = w[a] * (gax * gax + gay * gay + gaz * gaz)
+		+ w[b] * (gbx * gbx + gby * gby + gbz * gbz)
+		+ w[c] * (gcx * gcx + gcy * gcy + gcz * gcz);
+	if (denominator < MIN_GRADIENT_LENGTH) {
+		return;
+	}
+	double lambda = -std::max(0.0, std::min(1.0, constraint.k)) * C / denominator;
+	px[a] += lambda * w[a] * gax; py[a] += lambda * w[a] * gay; pz[a] += lambda * w[a] * gaz;
+	px[b] += lambda * w[b] * gbx; py[b] += lambda * w[b] * gby; pz[b] += lambda * w[b] * gbz;
+	px[c] += lambda * w[c] * gcx; py[c] += lambda * w[c] * gcy; pz[c] += lambda * w[c] * gcz;
+}
+
+StretchedConstraintSolver::StretchedConstraintSolver() {
+	// Nothing to see here
+}
+
+StretchedConstraintSolver::~StretchedConstraintSolver() {
+	// Nothing to see here
+}
+
+void StretchedConstraintSolver::addBendConstraint(const StretchedBendConstraint &constraint) {
+	bendConstraints.push_back(constraint);
+	needsColoring = true;
+}
+
+void StretchedConstraintSolver::addTriangleAreaConstraint(const StretchedTriangleAreaConstraint &constraint) {
+	areaConstraints.push_back(constraint);
+	needsColoring = true;
+}
+
+void StretchedConstraintSolver::clear() {
+	bendConstraints.clear();
+	areaConstraints.clear();
+	bendColorStarts.clear();
+	areaColorStarts.clear();
+	needsColoring = false;
+}
+
+void StretchedConstraintSolver::remapParticles(const std::vector<int> &newIndices) {
+	remapAndSortConstraints(bendConstraints, newIndices);
+	remapAndSortConstraints(areaConstraints, newIndices);
+	needsColoring = hasConstraints();
+}
+
+bool StretchedConstraintSolver::hasConstraints() const {
+	return !bendConstraints.empty() || !areaConstraints.empty();
+}
+
+int StretchedConstraintSolver::getColorCount() const {
+	return std::max(0, (int)bendColorStarts.size() - 1) + std::max(0, (int)areaColorStarts.size() - 1);
+}
+
+const std::vector<StretchedBendConstraint> &StretchedConstraintSolver::getBendConstraints() const {
+	return bendConstraints;
+}
+
+const std::vector<StretchedTriangleAreaConstraint> &StretchedConstraintSolver::getTriangleAreaConstraints() const {
+	return areaConstraints;
+}
+
+void StretchedConstraintSolver::colorConstraints(int particleCount) {
+	colorAndSortConstraints(bendConstraints, particleCount, bendColorStarts);
+	colorAndSortConstraints(areaConstraints, particleCount, areaColorStarts);
+	needsColoring = false;
+}
+
+void StretchedConstraintSolver::project(StretchedParticleSystem &system) {
+	if (!hasConstraints()) {
+		return;
+	}
+	if (needsColoring) {
+		colorConstraints(system.getParticleCount());
+	}
+	double *px = system.positions.x.data();
+	double *py = system.positions.y.data();
+	double *pz = system.positions.z.data();
+	const double *w = system.inverseMasses.data();
+	const StretchedBendConstraint *bends = bendConstraints.data();
+	const StretchedTriangleAreaConstraint *areas = areaConstraints.data();
+
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		for (int color = 0; color + 1 < (int)bendColorStarts.size(); color++) {
+			auto projectBends = [&](int begin, int end) {
+				for (int i = begin; i < end; i++) {
+					projectBendConstraint(bends[i], px, py, pz, w);
+				}
+			};
+			if (color >= MAX_PARALLEL_COLORS) {
+				projectBends(bendColorStarts[color], bendColorStarts[color + 1]);
+			} else {
+				threadPool->parallelFor(bendColorStarts[color], bendColorStarts[color + 1], projectBends, MIN_CONSTRAINTS_PER_THREAD);
+			}
+		}
+		for (int color = 0; color + 1 < (int)areaColorStarts.size(); color++) {
+			auto projectAreas = [&](int begin, int end) {
+				for (int i = begin; i < end; i++) {
+					projectTriangleAreaConstraint(areas[i], px, py, pz, w);
+				}
+			};
+			if (color >= MAX_PARALLEL_COLORS) {
+				projectAreas(areaColorStarts[color], areaColorStarts[color + 1]);
+			} else {
+				threadPool->parallelFor(areaColorStarts[color], areaColorStarts[color + 1], projectAreas, MIN_CONSTRAINTS_PER_THREAD);
+			}
+		}
+	}
+}
+
+void StretchedConstraintSolver::solve(StretchedParticleSystem &system, double timeStep) {
+	if (!hasConstraints()) {
+		return;
+	}
+	project(system);
+	int n = system.getParticleCount();
+	double inverseTimeStep = 1.0 / timeStep;
+	for (int i = 0; i < n; i++) {
+		system.velocities.x[i] = (system.positions.x[i] - system.previousPositions.x[i]) * inverseTimeStep;
+		system.velocities.y[i] = (system.positions.y[i] - system.previousPositions.y[i]) * inverseTimeStep;
+		system.velocities.z[i] = (system.positions.z[i] - system.previousPositions.z[i]) * inverseTimeStep;
+	}
+}
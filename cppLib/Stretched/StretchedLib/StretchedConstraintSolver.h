@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedConstraints.h"
+#include "StretchedThreadPool.h"
+
+class StretchedParticleSystem;
+
+// Position based (Gauss-Seidel) solver for StretchedBendConstraint and StretchedTriangleAreaConstraint.
+// The constraints are graph colored so that no two constraints of the same color share a particle;
+// each color is then projected in parallel across the thread pool without any atomics or locks.
+// The constraint stiffness k is the usual PBD stiffness in [0, 1].
+class StretchedConstraintSolver {
+
+public:
+	StretchedConstraintSolver();
+	~StretchedConstraintSolver();
+
+	int iterations = 4;
+	StretchedThreadPool *threadPool = &StretchedThreadPool::getSharedPool();
+
+	void addBendConstraint(const StretchedBendConstraint &constraint);
+	void addTriangleAreaConstraint(const StretchedTriangleAreaConstraint &constraint);
+	void clear();
+	// Renames the particles (particle i becomes newIndices[i]) and sorts each table by the lowest particle
+	// of its constraints; they are colored again (keeping that order within each color) before the next solve
+	void remapParticles(const std::vector<int> &newIndices);
+
+	bool hasConstraints() const;
+	int getColorCount() const;
+
+	// Projects the constraints on the particle positions, then updates the velocities
+	// from the corrected positions (v = (x - x_prev) / h)
+	void solve(StretchedParticleSystem &system, double timeStep);
+	// Runs the projection iterations only
+	void project(StretchedParticleSystem &system);
+
+	// Constraints, reordered so that each color is contiguous once colored
+	const std::vector<StretchedBendConstraint> &getBendConstraints() const;
+	const std::vector<StretchedTriangleAreaConstraint> &getTriangleAreaConstraints() const;
+
+private:
+	std::vector<StretchedBendConstraint> bendConstraints;
+	std::vector<StretchedTriangleAreaConstraint> areaConstraints;
+	// Color c of each table occupies [colorStarts[c], colorStarts[c + 1])
+	std::vector<int> bendColorStarts;
+	std::vector<int> areaColorStarts;
+	bool needsColoring = false;
+
+	void colorConstraints(int particleCount);
+};
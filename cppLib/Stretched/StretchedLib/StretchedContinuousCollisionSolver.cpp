@@ -0,0 +1,341 @@
+#include "StretchedContinuousCollisionSolver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "MathLib/V3D.h"
+
+#include "StretchedParticleSystem.h"
+
+
+// Bisection steps used to refine each coplanarity time
+static const int ROOT_BISECTION_STEPS = 40;
+// Barycentric slack when checking if a point lies inside a triangle
+static const double BARYCENTRIC_TOLERANCE = 1e-6;
+// No impact recorded for a particle
+static const double NO_IMPACT = 2;
+
+static V3D getPoint(const StretchedVectorArray &points, int i) {
+	return V3D(points.x[i], points.y[i], points.z[i]);
+}
+
+static double evaluateCubic(const double c[4], double t) {
+	return ((c[3] * t + c[2]) * t + c[1]) * t + c[0];
+}
+
+// Roots of c3 t^3 + c2 t^2 + c1 t + c0 in [0, 1], ascending. The interval is split at the
+// extrema of the cubic so each piece is monotonic, then each sign change is bisected.
+static int findCubicRootsInUnitInterval(const double c[4], double roots[3]) {
+	double splits[4];
+	int splitCount = 0;
+	splits[splitCount++] = 0;
+	// Extrema: 3 c3 t^2 + 2 c2 t + c1 = 0
+	double qa = 3 * c[3], qb = 2 * c[2], qc = c[1];
+	if (fabs(qa) > 1e-300) {
+		double discriminant = qb * qb - 4 * qa * qc;
+		if (discriminant >= 0) {
+			double root = sqrt(discriminant);
+			double t0 = (-qb - root) / (2 * qa), t1 = (-qb + root) / (2 * qa);
+			if (t0 > t1) {
+				std::swap(t0, t1);
+			}
+			if (t0 > 0 && t0 < 1) {
+				splits[splitCount++] = t0;
+			}
+			if (t1 > 0 && t1 < 1 && t1 != t0) {
+				splits[splitCount++] = t1;
+			}
+		}
+	} else if (fabs(qb) > 1e-300) {
+		double t0 = -qc / qb;
+		if (t0 > 0 && t0 < 1) {
+			splits[splitCount++] = t0;
+		}
+	}
+	splits[splitCount++] = 1;
+
+	int rootCount = 0;
+	for (int i = 0; i + 1 < splitCount; i++) {
+		double low = splits[i], high = splits[i + 1];
+		double fLow = evaluateCubic(c, low), fHigh = evaluateCubic(c, high);
+		if (fLow == 0) {
+			if (rootCount == 0 || roots[rootCount - 1] != low) {
+				roots[rootCount++] = low;
+			}
+			continue;
+		}
+		if (fHigh == 0 || (fLow < 0) != (fHigh < 0)) {
+			for (int step = 0; step < ROOT_BISECTION_STEPS && fHigh != 0; step++) {
+				double middle = 0.5 * (low + high);
+				double fMiddle = evaluateCubic(c, middle);
+				if ((fMiddle < 0) == (fLow < 0)) {
+					low = middle;
+					fLow = fMiddle;
+				} else {
+					high = middle;
+					fHigh = fMiddle;
+				}
+			}
+			if (rootCount < 3) {
+				roots[rootCount++] = high;
+			}
+		}
+	}
+	return rootCount;
+}
+
+// Times in [0, 1] at which x0..x3 moving with v0..v3 are coplanar: ((x1 - x0) x (x2 - x0)) . (x3 - x0) = 0.
+// When the points stay coplanar over the whole step only the end of the step is returned.
+static int findCoplanarTimes(const V3D x[4], const V3D v[4], double times[3]) {
+	V3D x10 = x[1] - x[0], x20 = x[2] - x[0], x30 = x[3] - x[0];
+	V3D v10 = v[1] - v[0], v20 = v[2] - v[0], v30 = v[3] - v[0];
+	V3D v10v20 = v10.cross(v20);
+	V3D mixed = x10.cross(v20) + v10.cross(x20);
+	V3D x10x20 = x10.cross(x20);
+	double c[4];
+	c[3] = v10v20.dot(v30);
+	c[2] = mixed.dot(v30) + v10v20.dot(x30);
+	c[1] = mixed.dot(x30) + x10x20.dot(v30);
+	c[0] = x10x20.dot(x30);
+
+	double scale = ((x10.length() + v10.length()) * (x20.length() + v20.length()) * (x30.length() + v30.length()));
+	double largest = std::max(std::max(fabs(c[0]), fabs(c[1])), std::max(fabs(c[2]), fabs(c[3])));
+	if (largest <= 1e-12 * scale) {
+		times[0] = 1;
+		return 1;
+	}
+	return findCubicRootsInUnitInterval(c, times);
+}
+
+// Early out before solving for the coplanar times: do the boxes swept by the two groups of
+// particles over the step (padded by thickness) overlap?
+static bool sweptBoxesOverlap(const StretchedParticleSystem &system, const int *first, int firstCount, const int *second, int secondCount, double thickness) {
+	const std::vector<double> *startAxes[3] = { &system.previousPositions.x, &system.previousPositions.y, &system.previousPositions.z };
+	const std::vector<double> *endAxes[3] = { &system.positions.x, &system.positions.y, &system.positions.z };
+	for (int axis = 0; axis < 3; axis++) {
+		const std::vector<double> &s = *startAxes[axis];
+		const std::vector<double> &e = *endAxes[axis];
+		double firstMin = s[first[0]], firstMax = firstMin;
+		for (int k = 0; k < firstCount; k++) {
+			firstMin = std::min(firstMin, std::min(s[first[k]], e[first[k]]));
+			firstMax = std::max(firstMax, std::max(s[first[k]], e[first[k]]));
+		}
+		double secondMin = s[second[0]], secondMax = secondMin;
+		for (int k = 0; k < secondCount; k++) {
+			secondMin = std::min(secondMin, std::min(s[second[k]], e[second[k]]));
+			secondMax = std::max(secondMax, std::max(s[second[k]], e[second[k]]));
+		}
+		if (firstMax + thickness < secondMin || secondMax + thickness < firstMin) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Closest points of segments p1-q1 and p2-q2 (Ericson, Real-Time Collision Detection 5.1.9). Returns the squared distance.
+static double closestSegmentSegment(const V3D &p1, const V3D &q1, const V3D &p2, const V3D &q2, double &s, double &t) {
+	V3D d1 = q1 - p1, d2 = q2 - p2, r = p1 - p2;
+	double a = d1.dot(d1), e = d2.dot(d2), f = d2.dot(r);
+	if (a <= EPSILON_CHECK && e <= EPSILON_CHECK) {
+		s = t = 0;
+	} else if (a <= EPSILON_CHECK) {
+		s = 0;
+		t = std::max(0.0, std::min(1.0, f / e));
+	} else {
+		double c = d1.dot(r);
+		if (e <= EPSILON_CHECK) {
+			t = 0;
+			s = std::max(0.0, std::min(1.0, -c / a));
+		} else {
+			double b = d1.dot(d2);
+			double denominator = a * e - b * b;
+			s = denominator > EPSILON_CHECK ? std::max(0.0, std::min(1.0, (b * f - c * e) / denominator)) : 0;
+			t = (b * s + f) / e;
+			if (t < 0) {
+				t = 0;
+				s = std::max(0.0, std::min(1.0, -c / a));
+			} else if (t > 1) {
+				t = 1;
+				s = std::max(0.0, std::min(1.0, (b - c) / a));
+			}
+		}
+	}
+	V3D difference = (p1 + d1 * s) - (p2 + d2 * t);
+	return difference.dot(difference);
+}
+
+StretchedContinuousCollisionSolver::StretchedContinuousCollisionSolver() {
+	// Nothing to see here
+}
+
+StretchedContinuousCollisionSolver::~StretchedContinuousCollisionSolver() {
+	// Nothing to see here
+}
+
+void StretchedContinuousCollisionSolver::invalidate() {
+	needsBuild = true;
+}
+
+const StretchedTriangleBVH &StretchedContinuousCollisionSolver::getBVH() const {
+	return bvh;
+}
+
+int StretchedContinuousCollisionSolver::getLastCandidatePairCount() const {
+	return lastCandidatePairCount;
+}
+
+bool StretchedContinuousCollisionSolver::testVertexFace(const StretchedParticleSystem &system, int p, int a, int b, int c, double &impactTime) const {
+	int indices[4] = { a, b, c, p };
+	if (!sweptBoxesOverlap(system, indices + 3, 1, indices, 3, thickness)) {
+		return false;
+	}
+	V3D x[4], v[4];
+	for (int k = 0; k < 4; k++) {
+		x[k] = getPoint(system.previousPositions, indices[k]);
+		v[k] = getPoint(system.positions, indices[k]) - x[k];
+	}
+	double times[3];
+	int timeCount = findCoplanarTimes(x, v, times);
+	for (int i = 0; i < timeCount; i++) {
+		double t = times[i];
+		V3D xa = x[0] + v[0] * t, xb = x[1] + v[1] * t, xc = x[2] + v[2] * t, xp = x[3] + v[3] * t;
+		V3D ab = xb - xa, ac = xc - xa, ap = xp - xa;
+		V3D normal = ab.cross(ac);
+		double sqArea = normal.dot(normal);
+		if (sqArea < EPSILON_CHECK) {
+			continue;
+		}
+		double distance = fabs(ap.dot(normal)) / sqrt(sqArea);
+		if (distance > thickness) {
+			continue;
+		}
+		// Barycentric coordinates of the projection of p
+		double wb = ap.cross(ac).dot(normal) / sqArea;
+		double wc = ab.cross(ap).dot(normal) / sqArea;
+		double wa = 1 - wb - wc;
+		if (wa >= -BARYCENTRIC_TOLERANCE && wb >= -BARYCENTRIC_TOLERANCE && wc >= -BARYCENTRIC_TOLERANCE) {
+			impactTime = t;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool StretchedContinuousCollisionSolver::testEdgeEdge(const StretchedParticleSystem &system, int a, int b, int c, int d, double &impactTime) const {
+	int indices[4] = { a, b, c, d };
+	if (!sweptBoxesOverlap(system, indices, 2, indices + 2, 2, thickness)) {
+		return false;
+	}
+	V3D x[4], v[4];
+	for (int k = 0; k < 4; k++) {
+		x[k] = getPoint(system.previousPositions, indices[k]);
+		v[k] = getPoint(system.positions, indices[k]) - x[k];
+	}
+	double times[3];
+	int timeCount = findCoplanarTimes(x, v, times);
+	for (int i = 0; i < timeCount; i++) {
+		double t = times[i];
+		double s, u;
+		double sqDistance = closestSegmentSegment(x[0] + v[0] * t, x[1] + v[1] * t, x[2] + v[2] * t, x[3] + v[3] * t, s, u);
+		if (sqDistance <= thickness * thickness) {
+			impactTime = t;
+			return true;
+		}
+	}
+	return false;
+}
+
+void StretchedContinuousCollisionSolver::recordImpact(int a, int b, int c, int d, double impactTime) {
+	int indices[4] = { a, b, c, d };
+	for (int k = 0; k < 4; k++) {
+		impactTimes[indices[k]] = std::min(impactTimes[indices[k]], impactTime);
+	}
+}
+
+int StretchedContinuousCollisionSolver::detectImpacts(const StretchedParticleSystem &system) {
+	const std::vector<int> &triangles = system.triangleIndices;
+	impactTimes.assign(system.getParticleCount(), NO_IMPACT);
+	pairsA.clear();
+	pairsB.clear();
+	bvh.findOverlappingPairs(pairsA, pairsB);
+
+	int pairCount = (int)pairsA.size();
+	lastCandidatePairCount += pairCount;
+	for (int k = 0; k < pairCount; k++) {
+		const int *t1 = &triangles[3 * pairsA[k]];
+		const int *t2 = &triangles[3 * pairsB[k]];
+		double impactTime;
+		// Vertices of each triangle against the face of the other
+		for (int i = 0; i < 3; i++) {
+			if (testVertexFace(system, t1[i], t2[0], t2[1], t2[2], impactTime)) {
+				recordImpact(t1[i], t2[0], t2[1], t2[2], impactTime);
+			}
+			if (testVertexFace(system, t2[i], t1[0], t1[1], t1[2], impactTime)) {
+				recordImpact(t2[i], t1[0], t1[1], t1[2], impactTime);
+			}
+		}
+		// Every edge of one triangle against every edge of the other
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++) {
+				int a = t1[i], b = t1[(i + 1) % 3], c = t2[j], d = t2[(j + 1) % 3];
+				if (testEdgeEdge(system, a, b, c, d, impactTime)) {
+					recordImpact(a, b, c, d, impactTime);
+				}
+			}
+		}
+	}
+
+	int collidingCount = 0;
+	for (int i = 0; i < (int)impactTimes.size(); i++) {
+		if (impactTimes[i] <= 1) {
+			collidingCount++;
+		}
+	}
+	return collidingCount;
+}
+
+int StretchedContinuousCollisionSolver::resolve(StretchedParticleSystem &system, double timeStep) {
+	const std::vector<int> &triangles = system.triangleIndices;
+	lastCandidatePairCount = 0;
+	if (triangles.empty()) {
+		return 0;
+	}
+	// The tree is only rebuilt when the triangles change, otherwise refit
+	if (needsBuild || (int)triangles.size() != builtTriangleIndexCount) {
+		bvh.build(triangles, system.previousPositions, system.positions, thickness);
+		builtTriangleIndexCount = (int)triangles.size();
+		needsBuild = false;
+	} else {
+		bvh.refit(system.previousPositions, system.positions, thickness);
+	}
+
+	int n = system.getParticleCount();
+	int firstCollidingCount = 0;
+	for (int pass = 0; pass < maxPasses; pass++) {
+		if (pass > 0) {
+			bvh.refit(system.previousPositions, system.positions, thickness);
+		}
+		int collidingCount = detectImpacts(system);
+		if (pass == 0) {
+			firstCollidingCount = collidingCount;
+		}
+		if (collidingCount == 0) {
+			break;
+		}
+		// Move the colliding particles back along their path; on the last pass all the way to the start
+		bool lastPass = pass == maxPasses - 1;
+		for (int i = 0; i < n; i++) {
+			if (impactTimes[i] > 1 || system.inverseMasses[i] == 0) {
+				continue;
+			}
+			double t = lastPass ? 0 : impactTimeScale * impactTimes[i];
+			system.positions.x[i] = system.previousPositions.x[i] + t * (system.positions.x[i] - system.previousPositions.x[i]);
+			system.positions.y[i] = system.previousPositions.y[i] + t * (system.positions.y[i] - system.previousPositions.y[i]);
+			system.positions.z[i] = system.previousPositions.z[i] + t * (system.positions.z[i] - system.previousPositions.z[i]);
+			system.velocities.x[i] = (system.positions.x[i] - system.previousPositions.x[i]) / timeStep;
+			system.velocities.y[i] = (system.positions.y[i] - system.previousPositions.y[i]) / timeStep;
+			system.velocities.z[i] = (system.positions.z[i] - system.previousPositions.z[i]) / timeStep;
+		}
+	}
+	return firstCollidingCount;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedTriangleBVH.h"
+
+class StretchedParticleSystem;
+
+// Continuous collision detection and response for the fabric triangles against each other.
+// The motion of each particle over the step is taken as linear from previousPositions to positions.
+// Candidate triangle pairs come from a StretchedTriangleBVH over the swept triangles (built once, refit
+// every step); each pair runs the vertex-face and edge-edge tests, which solve for the times the four
+// points become coplanar and check for contact at those times.
+// Colliding particles are moved back along their path to just before their first time of impact
+// (an inelastic stop), then the step is checked again. Particles still colliding after the last pass
+// are moved back to their start of step positions, which were free of intersections.
+class StretchedContinuousCollisionSolver {
+
+public:
+	StretchedContinuousCollisionSolver();
+	~StretchedContinuousCollisionSolver();
+
+	// Contact distance, also used to pad the BVH boxes
+	double thickness = 0.01;
+	// Fraction of the time of impact the colliding particles are moved back to
+	double impactTimeScale = 0.9;
+	// Detect/respond passes per step
+	int maxPasses = 4;
+
+	// Resolves the collisions of the last step. Returns the number of colliding particles found in the first pass.
+	int resolve(StretchedParticleSystem &system, double timeStep);
+
+	// Forces the BVH to be rebuilt on the next step (needed after changing the triangles in place)
+	void invalidate();
+
+	const StretchedTriangleBVH &getBVH() const;
+	// Candidate triangle pairs tested by the last resolve, over all its passes
+	int getLastCandidatePairCount() const;
+
+private:
+	StretchedTriangleBVH bvh;
+	bool needsBuild = true;
+	int builtTriangleIndexCount = -1;
+	int lastCandidatePairCount = 0;
+
+	std::vector<int> pairsA;
+	std::vector<int> pairsB;
+	// Earliest time of impact (in [0, 1]) per particle, > 1 when not colliding
+	std::vector<double> impactTimes;
+
+	// Runs the vertex-face and edge-edge tests of the candidate pairs, filling impactTimes. Returns the number of colliding particles.
+	int detectImpacts(const StretchedParticleSystem &system);
+	bool testVertexFace(const StretchedParticleSystem &system, int v, int a, int b, int c, double &impactTime) const;
+	bool testEdgeEdge(const StretchedParticleSystem &system, int a, int b, int c, int d, double &impactTime) const;
+	void recordImpact(int a, int b, int c, int d, double impactTime);
+};
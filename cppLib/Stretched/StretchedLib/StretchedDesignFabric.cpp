@@ -0,0 +1,544 @@
+#include "StretchedDesignFabric.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "GUILib/GLUtils.h"
+
+#include "StretchedColor.h"
+
+
+// Radius of the region (around the origin of the design plane) the triangulation starts with; it doubles
+// whenever a point falls outside
+static const double DESIGN_FABRIC_INITIAL_RADIUS = 10.0;
+static const GLfloat DESIGN_FABRIC_LINE_WIDTH = 2;
+
+static int edgeKeyLo(uint64_t key) {
+	return (int)(key >> 32);
+}
+
+static int edgeKeyHi(uint64_t key) {
+	return (int)(key & 0xffffffffu);
+}
+
+static void replaceSpringEnd(StretchedSpringTable &springs, int spring, int from, int to) {
+	if (springs.indicesA[spring] == from) {
+		springs.indicesA[spring] = to;
+	}
+	if (springs.indicesB[spring] == from) {
+		springs.indicesB[spring] = to;
+	}
+}
+
+StretchedDesignFabric::StretchedDesignFabric() {
+	boundsRadius = DESIGN_FABRIC_INITIAL_RADIUS;
+	delaunay.reset(0, 0, boundsRadius);
+	delaunay.clearChanges();
+}
+
+StretchedDesignFabric::~StretchedDesignFabric() {
+	// Nothing to see here
+}
+
+uint64_t StretchedDesignFabric::edgeKey(int a, int b) {
+	return ((uint64_t)std::min(a, b) << 32) | (uint32_t)std::max(a, b);
+}
+
+void StretchedDesignFabric::clear() {
+	StretchedParticleSystem *attachedSystem = system;
+	detach();
+	vertexPoints.clear();
+	vertexExtrusions.clear();
+	vertexSlots.clear();
+	extrusionVertices.clear();
+	boundsRadius = DESIGN_FABRIC_INITIAL_RADIUS;
+	delaunay.reset(0, 0, boundsRadius);
+	delaunay.clearChanges();
+	if (attachedSystem != NULL) {
+		attach(attachedSystem);
+	}
+}
+
+int StretchedDesignFabric::addExtrusion(const std::vector<P3D> &points) {
+	beginEdit();
+	int extrusion = (int)extrusionVertices.size();
+	extrusionVertices.push_back(std::vector<int>());
+	for (int i = 0; i < (int)points.size(); i++) {
+		createVertex(extrusion, points[i]);
+	}
+	flush();
+	return extrusion;
+}
+
+void StretchedDesignFabric::moveExtrusion(int extrusion, const std::vector<P3D> &points) {
+	beginEdit();
+	// Drop the vertices that are no longer needed first, while all the others are in the triangulation
+	int kept = std::min((int)extrusionVertices[extrusion].size(), (int)points.size());
+	while ((int)extrusionVertices[extrusion].size() > kept) {
+		destroyVertex(extrusionVertices[extrusion].back());
+	}
+
+	// Take the rest out all at once, then put them back at their new points
+	std::vector<int> moving = extrusionVertices[extrusion];
+	for (int i = 0; i < kept; i++) {
+		delaunay.remove(moving[i]);
+	}
+	std::vector<int> failed;
+	for (int i = 0; i < kept; i++) {
+		int v = moving[i];
+		vertexPoints[v] = points[i];
+		if (!insertVertex(v)) {
+			failed.push_back(v);
+			continue;
+		}
+		if (system != NULL) {
+			system->positions.set(v, points[i]);
+			system->previousPositions.set(v, points[i]);
+			system->velocities.set(v, P3D());
+		}
+	}
+	flush();
+	// Points that landed on another vertex go away; the highest ids first, so that moving the last
+	// vertex into a freed id never moves one of them
+	std::sort(failed.begin(), failed.end());
+	for (int i = (int)failed.size() - 1; i >= 0; i--) {
+		destroyVertex(failed[i]);
+	}
+
+	for (int i = kept; i < (int)points.size(); i++) {
+		createVertex(extrusion, points[i]);
+	}
+	flush();
+}
+
+void StretchedDesignFabric::removeExtrusion(int extrusion) {
+	beginEdit();
+	while (!extrusionVertices[extrusion].empty()) {
+		destroyVertex(extrusionVertices[extrusion].back());
+	}
+	flush();
+}
+
+void StretchedDesignFabric::attach(StretchedParticleSystem *system) {
+	detach();
+	this->system = system;
+	beginEdit();
+
+	system->positions.clear();
+	system->previousPositions.clear();
+	system->velocities.clear();
+	system->forces.clear();
+	system->masses.clear();
+	system->inverseMasses.clear();
+	system->springs.clear();
+	system->zeroLengthSprings.clear();
+	system->triangleIndices.clear();
+	system->constraintSolver.clear();
+	for (int v = 0; v < getVertexCount(); v++) {
+		system->addParticle(vertexPoints[v], particleMass);
+	}
+
+	std::vector<uint64_t> keys;
+	for (int t = 0; t < delaunay.getTriangleSlotCount(); t++) {
+		if (!delaunay.isTriangleAlive(t) || !delaunay.isRealTriangle(t)) {
+			continue;
+		}
+		addTriangleSlot(t);
+		for (int k = 0; k < 3; k++) {
+			keys.push_back(edgeKey(delaunay.getTriangleVertex(t, k), delaunay.getTriangleVertex(t, (k + 1) % 3)));
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	// Springs go in type order, so the table only appends
+	std::vector<StretchedSpringType> edgeTypes(keys.size());
+	std::vector<int> bendEnds(2 * keys.size());
+	system->springs.reserve(2 * (int)keys.size());
+	for (int e = 0; e < (int)keys.size(); e++) {
+		classifyEdge(keys[e], edgeTypes[e], bendEnds[2 * e], bendEnds[2 * e + 1]);
+		if (edgeTypes[e] == FABRIC_SPRING_STRUCTURAL) {
+			addEdgeSpring(keys[e], false, edgeKeyLo(keys[e]), edgeKeyHi(keys[e]), structuralStiffness, FABRIC_SPRING_STRUCTURAL);
+		}
+	}
+	for (int e = 0; e < (int)keys.size(); e++) {
+		if (bendEnds[2 * e] >= 0) {
+			addEdgeSpring(keys[e], true, bendEnds[2 * e], bendEnds[2 * e + 1], bendStiffness, FABRIC_SPRING_BEND);
+		}
+	}
+	for (int e = 0; e < (int)keys.size(); e++) {
+		if (edgeTypes[e] == FABRIC_SPRING_SHEAR) {
+			addEdgeSpring(keys[e], false, edgeKeyLo(keys[e]), edgeKeyHi(keys[e]), shearStiffness, FABRIC_SPRING_SHEAR);
+		}
+	}
+	delaunay.clearChanges();
+	system->topologyChanged();
+}
+
+void StretchedDesignFabric::detach() {
+	system = NULL;
+	triangleSlots.clear();
+	slotTriangles.clear();
+	edgeSprings.clear();
+	springEdges.clear();
+	springIsBend.clear();
+}
+
+StretchedParticleSystem *StretchedDesignFabric::getAttachedSystem() const {
+	return system;
+}
+
+int StretchedDesignFabric::getVertexCount() const {
+	return (int)vertexPoints.size();
+}
+
+int StretchedDesignFabric::getTriangleCount() const {
+	return delaunay.getRealTriangleCount();
+}
+
+DelaunayTriangulation StretchedDesignFabric::getTriangulation() const {
+	std::vector<int> indices;
+	indices.reserve(3 * delaunay.getRealTriangleCount());
+	for (int t = 0; t < delaunay.getTriangleSlotCount(); t++) {
+		if (delaunay.isTriangleAlive(t) && delaunay.isRealTriangle(t)) {
+			for (int k = 0; k < 3; k++) {
+				indices.push_back(delaunay.getTriangleVertex(t, k));
+			}
+		}
+	}
+	return DelaunayTriangulation(vertexPoints, indices);
+}
+
+int StretchedDesignFabric::getLastChangedTriangleCount() const {
+	return lastChangedTriangleCount;
+}
+
+int StretchedDesignFabric::getLastChangedSpringCount() const {
+	return lastChangedSpringCount;
+}
+
+void StretchedDesignFabric::draw() {
+	StretchedColor color = StretchedColor::CYAN;
+	glLineWidth(DESIGN_FABRIC_LINE_WIDTH);
+	glColor4d(color.red, color.green, color.blue, color.alpha);
+	glBegin(GL_LINES);
+	for (int t = 0; t < delaunay.getTriangleSlotCount(); t++) {
+		if (!delaunay.isTriangleAlive(t) || !delaunay.isRealTriangle(t)) {
+			continue;
+		}
+		for (int k = 0; k < 3; k++) {
+			const P3D &a = vertexPoints[delaunay.getTriangleVertex(t, k)];
+			const P3D &b = vertexPoints[delaunay.getTriangleVertex(t, (k + 1) % 3)];
+			glVertex3d(a[0], a[1], a[2]);
+			glVertex3d(b[0], b[1], b[2]);
+		}
+	}
+	glEnd();
+	glLineWidth(1);
+}
+
+int StretchedDesignFabric::createVertex(int extrusion, const P3D &point) {
+	int v = getVertexCount();
+	vertexPoints.push_back(point);
+	vertexExtrusions.push_back(extrusion);
+	vertexSlots.push_back((int)extrusionVertices[extrusion].size());
+	if (!insertVertex(v)) {
+		vertexPoints.pop_back();
+		vertexExtrusions.pop_back();
+		vertexSlots.pop_back();
+		return -1;
+	}
+	extrusionVertices[extrusion].push_back(v);
+	if (system != NULL) {
+		system->addParticle(point, particleMass);
+	}
+	return v;
+}
+
+bool StretchedDesignFabric::insertVertex(int vertex) {
+	const P3D &point = vertexPoints[vertex];
+	if (!delaunay.isInBounds(point[0], point[2])) {
+		growBounds(point);
+	}
+	return delaunay.insert(vertex, point[0], point[2]);
+}
+
+void StretchedDesignFabric::growBounds(const P3D &point) {
+	double distance = sqrt(point[0] * point[0] + point[2] * point[2]);
+	while (boundsRadius < distance) {
+		boundsRadius *= 2;
+	}
+	std::vector<int> present;
+	for (int v = 0; v < getVertexCount(); v++) {
+		if (delaunay.contains(v)) {
+			present.push_back(v);
+		}
+	}
+	// Every triangle is replaced, which flush picks up like any other change
+	delaunay.reset(0, 0, boundsRadius);
+	for (int i = 0; i < (int)present.size(); i++) {
+		delaunay.insert(present[i], vertexPoints[present[i]][0], vertexPoints[present[i]][2]);
+	}
+}
+
+void StretchedDesignFabric::destroyVertex(int vertex) {
+	if (delaunay.contains(vertex)) {
+		delaunay.remove(vertex);
+	}
+	// The springs and triangles of the vertex go before any other vertex is renamed
+	flush();
+
+	std::vector<int> &vertices = extrusionVertices[vertexExtrusions[vertex]];
+	int slot = vertexSlots[vertex];
+	vertices[slot] = vertices.back();
+	vertexSlots[vertices[slot]] = slot;
+	vertices.pop_back();
+
+	int last = getVertexCount() - 1;
+	if (last != vertex) {
+		renameVertex(last, vertex);
+	}
+	vertexPoints.pop_back();
+	vertexExtrusions.pop_back();
+	vertexSlots.pop_back();
+	if (system != NULL) {
+		system->positions.resize(last);
+		system->previousPositions.resize(last);
+		system->velocities.resize(last);
+		system->forces.resize(last);
+		system->masses.resize(last);
+		system->inverseMasses.resize(last);
+	}
+}
+
+void StretchedDesignFabric::renameVertex(int from, int to) {
+	if (delaunay.contains(from)) {
+		std::vector<int> star;
+		delaunay.getVertexTriangles(from, star);
+		for (int i = 0; i < (int)star.size() && system != NULL; i++) {
+			int t = star[i];
+			int k = 0;
+			while (delaunay.getTriangleVertex(t, k) != from) {
+				k++;
+			}
+			int next = delaunay.getTriangleVertex(t, (k + 1) % 3);
+			int opposite = delaunay.getTriangleVertex(t, (k + 2) % 3);
+
+			// The springs of the edge (from, next) move to the key (to, next); only the one along it ends at from
+			std::unordered_map<uint64_t, StretchedFabricEdgeSprings>::iterator it = next >= 0 ? edgeSprings.find(edgeKey(from, next)) : edgeSprings.end();
+			if (it != edgeSprings.end()) {
+				StretchedFabricEdgeSprings record = it->second;
+				edgeSprings.erase(it);
+				uint64_t key = edgeKey(to, next);
+				edgeSprings[key] = record;
+				if (record.edgeSpring >= 0) {
+					springEdges[record.edgeSpring] = key;
+					replaceSpringEnd(system->springs, record.edgeSpring, from, to);
+				}
+				if (record.bendSpring >= 0) {
+					springEdges[record.bendSpring] = key;
+				}
+			}
+			// The bend spring across the edge opposite from ends at from
+			it = next >= 0 && opposite >= 0 ? edgeSprings.find(edgeKey(next, opposite)) : edgeSprings.end();
+			if (it != edgeSprings.end() && it->second.bendSpring >= 0) {
+				replaceSpringEnd(system->springs, it->second.bendSpring, from, to);
+			}
+			if (t < (int)triangleSlots.size() && triangleSlots[t] >= 0) {
+				system->triangleIndices[3 * triangleSlots[t] + k] = to;
+			}
+		}
+		delaunay.renameVertex(from, to);
+	}
+
+	vertexPoints[to] = vertexPoints[from];
+	vertexExtrusions[to] = vertexExtrusions[from];
+	vertexSlots[to] = vertexSlots[from];
+	extrusionVertices[vertexExtrusions[to]][vertexSlots[to]] = to;
+	if (system != NULL) {
+		system->positions.set(to, system->positions.getPoint(from));
+		system->previousPositions.set(to, system->previousPositions.getPoint(from));
+		system->velocities.set(to, system->velocities.getPoint(from));
+		system->forces.set(to, system->forces.getPoint(from));
+		system->masses[to] = system->masses[from];
+		system->inverseMasses[to] = system->inverseMasses[from];
+	}
+}
+
+void StretchedDesignFabric::beginEdit() {
+	lastChangedTriangleCount = 0;
+	lastChangedSpringCount = 0;
+}
+
+void StretchedDesignFabric::flush() {
+	const std::vector<int> &removed = delaunay.getRemovedTriangles();
+	const std::vector<int> &created = delaunay.getCreatedTriangles();
+	lastChangedTriangleCount += (int)(removed.size() + created.size());
+	if (system == NULL) {
+		delaunay.clearChanges();
+		return;
+	}
+
+	// An id may be removed, reused and removed again; only its current triangle has a slot
+	for (int i = 0; i < (int)removed.size(); i++) {
+		removeTriangleSlot(removed[i]);
+	}
+	std::vector<uint64_t> keys;
+	for (int i = 0; i < (int)created.size(); i++) {
+		int t = created[i];
+		if (!delaunay.isTriangleAlive(t) || !delaunay.isRealTriangle(t)) {
+			continue;
+		}
+		if (t >= (int)triangleSlots.size() || triangleSlots[t] < 0) {
+			addTriangleSlot(t);
+		}
+		for (int k = 0; k < 3; k++) {
+			keys.push_back(edgeKey(delaunay.getTriangleVertex(t, k), delaunay.getTriangleVertex(t, (k + 1) % 3)));
+		}
+	}
+	const std::vector<int> &removedVertices = delaunay.getRemovedTriangleVertices();
+	for (int i = 0; i + 2 < (int)removedVertices.size(); i += 3) {
+		for (int k = 0; k < 3; k++) {
+			keys.push_back(edgeKey(removedVertices[i + k], removedVertices[i + (k + 1) % 3]));
+		}
+	}
+	delaunay.clearChanges();
+
+	// Every edge of a changed triangle may have gained or lost a side, so its springs are made again
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	for (int i = 0; i < (int)keys.size(); i++) {
+		rebuildEdgeSprings(keys[i]);
+	}
+	system->topologyChanged();
+}
+
+void StretchedDesignFabric::addTriangleSlot(int triangle) {
+	if (triangle >= (int)triangleSlots.size()) {
+		triangleSlots.resize(triangle + 1, -1);
+	}
+	triangleSlots[triangle] = (int)slotTriangles.size();
+	slotTriangles.push_back(triangle);
+	for (int k = 0; k < 3; k++) {
+		system->triangleIndices.push_back(delaunay.getTriangleVertex(triangle, k));
+	}
+}
+
+void StretchedDesignFabric::removeTriangleSlot(int triangle) {
+	if (triangle >= (int)triangleSlots.size() || triangleSlots[triangle] < 0) {
+		return;
+	}
+	// The last surface triangle fills the hole
+	int slot = triangleSlots[triangle];
+	int last = (int)slotTriangles.size() - 1;
+	for (int k = 0; k < 3; k++) {
+		system->triangleIndices[3 * slot + k] = system->triangleIndices[3 * last + k];
+	}
+	slotTriangles[slot] = slotTriangles[last];
+	triangleSlots[slotTriangles[slot]] = slot;
+	triangleSlots[triangle] = -1;
+	slotTriangles.pop_back();
+	system->triangleIndices.resize(3 * last);
+}
+
+bool StretchedDesignFabric::classifyEdge(uint64_t key, StretchedSpringType &type, int &bendA, int &bendB) const {
+	int a = edgeKeyLo(key);
+	int b = edgeKeyHi(key);
+	bendA = -1;
+	bendB = -1;
+	int sides[2];
+	if (!delaunay.findEdgeTriangles(a, b, sides[0], sides[1])) {
+		return false;
+	}
+	// Shear if the edge is the longest side of every triangle along it (as in createFabricSprings)
+	double length = (vertexPoints[a] - vertexPoints[b]).length();
+	int opposites[2];
+	int realSides = 0;
+	bool isShear = true;
+	for (int s = 0; s < 2; s++) {
+		if (sides[s] < 0 || !delaunay.isRealTriangle(sides[s])) {
+			continue;
+		}
+		int opposite = 0;
+		for (int k = 0; k < 3; k++) {
+			int v = delaunay.getTriangleVertex(sides[s], k);
+			if (v != a && v != b) {
+				opposite = v;
+			}
+		}
+		double lengthA = (vertexPoints[opposite] - vertexPoints[a]).length();
+		double lengthB = (vertexPoints[opposite] - vertexPoints[b]).length();
+		isShear = isShear && length > (1 + SHEAR_EDGE_LENGTH_TOLERANCE) * lengthA && length > (1 + SHEAR_EDGE_LENGTH_TOLERANCE) * lengthB;
+		opposites[realSides++] = opposite;
+	}
+	if (realSides == 0) {
+		return false;
+	}
+	type = isShear ? FABRIC_SPRING_SHEAR : FABRIC_SPRING_STRUCTURAL;
+	if (realSides == 2) {
+		bendA = opposites[0];
+		bendB = opposites[1];
+	}
+	return true;
+}
+
+void StretchedDesignFabric::rebuildEdgeSprings(uint64_t key) {
+	// Removing a spring can move the other spring of the same edge, so look the record up again each time
+	std::unordered_map<uint64_t, StretchedFabricEdgeSprings>::iterator it = edgeSprings.find(key);
+	if (it != edgeSprings.end()) {
+		if (it->second.edgeSpring >= 0) {
+			removeEdgeSpring(it->second.edgeSpring);
+		}
+		it = edgeSprings.find(key);
+		if (it->second.bendSpring >= 0) {
+			removeEdgeSpring(it->second.bendSpring);
+		}
+		edgeSprings.erase(key);
+	}
+
+	StretchedSpringType type;
+	int bendA, bendB;
+	if (!classifyEdge(key, type, bendA, bendB)) {
+		return;
+	}
+	addEdgeSpring(key, false, edgeKeyLo(key), edgeKeyHi(key), type == FABRIC_SPRING_SHEAR ? shearStiffness : structuralStiffness, type);
+	if (bendA >= 0) {
+		addEdgeSpring(key, true, bendA, bendB, bendStiffness, FABRIC_SPRING_BEND);
+	}
+}
+
+void StretchedDesignFabric::addEdgeSpring(uint64_t key, bool isBend, int a, int b, double stiffness, StretchedSpringType type) {
+	double restLength = (vertexPoints[a] - vertexPoints[b]).length();
+	springMoves.clear();
+	int spring = system->springs.add(a, b, restLength, stiffness, type, 1.0, &springMoves);
+	springEdges.resize(system->springs.size());
+	springIsBend.resize(system->springs.size());
+	applySpringMoves();
+	springEdges[spring] = key;
+	springIsBend[spring] = isBend;
+	StretchedFabricEdgeSprings &record = edgeSprings[key];
+	(isBend ? record.bendSpring : record.edgeSpring) = spring;
+	lastChangedSpringCount++;
+}
+
+void StretchedDesignFabric::removeEdgeSpring(int spring) {
+	StretchedFabricEdgeSprings &record = edgeSprings[springEdges[spring]];
+	(springIsBend[spring] ? record.bendSpring : record.edgeSpring) = -1;
+	springMoves.clear();
+	system->springs.remove(spring, &springMoves);
+	applySpringMoves();
+	springEdges.resize(system->springs.size());
+	springIsBend.resize(system->springs.size());
+	lastChangedSpringCount++;
+}
+
+void StretchedDesignFabric::applySpringMoves() {
+	for (int i = 0; i < (int)springMoves.size(); i += 2) {
+		int from = springMoves[i];
+		int to = springMoves[i + 1];
+		springEdges[to] = springEdges[from];
+		springIsBend[to] = springIsBend[from];
+		StretchedFabricEdgeSprings &record = edgeSprings[springEdges[to]];
+		(springIsBend[to] ? record.bendSpring : record.edgeSpring) = to;
+	}
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "MathLib/P3D.h"
+
+#include "DelaunayTriangulation.h"
+#include "StretchedConstants.h"
+#include "StretchedIncrementalDelaunay.h"
+#include "StretchedParticleSystem.h"
+
+// The springs made for one edge of the design triangulation (-1 if none): the structural or shear spring
+// along the edge and the bend spring across it
+struct StretchedFabricEdgeSprings {
+	int edgeSpring = -1;
+	int bendSpring = -1;
+};
+
+// The fabric of a design, triangulated from the points of its extrusions (on the XZ plane) and kept up to
+// date one extrusion at a time. Once a particle system is attached, the design is its fabric: one particle
+// per triangulation vertex, one surface triangle per triangle and the structural, shear and bend springs of
+// createFabricSprings with rest lengths from the design points. Adding, moving or removing an extrusion
+// then re-triangulates only the region around its points and replaces only the triangles and springs of
+// the edges that changed, so an edit costs about the size of the region it touches rather than the fabric.
+// Vertex ids are the particle indices; removing a vertex moves the last particle into its place.
+class StretchedDesignFabric {
+
+public:
+	StretchedDesignFabric();
+	~StretchedDesignFabric();
+
+	StretchedDesignFabric(const StretchedDesignFabric &) = delete;
+	StretchedDesignFabric &operator=(const StretchedDesignFabric &) = delete;
+
+	double structuralStiffness = FABRIC_STRUCTURAL_SPRING_STIFFNESS;
+	double shearStiffness = FABRIC_SHEAR_SPRING_STIFFNESS;
+	double bendStiffness = FABRIC_BEND_SPRING_STIFFNESS;
+	double particleMass = FABRIC_PARTICLE_MASS;
+
+	// Removes every extrusion (the attached system is emptied too)
+	void clear();
+
+	// Points on top of an existing vertex are skipped. Returns the id of the new extrusion.
+	int addExtrusion(const std::vector<P3D> &points);
+	// Gives an extrusion new points (the number of points may change); the particles of the points
+	// that remain start over at rest on their new design points
+	void moveExtrusion(int extrusion, const std::vector<P3D> &points);
+	void removeExtrusion(int extrusion);
+
+	// Replaces the particles, springs, triangles and constraints of system with the design and keeps them
+	// in sync with the edits until detach. The system must stay alive while attached.
+	void attach(StretchedParticleSystem *system);
+	void detach();
+	StretchedParticleSystem *getAttachedSystem() const;
+
+	int getVertexCount() const;
+	int getTriangleCount() const;
+	DelaunayTriangulation getTriangulation() const;
+	// What the last edit replaced: triangles removed plus created, and springs removed plus created
+	int getLastChangedTriangleCount() const;
+	int getLastChangedSpringCount() const;
+
+	void draw();
+
+private:
+	StretchedIncrementalDelaunay delaunay;
+	double boundsRadius;
+
+	// Per vertex: design point, owner extrusion and index in the vertex list of the owner
+	std::vector<P3D> vertexPoints;
+	std::vector<int> vertexExtrusions;
+	std::vector<int> vertexSlots;
+	// Per extrusion id (removed extrusions keep their id with no vertices)
+	std::vector<std::vector<int> > extrusionVertices;
+
+	StretchedParticleSystem *system = NULL;
+	// Delaunay triangle -> surface triangle of the system (-1 if none) and back
+	std::vector<int> triangleSlots;
+	std::vector<int> slotTriangles;
+	// Springs per edge key, and per spring the edge it was made for
+	std::unordered_map<uint64_t, StretchedFabricEdgeSprings> edgeSprings;
+	std::vector<uint64_t> springEdges;
+	std::vector<char> springIsBend;
+	std::vector<int> springMoves;
+
+	int lastChangedTriangleCount = 0;
+	int lastChangedSpringCount = 0;
+
+	static uint64_t edgeKey(int a, int b);
+	int createVertex(int extrusion, const P3D &point);
+	void destroyVertex(int vertex);
+	void renameVertex(int from, int to);
+	bool insertVertex(int vertex);
+	// Starts the triangulation over with bounds that hold point
+	void growBounds(const P3D &point);
+	void beginEdit();
+	// Patches the system with the triangles changed since the last flush
+	void flush();
+
+	void addTriangleSlot(int triangle);
+	void removeTriangleSlot(int triangle);
+	// The spring type along an edge and the ends of the bend spring across it (-1 if none). Returns false
+	// if no design triangle has the edge.
+	bool classifyEdge(uint64_t key, StretchedSpringType &type, int &bendA, int &bendB) const;
+	void rebuildEdgeSprings(uint64_t key);
+	void addEdgeSpring(uint64_t key, bool isBend, int a, int b, double stiffness, StretchedSpringType type);
+	void removeEdgeSpring(int spring);
+	void applySpringMoves();
+};
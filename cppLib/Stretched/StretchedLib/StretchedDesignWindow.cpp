@@ -12,6 +12,9 @@
 
 #include "DelaunayTriangulator.h"
 
+// How far the arrow keys move the last extrusion
+static const double EXTRUSION_NUDGE_DISTANCE = 0.05;
+
 void TW_CALL updateExtrusionMakerCircleRadius(const void *value, void *clientData) {
 	double radius = *static_cast<const double *>(value);
 	StretchedExtrusionMaker *maker = (StretchedExtrusionMaker *)clientData;
@@ -31,6 +34,7 @@ StretchedDesignWindow::StretchedDesignWindow(int x, int y, int w, int h, GLAppli
 	TwAddVarRW(glApp->mainMenuBar, "Show Design Environment", TW_TYPE_BOOLCPP, &showDesignEnvironment, designVarGroup);
 	TwAddVarRW(glApp->mainMenuBar, "Show Extrusions", TW_TYPE_BOOLCPP, &showExtrusions, designVarGroup);
 	TwAddVarRW(glApp->mainMenuBar, "Show Delaunay Triangulation", TW_TYPE_BOOLCPP, &showDelaunayTriangulaton, designVarGroup);
+	TwAddVarRW(glApp->mainMenuBar, "Show Design Fabric", TW_TYPE_BOOLCPP, &showDesignFabric, designVarGroup);
 	
 	// Debugging window params
 	char* debugVarGroup = "group = 'Debug Options'";
@@ -224,9 +228,28 @@ bool StretchedDesignWindow::onKeyEvent(int key, int actionI, int mods) {
 			case EDITING:
 				Logger::consolePrint("Finished creating extrusion");
 				extrusions.push_back(extrusionMaker->createExtrusion());
+				extrusionFabricIds.push_back(designFabric.addExtrusion(extrusions.back()->points));
 				extrusionMaker->setState(StretchedExtrusionMakerState::NONE);
+				Logger::consolePrint("Design fabric: %d triangles and %d springs changed", designFabric.getLastChangedTriangleCount(), designFabric.getLastChangedSpringCount());
 				break;
 		}
+	} else if (compareKeyPressIgnoreCase(key, 'X') && actionI == GLFW_PRESS) {
+		// Remove the last finished extrusion
+		if (!extrusions.empty()) {
+			designFabric.removeExtrusion(extrusionFabricIds.back());
+			delete extrusions.back();
+			extrusions.pop_back();
+			extrusionFabricIds.pop_back();
+			Logger::consolePrint("Removed extrusion: %d triangles and %d springs changed", designFabric.getLastChangedTriangleCount(), designFabric.getLastChangedSpringCount());
+		}
+	} else if (key == GLFW_KEY_LEFT && actionI != GLFW_RELEASE) {
+		moveLastExtrusion(-EXTRUSION_NUDGE_DISTANCE, 0);
+	} else if (key == GLFW_KEY_RIGHT && actionI != GLFW_RELEASE) {
+		moveLastExtrusion(EXTRUSION_NUDGE_DISTANCE, 0);
+	} else if (key == GLFW_KEY_UP && actionI != GLFW_RELEASE) {
+		moveLastExtrusion(0, EXTRUSION_NUDGE_DISTANCE);
+	} else if (key == GLFW_KEY_DOWN && actionI != GLFW_RELEASE) {
+		moveLastExtrusion(0, -EXTRUSION_NUDGE_DISTANCE);
 	} else if (compareKeyPressIgnoreCase(key, 'P') && actionI == GLFW_PRESS) {
 		switch (currentState) {
 			case EDITING:
@@ -236,19 +259,7 @@ bool StretchedDesignWindow::onKeyEvent(int key, int actionI, int mods) {
 				break;
 		}
 	} else if (compareKeyPressIgnoreCase(key, 'w') && actionI == GLFW_PRESS) {
-		// Concatenate all the extrusions
-		int totalExtrusionPtSize = 0;
-		int extrusionsSize = extrusions.size();
-		for (int i = 0; i < extrusionsSize; i++) {
-			totalExtrusionPtSize += extrusions[i]->points.size();
-		}
-		std::vector<P3D> allPoints = std::vector<P3D>();
-		allPoints.reserve(totalExtrusionPtSize);
-		for (int i = 0; i < extrusionsSize; i++) {
-			std::vector<P3D> exPts = extrusions[i]->points;
-			allPoints.insert(allPoints.end(), exPts.begin(), exPts.end());
-		}
-		triangulation = triangulator->triangulatePoints(allPoints, DelaunayTriangulatorPlane2DType::XZ_PLANE);
+		triangulation = triangulator->triangulatePoints(getAllExtrusionPoints(), DelaunayTriangulatorPlane2DType::XZ_PLANE);
 		triangulation.setColor(StretchedColor::GREEN);
 		Logger::consolePrint("Finished  Delaunay Triangulation");
 	}
@@ -258,6 +269,46 @@ bool StretchedDesignWindow::onKeyEvent(int key, int actionI, int mods) {
 	return true;
 }
 
+void StretchedDesignWindow::moveLastExtrusion(double dx, double dz) {
+	if (extrusions.empty()) {
+		return;
+	}
+	std::vector<P3D> &points = extrusions.back()->points;
+	for (int i = 0; i < (int)points.size(); i++) {
+		points[i][0] += dx;
+		points[i][2] += dz;
+	}
+	designFabric.moveExtrusion(extrusionFabricIds.back(), points);
+}
+
+std::vector<P3D> StretchedDesignWindow::getAllExtrusionPoints() const {
+	// Concatenate all the extrusions
+	int totalExtrusionPtSize = 0;
+	int extrusionsSize = extrusions.size();
+	for (int i = 0; i < extrusionsSize; i++) {
+		totalExtrusionPtSize += extrusions[i]->points.size();
+	}
+	std::vector<P3D> allPoints = std::vector<P3D>();
+	allPoints.reserve(totalExtrusionPtSize);
+	for (int i = 0; i < extrusionsSize; i++) {
+		const std::vector<P3D> &exPts = extrusions[i]->points;
+		allPoints.insert(allPoints.end(), exPts.begin(), exPts.end());
+	}
+	return allPoints;
+}
+
+std::vector<DelaunayTriangulation> StretchedDesignWindow::getTriangulationHierarchy(const std::vector<double> &maxTriangleAreas) {
+	return triangulator->triangulateHierarchy(getAllExtrusionPoints(), DelaunayTriangulatorPlane2DType::XZ_PLANE, maxTriangleAreas);
+}
+
+StretchedDesignFabric &StretchedDesignWindow::getDesignFabric() {
+	return designFabric;
+}
+
+const std::vector<StretchedExtrusion *> &StretchedDesignWindow::getExtrusions() const {
+	return extrusions;
+}
+
 bool StretchedDesignWindow::onCharacterPressedEvent(int key, int mods) {
 	if (GLWindow3D::onCharacterPressedEvent(key, mods)) return true;
 	return false;
@@ -300,6 +351,9 @@ void StretchedDesignWindow::drawScene() {
 	if (showDelaunayTriangulaton) {
 		triangulation.draw();
 	}
+	if (showDesignFabric) {
+		designFabric.draw();
+	}
 
 }
 
@@ -340,6 +394,8 @@ void StretchedDesignWindow::reset() {
 
 	// Clear any completed extrusions
 	extrusions.clear();
+	extrusionFabricIds.clear();
+	designFabric.clear();
 
 	// Clear any triangulation points
 	triangulation = DelaunayTriangulation();
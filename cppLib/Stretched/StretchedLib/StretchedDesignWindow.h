@@ -13,6 +13,7 @@
 #include "StretchedExtrusionMaker.h"
 #include "DelaunayTriangulator.h"
 #include "DelaunayTriangulation.h"
+#include "StretchedDesignFabric.h"
 
 /**
  *  StretchedDesignWindow
@@ -33,6 +34,7 @@ private:
 	bool shouldPrintMouseLocation = false;
 	bool showDesignEnvironment = true;
 	bool showDelaunayTriangulaton = true;
+	bool showDesignFabric = true;
 	bool showExtrusions = true;
 
 	// Fabric surface
@@ -46,6 +48,14 @@ private:
 	// For Triangulation
 	DelaunayTriangulator *triangulator = NULL;
 	DelaunayTriangulation triangulation;
+
+	// Triangulation of the extrusion points kept up to date as extrusions are added, nudged and removed
+	// (fabric id of each extrusion in extrusionFabricIds)
+	StretchedDesignFabric designFabric;
+	std::vector<int> extrusionFabricIds;
+	void moveLastExtrusion(double dx, double dz);
+	// The points of all the extrusions, in order
+	std::vector<P3D> getAllExtrusionPoints() const;
 	
 	StretchedDesignWindowMode windowMode = StretchedDesignWindowMode::EDIT;
 
@@ -87,6 +97,12 @@ public:
 	virtual GLMesh* getTriangulatedFabricAreaMesh();
 	// Returns the triangulation mesh
 	virtual DelaunayTriangulation StretchedDesignWindow::getDelaunayTriangulation();
+	// The incrementally triangulated design, for attaching a simulation that follows the edits
+	StretchedDesignFabric &getDesignFabric();
+	// The finished extrusions (their points are the vertices of the triangulation)
+	const std::vector<StretchedExtrusion *> &getExtrusions() const;
+	// Triangulations of the extrusion points refined to each of the max triangle areas (coarse to fine)
+	std::vector<DelaunayTriangulation> getTriangulationHierarchy(const std::vector<double> &maxTriangleAreas);
 
 
 
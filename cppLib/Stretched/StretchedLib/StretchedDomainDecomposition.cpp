@@ -0,0 +1,548 @@
+#include "StretchedDomainDecomposition.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Utils/Logger.h"
+
+#include "StretchedParticleSystem.h"
+#include "StretchedStepPolicies.h"
+
+// How the particles and springs are split, computed once by load
+struct StretchedDomainDecomposition::Partition {
+	// Particles in Morton order; domain d owns order[starts[d]] to order[starts[d + 1] - 1]
+	std::vector<int> order;
+	std::vector<int> starts;
+	// Per particle: owner domain, index among the owned particles of the owner, and slot in the send
+	// buffer of the owner (-1 if no other domain has a spring to it)
+	std::vector<int> owners;
+	std::vector<int> localIndices;
+	std::vector<int> sendSlots;
+	// Springs with at least one end in each domain, ascending
+	std::vector<int> springStarts;
+	std::vector<int> springs;
+};
+
+// Everything a domain reads and writes during a step (local particle indices: owned, then ghosts)
+struct StretchedDomainDecomposition::Domain {
+	int ownedCount = 0;
+	std::vector<int> globalIds;
+	// Positions of the owned and ghost particles, the rest of the state of the owned ones only
+	std::vector<double> px, py, pz;
+	std::vector<double> ox, oy, oz;
+	std::vector<double> vx, vy, vz;
+	std::vector<double> fx, fy, fz;
+	std::vector<double> masses;
+	std::vector<double> inverseMasses;
+
+	// Springs with an owned end, in the order of the system's table
+	std::vector<int> indicesA;
+	std::vector<int> indicesB;
+	std::vector<double> restLengths;
+	std::vector<double> stiffnesses;
+	std::vector<double> springForces;
+	// Springs of each owned particle (ascending) and the sign of the force on it
+	std::vector<int> incidenceStarts;
+	std::vector<int> incidenceSprings;
+	std::vector<double> incidenceSigns;
+
+	std::vector<int> pinIndices;
+	std::vector<double> pinX, pinY, pinZ;
+	std::vector<double> pinStiffnesses;
+
+	// Owned particles other domains need, and their positions after odd and even steps
+	std::vector<int> sendParticles;
+	std::vector<double> sendBuffers[2];
+	// Per ghost: the domain that owns it and its slot in that domain's send buffers
+	std::vector<int> ghostDomains;
+	std::vector<int> ghostSlots;
+};
+
+// Number of NUMA nodes of the machine (1 where it can not be queried)
+static int queryNumaNodeCount() {
+#ifdef _WIN32
+	ULONG highestNode = 0;
+	if (GetNumaHighestNodeNumber(&highestNode)) {
+		return (int)highestNode + 1;
+	}
+	return 1;
+#elif defined(__linux__)
+	int count = 0;
+	while (true) {
+		char fileName[128];
+		sprintf(fileName, "/sys/devices/system/node/node%d/cpulist", count);
+		FILE *file = fopen(fileName, "r");
+		if (file == NULL) {
+			break;
+		}
+		fclose(file);
+		count++;
+	}
+	return std::max(1, count);
+#else
+	return 1;
+#endif
+}
+
+// Restricts the calling thread to the processors of a NUMA node. Returns false if it could not.
+static bool pinThreadToNumaNode(int node) {
+#ifdef _WIN32
+	GROUP_AFFINITY affinity;
+	ZeroMemory(&affinity, sizeof(affinity));
+	if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity)) {
+		return false;
+	}
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL) != 0;
+#elif defined(__linux__)
+	char fileName[128];
+	sprintf(fileName, "/sys/devices/system/node/node%d/cpulist", node);
+	FILE *file = fopen(fileName, "r");
+	if (file == NULL) {
+		return false;
+	}
+	// Comma separated processors and ranges, as in 0-7,16-23
+	cpu_set_t processors;
+	CPU_ZERO(&processors);
+	int first = 0, last = 0;
+	while (fscanf(file, "%d", &first) == 1) {
+		last = first;
+		int separator = fgetc(file);
+		if (separator == '-') {
+			if (fscanf(file, "%d", &last) != 1) {
+				break;
+			}
+			separator = fgetc(file);
+		}
+		for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+			CPU_SET(cpu, &processors);
+		}
+		if (separator != ',') {
+			break;
+		}
+	}
+	fclose(file);
+	return CPU_COUNT(&processors) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(processors), &processors) == 0;
+#else
+	return false;
+#endif
+}
+
+// Spreads the low 21 bits of v to every third bit
+static uint64_t spreadMortonBits(uint64_t v) {
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffULL;
+	v = (v | v << 16) & 0x1f0000ff0000ffULL;
+	v = (v | v << 8) & 0x100f00f00f00f00fULL;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+	v = (v | v << 2) & 0x1249249249249249ULL;
+	return v;
+}
+
+StretchedDomainDecomposition::StretchedDomainDecomposition() {
+	// Nothing to see here
+}
+
+StretchedDomainDecomposition::~StretchedDomainDecomposition() {
+	clear();
+}
+
+void StretchedDomainDecomposition::clear() {
+	for (int d = 0; d < (int)domains.size(); d++) {
+		delete domains[d];
+	}
+	domains.clear();
+	delete threadPool;
+	threadPool = NULL;
+	stepCount = 0;
+	haloParticleCount = 0;
+	cutSpringCount = 0;
+}
+
+bool StretchedDomainDecomposition::load(const StretchedParticleSystem &system) {
+	if (system.integrationType != SYMPLECTIC_EULER && system.integrationType != VERLET) {
+		Logger::consolePrint("The domain decomposition only steps the symplectic Euler and Verlet integrators");
+		return false;
+	}
+	if (system.constraintSolver.hasConstraints() || system.avoidSelfIntersections || system.useContinuousCollisions || system.useSleeping) {
+		Logger::consolePrint("The domain decomposition has no position based constraints, collisions or sleeping");
+		return false;
+	}
+	clear();
+
+	int n = system.getParticleCount();
+	int count = domainCount > 0 ? domainCount : std::max(1, (int)std::thread::hardware_concurrency());
+	count = std::max(1, std::min(count, n));
+
+	// Morton codes of the positions quantized to 21 bits per axis over the bounding box
+	Partition partition;
+	const StretchedVectorArray &positions = system.positions;
+	double low[3] = { 0, 0, 0 }, high[3] = { 0, 0, 0 };
+	const std::vector<double> *axes[3] = { &positions.x, &positions.y, &positions.z };
+	for (int c = 0; c < 3 && n > 0; c++) {
+		low[c] = *std::min_element(axes[c]->begin(), axes[c]->end());
+		high[c] = *std::max_element(axes[c]->begin(), axes[c]->end());
+	}
+	std::vector<uint64_t> codes(n, 0);
+	for (int i = 0; i < n; i++) {
+		for (int c = 0; c < 3; c++) {
+			double extent = high[c] - low[c];
+			uint64_t cell = extent > 0 ? (uint64_t)(((*axes[c])[i] - low[c]) / extent * 2097151.0) : 0;
+			codes[i] |= spreadMortonBits(cell) << c;
+		}
+	}
+	partition.order.resize(n);
+	for (int i = 0; i < n; i++) {
+		partition.order[i] = i;
+	}
+	std::sort(partition.order.begin(), partition.order.end(), [&](int a, int b) {
+		return codes[a] < codes[b] || (codes[a] == codes[b] && a < b);
+	});
+
+	// Equal runs of the curve
+	partition.starts.resize(count + 1);
+	partition.owners.resize(n);
+	partition.localIndices.resize(n);
+	for (int d = 0; d <= count; d++) {
+		partition.starts[d] = (int)((int64_t)n * d / count);
+	}
+	for (int d = 0; d < count; d++) {
+		for (int k = partition.starts[d]; k < partition.starts[d + 1]; k++) {
+			partition.owners[partition.order[k]] = d;
+			partition.localIndices[partition.order[k]] = k - partition.starts[d];
+		}
+	}
+
+	// Springs of each domain; a spring across a cut belongs to both and sends both its ends
+	const StretchedSpringTable &springs = system.springs;
+	int springCount = springs.size();
+	std::vector<char> sent(n, 0);
+	partition.springStarts.assign(count + 1, 0);
+	for (int s = 0; s < springCount; s++) {
+		int ownerA = partition.owners[springs.indicesA[s]];
+		int ownerB = partition.owners[springs.indicesB[s]];
+		partition.springStarts[ownerA + 1]++;
+		if (ownerB != ownerA) {
+			partition.springStarts[ownerB + 1]++;
+			sent[springs.indicesA[s]] = 1;
+			sent[springs.indicesB[s]] = 1;
+		}
+	}
+	for (int d = 0; d < count; d++) {
+		partition.springStarts[d + 1] += partition.springStarts[d];
+	}
+	partition.springs.resize(partition.springStarts[count]);
+	std::vector<int> next(partition.springStarts.begin(), partition.springStarts.end() - 1);
+	for (int s = 0; s < springCount; s++) {
+		int ownerA = partition.owners[springs.indicesA[s]];
+		int ownerB = partition.owners[springs.indicesB[s]];
+		partition.springs[next[ownerA]++] = s;
+		if (ownerB != ownerA) {
+			partition.springs[next[ownerB]++] = s;
+		}
+	}
+	partition.sendSlots.assign(n, -1);
+	for (int d = 0; d < count; d++) {
+		int slots = 0;
+		for (int k = partition.starts[d]; k < partition.starts[d + 1]; k++) {
+			if (sent[partition.order[k]]) {
+				partition.sendSlots[partition.order[k]] = slots++;
+			}
+		}
+	}
+
+	upAxis = system.upAxis;
+	useVerlet = system.integrationType == VERLET;
+	useGravity = system.useGravity;
+	useDragForce = system.useDragForce;
+	useFloorConstraint = system.useFloorConstraint;
+	useVelocityDamping = system.useVelocityDamping;
+	velocityDampingConstant = system.velocityDampingConstant;
+	dragScale = -system.coefficientOfDrag * system.particleArea;
+	floorHeight = system.floorHeight;
+
+	// Each domain is allocated and filled by its own thread, pinned first, so the pages of its arrays are
+	// first touched (and placed) on its node. The calling thread (index 0) is left alone.
+	numaNodeCount = queryNumaNodeCount();
+	threadPool = new StretchedThreadPool(count + 1);
+	domains.assign(count, NULL);
+	threadPool->runOnAllThreads([&](int threadIndex) {
+		if (threadIndex == 0) {
+			return;
+		}
+		int d = threadIndex - 1;
+		if (pinThreads && numaNodeCount > 1) {
+			pinThreadToNumaNode((int)((int64_t)d * numaNodeCount / count));
+		}
+		buildDomain(d, system, partition);
+	});
+	for (int d = 0; d < count; d++) {
+		haloParticleCount += (int)domains[d]->globalIds.size() - domains[d]->ownedCount;
+	}
+	cutSpringCount = partition.springStarts[count] - springCount;
+	return true;
+}
+
+void StretchedDomainDecomposition::buildDomain(int d, const StretchedParticleSystem &system, const Partition &partition) {
+	Domain *domain = new Domain();
+	domains[d] = domain;
+	int begin = partition.starts[d];
+	int ownedCount = partition.starts[d + 1] - begin;
+	domain->ownedCount = ownedCount;
+	domain->globalIds.assign(partition.order.begin() + begin, partition.order.begin() + begin + ownedCount);
+
+	// Ghosts: the far ends of the springs across the cut, by global index
+	const StretchedSpringTable &springs = system.springs;
+	int firstSpring = partition.springStarts[d];
+	int springCount = partition.springStarts[d + 1] - firstSpring;
+	std::vector<int> ghosts;
+	for (int k = 0; k < springCount; k++) {
+		int s = partition.springs[firstSpring + k];
+		int a = springs.indicesA[s], b = springs.indicesB[s];
+		if (partition.owners[a] != d) {
+			ghosts.push_back(a);
+		}
+		if (partition.owners[b] != d) {
+			ghosts.push_back(b);
+		}
+	}
+	std::sort(ghosts.begin(), ghosts.end());
+	ghosts.erase(std::unique(ghosts.begin(), ghosts.end()), ghosts.end());
+	int ghostCount = (int)ghosts.size();
+	domain->globalIds.insert(domain->globalIds.end(), ghosts.begin(), ghosts.end());
+	domain->ghostDomains.resize(ghostCount);
+	domain->ghostSlots.resize(ghostCount);
+	for (int g = 0; g < ghostCount; g++) {
+		domain->ghostDomains[g] = partition.owners[ghosts[g]];
+		domain->ghostSlots[g] = partition.sendSlots[ghosts[g]];
+	}
+	auto localIndex = [&](int particle) {
+		if (partition.owners[particle] == d) {
+			return partition.localIndices[particle];
+		}
+		return ownedCount + (int)(std::lower_bound(ghosts.begin(), ghosts.end(), particle) - ghosts.begin());
+	};
+
+	// Particle state
+	int localCount = ownedCount + ghostCount;
+	domain->px.resize(localCount);
+	domain->py.resize(localCount);
+	domain->pz.resize(localCount);
+	domain->ox.resize(ownedCount);
+	domain->oy.resize(ownedCount);
+	domain->oz.resize(ownedCount);
+	domain->vx.resize(ownedCount);
+	domain->vy.resize(ownedCount);
+	domain->vz.resize(ownedCount);
+	domain->fx.assign(ownedCount, 0);
+	domain->fy.assign(ownedCount, 0);
+	domain->fz.assign(ownedCount, 0);
+	domain->masses.resize(ownedCount);
+	domain->inverseMasses.resize(ownedCount);
+	for (int i = 0; i < localCount; i++) {
+		int global = domain->globalIds[i];
+		domain->px[i] = system.positions.x[global];
+		domain->py[i] = system.positions.y[global];
+		domain->pz[i] = system.positions.z[global];
+		if (i >= ownedCount) {
+			continue;
+		}
+		domain->ox[i] = system.previousPositions.x[global];
+		domain->oy[i] = system.previousPositions.y[global];
+		domain->oz[i] = system.previousPositions.z[global];
+		domain->vx[i] = system.velocities.x[global];
+		domain->vy[i] = system.velocities.y[global];
+		domain->vz[i] = system.velocities.z[global];
+		domain->masses[i] = system.masses[global];
+		domain->inverseMasses[i] = system.inverseMasses[global];
+	}
+
+	// Springs and their incidence on the owned particles, built as in StretchedSpringForceKernel
+	domain->indicesA.resize(springCount);
+	domain->indicesB.resize(springCount);
+	domain->restLengths.resize(springCount);
+	domain->stiffnesses.resize(springCount);
+	domain->springForces.assign(3 * springCount, 0);
+	domain->incidenceStarts.assign(ownedCount + 1, 0);
+	for (int k = 0; k < springCount; k++) {
+		int s = partition.springs[firstSpring + k];
+		domain->indicesA[k] = localIndex(springs.indicesA[s]);
+		domain->indicesB[k] = localIndex(springs.indicesB[s]);
+		domain->restLengths[k] = springs.restLengths[s];
+		domain->stiffnesses[k] = springs.stiffnesses[s];
+		if (domain->indicesA[k] < ownedCount) {
+			domain->incidenceStarts[domain->indicesA[k] + 1]++;
+		}
+		if (domain->indicesB[k] < ownedCount) {
+			domain->incidenceStarts[domain->indicesB[k] + 1]++;
+		}
+	}
+	for (int i = 0; i < ownedCount; i++) {
+		domain->incidenceStarts[i + 1] += domain->incidenceStarts[i];
+	}
+	std::vector<int> next(domain->incidenceStarts.begin(), domain->incidenceStarts.end() - 1);
+	domain->incidenceSprings.resize(domain->incidenceStarts[ownedCount]);
+	domain->incidenceSigns.resize(domain->incidenceStarts[ownedCount]);
+	for (int k = 0; k < springCount; k++) {
+		if (domain->indicesA[k] < ownedCount) {
+			int slot = next[domain->indicesA[k]]++;
+			domain->incidenceSprings[slot] = k;
+			domain->incidenceSigns[slot] = 1;
+		}
+		if (domain->indicesB[k] < ownedCount) {
+			int slot = next[domain->indicesB[k]]++;
+			domain->incidenceSprings[slot] = k;
+			domain->incidenceSigns[slot] = -1;
+		}
+	}
+
+	// Pins of the owned particles, in the order of the system's table
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	for (int s = 0; s < pins.size(); s++) {
+		int particle = pins.indices[s];
+		if (partition.owners[particle] != d) {
+			continue;
+		}
+		domain->pinIndices.push_back(partition.localIndices[particle]);
+		domain->pinX.push_back(pins.restPositions.x[s]);
+		domain->pinY.push_back(pins.restPositions.y[s]);
+		domain->pinZ.push_back(pins.restPositions.z[s]);
+		domain->pinStiffnesses.push_back(pins.stiffnesses[s]);
+	}
+
+	// Boundary particles, with their current positions ready for the first step
+	for (int i = 0; i < ownedCount; i++) {
+		if (partition.sendSlots[domain->globalIds[i]] >= 0) {
+			domain->sendParticles.push_back(i);
+		}
+	}
+	int sendCount = (int)domain->sendParticles.size();
+	for (int b = 0; b < 2; b++) {
+		domain->sendBuffers[b].resize(3 * sendCount);
+	}
+	for (int k = 0; k < sendCount; k++) {
+		int i = domain->sendParticles[k];
+		domain->sendBuffers[0][3 * k] = domain->px[i];
+		domain->sendBuffers[0][3 * k + 1] = domain->py[i];
+		domain->sendBuffers[0][3 * k + 2] = domain->pz[i];
+	}
+}
+
+void StretchedDomainDecomposition::store(StretchedParticleSystem &system) const {
+	for (int d = 0; d < (int)domains.size(); d++) {
+		const Domain &domain = *domains[d];
+		for (int i = 0; i < domain.ownedCount; i++) {
+			int global = domain.globalIds[i];
+			system.positions.x[global] = domain.px[i];
+			system.positions.y[global] = domain.py[i];
+			system.positions.z[global] = domain.pz[i];
+			system.previousPositions.x[global] = domain.ox[i];
+			system.previousPositions.y[global] = domain.oy[i];
+			system.previousPositions.z[global] = domain.oz[i];
+			system.velocities.x[global] = domain.vx[i];
+			system.velocities.y[global] = domain.vy[i];
+			system.velocities.z[global] = domain.vz[i];
+		}
+	}
+}
+
+void StretchedDomainDecomposition::step(double timeStep) {
+	if (domains.empty()) {
+		return;
+	}
+	// The pool returns once every domain is done, which is the only synchronization a step needs
+	int parity = stepCount & 1;
+	threadPool->runOnAllThreads([&](int threadIndex) {
+		if (threadIndex > 0) {
+			stepDomain(*domains[threadIndex - 1], timeStep, parity);
+		}
+	});
+	stepCount++;
+}
+
+void StretchedDomainDecomposition::steps(int count, double timeStep) {
+	for (int i = 0; i < count; i++) {
+		step(timeStep);
+	}
+}
+
+void StretchedDomainDecomposition::stepDomain(Domain &domain, double timeStep, int parity) {
+	int n = domain.ownedCount;
+	double *px = domain.px.data(), *py = domain.py.data(), *pz = domain.pz.data();
+	double *ox = domain.ox.data(), *oy = domain.oy.data(), *oz = domain.oz.data();
+	double *vx = domain.vx.data(), *vy = domain.vy.data(), *vz = domain.vz.data();
+	double *fx = domain.fx.data(), *fy = domain.fy.data(), *fz = domain.fz.data();
+
+	// Ghost positions from the buffers the neighbours filled at the end of the last step
+	int ghostCount = (int)domain.ghostDomains.size();
+	for (int g = 0; g < ghostCount; g++) {
+		const double *source = &domains[domain.ghostDomains[g]]->sendBuffers[parity][3 * domain.ghostSlots[g]];
+		px[n + g] = source[0];
+		py[n + g] = source[1];
+		pz[n + g] = source[2];
+	}
+
+	// The loops of StretchedParticleSystem::step over the owned particles (the springs also read the ghosts)
+	typedef StretchedStepLoops<double> Loops;
+	StretchedParticleArrays<double> particles = { px, py, pz, ox, oy, oz, vx, vy, vz, fx, fy, fz, domain.masses.data(), domain.inverseMasses.data() };
+	StretchedAllParticles owned(n);
+	Loops::clearForces(particles, owned);
+	if (useGravity) {
+		Loops::accumulateGravity(particles, owned, upAxis);
+	}
+	if (useDragForce) {
+		Loops::accumulateDrag(particles, owned, dragScale);
+	}
+	StretchedSpringArrays<double> springs = { domain.indicesA.data(), domain.indicesB.data(), domain.restLengths.data(), domain.stiffnesses.data() };
+	Loops::computeSpringForces(springs, px, py, pz, domain.springForces.data(), 0, (int)domain.indicesA.size());
+	StretchedIncidenceArrays<double> incidence = { domain.incidenceStarts.data(), domain.incidenceSprings.data(), domain.incidenceSigns.data() };
+	Loops::gatherSprings(incidence, domain.springForces.data(), fx, fy, fz, 0, n);
+	StretchedPinArrays<double> pins = { domain.pinIndices.data(), domain.pinX.data(), domain.pinY.data(), domain.pinZ.data(), domain.pinStiffnesses.data(), (int)domain.pinIndices.size() };
+	Loops::accumulatePinForces(particles, pins);
+
+	double damping = useVelocityDamping ? velocityDampingConstant : 0;
+	if (useVerlet) {
+		StretchedVerletPolicy::integrate(particles, owned, timeStep, damping);
+	} else {
+		StretchedSymplecticEulerPolicy::integrate(particles, owned, timeStep, damping);
+	}
+	if (useFloorConstraint) {
+		Loops::resolveFloorConstraint(particles, owned, upAxis, floorHeight);
+	}
+
+	// Boundary positions for the neighbours' next step (the other buffer is still being read this step)
+	double *send = domain.sendBuffers[1 - parity].data();
+	int sendCount = (int)domain.sendParticles.size();
+	for (int k = 0; k < sendCount; k++) {
+		int i = domain.sendParticles[k];
+		send[3 * k] = px[i];
+		send[3 * k + 1] = py[i];
+		send[3 * k + 2] = pz[i];
+	}
+}
+
+int StretchedDomainDecomposition::getDomainCount() const {
+	return (int)domains.size();
+}
+
+int StretchedDomainDecomposition::getNumaNodeCount() const {
+	return numaNodeCount;
+}
+
+int StretchedDomainDecomposition::getHaloParticleCount() const {
+	return haloParticleCount;
+}
+
+int StretchedDomainDecomposition::getCutSpringCount() const {
+	return cutSpringCount;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "StretchedConstants.h"
+#include "StretchedThreadPool.h"
+
+class StretchedParticleSystem;
+
+// Explicit stepping of a large fabric split into spatial subdomains, one per thread, for machines with
+// several NUMA nodes (memory controllers). The particles are sorted along a Morton curve of their
+// positions and cut into equal runs; each subdomain keeps its own particle arrays and the springs and
+// pins of its particles, allocated and first touched by its thread, which is pinned to one NUMA node, so
+// a step mostly streams memory local to the node. The positions of the particles a subdomain needs from
+// its neighbours (the far ends of the springs that cross the cut) come through halo buffers: after
+// integrating, each thread copies its boundary particles into its own send buffer, and at the start of
+// the next step every thread copies the ones it needs out of its neighbours' buffers (two buffers
+// alternate, so a single barrier per step is enough).
+// Springs that cross the cut are evaluated on both sides, and each domain runs the step loops of
+// StretchedParticleSystem (StretchedStepPolicies.h) on its particles, so every particle sums its forces
+// in the same order and the result matches StretchedParticleSystem::step exactly for any domain count.
+// Covers the SYMPLECTIC_EULER and VERLET integrators with gravity, drag, damping, pins and the floor.
+class StretchedDomainDecomposition {
+
+public:
+	StretchedDomainDecomposition();
+	~StretchedDomainDecomposition();
+
+	StretchedDomainDecomposition(const StretchedDomainDecomposition &) = delete;
+	StretchedDomainDecomposition &operator=(const StretchedDomainDecomposition &) = delete;
+
+	// Number of subdomains (and threads) used by load, <= 0 for one per hardware thread
+	int domainCount = 0;
+	// Pins each thread to the NUMA node of its subdomain (subdomains are spread evenly over the nodes)
+	bool pinThreads = true;
+
+	// Splits the particles of system into subdomains and copies the state and settings in. Returns false
+	// if the system uses something the decomposed step does not cover (implicit integrators, position
+	// based constraints, collisions or sleeping).
+	bool load(const StretchedParticleSystem &system);
+	// Writes the positions, previous positions and velocities back (the system must be the one loaded)
+	void store(StretchedParticleSystem &system) const;
+
+	void step(double timeStep = DELTA_T);
+	void steps(int count, double timeStep = DELTA_T);
+
+	int getDomainCount() const;
+	int getNumaNodeCount() const;
+	// Particles copied through the halo buffers every step, and springs evaluated on both sides of a cut
+	int getHaloParticleCount() const;
+	int getCutSpringCount() const;
+
+private:
+	struct Partition;
+	struct Domain;
+	std::vector<Domain *> domains;
+	// One thread per domain plus the calling thread, which only waits for them
+	StretchedThreadPool *threadPool = NULL;
+	int numaNodeCount = 1;
+	int stepCount = 0;
+	int haloParticleCount = 0;
+	int cutSpringCount = 0;
+
+	// Settings copied from the system
+	bool useVerlet = true;
+	int upAxis = 1;
+	bool useGravity = false;
+	bool useDragForce = false;
+	bool useFloorConstraint = true;
+	bool useVelocityDamping = true;
+	double velocityDampingConstant = 0;
+	double dragScale = 0;
+	double floorHeight = 0;
+
+	void clear();
+	// Builds domain d from its share of the partition, on the thread that will step it
+	void buildDomain(int d, const StretchedParticleSystem &system, const Partition &partition);
+	void stepDomain(Domain &domain, double timeStep, int parity);
+};
@@ -0,0 +1,674 @@
+#include "StretchedEquilibriumSolver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Utils/Logger.h"
+
+#include "StretchedParticleSystem.h"
+
+
+// Backtracking steps (halving) of the line search
+static const int LINE_SEARCH_STEPS = 30;
+// Steps are taken if E drops by at least this fraction of the decrease the gradient predicts
+static const double LINE_SEARCH_SUFFICIENT_DECREASE = 1e-4;
+// Backtracking steps (halving) along the lowest mode when leaving a saddle
+static const int SADDLE_LINE_SEARCH_STEPS = 20;
+// Factorization attempts (raising the shift tenfold each time) when checking for a saddle
+static const int MAX_FACTORIZATION_ATTEMPTS = 8;
+// Inverse iterations for the lowest mode of the Hessian at a saddle
+static const int SADDLE_MODE_ITERATIONS = 30;
+
+static double dot(const double *a, const double *b, int count) {
+	double sum = 0;
+	for (int i = 0; i < count; i++) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+StretchedEquilibriumSolver::StretchedEquilibriumSolver() {
+	// The saddle check raises the shift whenever the Hessian is indefinite
+	cholesky.logIndefinite = false;
+}
+
+StretchedEquilibriumSolver::~StretchedEquilibriumSolver() {
+	// Nothing to see here
+}
+
+int StretchedEquilibriumSolver::solve(StretchedParticleSystem &system) {
+	int n = system.getParticleCount();
+	int dofs = 3 * n;
+	xTrial.resize(dofs);
+	gradient.resize(dofs);
+	gradientTrial.resize(dofs);
+	direction.resize(dofs);
+	rightHandSide.resize(dofs);
+	movingDiagonal.resize(dofs);
+
+	lastSettleSteps = settle(system);
+	prepare(system);
+	if (useFloor) {
+		for (int i = 0; i < n; i++) {
+			x[3 * i + upAxis] = std::max(x[3 * i + upAxis], floorHeight);
+		}
+	}
+
+	converged = false;
+	lastIterations = 0;
+	lastEnergyEvaluations = 1;
+	double energy = computeEnergy(system, x, gradient);
+	double stepTolerance = tolerance * lengthScale;
+	double initialGradientNorm = -1;
+	conjugateGradient.maxIterations = maxConjugateGradientIterations;
+	while (lastIterations < maxIterations) {
+		updateMovingDiagonal();
+		double gradientNorm = 0;
+		double largestForceStep = 0;
+		for (int i = 0; i < n; i++) {
+			double sqForce = 0;
+			for (int c = 0; c < 3; c++) {
+				double force = movingDiagonal[3 * i + c] > 0 ? -gradient[3 * i + c] : 0;
+				rightHandSide[3 * i + c] = force;
+				sqForce += force * force;
+			}
+			gradientNorm += sqForce;
+			largestForceStep = std::max(largestForceStep, sqForce * inverseDiagonal[3 * i] * inverseDiagonal[3 * i]);
+		}
+		gradientNorm = sqrt(gradientNorm);
+		if (initialGradientNorm < 0) {
+			initialGradientNorm = gradientNorm;
+		}
+		// Converged once no particle would move more than the tolerance to balance its force on its own
+		if (sqrt(largestForceStep) < stepTolerance) {
+			if (escapeSaddle(system, energy)) {
+				lastIterations++;
+				continue;
+			}
+			converged = true;
+			break;
+		}
+
+		// Inexact Newton step, more exact as the gradient drops
+		assembleHessian(system, x, regularization);
+		conjugateGradient.tolerance = std::min(0.5, sqrt(gradientNorm / initialGradientNorm));
+		conjugateGradient.solveTruncated(hessianAssembler.getMatrix(), rightHandSide, movingDiagonal, direction);
+		// The rigid motions are only held by the regularization, any part of them in the step is drift
+		computeRigidModes(system);
+		removeRigidModes(direction);
+
+		// Backtracking line search, starting from the full step or one moving no particle more than a mean rest length
+		double slope = dot(gradient.data(), direction.data(), dofs);
+		double alpha = std::min(1.0, lengthScale / computeLargestStep(n));
+		bool accepted = false;
+		for (int k = 0; k < LINE_SEARCH_STEPS && !accepted; k++) {
+			moveTrial(alpha);
+			double change = computeEnergyChange(system);
+			lastEnergyEvaluations++;
+			if (change < 0 && change <= LINE_SEARCH_SUFFICIENT_DECREASE * alpha * slope) {
+				energy += change;
+				accepted = true;
+			}
+			alpha *= 0.5;
+		}
+		if (!accepted) {
+			// E does not drop along the step as far as doubles resolve it
+			break;
+		}
+		x.swap(xTrial);
+		gradient.swap(gradientTrial);
+		lastIterations++;
+	}
+	// The changes add up to the energy with some round off
+	lastEnergy = computeEnergy(system, x, gradient);
+
+	for (int i = 0; i < n; i++) {
+		P3D position(x[3 * i], x[3 * i + 1], x[3 * i + 2]);
+		system.positions.set(i, position);
+		system.previousPositions.set(i, position);
+	}
+	system.velocities.setZero();
+	return lastIterations;
+}
+
+void StretchedEquilibriumSolver::updateMovingDiagonal() {
+	int dofs = (int)x.size();
+	for (int i = 0; i < dofs; i++) {
+		movingDiagonal[i] = inverseDiagonal[i] > 0 ? 1 / inverseDiagonal[i] : 0;
+	}
+	if (useFloor) {
+		for (int i = upAxis; i < dofs; i += 3) {
+			if (x[i] <= floorHeight && gradient[i] >= 0) {
+				movingDiagonal[i] = 0;
+			}
+		}
+	}
+}
+
+void StretchedEquilibriumSolver::moveTrial(double alpha) {
+	int dofs = (int)x.size();
+	for (int i = 0; i < dofs; i++) {
+		xTrial[i] = x[i] + alpha * direction[i];
+	}
+	if (useFloor) {
+		for (int i = upAxis; i < dofs; i += 3) {
+			xTrial[i] = std::max(xTrial[i], floorHeight);
+		}
+	}
+}
+
+double StretchedEquilibriumSolver::computeLargestStep(int n) const {
+	double largestStep = 0;
+	for (int i = 0; i < n; i++) {
+		const double *d = &direction[3 * i];
+		largestStep = std::max(largestStep, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+	return sqrt(largestStep);
+}
+
+bool StretchedEquilibriumSolver::escapeSaddle(const StretchedParticleSystem &system, double &energy) {
+	// H + regularization D factors at a minimum; the rigid motions are the only zero modes
+	double shift = regularization;
+	if (!factorizeHessian(system, true, shift) || shift <= regularization) {
+		return false;
+	}
+	if (!(computeSaddleDirection(system, shift) < 0)) {
+		return false;
+	}
+	int dofs = (int)x.size();
+	for (int i = 0; i < dofs; i++) {
+		if (movingDiagonal[i] == 0) {
+			direction[i] = 0;
+		}
+	}
+	double alpha = 1;
+	for (int k = 0; k < SADDLE_LINE_SEARCH_STEPS; k++) {
+		moveTrial(alpha);
+		double change = computeEnergyChange(system);
+		lastEnergyEvaluations++;
+		if (change < 0) {
+			x.swap(xTrial);
+			gradient.swap(gradientTrial);
+			energy += change;
+			return true;
+		}
+		alpha *= 0.5;
+	}
+	return false;
+}
+
+int StretchedEquilibriumSolver::settle(StretchedParticleSystem &system) {
+	int n = system.getParticleCount();
+	double totalMass = 0;
+	for (int i = 0; i < n; i++) {
+		if (system.inverseMasses[i] != 0) {
+			totalMass += system.masses[i];
+		}
+	}
+	// Motion below the tolerance per step counts as settled, so a system already at rest stops at once
+	double restSpeed = computeMeanRestLength(system) * tolerance / DELTA_T;
+	double restKineticEnergy = 0.5 * totalMass * restSpeed * restSpeed;
+	double peakKineticEnergy = 0;
+	for (int k = 0; k < settleSteps; k++) {
+		system.step();
+		const StretchedVectorArray &v = system.velocities;
+		double kineticEnergy = 0;
+		for (int i = 0; i < n; i++) {
+			if (system.inverseMasses[i] != 0) {
+				kineticEnergy += 0.5 * system.masses[i] * (v.x[i] * v.x[i] + v.y[i] * v.y[i] + v.z[i] * v.z[i]);
+			}
+		}
+		peakKineticEnergy = std::max(peakKineticEnergy, kineticEnergy);
+		if (kineticEnergy <= std::max(settleKineticEnergyRatio * peakKineticEnergy, restKineticEnergy)) {
+			return k + 1;
+		}
+	}
+	return settleSteps;
+}
+
+double StretchedEquilibriumSolver::computeMeanRestLength(const StretchedParticleSystem &system) {
+	const StretchedSpringTable &springs = system.springs;
+	double restLengthSum = 0;
+	for (int s = 0; s < springs.size(); s++) {
+		restLengthSum += springs.restLengths[s];
+	}
+	return restLengthSum > 0 ? restLengthSum / springs.size() : 1.0;
+}
+
+double StretchedEquilibriumSolver::computeWeightedDot(const double *a, const double *b) const {
+	int dofs = (int)x.size();
+	double sum = 0;
+	for (int i = 0; i < dofs; i++) {
+		sum += inverseDiagonal[i] > 0 ? a[i] * b[i] / inverseDiagonal[i] : 0;
+	}
+	return sum;
+}
+
+void StretchedEquilibriumSolver::computeRigidModes(const StretchedParticleSystem &system) {
+	int n = system.getParticleCount();
+	int dofs = 3 * n;
+	rigidModes.clear();
+	// Pins, fixed particles, gravity and particles held on the floor all stop the fabric moving freely
+	if (system.zeroLengthSprings.size() > 0 || gravity != 0 || std::find(fixed.begin(), fixed.end(), 1) != fixed.end()) {
+		return;
+	}
+	for (int i = 0; i < dofs; i++) {
+		if (movingDiagonal[i] == 0 && inverseDiagonal[i] > 0) {
+			return;
+		}
+	}
+
+	double center[3] = { 0, 0, 0 };
+	for (int i = 0; i < n; i++) {
+		for (int c = 0; c < 3; c++) {
+			center[c] += x[3 * i + c] / n;
+		}
+	}
+	rigidModes.assign((size_t)6 * dofs, 0.0);
+	for (int m = 0; m < 6; m++) {
+		double *mode = &rigidModes[(size_t)m * dofs];
+		for (int i = 0; i < n; i++) {
+			if (m < 3) {
+				mode[3 * i + m] = 1;
+			} else {
+				// Rotation about axis m - 3 through the center
+				int c1 = (m - 2) % 3, c2 = (m - 1) % 3;
+				mode[3 * i + c2] = x[3 * i + c1] - center[c1];
+				mode[3 * i + c1] = center[c2] - x[3 * i + c2];
+			}
+		}
+		for (int k = 0; k < m; k++) {
+			const double *other = &rigidModes[(size_t)k * dofs];
+			double projection = computeWeightedDot(other, mode);
+			for (int i = 0; i < dofs; i++) {
+				mode[i] -= projection * other[i];
+			}
+		}
+		double norm = sqrt(computeWeightedDot(mode, mode));
+		for (int i = 0; i < dofs; i++) {
+			mode[i] = norm > 0 ? mode[i] / norm : 0;
+		}
+	}
+}
+
+void StretchedEquilibriumSolver::removeRigidModes(std::vector<double> &v) const {
+	int dofs = (int)x.size();
+	int modeCount = (int)(rigidModes.size() / dofs);
+	for (int m = 0; m < modeCount; m++) {
+		const double *mode = &rigidModes[(size_t)m * dofs];
+		double projection = computeWeightedDot(mode, v.data());
+		for (int i = 0; i < dofs; i++) {
+			v[i] -= projection * mode[i];
+		}
+	}
+}
+
+double StretchedEquilibriumSolver::computeSaddleDirection(const StretchedParticleSystem &system, double shift) {
+	int n = system.getParticleCount();
+	int dofs = 3 * n;
+	std::vector<double> weights(dofs);
+	for (int i = 0; i < dofs; i++) {
+		weights[i] = inverseDiagonal[i] > 0 ? 1 / inverseDiagonal[i] : 0;
+	}
+
+	computeRigidModes(system);
+	auto deflate = [&](std::vector<double> &v) {
+		removeRigidModes(v);
+		double norm = sqrt(computeWeightedDot(v.data(), v.data()));
+		for (int i = 0; i < dofs; i++) {
+			v[i] = norm > 0 ? v[i] / norm : 0;
+		}
+	};
+
+	// Inverse iteration with the factor of H + shift D converges to the most negative mode of H
+	std::vector<double> &v = direction;
+	std::vector<double> product(dofs);
+	unsigned int seed = 1;
+	for (int i = 0; i < dofs; i++) {
+		seed = seed * 1103515245u + 12345u;
+		v[i] = weights[i] > 0 ? ((seed >> 16) & 0x7fff) / 32767.0 - 0.5 : 0;
+	}
+	deflate(v);
+	for (int iteration = 0; iteration < SADDLE_MODE_ITERATIONS; iteration++) {
+		for (int i = 0; i < dofs; i++) {
+			product[i] = weights[i] * v[i];
+		}
+		cholesky.solve(product);
+		v.swap(product);
+		deflate(v);
+	}
+	hessianAssembler.getMatrix().multiply(v, product);
+	double curvature = dot(v.data(), product.data(), dofs) - shift;
+	if (!(curvature < 0)) {
+		return curvature;
+	}
+
+	// Downhill, moving the farthest particle by one mean rest length
+	double maxNorm = 0;
+	for (int i = 0; i < n; i++) {
+		const double *d = &v[3 * i];
+		maxNorm = std::max(maxNorm, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+	double scale = lengthScale / sqrt(maxNorm);
+	if (dot(gradient.data(), v.data(), dofs) > 0) {
+		scale = -scale;
+	}
+	for (int i = 0; i < dofs; i++) {
+		v[i] *= scale;
+	}
+	return curvature;
+}
+
+// Nested dissection of the particle graph, with the x, y, z rows of each particle kept together
+std::vector<int> StretchedEquilibriumSolver::computeOrdering(const StretchedParticleSystem &system) {
+	int n = system.getParticleCount();
+	const StretchedSpringTable &springs = system.springs;
+	triplets.clear();
+	triplets.reserve(n + 2 * springs.size());
+	for (int i = 0; i < n; i++) {
+		triplets.push_back(StretchedSparseTriplet(i, i, 1.0));
+	}
+	for (int s = 0; s < springs.size(); s++) {
+		triplets.push_back(StretchedSparseTriplet(springs.indicesA[s], springs.indicesB[s], 1.0));
+		triplets.push_back(StretchedSparseTriplet(springs.indicesB[s], springs.indicesA[s], 1.0));
+	}
+	StretchedSparseMatrix particleGraph;
+	particleGraph.setFromTriplets(n, n, triplets);
+	std::vector<int> particleOrdering = StretchedSparseCholesky::computeNestedDissectionOrdering(particleGraph, system.positions);
+	std::vector<int> ordering(3 * n);
+	for (int k = 0; k < n; k++) {
+		for (int c = 0; c < 3; c++) {
+			ordering[3 * k + c] = 3 * particleOrdering[k] + c;
+		}
+	}
+	return ordering;
+}
+
+void StretchedEquilibriumSolver::prepare(const StretchedParticleSystem &system) {
+	int n = system.getParticleCount();
+	const StretchedVectorArray &p = system.positions;
+	x.resize(3 * n);
+	fixed.resize(n);
+	for (int i = 0; i < n; i++) {
+		x[3 * i] = p.x[i];
+		x[3 * i + 1] = p.y[i];
+		x[3 * i + 2] = p.z[i];
+		fixed[i] = system.inverseMasses[i] == 0;
+	}
+	computeInverseDiagonal(system);
+	// The tolerance is relative to the mean rest length so it does not depend on the units of the design
+	lengthScale = computeMeanRestLength(system);
+	useFloor = system.useFloorConstraint;
+	floorHeight = system.floorHeight;
+	upAxis = system.upAxis;
+	gravity = system.useGravity ? GRAVITY : 0;
+	// Solves are far apart and the springs may have been edited in between, so the pattern is rebuilt once per solve
+	hessianAssembler.invalidate();
+}
+
+bool StretchedEquilibriumSolver::factorizeHessian(const StretchedParticleSystem &system, bool analyze, double &shift) {
+	int dofs = (int)x.size();
+	for (int attempt = 0; attempt < MAX_FACTORIZATION_ATTEMPTS; attempt++) {
+		bool patternRebuilt = assembleHessian(system, x, shift);
+		// The pattern only depends on the springs, so it is analyzed once per solve
+		if ((analyze && attempt == 0) || patternRebuilt || !cholesky.isAnalyzed() || cholesky.getSize() != dofs) {
+			cholesky.analyze(hessianAssembler.getMatrix(), computeOrdering(system));
+		}
+		if (cholesky.factorize(hessianAssembler.getMatrix())) {
+			return true;
+		}
+		shift *= 10;
+	}
+	return false;
+}
+
+double StretchedEquilibriumSolver::computeShapeGradient(const StretchedParticleSystem &system, const StretchedVectorArray &target, const std::vector<double> &weights,
+	std::vector<double> &restLengthRatioGradient, std::vector<double> &stiffnessGradient) {
+	int n = system.getParticleCount();
+	int targetCount = std::min(n, target.size());
+	const StretchedSpringTable &springs = system.springs;
+	int springCount = springs.size();
+	restLengthRatioGradient.assign(springCount, 0.0);
+	stiffnessGradient.assign(springCount, 0.0);
+	prepare(system);
+
+	// dLoss/dx, which is also the right hand side of the adjoint system
+	double loss = 0;
+	adjoint.assign(3 * n, 0.0);
+	for (int i = 0; i < targetCount; i++) {
+		double w = weights.empty() ? 1.0 : weights[i];
+		double d[3] = { x[3 * i] - target.x[i], x[3 * i + 1] - target.y[i], x[3 * i + 2] - target.z[i] };
+		loss += 0.5 * w * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		if (!fixed[i]) {
+			for (int c = 0; c < 3; c++) {
+				adjoint[3 * i + c] = w * d[c];
+			}
+		}
+	}
+
+	// H is symmetric so the adjoint system is H lambda = dLoss/dx. The compressed springs have negative
+	// transverse stiffness, but at a minimum the sum is still positive semi-definite.
+	double shift = regularization;
+	if (!factorizeHessian(system, true, shift)) {
+		Logger::consolePrint("Could not factorize the equilibrium Hessian for the shape gradient");
+		return -1;
+	}
+	cholesky.solve(adjoint);
+
+	// dLoss/dp = -lambda^T dg/dp, where g_a = -g_b = k (l - L) (x_a - x_b) / l for each spring
+	for (int s = 0; s < springCount; s++) {
+		int a = springs.indicesA[s];
+		int b = springs.indicesB[s];
+		double d[3] = { x[3 * a] - x[3 * b], x[3 * a + 1] - x[3 * b + 1], x[3 * a + 2] - x[3 * b + 2] };
+		double length = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		if (length < EPSILON_CHECK) {
+			continue;
+		}
+		double projected = 0;
+		for (int c = 0; c < 3; c++) {
+			projected += (adjoint[3 * a + c] - adjoint[3 * b + c]) * d[c];
+		}
+		projected /= length;
+		double restLength = springs.restLengths[s];
+		double ratio = springs.restLengthRatios[s];
+		// dg_a/dL = -k (x_a - x_b) / l, and L = ratio * (length the spring was made at)
+		double restLengthGradient = springs.stiffnesses[s] * projected;
+		restLengthRatioGradient[s] = ratio != 0 ? restLengthGradient * restLength / ratio : 0;
+		// dg_a/dk = (l - L) (x_a - x_b) / l
+		stiffnessGradient[s] = -(length - restLength) * projected;
+	}
+	return loss;
+}
+
+bool StretchedEquilibriumSolver::assembleHessian(const StretchedParticleSystem &system, const std::vector<double> &pos, double shift) {
+	int n = system.getParticleCount();
+	const StretchedSpringTable &springs = system.springs;
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	bool patternRebuilt = hessianAssembler.begin(system);
+
+	// Regularization (identity rows for fixed and unconnected particles)
+	for (int i = 0; i < n; i++) {
+		hessianAssembler.setDiagonal(i, inverseDiagonal[3 * i] == 0 ? 1.0 : shift / inverseDiagonal[3 * i]);
+	}
+
+	int springCount = springs.size();
+	for (int s = 0; s < springCount; s++) {
+		int a = springs.indicesA[s];
+		int b = springs.indicesB[s];
+		double u[3] = { pos[3 * a] - pos[3 * b], pos[3 * a + 1] - pos[3 * b + 1], pos[3 * a + 2] - pos[3 * b + 2] };
+		double length = sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+		double k = springs.stiffnesses[s];
+		double transverse = 0;
+		if (length < EPSILON_CHECK) {
+			k = 0;
+		} else {
+			u[0] /= length;
+			u[1] /= length;
+			u[2] /= length;
+			// Negative for compressed springs, so H is indefinite away from a minimum and the shift is raised
+			transverse = 1 - springs.restLengths[s] / length;
+		}
+		hessianAssembler.addSpring(s, a, b, u, k, transverse, !fixed[a], !fixed[b]);
+	}
+
+	for (int s = 0; s < pins.size(); s++) {
+		int a = pins.indices[s];
+		if (fixed[a]) {
+			continue;
+		}
+		hessianAssembler.addToDiagonal(a, pins.stiffnesses[s]);
+	}
+	return patternRebuilt;
+}
+
+void StretchedEquilibriumSolver::computeInverseDiagonal(const StretchedParticleSystem &system) {
+	int n = system.getParticleCount();
+	std::vector<double> stiffness(n, 0.0);
+	const StretchedSpringTable &springs = system.springs;
+	for (int s = 0; s < springs.size(); s++) {
+		stiffness[springs.indicesA[s]] += springs.stiffnesses[s];
+		stiffness[springs.indicesB[s]] += springs.stiffnesses[s];
+	}
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	for (int s = 0; s < pins.size(); s++) {
+		stiffness[pins.indices[s]] += pins.stiffnesses[s];
+	}
+	inverseDiagonal.resize(3 * n);
+	for (int i = 0; i < n; i++) {
+		double inverse = (fixed[i] || stiffness[i] <= 0) ? 0 : 1 / stiffness[i];
+		inverseDiagonal[3 * i] = inverseDiagonal[3 * i + 1] = inverseDiagonal[3 * i + 2] = inverse;
+	}
+}
+
+double StretchedEquilibriumSolver::computeEnergy(const StretchedParticleSystem &system, const std::vector<double> &pos, std::vector<double> &grad) {
+	int n = system.getParticleCount();
+	std::fill(grad.begin(), grad.end(), 0.0);
+	double energy = 0;
+
+	const StretchedSpringTable &springs = system.springs;
+	int springCount = springs.size();
+	for (int s = 0; s < springCount; s++) {
+		int a = springs.indicesA[s];
+		int b = springs.indicesB[s];
+		double d[3] = { pos[3 * a] - pos[3 * b], pos[3 * a + 1] - pos[3 * b + 1], pos[3 * a + 2] - pos[3 * b + 2] };
+		double length = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		double stretch = length - springs.restLengths[s];
+		energy += 0.5 * springs.stiffnesses[s] * stretch * stretch;
+		if (length < EPSILON_CHECK) {
+			continue;
+		}
+		// dE/dx_a = k (l - L) (x_a - x_b) / l
+		double scale = springs.stiffnesses[s] * stretch / length;
+		for (int c = 0; c < 3; c++) {
+			grad[3 * a + c] += scale * d[c];
+			grad[3 * b + c] -= scale * d[c];
+		}
+	}
+
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	for (int s = 0; s < pins.size(); s++) {
+		int a = pins.indices[s];
+		double k = pins.stiffnesses[s];
+		double d[3] = { pos[3 * a] - pins.restPositions.x[s], pos[3 * a + 1] - pins.restPositions.y[s], pos[3 * a + 2] - pins.restPositions.z[s] };
+		energy += 0.5 * k * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		for (int c = 0; c < 3; c++) {
+			grad[3 * a + c] += k * d[c];
+		}
+	}
+
+	// Potential of the gravity force m g along the up axis
+	if (gravity != 0) {
+		for (int i = 0; i < n; i++) {
+			energy -= gravity * system.masses[i] * pos[3 * i + upAxis];
+			grad[3 * i + upAxis] -= gravity * system.masses[i];
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		if (fixed[i]) {
+			grad[3 * i] = grad[3 * i + 1] = grad[3 * i + 2] = 0;
+		}
+	}
+	return energy;
+}
+
+double StretchedEquilibriumSolver::computeEnergyChange(const StretchedParticleSystem &system) {
+	int n = system.getParticleCount();
+	std::vector<double> &grad = gradientTrial;
+	std::fill(grad.begin(), grad.end(), 0.0);
+	double change = 0;
+	const StretchedSpringTable &springs = system.springs;
+	int springCount = springs.size();
+	for (int s = 0; s < springCount; s++) {
+		int a = springs.indicesA[s];
+		int b = springs.indicesB[s];
+		double d[3], e[3];
+		double dd = 0, ee = 0, de = 0;
+		for (int c = 0; c < 3; c++) {
+			d[c] = x[3 * a + c] - x[3 * b + c];
+			e[c] = (xTrial[3 * a + c] - x[3 * a + c]) - (xTrial[3 * b + c] - x[3 * b + c]);
+			dd += d[c] * d[c];
+			de += d[c] * e[c];
+		}
+		double length = sqrt(dd);
+		double trial[3] = { d[0] + e[0], d[1] + e[1], d[2] + e[2] };
+		double trialLength = sqrt(trial[0] * trial[0] + trial[1] * trial[1] + trial[2] * trial[2]);
+		for (int c = 0; c < 3; c++) {
+			ee += e[c] * e[c];
+		}
+		double lengthChange = length + trialLength > 0 ? (2 * de + ee) / (length + trialLength) : 0;
+		double restLength = springs.restLengths[s];
+		change += 0.5 * springs.stiffnesses[s] * lengthChange * (length + trialLength - 2 * restLength);
+		if (trialLength < EPSILON_CHECK) {
+			continue;
+		}
+		double scale = springs.stiffnesses[s] * (trialLength - restLength) / trialLength;
+		for (int c = 0; c < 3; c++) {
+			grad[3 * a + c] += scale * trial[c];
+			grad[3 * b + c] -= scale * trial[c];
+		}
+	}
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	for (int s = 0; s < pins.size(); s++) {
+		int a = pins.indices[s];
+		double k = pins.stiffnesses[s];
+		double d[3] = { x[3 * a] - pins.restPositions.x[s], x[3 * a + 1] - pins.restPositions.y[s], x[3 * a + 2] - pins.restPositions.z[s] };
+		for (int c = 0; c < 3; c++) {
+			double e = xTrial[3 * a + c] - x[3 * a + c];
+			change += 0.5 * k * e * (2 * d[c] + e);
+			grad[3 * a + c] += k * (d[c] + e);
+		}
+	}
+	if (gravity != 0) {
+		for (int i = 0; i < n; i++) {
+			change -= gravity * system.masses[i] * (xTrial[3 * i + upAxis] - x[3 * i + upAxis]);
+			grad[3 * i + upAxis] -= gravity * system.masses[i];
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		if (fixed[i]) {
+			grad[3 * i] = grad[3 * i + 1] = grad[3 * i + 2] = 0;
+		}
+	}
+	return change;
+}
+
+bool StretchedEquilibriumSolver::hasConverged() const {
+	return converged;
+}
+
+double StretchedEquilibriumSolver::getLastEnergy() const {
+	return lastEnergy;
+}
+
+int StretchedEquilibriumSolver::getLastIterations() const {
+	return lastIterations;
+}
+
+int StretchedEquilibriumSolver::getLastEnergyEvaluations() const {
+	return lastEnergyEvaluations;
+}
+
+int StretchedEquilibriumSolver::getLastSettleSteps() const {
+	return lastSettleSteps;
+}
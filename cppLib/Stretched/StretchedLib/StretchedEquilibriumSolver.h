@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedConjugateGradientSolver.h"
+#include "StretchedHessianAssembler.h"
+#include "StretchedSparseCholesky.h"
+#include "StretchedSparseMatrix.h"
+
+class StretchedParticleSystem;
+
+// Quasi-static solve for the rest shape of the fabric once the hydrogel springs have shrunk.
+// Instead of time stepping until the motion dies out, the total potential energy
+//   E(x) = sum_springs 1/2 k (|x_a - x_b| - L)^2 + sum_pins 1/2 k |x_a - p|^2 (- sum_i m_i g . x_i with gravity)
+// is minimized directly from the current (usually flat) positions, with the floor of the system as a
+// lower bound on the height of every particle, as in step().
+// The minimizer is a truncated Newton method: the spring Hessian H is assembled every iteration and
+// the step approximately solves H p = -g with conjugate gradients preconditioned by D, the summed spring
+// stiffness at each particle, more exactly as the gradient g drops. H is indefinite away from a minimum,
+// where springs are compressed, and the flat fabric is a saddle of E; the conjugate gradients then stop
+// at the negative curvature with a step that still goes downhill, which is how the fabric buckles. A
+// backtracking line search only takes steps that lower E enough. Without pins, fixed particles, gravity
+// or floor contact the rigid motions are removed from the step, they are only held by the regularization.
+// Particles resting on the floor that E pushes down are held for the iteration, and the trial positions
+// are projected onto the floor.
+// Converged once no particle would move more than tolerance times the mean spring rest length to
+// balance its force on its own (|g_i| / D_i). The soft bending modes of the fabric leave the position
+// of the minimum itself far less certain than that, so this stops as soon as E is flat. H is then
+// factored with the sparse Cholesky; if it is indefinite this is a saddle, and the solve continues along
+// the lowest mode of H, found by inverse iteration.
+// Fixed particles do not move. Damping, drag and the position based bend/area constraints play no
+// part in the rest shape. Which of the nearby minima of the buckled fabric the solve reaches depends
+// on the path, like the motion of the dynamic simulation does, so the two can settle in different
+// minima of similar energy; the optional settling time steps the system with its own step() first
+// (settleSteps > 0), for shapes decided by inertia.
+//
+// For inverse design, computeShapeGradient differentiates a shape matching loss at the solved
+// equilibrium with respect to the spring parameters using the adjoint method: at equilibrium
+// g(x, p) = dE/dx = 0, so dLoss/dp = -lambda^T dg/dp with H lambda = dLoss/dx, where H is the
+// full (unclamped) Hessian. One factorization and solve gives the gradient for every spring.
+class StretchedEquilibriumSolver {
+
+public:
+	StretchedEquilibriumSolver();
+	~StretchedEquilibriumSolver();
+
+	// Smallest shift: D times this is added to the Hessian diagonal (for the rigid motions)
+	double regularization = 1e-8;
+	// Newton iterations (a flat 61 x 61 grid fabric takes about 5000)
+	int maxIterations = 10000;
+	// Conjugate gradient iterations per Newton step
+	int maxConjugateGradientIterations = 200;
+	// Converged once |g_i| / D_i of every particle is below this fraction of the mean spring rest length
+	double tolerance = 1e-6;
+	// Optional settling: time steps until the kinetic energy is this fraction of its peak (or the motion per
+	// step is below the tolerance), at most settleSteps times. Off (0 steps) by default.
+	double settleKineticEnergyRatio = 1e-5;
+	int settleSteps = 0;
+
+	// Moves the particles to the minimum of the energy the system descends to (after settling if settleSteps
+	// is set). Velocities are cleared. Returns the number of iterations taken (not counting the steps).
+	int solve(StretchedParticleSystem &system);
+
+	// Loss = 1/2 sum_i w_i |x_i - target_i|^2 over the first target.size() particles (weights empty means
+	// all 1), evaluated at the current positions, which must be a solved equilibrium. Fills the derivative
+	// of the loss for each spring with respect to its rest length ratio (the rest length is the ratio times
+	// the length the spring was made at) and its stiffness, and returns the loss (negative on failure).
+	// Without pins the rigid motions make H singular; the regularization picks the smallest-norm response.
+	double computeShapeGradient(const StretchedParticleSystem &system, const StretchedVectorArray &target, const std::vector<double> &weights,
+		std::vector<double> &restLengthRatioGradient, std::vector<double> &stiffnessGradient);
+
+	bool hasConverged() const;
+	double getLastEnergy() const;
+	int getLastIterations() const;
+	int getLastEnergyEvaluations() const;
+	// Time steps taken to settle the system before the last solve
+	int getLastSettleSteps() const;
+
+private:
+	bool converged = false;
+	double lastEnergy = 0;
+	int lastIterations = 0;
+	int lastEnergyEvaluations = 0;
+	int lastSettleSteps = 0;
+	// Mean spring rest length, which the tolerance is relative to
+	double lengthScale = 1;
+
+	// Floor bound and gravity, taken from the system by prepare
+	bool useFloor = false;
+	double floorHeight = 0;
+	int upAxis = 1;
+	double gravity = 0;
+
+	// Interleaved (x0, y0, z0, x1, ...) solver state, reused between solves
+	std::vector<double> x;
+	std::vector<double> xTrial;
+	std::vector<double> gradient;
+	std::vector<double> gradientTrial;
+	std::vector<double> direction;
+	std::vector<double> rightHandSide;
+	std::vector<double> inverseDiagonal;
+	// D for the rows that move this iteration, 0 for the fixed and the floor held ones
+	std::vector<double> movingDiagonal;
+	std::vector<char> fixed;
+	// D-orthonormal rigid motions of the particles when nothing holds the fabric in place, else empty
+	std::vector<double> rigidModes;
+	// Newton and adjoint systems, lambda of the adjoint solve
+	std::vector<double> adjoint;
+	std::vector<StretchedSparseTriplet> triplets;
+	StretchedConjugateGradientSolver conjugateGradient;
+	StretchedHessianAssembler hessianAssembler;
+	StretchedSparseCholesky cholesky;
+
+	// Time steps the system until its kinetic energy has dropped to settleKineticEnergyRatio of the peak
+	// (or the motion per step is below the tolerance), at most settleSteps times. Returns the steps taken.
+	int settle(StretchedParticleSystem &system);
+	double computeMeanRestLength(const StretchedParticleSystem &system);
+	// Copies the positions into x and updates the fixed particles, D and the floor and gravity
+	void prepare(const StretchedParticleSystem &system);
+	// Energy at pos, with its gradient (zero for the fixed particles) written to grad
+	double computeEnergy(const StretchedParticleSystem &system, const std::vector<double> &pos, std::vector<double> &grad);
+	// E(xTrial) - E(x), from the change of each spring length so it keeps its precision close to the minimum,
+	// with the gradient at xTrial written to gradientTrial
+	double computeEnergyChange(const StretchedParticleSystem &system);
+	void computeInverseDiagonal(const StretchedParticleSystem &system);
+	// Fills movingDiagonal for the current x and gradient, holding the particles on the floor that E pushes down
+	void updateMovingDiagonal();
+	// xTrial = x + alpha direction, projected onto the floor
+	void moveTrial(double alpha);
+	// Takes the largest step 2^-k along the saddle direction that lowers E. Returns false if there is none.
+	bool escapeSaddle(const StretchedParticleSystem &system, double &energy);
+	// Largest particle displacement of direction
+	double computeLargestStep(int n) const;
+	// a^T D b
+	double computeWeightedDot(const double *a, const double *b) const;
+	// Fills rigidModes for the current x
+	void computeRigidModes(const StretchedParticleSystem &system);
+	// Removes the rigid motions from v (D-orthogonally)
+	void removeRigidModes(std::vector<double> &v) const;
+	// Scaled lowest mode of H (into direction) and its curvature, for leaving a saddle
+	double computeSaddleDirection(const StretchedParticleSystem &system, double shift);
+	// Factors H + shift D at x, raising the shift until it succeeds (at most MAX_FACTORIZATION_ATTEMPTS times)
+	bool factorizeHessian(const StretchedParticleSystem &system, bool analyze, double &shift);
+	std::vector<int> computeOrdering(const StretchedParticleSystem &system);
+	// Returns true if the Hessian pattern was rebuilt
+	bool assembleHessian(const StretchedParticleSystem &system, const std::vector<double> &pos, double shift);
+};
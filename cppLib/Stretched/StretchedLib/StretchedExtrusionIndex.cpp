@@ -0,0 +1,322 @@
+#include "StretchedExtrusionIndex.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#include "StretchedConstants.h"
+
+static const int MAX_CELLS_PER_SIDE = 1024;
+
+// Coordinate of the edge (a to b) where its other coordinate is at: exact at the end points and never
+// outside the edge, so points in line with a corner compare equal to it
+static double interpolate(double aAt, double aValue, double bAt, double bValue, double at) {
+	if (at == aAt) {
+		return aValue;
+	}
+	if (at == bAt) {
+		return bValue;
+	}
+	double value = aValue + (at - aAt) * (bValue - aValue) / (bAt - aAt);
+	return std::max(std::min(aValue, bValue), std::min(std::max(aValue, bValue), value));
+}
+
+StretchedExtrusionIndex::StretchedExtrusionIndex() {
+	// Nothing to see here
+}
+
+StretchedExtrusionIndex::~StretchedExtrusionIndex() {
+	// Nothing to see here
+}
+
+void StretchedExtrusionIndex::clear() {
+	edgeAU.clear();
+	edgeAV.clear();
+	edgeBU.clear();
+	edgeBV.clear();
+	edgeExtrusions.clear();
+	cellsU = 0;
+	cellsV = 0;
+	cellEdgeStarts.clear();
+	cellEdges.clear();
+	cellWindingStarts.clear();
+	cellWindingExtrusions.clear();
+	cellWindings.clear();
+}
+
+void StretchedExtrusionIndex::build(const std::vector<StretchedExtrusion *> &extrusions, int upAxis) {
+	clear();
+	axisU = (upAxis + 1) % 3;
+	axisV = (upAxis + 2) % 3;
+
+	// Outline edges: the points up to the first one back on the starting point
+	for (int e = 0; e < (int)extrusions.size(); e++) {
+		const std::vector<P3D> &points = extrusions[e]->points;
+		int closing = -1;
+		for (int k = 3; k < (int)points.size() && closing < 0; k++) {
+			if (fabs(points[k][axisU] - points[0][axisU]) < EPSILON_CHECK && fabs(points[k][axisV] - points[0][axisV]) < EPSILON_CHECK) {
+				closing = k;
+			}
+		}
+		for (int k = 0; k < closing; k++) {
+			const P3D &a = points[k];
+			const P3D &b = k + 1 == closing ? points[0] : points[k + 1];
+			if (a[axisU] == b[axisU] && a[axisV] == b[axisV]) {
+				continue;
+			}
+			edgeAU.push_back(a[axisU]);
+			edgeAV.push_back(a[axisV]);
+			edgeBU.push_back(b[axisU]);
+			edgeBV.push_back(b[axisV]);
+			edgeExtrusions.push_back(e);
+		}
+	}
+	int edgeCount = (int)edgeExtrusions.size();
+	if (edgeCount == 0) {
+		return;
+	}
+
+	// About one edge per cell
+	double minU = HUGE_VAL, minV = HUGE_VAL, maxU = -HUGE_VAL, maxV = -HUGE_VAL;
+	for (int k = 0; k < edgeCount; k++) {
+		minU = std::min(minU, std::min(edgeAU[k], edgeBU[k]));
+		maxU = std::max(maxU, std::max(edgeAU[k], edgeBU[k]));
+		minV = std::min(minV, std::min(edgeAV[k], edgeBV[k]));
+		maxV = std::max(maxV, std::max(edgeAV[k], edgeBV[k]));
+	}
+	double extentU = maxU - minU, extentV = maxV - minV;
+	gridMinU = minU;
+	gridMinV = minV;
+	cellSize = std::max(sqrt(extentU * extentV / edgeCount), std::max(extentU, extentV) / MAX_CELLS_PER_SIDE);
+	cellSize = std::max(cellSize, EPSILON_CHECK);
+	cellsU = std::min(MAX_CELLS_PER_SIDE, (int)(extentU / cellSize) + 1);
+	cellsV = std::min(MAX_CELLS_PER_SIDE, (int)(extentV / cellSize) + 1);
+	auto columnOf = [&](double u) {
+		return std::max(0, std::min(cellsU - 1, (int)floor((u - gridMinU) / cellSize)));
+	};
+	auto rowOf = [&](double v) {
+		return std::max(0, std::min(cellsV - 1, (int)floor((v - gridMinV) / cellSize)));
+	};
+
+	// Each edge in every cell its bounding box touches
+	int cellCount = cellsU * cellsV;
+	cellEdgeStarts.assign(cellCount + 1, 0);
+	cellEdges.clear();
+	for (int pass = 0; pass < 2; pass++) {
+		for (int k = 0; k < edgeCount; k++) {
+			int i0 = columnOf(std::min(edgeAU[k], edgeBU[k])), i1 = columnOf(std::max(edgeAU[k], edgeBU[k]));
+			int j0 = rowOf(std::min(edgeAV[k], edgeBV[k])), j1 = rowOf(std::max(edgeAV[k], edgeBV[k]));
+			for (int j = j0; j <= j1; j++) {
+				for (int i = i0; i <= i1; i++) {
+					int cell = j * cellsU + i;
+					if (pass == 0) {
+						cellEdgeStarts[cell + 1]++;
+					} else {
+						cellEdges[cellEdgeStarts[cell]++] = k;
+					}
+				}
+			}
+		}
+		if (pass == 0) {
+			for (int c = 0; c < cellCount; c++) {
+				cellEdgeStarts[c + 1] += cellEdgeStarts[c];
+			}
+			cellEdges.resize(cellEdgeStarts[cellCount]);
+		} else {
+			// The fill advanced every start to the next cell's
+			for (int c = cellCount; c > 0; c--) {
+				cellEdgeStarts[c] = cellEdgeStarts[c - 1];
+			}
+			cellEdgeStarts[0] = 0;
+		}
+	}
+
+	// Winding numbers at the cell centres: sweep each row of an outline's bounding box from its left side
+	// (where the winding is 0), crossing the edges along the row. The centres are nudged like the queries
+	// (see countCrossings), so a crossing right at a centre comes before it.
+	std::vector<int> windingCells;
+	std::vector<int> windingExtrusions;
+	std::vector<int> windingValues;
+	int first = 0;
+	while (first < edgeCount) {
+		int e = edgeExtrusions[first];
+		int last = first;
+		double outlineMinU = HUGE_VAL, outlineMaxU = -HUGE_VAL, outlineMinV = HUGE_VAL, outlineMaxV = -HUGE_VAL;
+		while (last < edgeCount && edgeExtrusions[last] == e) {
+			outlineMinU = std::min(outlineMinU, std::min(edgeAU[last], edgeBU[last]));
+			outlineMaxU = std::max(outlineMaxU, std::max(edgeAU[last], edgeBU[last]));
+			outlineMinV = std::min(outlineMinV, std::min(edgeAV[last], edgeBV[last]));
+			outlineMaxV = std::max(outlineMaxV, std::max(edgeAV[last], edgeBV[last]));
+			last++;
+		}
+		int i0 = columnOf(outlineMinU), i1 = columnOf(outlineMaxU);
+		int j0 = rowOf(outlineMinV), j1 = rowOf(outlineMaxV);
+		for (int j = j0; j <= j1; j++) {
+			double centerV = gridMinV + (j + 0.5) * cellSize;
+			int winding = 0;
+			for (int i = i0; i <= i1; i++) {
+				int cell = j * cellsU + i;
+				double centerU = gridMinU + (i + 0.5) * cellSize;
+				// Crossings of the row line that fall in this column, before and after the centre
+				int before = 0, after = 0;
+				for (int k = cellEdgeStarts[cell]; k < cellEdgeStarts[cell + 1]; k++) {
+					int edge = cellEdges[k];
+					if (edgeExtrusions[edge] != e) {
+						continue;
+					}
+					double au = edgeAU[edge], av = edgeAV[edge], bu = edgeBU[edge], bv = edgeBV[edge];
+					if ((av <= centerV) == (bv <= centerV)) {
+						continue;
+					}
+					double u = interpolate(av, au, bv, bu, centerV);
+					if (columnOf(u) != i) {
+						continue;
+					}
+					int sign = bv > av ? 1 : -1;
+					if (u <= centerU) {
+						before += sign;
+					} else {
+						after += sign;
+					}
+				}
+				winding -= before;
+				if (winding != 0) {
+					windingCells.push_back(cell);
+					windingExtrusions.push_back(e);
+					windingValues.push_back(winding);
+				}
+				winding -= after;
+			}
+		}
+		first = last;
+	}
+
+	// By cell (stable, so by ascending extrusion within each cell)
+	int windingCount = (int)windingCells.size();
+	cellWindingStarts.assign(cellCount + 1, 0);
+	for (int k = 0; k < windingCount; k++) {
+		cellWindingStarts[windingCells[k] + 1]++;
+	}
+	for (int c = 0; c < cellCount; c++) {
+		cellWindingStarts[c + 1] += cellWindingStarts[c];
+	}
+	std::vector<int> next(cellWindingStarts.begin(), cellWindingStarts.end() - 1);
+	cellWindingExtrusions.resize(windingCount);
+	cellWindings.resize(windingCount);
+	for (int k = 0; k < windingCount; k++) {
+		int slot = next[windingCells[k]]++;
+		cellWindingExtrusions[slot] = windingExtrusions[k];
+		cellWindings[slot] = windingValues[k];
+	}
+}
+
+int StretchedExtrusionIndex::findCell(double u, double v) const {
+	if (cellsU == 0 || u < gridMinU || v < gridMinV || u > gridMinU + cellsU * cellSize || v > gridMinV + cellsV * cellSize) {
+		return -1;
+	}
+	int i = std::max(0, std::min(cellsU - 1, (int)floor((u - gridMinU) / cellSize)));
+	int j = std::max(0, std::min(cellsV - 1, (int)floor((v - gridMinV) / cellSize)));
+	return j * cellsU + i;
+}
+
+int StretchedExtrusionIndex::countCrossings(int cell, int extrusion, double u, double v) const {
+	double centerU = gridMinU + (cell % cellsU + 0.5) * cellSize;
+	double centerV = gridMinV + (cell / cellsU + 0.5) * cellSize;
+	int change = 0;
+	for (int k = cellEdgeStarts[cell]; k < cellEdgeStarts[cell + 1]; k++) {
+		int edge = cellEdges[k];
+		if (edgeExtrusions[edge] != extrusion) {
+			continue;
+		}
+		double au = edgeAU[edge], av = edgeAV[edge], bu = edgeBU[edge], bv = edgeBV[edge];
+		// Along the row from the centre to u: each upward edge passed going right takes one turn off. The
+		// row is a hair above centerV, so it crosses the edges with one end at or below it and the other
+		// above, and a crossing at u (or at the centre) is to the left of the nudged point.
+		if ((av <= centerV) != (bv <= centerV)) {
+			double crossing = interpolate(av, au, bv, bu, centerV);
+			int sign = bv > av ? 1 : -1;
+			if (centerU < crossing && crossing <= u) {
+				change -= sign;
+			} else if (u < crossing && crossing <= centerU) {
+				change += sign;
+			}
+		}
+		// Then along the column from the centre's row to v: each rightward edge passed going up adds one.
+		// The column is a hair right of u, so it crosses the edges with one end at or left of u and the
+		// other right of it; where a crossing ties with v (or centerV), it is above the nudged point if
+		// the edge rises to the right (the rise over the nudge in u beats the far smaller nudge in v).
+		if ((au <= u) != (bu <= u)) {
+			double crossing = interpolate(au, av, bu, bv, u);
+			bool rising = (bv - av) * (bu - au) > 0;
+			bool belowCenter = crossing < centerV || (crossing == centerV && !rising);
+			bool belowPoint = crossing < v || (crossing == v && !rising);
+			int sign = bu > au ? 1 : -1;
+			if (!belowCenter && belowPoint) {
+				change += sign;
+			} else if (belowCenter && !belowPoint) {
+				change -= sign;
+			}
+		}
+	}
+	return change;
+}
+
+int StretchedExtrusionIndex::windingAt(int cell, int extrusion, double u, double v) const {
+	int winding = 0;
+	for (int k = cellWindingStarts[cell]; k < cellWindingStarts[cell + 1]; k++) {
+		if (cellWindingExtrusions[k] == extrusion) {
+			winding = cellWindings[k];
+			break;
+		}
+	}
+	return winding + countCrossings(cell, extrusion, u, v);
+}
+
+int StretchedExtrusionIndex::getWindingNumber(const P3D &point, int extrusion) const {
+	int cell = findCell(point[axisU], point[axisV]);
+	if (cell < 0) {
+		return 0;
+	}
+	return windingAt(cell, extrusion, point[axisU], point[axisV]);
+}
+
+int StretchedExtrusionIndex::findExtrusion(const P3D &point) const {
+	double u = point[axisU], v = point[axisV];
+	int cell = findCell(u, v);
+	if (cell < 0) {
+		return -1;
+	}
+	// Candidates are the outlines around the centre or with edges in the cell, both lists ascending
+	int w = cellWindingStarts[cell], wEnd = cellWindingStarts[cell + 1];
+	int k = cellEdgeStarts[cell], kEnd = cellEdgeStarts[cell + 1];
+	while (w < wEnd || k < kEnd) {
+		int fromWindings = w < wEnd ? cellWindingExtrusions[w] : INT_MAX;
+		int fromEdges = k < kEnd ? edgeExtrusions[cellEdges[k]] : INT_MAX;
+		int extrusion = std::min(fromWindings, fromEdges);
+		if (windingAt(cell, extrusion, u, v) != 0) {
+			return extrusion;
+		}
+		while (w < wEnd && cellWindingExtrusions[w] == extrusion) {
+			w++;
+		}
+		while (k < kEnd && edgeExtrusions[cellEdges[k]] == extrusion) {
+			k++;
+		}
+	}
+	return -1;
+}
+
+void StretchedExtrusionIndex::classify(const std::vector<P3D> &points, std::vector<int> &extrusions) const {
+	extrusions.resize(points.size());
+	for (int i = 0; i < (int)points.size(); i++) {
+		extrusions[i] = findExtrusion(points[i]);
+	}
+}
+
+int StretchedExtrusionIndex::getEdgeCount() const {
+	return (int)edgeExtrusions.size();
+}
+
+int StretchedExtrusionIndex::getCellCount() const {
+	return cellsU * cellsV;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+
+#include "MathLib/P3D.h"
+
+#include "StretchedExtrusion.h"
+
+// Uniform grid over the outlines of the closed extrusions of a design (the points up to where they come
+// back to the first one, as circles do; open curves have no inside) for finding which extrusion a point
+// of the design plane lies under. Every cell keeps the outline edges that touch it and the winding
+// number of each outline at its centre, so a query only counts the crossings of the edges in its own
+// cell on the way from the centre to the point. With about one edge per cell, classifying every vertex
+// of a fabric costs about the number of vertices plus edges, whatever the number of extrusions.
+// Points are classified as if nudged right (+u) by a hair and up (+v) by far less, the convention of the
+// usual crossing number test (a corner counts for the edge above it, a point on an edge is right of it),
+// so points on an outline or in line with its corners get one consistent answer.
+class StretchedExtrusionIndex {
+
+public:
+	StretchedExtrusionIndex();
+	~StretchedExtrusionIndex();
+
+	// Indexes the outlines on the plane normal to upAxis
+	void build(const std::vector<StretchedExtrusion *> &extrusions, int upAxis = 1);
+	void clear();
+
+	// Winding number of the outline of an extrusion around a point (0 outside, and for open extrusions)
+	int getWindingNumber(const P3D &point, int extrusion) const;
+	// Lowest index of the extrusions whose outline winds around the point, -1 if none
+	int findExtrusion(const P3D &point) const;
+	// findExtrusion of every point
+	void classify(const std::vector<P3D> &points, std::vector<int> &extrusions) const;
+
+	int getEdgeCount() const;
+	int getCellCount() const;
+
+private:
+	int axisU = 2;
+	int axisV = 0;
+
+	// Outline edges (a to b) on the plane, grouped by extrusion
+	std::vector<double> edgeAU, edgeAV, edgeBU, edgeBV;
+	std::vector<int> edgeExtrusions;
+
+	double gridMinU = 0;
+	double gridMinV = 0;
+	double cellSize = 1;
+	int cellsU = 0;
+	int cellsV = 0;
+	// Edges touching each cell (ascending, so grouped by extrusion)
+	std::vector<int> cellEdgeStarts;
+	std::vector<int> cellEdges;
+	// Nonzero winding numbers at each cell centre, by ascending extrusion
+	std::vector<int> cellWindingStarts;
+	std::vector<int> cellWindingExtrusions;
+	std::vector<int> cellWindings;
+
+	int findCell(double u, double v) const;
+	// Winding change of one extrusion from the centre of cell to (u, v), counted on its edges in the cell
+	int countCrossings(int cell, int extrusion, double u, double v) const;
+	int windingAt(int cell, int extrusion, double u, double v) const;
+};
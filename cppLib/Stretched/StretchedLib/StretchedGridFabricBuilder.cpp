@@ -0,0 +1,181 @@
+#include "StretchedGridFabricBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "StretchedParticleSystem.h"
+
+
+StretchedGridFabricBuilder::StretchedGridFabricBuilder() {
+	// Nothing to see here
+}
+
+StretchedGridFabricBuilder::~StretchedGridFabricBuilder() {
+	// Nothing to see here
+}
+
+StretchedGridFabricBuilder StretchedGridFabricBuilder::coarsen(int scale) const {
+	StretchedGridFabricBuilder coarse = *this;
+	scale = std::max(1, scale);
+	coarse.gridDim = (std::max(1, gridDim) - 1 + scale - 1) / scale + 1;
+	coarse.spacing = spacing * scale;
+	return coarse;
+}
+
+int StretchedGridFabricBuilder::getHydrogelColumnSpacing() const {
+	int dim = std::max(1, gridDim);
+	int minSpaceCount = std::max(1, hydrogelColumns - 1);
+	return std::max(1, (int)ceil((double)(dim - hydrogelColumns) / minSpaceCount));
+}
+
+int StretchedGridFabricBuilder::getHydrogelStartColumn() const {
+	if (hydrogelColumns <= 0) {
+		return 0;
+	}
+	int dim = std::max(1, gridDim);
+	int minSpaceCount = std::max(1, hydrogelColumns - 1);
+	int remainder = (dim - getHydrogelColumnSpacing() * minSpaceCount) % hydrogelColumns;
+	return std::max(0, remainder / 2);
+}
+
+int StretchedGridFabricBuilder::getFabricParticleCount() const {
+	int dim = std::max(1, gridDim);
+	return dim * dim;
+}
+
+int StretchedGridFabricBuilder::getHydrogelParticleCount() const {
+	if (hydrogelColumns <= 0) {
+		return 0;
+	}
+	int dim = std::max(1, gridDim);
+	int columns = 0;
+	for (int i = getHydrogelStartColumn(); i < dim; i += getHydrogelColumnSpacing()) {
+		columns++;
+	}
+	return columns * dim;
+}
+
+void StretchedGridFabricBuilder::build(StretchedParticleSystem &system) const {
+	int dim = std::max(1, gridDim);
+	int base = system.getParticleCount();
+	system.positions.reserve(base + getFabricParticleCount() + getHydrogelParticleCount());
+
+	// Fabric particle i * dim + k sits at column i (X) and row k (Z)
+	for (int i = 0; i < dim; i++) {
+		for (int k = 0; k < dim; k++) {
+			system.addParticle(P3D(i * spacing, 0, k * spacing), fabricMass);
+		}
+	}
+
+	// Two triangles per grid cell, with the diagonal alternating between cells
+	int fabricCount = dim * dim;
+	for (int i = 0; i < fabricCount - dim - 1; i++) {
+		if ((i + 1) % dim == 0) {
+			// The last point of a column has no cell after it
+			continue;
+		}
+		int a = base + i;
+		if (i % 2 == 0) {
+			int triangles[6] = { a, a + 1, a + dim, a + dim, a + 1, a + 1 + dim };
+			system.triangleIndices.insert(system.triangleIndices.end(), triangles, triangles + 6);
+		} else {
+			int triangles[6] = { a + dim, a, a + 1 + dim, a + 1 + dim, a, a + 1 };
+			system.triangleIndices.insert(system.triangleIndices.end(), triangles, triangles + 6);
+		}
+	}
+
+	// Hydrogel columns, one layer above the fabric
+	int hydrogelBase = system.getParticleCount();
+	int columnSpacing = getHydrogelColumnSpacing();
+	if (hydrogelColumns > 0) {
+		for (int i = getHydrogelStartColumn(); i < dim; i += columnSpacing) {
+			for (int k = 0; k < dim; k++) {
+				system.addParticle(P3D(i * spacing, layerHeight, k * spacing), hydrogelMass);
+			}
+		}
+	}
+
+	// Structural springs to the previous column and the next row
+	for (int i = 0; i < dim; i++) {
+		for (int k = 0; k < dim; k++) {
+			int current = base + i * dim + k;
+			if (i > 0) {
+				system.addSpring(current, current - dim, structuralStiffnessX, FABRIC_SPRING_STRUCTURAL);
+			}
+			if (k + 1 < dim) {
+				system.addSpring(current, current + 1, structuralStiffnessY, FABRIC_SPRING_STRUCTURAL);
+			}
+		}
+	}
+
+	// Bend springs skip one particle
+	for (int i = 0; i < dim; i++) {
+		for (int k = 0; k < dim; k++) {
+			int current = base + i * dim + k;
+			if (i - 2 >= 0) {
+				system.addSpring(current, current - 2 * dim, bendStiffnessX, FABRIC_SPRING_BEND);
+			}
+			if (k + 2 < dim) {
+				system.addSpring(current, current + 2, bendStiffnessY, FABRIC_SPRING_BEND);
+			}
+		}
+	}
+
+	// Shear springs across both diagonals of the cells of the previous column
+	for (int i = 0; i < dim; i++) {
+		for (int k = 0; k < dim; k++) {
+			int current = base + i * dim + k;
+			if (i >= 1 && k >= 1) {
+				system.addSpring(current, current - dim - 1, shearStiffnessXY, FABRIC_SPRING_SHEAR);
+			}
+			if (i >= 1 && k + 1 < dim) {
+				system.addSpring(current, current - dim + 1, shearStiffnessYX, FABRIC_SPRING_SHEAR);
+			}
+		}
+	}
+
+	// Hydrogel springs, with rest lengths shrunk from the printed lengths. As in the JS there is
+	// no spring straight down to the fabric, only to the fabric of the neighbouring columns.
+	// One pass per type so the spring table only ever appends.
+	if (hydrogelColumns > 0) {
+		int j = 0;
+		for (int i = getHydrogelStartColumn(); i < dim; i += columnSpacing) {
+			for (int k = 0; k < dim; k++) {
+				int fabric = base + i * dim + k;
+				int hydrogel = hydrogelBase + j;
+				// Diagonally down to the fabric of the neighbouring columns
+				if (i - 1 >= 0) {
+					system.addSpring(fabric - dim, hydrogel, hydrogelStiffnessZ, HYDROGEL_TO_FABRIC_SPRING, shrinkRatioZ);
+				}
+				if (i + 1 < dim) {
+					system.addSpring(fabric + dim, hydrogel, hydrogelStiffnessZ, HYDROGEL_TO_FABRIC_SPRING, shrinkRatioZ);
+				}
+				j++;
+			}
+		}
+		j = 0;
+		for (int i = getHydrogelStartColumn(); i < dim; i += columnSpacing) {
+			for (int k = 0; k < dim; k++) {
+				int hydrogel = hydrogelBase + j;
+				// Along the hydrogel line, to the previous and the one before it
+				if (k != 0) {
+					system.addSpring(hydrogel - 1, hydrogel, hydrogelStiffnessXY, HYDROGEL_TO_HYDROGEL_SPRING, shrinkRatioXY);
+				}
+				if (k - 2 >= 0) {
+					system.addSpring(hydrogel - 2, hydrogel, hydrogelStiffnessXY, HYDROGEL_TO_HYDROGEL_SPRING, shrinkRatioXY);
+				}
+				j++;
+			}
+		}
+	}
+
+	// Lift the seed particle in the middle of the grid (after the springs so it does not change any rest length)
+	int seed = base + dim * (dim + 1) / 2;
+	if (seed < base + fabricCount) {
+		int up = system.upAxis;
+		P3D position = system.positions.getPoint(seed);
+		position[up] += biasOffset;
+		system.positions.set(seed, position);
+		system.previousPositions.set(seed, position);
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "StretchedConstants.h"
+
+class StretchedParticleSystem;
+
+// Builds the square test fabric of the JS simulation (makeParticlesTest + createSprings in
+// src/js/app/stretched/HydrogelParticleSystem.js): a gridDim x gridDim grid of fabric particles
+// with structural, bend and shear springs, plus hydrogel columns printed one layer above the
+// fabric and tied to it with springs whose rest lengths are shrunk by the shrink ratios.
+// The JS grid lies in XY with Z up, here it lies in the XZ design plane with Y up.
+// Defaults mirror the simulation section of src/js/data/config.js.
+class StretchedGridFabricBuilder {
+
+public:
+	StretchedGridFabricBuilder();
+	~StretchedGridFabricBuilder();
+
+	int gridDim = FABRIC_GRID_DIM;
+	double spacing = FABRIC_PARTICLE_SPACING;
+	double fabricMass = FABRIC_PARTICLE_MASS;
+	double hydrogelMass = HYDROGEL_PARTICLE_MASS;
+
+	// Stiffnesses along the grid columns (X) and rows (Z, the JS Y axis)
+	double structuralStiffnessX = FABRIC_STRUCTURAL_SPRING_STIFFNESS;
+	double structuralStiffnessY = FABRIC_STRUCTURAL_SPRING_STIFFNESS_Y;
+	double bendStiffnessX = FABRIC_BEND_SPRING_STIFFNESS;
+	double bendStiffnessY = FABRIC_BEND_SPRING_STIFFNESS_Y;
+	double shearStiffnessXY = FABRIC_SHEAR_SPRING_STIFFNESS;
+	double shearStiffnessYX = FABRIC_SHEAR_SPRING_STIFFNESS_YX;
+
+	int hydrogelColumns = HYDROGEL_COLUMNS;
+	double layerHeight = HYDROGEL_LAYER_HEIGHT;
+	double hydrogelStiffnessZ = HYDROGEL_SPRING_STIFFNESS_Z;
+	double hydrogelStiffnessXY = HYDROGEL_SPRING_STIFFNESS_XY;
+	double shrinkRatioZ = HYDROGEL_SPRING_SHRINK_RATIO_Z;
+	double shrinkRatioXY = HYDROGEL_SPRING_SHRINK_RATIO_XY;
+
+	// The particle in the middle of the grid is lifted by this much after the springs are made, so the fabric buckles upwards
+	double biasOffset = FABRIC_BIAS_OFFSET;
+
+	// Adds the fabric and hydrogel particles, the fabric triangles and all the springs to the system
+	void build(StretchedParticleSystem &system) const;
+
+	// The same fabric at scale times the spacing, for the coarse levels of a multiresolution solve. The
+	// grid is rounded up so it covers at least the extent of this one.
+	StretchedGridFabricBuilder coarsen(int scale) const;
+
+	// Number of grid columns between hydrogel columns and the first column with hydrogel (same rules as the JS)
+	int getHydrogelColumnSpacing() const;
+	int getHydrogelStartColumn() const;
+	int getFabricParticleCount() const;
+	int getHydrogelParticleCount() const;
+};
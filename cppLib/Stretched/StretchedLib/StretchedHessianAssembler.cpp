@@ -0,0 +1,142 @@
+#include "StretchedHessianAssembler.h"
+
+#include <algorithm>
+
+#include "StretchedParticleSystem.h"
+
+
+StretchedHessianAssembler::StretchedHessianAssembler() {
+	// Nothing to see here
+}
+
+StretchedHessianAssembler::~StretchedHessianAssembler() {
+	// Nothing to see here
+}
+
+bool StretchedHessianAssembler::begin(const StretchedParticleSystem &system) {
+	bool rebuilt = false;
+	if (system.getParticleCount() != builtParticleCount || system.springs.size() != builtSpringCount) {
+		build(system);
+		rebuilt = true;
+	}
+	std::fill(matrix.values.begin(), matrix.values.end(), 0.0);
+	values = matrix.values.data();
+	return rebuilt;
+}
+
+void StretchedHessianAssembler::addSpring(int spring, int a, int b, const double u[3], double k, double c, bool aFree, bool bFree) {
+	const int *offsets = &springOffsets[4 * spring];
+	int strideA = rowLengths[a];
+	int strideB = rowLengths[b];
+	for (int i = 0; i < 3; i++) {
+		double *aa = values + offsets[0] + i * strideA;
+		double *bb = values + offsets[1] + i * strideB;
+		double *ab = values + offsets[2] + i * strideA;
+		double *ba = values + offsets[3] + i * strideB;
+		for (int j = 0; j < 3; j++) {
+			double value = k * ((1 - c) * u[i] * u[j] + (i == j ? c : 0));
+			if (aFree) {
+				aa[j] += value;
+			}
+			if (bFree) {
+				bb[j] += value;
+			}
+			if (aFree && bFree) {
+				ab[j] -= value;
+				ba[j] -= value;
+			}
+		}
+	}
+}
+
+void StretchedHessianAssembler::invalidate() {
+	builtSpringCount = -1;
+	builtParticleCount = -1;
+}
+
+const StretchedSparseMatrix &StretchedHessianAssembler::getMatrix() const {
+	return matrix;
+}
+
+void StretchedHessianAssembler::build(const StretchedParticleSystem &system) {
+	int n = system.getParticleCount();
+	const StretchedSpringTable &springs = system.springs;
+	int springCount = springs.size();
+
+	// Particles coupled to each particle (itself included), sorted and without repeats
+	std::vector<int> neighborStarts(n + 1, 0);
+	for (int i = 0; i < n; i++) {
+		neighborStarts[i + 1] = 1;
+	}
+	for (int s = 0; s < springCount; s++) {
+		neighborStarts[springs.indicesA[s] + 1]++;
+		neighborStarts[springs.indicesB[s] + 1]++;
+	}
+	for (int i = 0; i < n; i++) {
+		neighborStarts[i + 1] += neighborStarts[i];
+	}
+	std::vector<int> neighbors(neighborStarts[n]);
+	std::vector<int> next(neighborStarts.begin(), neighborStarts.end() - 1);
+	for (int i = 0; i < n; i++) {
+		neighbors[next[i]++] = i;
+	}
+	for (int s = 0; s < springCount; s++) {
+		int a = springs.indicesA[s];
+		int b = springs.indicesB[s];
+		neighbors[next[a]++] = b;
+		neighbors[next[b]++] = a;
+	}
+	std::vector<int> degrees(n);
+	for (int i = 0; i < n; i++) {
+		int *begin = neighbors.data() + neighborStarts[i];
+		int *end = neighbors.data() + neighborStarts[i + 1];
+		std::sort(begin, end);
+		degrees[i] = (int)(std::unique(begin, end) - begin);
+	}
+
+	// Each particle's three rows hold the same 3-column blocks
+	matrix = StretchedSparseMatrix(3 * n, 3 * n);
+	rowLengths.resize(n);
+	for (int i = 0; i < n; i++) {
+		rowLengths[i] = 3 * degrees[i];
+		for (int c = 0; c < 3; c++) {
+			matrix.rowStarts[3 * i + c + 1] = matrix.rowStarts[3 * i + c] + rowLengths[i];
+		}
+	}
+	matrix.columnIndices.resize(matrix.rowStarts[3 * n]);
+	matrix.values.assign(matrix.rowStarts[3 * n], 0.0);
+	for (int i = 0; i < n; i++) {
+		for (int c = 0; c < 3; c++) {
+			int *columns = &matrix.columnIndices[matrix.rowStarts[3 * i + c]];
+			for (int k = 0; k < degrees[i]; k++) {
+				int j = neighbors[neighborStarts[i] + k];
+				columns[3 * k] = 3 * j;
+				columns[3 * k + 1] = 3 * j + 1;
+				columns[3 * k + 2] = 3 * j + 2;
+			}
+		}
+	}
+
+	// Offset of the first entry of block (i, j) in the values
+	auto blockOffset = [&](int i, int j) {
+		const int *begin = neighbors.data() + neighborStarts[i];
+		int k = (int)(std::lower_bound(begin, begin + degrees[i], j) - begin);
+		return matrix.rowStarts[3 * i] + 3 * k;
+	};
+	diagonalOffsets.resize(n);
+	for (int i = 0; i < n; i++) {
+		diagonalOffsets[i] = blockOffset(i, i);
+	}
+	springOffsets.resize(4 * springCount);
+	for (int s = 0; s < springCount; s++) {
+		int a = springs.indicesA[s];
+		int b = springs.indicesB[s];
+		springOffsets[4 * s] = diagonalOffsets[a];
+		springOffsets[4 * s + 1] = diagonalOffsets[b];
+		springOffsets[4 * s + 2] = blockOffset(a, b);
+		springOffsets[4 * s + 3] = blockOffset(b, a);
+	}
+
+	builtParticleCount = n;
+	builtSpringCount = springCount;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "StretchedSparseMatrix.h"
+
+class StretchedParticleSystem;
+
+// Assembles the 3n x 3n spring Hessians of the implicit solvers (a 3x3 block per particle pair joined
+// by a spring plus the diagonal) without building triplets. The CSR pattern and, for every spring, the
+// offsets of its four blocks in the value array are computed once from the spring table; each assembly
+// then only zeroes the values and writes the blocks through the offsets, with no allocation or sorting.
+// Every spring block is part of the pattern whether or not its particles are fixed, so pinning only
+// changes values. The pattern is rebuilt when the particle or spring count changes, or after invalidate.
+class StretchedHessianAssembler {
+
+public:
+	StretchedHessianAssembler();
+	~StretchedHessianAssembler();
+
+	// Builds the pattern if needed and zeroes the values. Returns true if the pattern was (re)built.
+	bool begin(const StretchedParticleSystem &system);
+
+	// Sets the three diagonal entries of a particle
+	void setDiagonal(int particle, double value) {
+		int offset = diagonalOffsets[particle];
+		int stride = rowLengths[particle];
+		values[offset] = value;
+		values[offset + stride + 1] = value;
+		values[offset + 2 * stride + 2] = value;
+	}
+
+	void addToDiagonal(int particle, double value) {
+		int offset = diagonalOffsets[particle];
+		int stride = rowLengths[particle];
+		values[offset] += value;
+		values[offset + stride + 1] += value;
+		values[offset + 2 * stride + 2] += value;
+	}
+
+	// Adds the spring block k * (u u^T + c (I - u u^T)) at (a, a) and (b, b) of the free ends, and its
+	// negative at (a, b) and (b, a) if both ends are free
+	void addSpring(int spring, int a, int b, const double u[3], double k, double c, bool aFree, bool bFree);
+
+	// Forces the pattern to be rebuilt (needed after editing spring indices in place)
+	void invalidate();
+
+	const StretchedSparseMatrix &getMatrix() const;
+
+private:
+	StretchedSparseMatrix matrix;
+	// matrix.values, cached so the inline writes skip a level of indirection
+	double *values = NULL;
+
+	// Entries per row of each particle's three rows, and the offset of its (3i, 3i) entry
+	std::vector<int> rowLengths;
+	std::vector<int> diagonalOffsets;
+	// Offsets of the first entry of the (a, a), (b, b), (a, b) and (b, a) blocks of each spring
+	std::vector<int> springOffsets;
+	int builtSpringCount = -1;
+	int builtParticleCount = -1;
+
+	void build(const StretchedParticleSystem &system);
+};
@@ -0,0 +1,158 @@
+#include "StretchedHydrogelLayerBuilder.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#include "StretchedExtrusionIndex.h"
+#include "StretchedParticleSystem.h"
+
+// Extrusion points are matched to triangulation vertices on a grid this fine (the triangulator copies
+// the points, so they land in the same cell)
+static const double POINT_MATCH_RESOLUTION = 1e-7;
+
+// Cell of a point on the design plane (the two axes other than up)
+static uint64_t pointKey(const P3D &point, int upAxis) {
+	int64_t u = (int64_t)floor(point[(upAxis + 1) % 3] / POINT_MATCH_RESOLUTION + 0.5);
+	int64_t v = (int64_t)floor(point[(upAxis + 2) % 3] / POINT_MATCH_RESOLUTION + 0.5);
+	return ((uint64_t)(uint32_t)u << 32) | (uint32_t)v;
+}
+
+StretchedHydrogelLayerBuilder::StretchedHydrogelLayerBuilder() {
+	// Nothing to see here
+}
+
+StretchedHydrogelLayerBuilder::~StretchedHydrogelLayerBuilder() {
+	// Nothing to see here
+}
+
+int StretchedHydrogelLayerBuilder::build(DelaunayTriangulation triangulation, const std::vector<StretchedExtrusion *> &extrusions, StretchedParticleSystem &system) const {
+	int base = system.getParticleCount();
+	system.makeParticles(triangulation.getTriangulationPts(), triangulation.getTriangulationIndices(), fabricMass);
+	system.createFabricSprings(structuralStiffness, shearStiffness, bendStiffness);
+	int fabricCount = system.getParticleCount() - base;
+	int up = system.upAxis;
+
+	// Neighbours of each vertex along the triangle edges, sorted and without repeats
+	const std::vector<int> &triangles = system.triangleIndices;
+	std::vector<int> neighborStarts(fabricCount + 1, 0);
+	for (int i = 0; i < (int)triangles.size(); i++) {
+		neighborStarts[triangles[i] - base + 1] += 2;
+	}
+	for (int v = 0; v < fabricCount; v++) {
+		neighborStarts[v + 1] += neighborStarts[v];
+	}
+	std::vector<int> neighbors(neighborStarts[fabricCount]);
+	std::vector<int> next(neighborStarts.begin(), neighborStarts.end() - 1);
+	for (int t = 0; t + 2 < (int)triangles.size(); t += 3) {
+		for (int e = 0; e < 3; e++) {
+			int a = triangles[t + e] - base;
+			neighbors[next[a]++] = triangles[t + (e + 1) % 3] - base;
+			neighbors[next[a]++] = triangles[t + (e + 2) % 3] - base;
+		}
+	}
+	std::vector<int> degrees(fabricCount);
+	for (int v = 0; v < fabricCount; v++) {
+		int *begin = neighbors.data() + neighborStarts[v];
+		int *end = neighbors.data() + neighborStarts[v + 1];
+		std::sort(begin, end);
+		degrees[v] = (int)(std::unique(begin, end) - begin);
+	}
+	auto isEdge = [&](int a, int b) {
+		const int *begin = neighbors.data() + neighborStarts[a];
+		return std::binary_search(begin, begin + degrees[a], b);
+	};
+
+	// Vertex of each extrusion point (-1 if the triangulation has none there), and the extrusion each
+	// vertex belongs to (the first one with a point on it)
+	std::unordered_map<uint64_t, int> vertexByKey;
+	vertexByKey.reserve(fabricCount);
+	for (int v = 0; v < fabricCount; v++) {
+		vertexByKey.insert(std::make_pair(pointKey(system.positions.getPoint(base + v), up), v));
+	}
+	std::vector<std::vector<int> > pointVertices(extrusions.size());
+	std::vector<int> vertexExtrusions(fabricCount, -1);
+	for (int e = 0; e < (int)extrusions.size(); e++) {
+		const std::vector<P3D> &points = extrusions[e]->points;
+		pointVertices[e].resize(points.size());
+		for (int k = 0; k < (int)points.size(); k++) {
+			std::unordered_map<uint64_t, int>::const_iterator found = vertexByKey.find(pointKey(points[k], up));
+			int v = found == vertexByKey.end() ? -1 : found->second;
+			pointVertices[e][k] = v;
+			if (v >= 0 && vertexExtrusions[v] < 0) {
+				vertexExtrusions[v] = e;
+			}
+		}
+	}
+	// and the vertices inside a closed extrusion's outline go with it
+	if (fillClosedExtrusions) {
+		StretchedExtrusionIndex index;
+		index.build(extrusions, up);
+		for (int v = 0; v < fabricCount && index.getEdgeCount() > 0; v++) {
+			if (vertexExtrusions[v] < 0) {
+				vertexExtrusions[v] = index.findExtrusion(system.positions.getPoint(base + v));
+			}
+		}
+	}
+
+	// Hydrogel particles one layer above their vertices
+	std::vector<int> hydrogelParticles(fabricCount, -1);
+	for (int v = 0; v < fabricCount; v++) {
+		if (vertexExtrusions[v] < 0) {
+			continue;
+		}
+		P3D position = system.positions.getPoint(base + v);
+		position[up] += layerHeight;
+		hydrogelParticles[v] = system.getParticleCount();
+		system.addParticle(position, hydrogelMass);
+	}
+	int hydrogelCount = system.getParticleCount() - base - fabricCount;
+
+	// Hydrogel to fabric, to the neighbouring vertices outside the extrusion (all of them if none is)
+	for (int v = 0; v < fabricCount; v++) {
+		if (hydrogelParticles[v] < 0) {
+			continue;
+		}
+		int outside = 0;
+		for (int k = neighborStarts[v]; k < neighborStarts[v] + degrees[v]; k++) {
+			outside += vertexExtrusions[neighbors[k]] != vertexExtrusions[v] ? 1 : 0;
+		}
+		for (int k = neighborStarts[v]; k < neighborStarts[v] + degrees[v]; k++) {
+			int u = neighbors[k];
+			if (outside == 0 || vertexExtrusions[u] != vertexExtrusions[v]) {
+				system.addSpring(base + u, hydrogelParticles[v], hydrogelStiffnessZ, HYDROGEL_TO_FABRIC_SPRING, shrinkRatioZ);
+			}
+		}
+	}
+
+	// Hydrogel to hydrogel across the edges within an extrusion
+	for (int v = 0; v < fabricCount; v++) {
+		if (hydrogelParticles[v] < 0) {
+			continue;
+		}
+		for (int k = neighborStarts[v]; k < neighborStarts[v] + degrees[v]; k++) {
+			int u = neighbors[k];
+			if (u > v && vertexExtrusions[u] == vertexExtrusions[v]) {
+				system.addSpring(hydrogelParticles[v], hydrogelParticles[u], hydrogelStiffnessXY, HYDROGEL_TO_HYDROGEL_SPRING, shrinkRatioXY);
+			}
+		}
+	}
+	// and to the point before the previous one along the extrusion, where both steps are edges
+	for (int e = 0; e < (int)extrusions.size(); e++) {
+		const std::vector<int> &vertices = pointVertices[e];
+		for (int k = 2; k < (int)vertices.size(); k++) {
+			int a = vertices[k - 2], b = vertices[k - 1], c = vertices[k];
+			if (a < 0 || b < 0 || c < 0 || a == b || b == c || a == c) {
+				continue;
+			}
+			if (vertexExtrusions[a] != e || vertexExtrusions[b] != e || vertexExtrusions[c] != e) {
+				continue;
+			}
+			if (isEdge(a, b) && isEdge(b, c) && !isEdge(a, c)) {
+				system.addSpring(hydrogelParticles[a], hydrogelParticles[c], hydrogelStiffnessXY, HYDROGEL_TO_HYDROGEL_SPRING, shrinkRatioXY);
+			}
+		}
+	}
+	return hydrogelCount;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include "DelaunayTriangulation.h"
+#include "StretchedConstants.h"
+#include "StretchedExtrusion.h"
+
+class StretchedParticleSystem;
+
+// Builds the fabric of a design drawn in StretchedDesignWindow (a triangulation of its extrusion points)
+// with a hydrogel layer printed along its extrusions, the way StretchedGridFabricBuilder does for the
+// square test fabric (_createHydrogelSprings in src/js/app/stretched/HydrogelParticleSystem.js) but
+// without assuming a grid:
+// - every triangulation vertex at an extrusion point gets a hydrogel particle one layer above it, and so
+//   does every vertex inside the outline of a closed extrusion if fillClosedExtrusions is set (found with
+//   a StretchedExtrusionIndex, so in about linear time in the vertices and outline edges)
+// - hydrogel to fabric springs go down to the fabric of the neighbouring vertices (the other columns in
+//   the grid) that are not part of the same extrusion; vertices inside a filled extrusion, which have
+//   none, are tied to all their neighbours
+// - hydrogel to hydrogel springs join the hydrogel of neighbouring vertices of the same extrusion, and
+//   skip one point along the extrusion where its points follow triangulation edges (the grid's
+//   springs to the one before the previous)
+// Rest lengths are shrunk by the shrink ratios. Runs in one pass over the vertices and edges (plus a hash
+// lookup per extrusion point) and appends the springs in type order.
+class StretchedHydrogelLayerBuilder {
+
+public:
+	StretchedHydrogelLayerBuilder();
+	~StretchedHydrogelLayerBuilder();
+
+	double fabricMass = FABRIC_PARTICLE_MASS;
+	double hydrogelMass = HYDROGEL_PARTICLE_MASS;
+	double structuralStiffness = FABRIC_STRUCTURAL_SPRING_STIFFNESS;
+	double shearStiffness = FABRIC_SHEAR_SPRING_STIFFNESS;
+	double bendStiffness = FABRIC_BEND_SPRING_STIFFNESS;
+
+	double layerHeight = HYDROGEL_LAYER_HEIGHT;
+	double hydrogelStiffnessZ = HYDROGEL_SPRING_STIFFNESS_Z;
+	double hydrogelStiffnessXY = HYDROGEL_SPRING_STIFFNESS_XY;
+	double shrinkRatioZ = HYDROGEL_SPRING_SHRINK_RATIO_Z;
+	double shrinkRatioXY = HYDROGEL_SPRING_SHRINK_RATIO_XY;
+	// Print hydrogel over the whole inside of closed extrusions, not just along their points
+	bool fillClosedExtrusions = true;
+
+	// Adds the fabric particles, triangles and springs of the triangulation, then the hydrogel particles
+	// and springs of the extrusions, to an empty system. Returns the number of hydrogel particles.
+	int build(DelaunayTriangulation triangulation, const std::vector<StretchedExtrusion *> &extrusions, StretchedParticleSystem &system) const;
+};
@@ -0,0 +1,264 @@
+#include "StretchedImplicitIntegrator.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "StretchedParticleSystem.h"
+
+
+// Armijo constant and minimum step for the backtracking line search
+static const double LINE_SEARCH_SUFFICIENT_DECREASE = 1e-4;
+static const double LINE_SEARCH_MIN_STEP = 1.0 / 1024;
+
+StretchedImplicitIntegrator::StretchedImplicitIntegrator() {
+	// Nothing to see here
+}
+
+StretchedImplicitIntegrator::~StretchedImplicitIntegrator() {
+	// Nothing to see here
+}
+
+int StretchedImplicitIntegrator::step(StretchedParticleSystem &system, double timeStep) {
+	int n = system.getParticleCount();
+	int dofs = 3 * n;
+	double h = timeStep;
+	double sqTimeStep = h * h;
+
+	// Inertial target y = x + h v + h^2 M^-1 f_ext
+	system.accumulateExternalForces();
+	x.resize(dofs);
+	xStart.resize(dofs);
+	y.resize(dofs);
+	const StretchedVectorArray &p = system.positions;
+	const StretchedVectorArray &v = system.velocities;
+	const StretchedVectorArray &f = system.forces;
+	for (int i = 0; i < n; i++) {
+		double w = system.inverseMasses[i];
+		xStart[3 * i] = p.x[i];
+		xStart[3 * i + 1] = p.y[i];
+		xStart[3 * i + 2] = p.z[i];
+		y[3 * i] = p.x[i] + h * v.x[i] + sqTimeStep * w * f.x[i];
+		y[3 * i + 1] = p.y[i] + h * v.y[i] + sqTimeStep * w * f.y[i];
+		y[3 * i + 2] = p.z[i] + h * v.z[i] + sqTimeStep * w * f.z[i];
+		if (w == 0) {
+			// Fixed particles stay where they are
+			y[3 * i] = p.x[i];
+			y[3 * i + 1] = p.y[i];
+			y[3 * i + 2] = p.z[i];
+		}
+	}
+	x = y;
+
+	lastLinearSolverIterations = 0;
+	lastNewtonIterations = 0;
+	dx.assign(dofs, 0.0);
+	rhs.resize(dofs);
+	for (int iteration = 0; iteration < maxNewtonIterations; iteration++) {
+		computeGradient(system, x, h);
+		assembleHessian(system, x, h);
+		for (int i = 0; i < dofs; i++) {
+			rhs[i] = -gradient[i];
+			dx[i] = 0;
+		}
+		lastLinearSolverIterations += linearSolver.solve(hessianAssembler.getMatrix(), rhs, dx);
+		lastNewtonIterations++;
+
+		// Backtracking line search on the objective keeps Newton stable far from the solution. A step that
+		// does not lower the objective is never taken: if the Newton direction fails (a poor PCG solve), the
+		// mass scaled steepest descent step is tried, and if that fails too x is the minimum as far as the
+		// line search resolves it.
+		double objective = computeObjective(system, x, h);
+		double alpha = searchLine(system, h, objective);
+		if (alpha == 0) {
+			for (int i = 0; i < n; i++) {
+				double w = sqTimeStep * system.inverseMasses[i];
+				dx[3 * i] = -w * gradient[3 * i];
+				dx[3 * i + 1] = -w * gradient[3 * i + 1];
+				dx[3 * i + 2] = -w * gradient[3 * i + 2];
+			}
+			alpha = searchLine(system, h, objective);
+			if (alpha == 0) {
+				break;
+			}
+		}
+
+		double maxUpdate = 0;
+		for (int i = 0; i < dofs; i++) {
+			maxUpdate = std::max(maxUpdate, fabs(alpha * dx[i]));
+		}
+		if (maxUpdate / h < newtonTolerance) {
+			break;
+		}
+	}
+
+	// v = (x_new - x_n) / h, with the same velocity damping as the explicit integrators
+	double damping = system.useVelocityDamping ? 1 - system.velocityDampingConstant : 1;
+	for (int i = 0; i < n; i++) {
+		system.previousPositions.x[i] = xStart[3 * i];
+		system.previousPositions.y[i] = xStart[3 * i + 1];
+		system.previousPositions.z[i] = xStart[3 * i + 2];
+		system.positions.x[i] = x[3 * i];
+		system.positions.y[i] = x[3 * i + 1];
+		system.positions.z[i] = x[3 * i + 2];
+		system.velocities.x[i] = damping * (x[3 * i] - xStart[3 * i]) / h;
+		system.velocities.y[i] = damping * (x[3 * i + 1] - xStart[3 * i + 1]) / h;
+		system.velocities.z[i] = damping * (x[3 * i + 2] - xStart[3 * i + 2]) / h;
+	}
+	return lastNewtonIterations;
+}
+
+double StretchedImplicitIntegrator::computeObjective(const StretchedParticleSystem &system, const std::vector<double> &pos, double timeStep) {
+	int n = system.getParticleCount();
+	double inverseSqTimeStep = 1.0 / (timeStep * timeStep);
+	double energy = 0;
+	for (int i = 0; i < n; i++) {
+		if (system.inverseMasses[i] == 0) {
+			continue;
+		}
+		double dx = pos[3 * i] - y[3 * i];
+		double dy = pos[3 * i + 1] - y[3 * i + 1];
+		double dz = pos[3 * i + 2] - y[3 * i + 2];
+		energy += 0.5 * inverseSqTimeStep * system.masses[i] * (dx * dx + dy * dy + dz * dz);
+	}
+
+	const StretchedSpringTable &springs = system.springs;
+	int springCount = springs.size();
+	for (int s = 0; s < springCount; s++) {
+		int a = springs.indicesA[s];
+		int b = springs.indicesB[s];
+		double dx = pos[3 * a] - pos[3 * b];
+		double dy = pos[3 * a + 1] - pos[3 * b + 1];
+		double dz = pos[3 * a + 2] - pos[3 * b + 2];
+		double stretch = sqrt(dx * dx + dy * dy + dz * dz) - springs.restLengths[s];
+		energy += 0.5 * springs.stiffnesses[s] * stretch * stretch;
+	}
+
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	for (int s = 0; s < pins.size(); s++) {
+		int a = pins.indices[s];
+		double dx = pos[3 * a] - pins.restPositions.x[s];
+		double dy = pos[3 * a + 1] - pins.restPositions.y[s];
+		double dz = pos[3 * a + 2] - pins.restPositions.z[s];
+		energy += 0.5 * pins.stiffnesses[s] * (dx * dx + dy * dy + dz * dz);
+	}
+	return energy;
+}
+
+double StretchedImplicitIntegrator::searchLine(const StretchedParticleSystem &system, double timeStep, double objective) {
+	int dofs = (int)x.size();
+	double slope = 0;
+	for (int i = 0; i < dofs; i++) {
+		slope += gradient[i] * dx[i];
+	}
+	if (!(slope < 0)) {
+		return 0;
+	}
+	xTrial.resize(dofs);
+	for (double alpha = 1; alpha >= LINE_SEARCH_MIN_STEP; alpha *= 0.5) {
+		for (int i = 0; i < dofs; i++) {
+			xTrial[i] = x[i] + alpha * dx[i];
+		}
+		if (computeObjective(system, xTrial, timeStep) <= objective + LINE_SEARCH_SUFFICIENT_DECREASE * alpha * slope) {
+			x.swap(xTrial);
+			return alpha;
+		}
+	}
+	return 0;
+}
+
+void StretchedImplicitIntegrator::computeGradient(const StretchedParticleSystem &system, const std::vector<double> &pos, double timeStep) {
+	int n = system.getParticleCount();
+	double inverseSqTimeStep = 1.0 / (timeStep * timeStep);
+	gradient.resize(3 * n);
+	for (int i = 0; i < n; i++) {
+		double m = inverseSqTimeStep * system.masses[i];
+		for (int c = 0; c < 3; c++) {
+			gradient[3 * i + c] = m * (pos[3 * i + c] - y[3 * i + c]);
+		}
+	}
+
+	const StretchedSpringTable &springs = system.springs;
+	int springCount = springs.size();
+	for (int s = 0; s < springCount; s++) {
+		int a = springs.indicesA[s];
+		int b = springs.indicesB[s];
+		double d[3] = { pos[3 * a] - pos[3 * b], pos[3 * a + 1] - pos[3 * b + 1], pos[3 * a + 2] - pos[3 * b + 2] };
+		double length = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		if (length < EPSILON_CHECK) {
+			continue;
+		}
+		// dE/dx_a = k (l - L) (x_a - x_b) / l
+		double scale = springs.stiffnesses[s] * (length - springs.restLengths[s]) / length;
+		for (int c = 0; c < 3; c++) {
+			gradient[3 * a + c] += scale * d[c];
+			gradient[3 * b + c] -= scale * d[c];
+		}
+	}
+
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	for (int s = 0; s < pins.size(); s++) {
+		int a = pins.indices[s];
+		double k = pins.stiffnesses[s];
+		gradient[3 * a] += k * (pos[3 * a] - pins.restPositions.x[s]);
+		gradient[3 * a + 1] += k * (pos[3 * a + 1] - pins.restPositions.y[s]);
+		gradient[3 * a + 2] += k * (pos[3 * a + 2] - pins.restPositions.z[s]);
+	}
+
+	// Fixed particles never move
+	for (int i = 0; i < n; i++) {
+		if (system.inverseMasses[i] == 0) {
+			gradient[3 * i] = gradient[3 * i + 1] = gradient[3 * i + 2] = 0;
+		}
+	}
+}
+
+void StretchedImplicitIntegrator::assembleHessian(const StretchedParticleSystem &system, const std::vector<double> &pos, double timeStep) {
+	int n = system.getParticleCount();
+	double inverseSqTimeStep = 1.0 / (timeStep * timeStep);
+	const StretchedSpringTable &springs = system.springs;
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	hessianAssembler.begin(system);
+
+	// Mass matrix (identity rows for fixed particles)
+	for (int i = 0; i < n; i++) {
+		hessianAssembler.setDiagonal(i, system.inverseMasses[i] == 0 ? 1.0 : inverseSqTimeStep * system.masses[i]);
+	}
+
+	int springCount = springs.size();
+	for (int s = 0; s < springCount; s++) {
+		int a = springs.indicesA[s];
+		int b = springs.indicesB[s];
+		double u[3] = { pos[3 * a] - pos[3 * b], pos[3 * a + 1] - pos[3 * b + 1], pos[3 * a + 2] - pos[3 * b + 2] };
+		double length = sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+		if (length < EPSILON_CHECK) {
+			continue;
+		}
+		u[0] /= length;
+		u[1] /= length;
+		u[2] /= length;
+		// The transverse term is clamped at 0 for compressed springs so the Hessian stays positive definite
+		double transverse = std::max(0.0, 1 - springs.restLengths[s] / length);
+		double k = springs.stiffnesses[s];
+		hessianAssembler.addSpring(s, a, b, u, k, transverse, system.inverseMasses[a] != 0, system.inverseMasses[b] != 0);
+	}
+
+	for (int s = 0; s < pins.size(); s++) {
+		int a = pins.indices[s];
+		if (system.inverseMasses[a] == 0) {
+			continue;
+		}
+		hessianAssembler.addToDiagonal(a, pins.stiffnesses[s]);
+	}
+}
+
+void StretchedImplicitIntegrator::invalidate() {
+	hessianAssembler.invalidate();
+}
+
+int StretchedImplicitIntegrator::getLastNewtonIterations() const {
+	return lastNewtonIterations;
+}
+
+int StretchedImplicitIntegrator::getLastLinearSolverIterations() const {
+	return lastLinearSolverIterations;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedConstants.h"
+#include "StretchedConjugateGradientSolver.h"
+#include "StretchedHessianAssembler.h"
+
+class StretchedParticleSystem;
+
+// Backward (implicit) Euler for the particle system. Each step minimizes
+//   g(x) = 1/(2h^2) (x - y)^T M (x - y) + E(x),   y = x_n + h v_n + h^2 M^-1 f_ext
+// with Newton's method: the sparse spring Hessian is assembled every iteration (into a pattern
+// built once per topology) and the Newton system is solved with preconditioned conjugate gradient. This stays stable for
+// the stiff hydrogel springs at full DELTA_T steps.
+class StretchedImplicitIntegrator {
+
+public:
+	StretchedImplicitIntegrator();
+	~StretchedImplicitIntegrator();
+
+	// Newton stops once the largest per-particle update (in velocity units, |dx| / h) is below this
+	double newtonTolerance = NEWTON_TOLERANCE;
+	int maxNewtonIterations = 20;
+	StretchedConjugateGradientSolver linearSolver;
+
+	// Advances the system by one timestep. Returns the number of Newton iterations taken.
+	int step(StretchedParticleSystem &system, double timeStep);
+
+	// Forces the Hessian pattern to be rebuilt (needed after editing spring indices in place)
+	void invalidate();
+
+	int getLastNewtonIterations() const;
+	int getLastLinearSolverIterations() const;
+
+private:
+	int lastNewtonIterations = 0;
+	int lastLinearSolverIterations = 0;
+
+	// Interleaved (x0, y0, z0, x1, ...) solver state, reused between steps
+	std::vector<double> x;
+	std::vector<double> xStart;
+	std::vector<double> y;
+	std::vector<double> xTrial;
+	std::vector<double> gradient;
+	std::vector<double> rhs;
+	std::vector<double> dx;
+	StretchedHessianAssembler hessianAssembler;
+
+	double computeObjective(const StretchedParticleSystem &system, const std::vector<double> &pos, double timeStep);
+	// Moves x along dx by the largest step 2^-k (down to LINE_SEARCH_MIN_STEP) that decreases the objective
+	// enough (Armijo). Returns the step, or 0 with x unchanged if dx is not a descent direction or none does.
+	double searchLine(const StretchedParticleSystem &system, double timeStep, double objective);
+	void computeGradient(const StretchedParticleSystem &system, const std::vector<double> &pos, double timeStep);
+	void assembleHessian(const StretchedParticleSystem &system, const std::vector<double> &pos, double timeStep);
+};
@@ -0,0 +1,450 @@
+#include "StretchedIncrementalDelaunay.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+// Circumradius of the ghost triangle over the radius of the bounds. The larger it is, the closer the real
+// triangles get to covering the convex hull (a ghost too close cuts off thin triangles along the hull).
+static const double GHOST_TRIANGLE_SCALE = 1000;
+// Points closer than this fraction of the bounds radius to a vertex are taken for that vertex
+static const double DUPLICATE_POINT_TOLERANCE = 1e-12;
+// The ghost vertices are at 90, 210 and 330 degrees (counterclockwise)
+static const double GHOST_FIRST_ANGLE = 1.5707963267948966;
+static const double GHOST_ANGLE_STEP = 2.0943951023931957;
+
+StretchedIncrementalDelaunay::StretchedIncrementalDelaunay() {
+	reset(0, 0, 1);
+}
+
+StretchedIncrementalDelaunay::~StretchedIncrementalDelaunay() {
+	// Nothing to see here
+}
+
+void StretchedIncrementalDelaunay::reset(double centerA, double centerB, double radius) {
+	for (int t = 0; t < (int)triangleAlive.size(); t++) {
+		if (triangleAlive[t]) {
+			freeTriangle(t);
+		}
+	}
+	pointsA.clear();
+	pointsB.clear();
+	vertexTriangles.clear();
+	triangleVertices.clear();
+	triangleNeighbors.clear();
+	triangleAlive.clear();
+	freeTriangles.clear();
+	triangleMarks.clear();
+	realTriangleCount = 0;
+
+	this->centerA = centerA;
+	this->centerB = centerB;
+	this->radius = radius;
+	double ghostRadius = GHOST_TRIANGLE_SCALE * radius;
+	for (int g = 0; g < 3; g++) {
+		double angle = GHOST_FIRST_ANGLE + g * GHOST_ANGLE_STEP;
+		ghostA[g] = centerA + ghostRadius * cos(angle);
+		ghostB[g] = centerB + ghostRadius * sin(angle);
+	}
+	lastTriangle = createTriangle(-1, -2, -3);
+	for (int k = 0; k < 3; k++) {
+		triangleNeighbors[3 * lastTriangle + k] = -1;
+	}
+}
+
+bool StretchedIncrementalDelaunay::isInBounds(double a, double b) const {
+	double da = a - centerA, db = b - centerB;
+	return da * da + db * db <= radius * radius;
+}
+
+double StretchedIncrementalDelaunay::pointA(int vertex) const {
+	return vertex >= 0 ? pointsA[vertex] : ghostA[-vertex - 1];
+}
+
+double StretchedIncrementalDelaunay::pointB(int vertex) const {
+	return vertex >= 0 ? pointsB[vertex] : ghostB[-vertex - 1];
+}
+
+// Positive if (a, b) is to the left of u -> v
+double StretchedIncrementalDelaunay::orientation(int u, int v, double a, double b) const {
+	double ua = pointA(u), ub = pointB(u);
+	return (pointA(v) - ua) * (b - ub) - (pointB(v) - ub) * (a - ua);
+}
+
+bool StretchedIncrementalDelaunay::isInCircumcircle(int triangle, double a, double b) const {
+	return isInCircumcircle(triangleVertices[3 * triangle], triangleVertices[3 * triangle + 1], triangleVertices[3 * triangle + 2], a, b);
+}
+
+bool StretchedIncrementalDelaunay::isInCircumcircle(int u, int v, int w, double a, double b) const {
+	int vertices[3] = { u, v, w };
+	double da[3], db[3], d[3];
+	for (int k = 0; k < 3; k++) {
+		da[k] = pointA(vertices[k]) - a;
+		db[k] = pointB(vertices[k]) - b;
+		d[k] = da[k] * da[k] + db[k] * db[k];
+	}
+	double determinant = da[0] * (db[1] * d[2] - d[1] * db[2])
+		- db[0] * (da[1] * d[2] - d[1] * da[2])
+		+ d[0] * (da[1] * db[2] - db[1] * da[2]);
+	return determinant > 0;
+}
+
+int StretchedIncrementalDelaunay::createTriangle(int u, int v, int w) {
+	int t;
+	if (!freeTriangles.empty()) {
+		t = freeTriangles.back();
+		freeTriangles.pop_back();
+	} else {
+		t = (int)triangleAlive.size();
+		triangleVertices.resize(3 * (t + 1));
+		triangleNeighbors.resize(3 * (t + 1), -1);
+		triangleAlive.push_back(0);
+		triangleMarks.push_back(0);
+	}
+	triangleVertices[3 * t] = u;
+	triangleVertices[3 * t + 1] = v;
+	triangleVertices[3 * t + 2] = w;
+	triangleAlive[t] = 1;
+	triangleMarks[t] = 0;
+	if (isRealTriangle(t)) {
+		realTriangleCount++;
+		createdTriangles.push_back(t);
+	}
+	return t;
+}
+
+void StretchedIncrementalDelaunay::freeTriangle(int triangle) {
+	if (isRealTriangle(triangle)) {
+		realTriangleCount--;
+		removedTriangles.push_back(triangle);
+		removedTriangleVertices.insert(removedTriangleVertices.end(), &triangleVertices[3 * triangle], &triangleVertices[3 * triangle] + 3);
+	}
+	triangleAlive[triangle] = 0;
+	freeTriangles.push_back(triangle);
+}
+
+int StretchedIncrementalDelaunay::vertexIndex(int triangle, int vertex) const {
+	for (int k = 0; k < 3; k++) {
+		if (triangleVertices[3 * triangle + k] == vertex) {
+			return k;
+		}
+	}
+	return -1;
+}
+
+void StretchedIncrementalDelaunay::setNeighborAcross(int triangle, int u, int v, int neighbor) {
+	for (int k = 0; k < 3; k++) {
+		int x = triangleVertices[3 * triangle + (k + 1) % 3];
+		int y = triangleVertices[3 * triangle + (k + 2) % 3];
+		if ((x == u && y == v) || (x == v && y == u)) {
+			triangleNeighbors[3 * triangle + k] = neighbor;
+			return;
+		}
+	}
+}
+
+int StretchedIncrementalDelaunay::locate(double a, double b) const {
+	int t = lastTriangle;
+	if (t < 0 || !triangleAlive[t]) {
+		t = 0;
+		while (!triangleAlive[t]) {
+			t++;
+		}
+	}
+	// Visibility walk, which always ends for Delaunay triangulations; the step limit is for round off
+	int steps = (int)triangleAlive.size() + 3;
+	for (int step = 0; step < steps; step++) {
+		int next = -1;
+		for (int k = 0; k < 3 && next < 0; k++) {
+			int u = triangleVertices[3 * t + (k + 1) % 3];
+			int v = triangleVertices[3 * t + (k + 2) % 3];
+			if (orientation(u, v, a, b) < 0) {
+				next = triangleNeighbors[3 * t + k];
+			}
+		}
+		if (next < 0) {
+			return t;
+		}
+		t = next;
+	}
+	for (t = 0; t < (int)triangleAlive.size(); t++) {
+		if (triangleAlive[t]) {
+			const int *v = &triangleVertices[3 * t];
+			if (orientation(v[0], v[1], a, b) >= 0 && orientation(v[1], v[2], a, b) >= 0 && orientation(v[2], v[0], a, b) >= 0) {
+				return t;
+			}
+		}
+	}
+	return lastTriangle;
+}
+
+bool StretchedIncrementalDelaunay::insert(int vertex, double a, double b) {
+	if (vertex < 0 || !isInBounds(a, b) || contains(vertex)) {
+		return false;
+	}
+	int t = locate(a, b);
+	double tolerance = DUPLICATE_POINT_TOLERANCE * radius;
+	for (int k = 0; k < 3; k++) {
+		int v = triangleVertices[3 * t + k];
+		if (fabs(pointA(v) - a) <= tolerance && fabs(pointB(v) - b) <= tolerance) {
+			return false;
+		}
+	}
+	if ((int)pointsA.size() <= vertex) {
+		pointsA.resize(vertex + 1, 0);
+		pointsB.resize(vertex + 1, 0);
+		vertexTriangles.resize(vertex + 1, -1);
+	}
+	pointsA[vertex] = a;
+	pointsB[vertex] = b;
+
+	// Cavity: the connected triangles whose circumcircle holds the point
+	currentMark++;
+	std::vector<int> cavity;
+	std::vector<int> stack(1, t);
+	triangleMarks[t] = currentMark;
+	while (!stack.empty()) {
+		int x = stack.back();
+		stack.pop_back();
+		cavity.push_back(x);
+		for (int k = 0; k < 3; k++) {
+			int n = triangleNeighbors[3 * x + k];
+			if (n >= 0 && triangleMarks[n] != currentMark && isInCircumcircle(n, a, b)) {
+				triangleMarks[n] = currentMark;
+				stack.push_back(n);
+			}
+		}
+	}
+
+	// Its boundary edges (counterclockwise) and the triangles outside them
+	std::vector<int> boundary;
+	for (int i = 0; i < (int)cavity.size(); i++) {
+		int x = cavity[i];
+		for (int k = 0; k < 3; k++) {
+			int n = triangleNeighbors[3 * x + k];
+			if (n < 0 || triangleMarks[n] != currentMark) {
+				boundary.push_back(triangleVertices[3 * x + (k + 1) % 3]);
+				boundary.push_back(triangleVertices[3 * x + (k + 2) % 3]);
+				boundary.push_back(n);
+			}
+		}
+	}
+	for (int i = 0; i < (int)cavity.size(); i++) {
+		freeTriangle(cavity[i]);
+	}
+
+	// A fan around the new vertex
+	int fanSize = (int)boundary.size() / 3;
+	std::vector<int> fan(fanSize);
+	for (int i = 0; i < fanSize; i++) {
+		int u = boundary[3 * i], v = boundary[3 * i + 1], outside = boundary[3 * i + 2];
+		fan[i] = createTriangle(u, v, vertex);
+		triangleNeighbors[3 * fan[i] + 2] = outside;
+		if (outside >= 0) {
+			setNeighborAcross(outside, u, v, fan[i]);
+		}
+		if (u >= 0) {
+			vertexTriangles[u] = fan[i];
+		}
+	}
+	for (int i = 0; i < fanSize; i++) {
+		int u = boundary[3 * i], v = boundary[3 * i + 1];
+		for (int j = 0; j < fanSize; j++) {
+			// Across (v, vertex) is the fan triangle starting at v, across (vertex, u) the one ending at u
+			if (boundary[3 * j] == v) {
+				triangleNeighbors[3 * fan[i]] = fan[j];
+			}
+			if (boundary[3 * j + 1] == u) {
+				triangleNeighbors[3 * fan[i] + 1] = fan[j];
+			}
+		}
+	}
+	vertexTriangles[vertex] = fan[0];
+	lastTriangle = fan[0];
+	return true;
+}
+
+void StretchedIncrementalDelaunay::remove(int vertex) {
+	if (!contains(vertex)) {
+		return;
+	}
+	// The link of the vertex (counterclockwise) and the triangles outside each of its edges
+	std::vector<int> star;
+	getVertexTriangles(vertex, star);
+	int m = (int)star.size();
+	std::vector<int> polygon(m);
+	std::vector<int> outside(m);
+	for (int i = 0; i < m; i++) {
+		int k = vertexIndex(star[i], vertex);
+		polygon[i] = triangleVertices[3 * star[i] + (k + 1) % 3];
+		outside[i] = triangleNeighbors[3 * star[i] + k];
+	}
+	for (int i = 0; i < m; i++) {
+		freeTriangle(star[i]);
+	}
+	vertexTriangles[vertex] = -1;
+
+	// Delaunay ear clipping: an ear is convex and holds no other vertex of the polygon in its circumcircle
+	std::vector<int> remaining(polygon);
+	std::vector<int> created;
+	while ((int)remaining.size() >= 3) {
+		int size = (int)remaining.size();
+		int ear = -1, convexEar = -1;
+		for (int i = 0; i < size && ear < 0; i++) {
+			int u = remaining[(i + size - 1) % size], v = remaining[i], w = remaining[(i + 1) % size];
+			if (size > 3 && orientation(u, v, pointA(w), pointB(w)) <= 0) {
+				continue;
+			}
+			if (convexEar < 0) {
+				convexEar = i;
+			}
+			bool empty = true;
+			for (int j = 0; j < size && empty; j++) {
+				int x = remaining[j];
+				if (x != u && x != v && x != w) {
+					empty = !isInCircumcircle(u, v, w, pointA(x), pointB(x));
+				}
+			}
+			if (empty) {
+				ear = i;
+			}
+		}
+		if (ear < 0) {
+			// Only from round off on nearly cocircular points
+			ear = convexEar >= 0 ? convexEar : 0;
+		}
+		int u = remaining[(ear + size - 1) % size], v = remaining[ear], w = remaining[(ear + 1) % size];
+		created.push_back(createTriangle(u, v, w));
+		remaining.erase(remaining.begin() + ear);
+	}
+
+	// Neighbours: the outside triangles across the polygon edges, the other new triangles across the diagonals
+	for (int i = 0; i < (int)created.size(); i++) {
+		int t = created[i];
+		for (int k = 0; k < 3; k++) {
+			int u = triangleVertices[3 * t + (k + 1) % 3];
+			int v = triangleVertices[3 * t + (k + 2) % 3];
+			int neighbor = -1;
+			bool onPolygon = false;
+			for (int j = 0; j < m && !onPolygon; j++) {
+				if (polygon[j] == u && polygon[(j + 1) % m] == v) {
+					onPolygon = true;
+					neighbor = outside[j];
+					if (neighbor >= 0) {
+						setNeighborAcross(neighbor, u, v, t);
+					}
+				}
+			}
+			for (int j = 0; j < (int)created.size() && !onPolygon && neighbor < 0; j++) {
+				if (j != i && vertexIndex(created[j], u) >= 0 && vertexIndex(created[j], v) >= 0) {
+					neighbor = created[j];
+				}
+			}
+			triangleNeighbors[3 * t + k] = neighbor;
+			if (triangleVertices[3 * t + k] >= 0) {
+				vertexTriangles[triangleVertices[3 * t + k]] = t;
+			}
+		}
+	}
+	lastTriangle = created[0];
+}
+
+bool StretchedIncrementalDelaunay::contains(int vertex) const {
+	return vertex >= 0 && vertex < (int)vertexTriangles.size() && vertexTriangles[vertex] >= 0;
+}
+
+void StretchedIncrementalDelaunay::renameVertex(int from, int to) {
+	if ((int)pointsA.size() <= to) {
+		pointsA.resize(to + 1, 0);
+		pointsB.resize(to + 1, 0);
+		vertexTriangles.resize(to + 1, -1);
+	}
+	pointsA[to] = pointsA[from];
+	pointsB[to] = pointsB[from];
+	if (contains(from)) {
+		std::vector<int> star;
+		getVertexTriangles(from, star);
+		for (int i = 0; i < (int)star.size(); i++) {
+			triangleVertices[3 * star[i] + vertexIndex(star[i], from)] = to;
+		}
+	}
+	vertexTriangles[to] = vertexTriangles[from];
+	vertexTriangles[from] = -1;
+}
+
+void StretchedIncrementalDelaunay::getPoint(int vertex, double &a, double &b) const {
+	a = pointA(vertex);
+	b = pointB(vertex);
+}
+
+void StretchedIncrementalDelaunay::getVertexTriangles(int vertex, std::vector<int> &triangles) const {
+	triangles.clear();
+	if (!contains(vertex)) {
+		return;
+	}
+	int first = vertexTriangles[vertex];
+	int t = first;
+	// The star is closed (the ghosts surround every real vertex), the limit is for broken links only
+	for (int step = 0; step < (int)triangleAlive.size() && t >= 0; step++) {
+		triangles.push_back(t);
+		// In (vertex, x, y) the next triangle counterclockwise shares (vertex, y), which is opposite x
+		t = triangleNeighbors[3 * t + (vertexIndex(t, vertex) + 1) % 3];
+		if (t == first) {
+			break;
+		}
+	}
+}
+
+bool StretchedIncrementalDelaunay::findEdgeTriangles(int a, int b, int &left, int &right) const {
+	left = -1;
+	right = -1;
+	std::vector<int> star;
+	getVertexTriangles(a, star);
+	for (int i = 0; i < (int)star.size(); i++) {
+		int k = vertexIndex(star[i], a);
+		if (triangleVertices[3 * star[i] + (k + 1) % 3] == b) {
+			left = star[i];
+		} else if (triangleVertices[3 * star[i] + (k + 2) % 3] == b) {
+			right = star[i];
+		}
+	}
+	return left >= 0 || right >= 0;
+}
+
+int StretchedIncrementalDelaunay::getTriangleSlotCount() const {
+	return (int)triangleAlive.size();
+}
+
+bool StretchedIncrementalDelaunay::isTriangleAlive(int triangle) const {
+	return triangleAlive[triangle] != 0;
+}
+
+bool StretchedIncrementalDelaunay::isRealTriangle(int triangle) const {
+	return triangleVertices[3 * triangle] >= 0 && triangleVertices[3 * triangle + 1] >= 0 && triangleVertices[3 * triangle + 2] >= 0;
+}
+
+int StretchedIncrementalDelaunay::getTriangleVertex(int triangle, int k) const {
+	return triangleVertices[3 * triangle + k];
+}
+
+int StretchedIncrementalDelaunay::getRealTriangleCount() const {
+	return realTriangleCount;
+}
+
+const std::vector<int> &StretchedIncrementalDelaunay::getCreatedTriangles() const {
+	return createdTriangles;
+}
+
+const std::vector<int> &StretchedIncrementalDelaunay::getRemovedTriangles() const {
+	return removedTriangles;
+}
+
+const std::vector<int> &StretchedIncrementalDelaunay::getRemovedTriangleVertices() const {
+	return removedTriangleVertices;
+}
+
+void StretchedIncrementalDelaunay::clearChanges() {
+	createdTriangles.clear();
+	removedTriangles.clear();
+	removedTriangleVertices.clear();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+
+// Delaunay triangulation of a point set in a plane that is edited one vertex at a time, for keeping a
+// triangulated design in sync with small edits without re-triangulating everything.
+// Insertion is Bowyer-Watson (the triangles whose circumcircle holds the new point are replaced by a fan
+// around it), removal re-triangulates the star of the vertex by Delaunay ear clipping, so both cost about
+// the number of triangles they change. Three ghost vertices (ids -1, -2 and -3) far outside the bounds
+// close the triangulation, so every real vertex is interior; triangles with a ghost vertex are not part of
+// the design (isRealTriangle). Vertex ids are chosen by the caller (dense, >= 0).
+// Every triangle removed and created since clearChanges is reported, for patching what was built from them.
+class StretchedIncrementalDelaunay {
+
+public:
+	StretchedIncrementalDelaunay();
+	~StretchedIncrementalDelaunay();
+
+	// Starts over with no vertices; points must then lie within radius of (centerA, centerB).
+	// The triangles alive before are reported as removed.
+	void reset(double centerA, double centerB, double radius);
+	bool isInBounds(double a, double b) const;
+
+	// Returns false (and inserts nothing) if the point is out of bounds or on an existing vertex
+	bool insert(int vertex, double a, double b);
+	void remove(int vertex);
+	bool contains(int vertex) const;
+	// Gives a vertex a new (unused) id
+	void renameVertex(int from, int to);
+
+	void getPoint(int vertex, double &a, double &b) const;
+	// Triangles around the vertex, counterclockwise
+	void getVertexTriangles(int vertex, std::vector<int> &triangles) const;
+	// The triangles on either side of the edge (-1 if none), the one with a -> b counterclockwise first.
+	// Returns false if the edge is not in the triangulation.
+	bool findEdgeTriangles(int a, int b, int &left, int &right) const;
+
+	// Triangle ids index slots that are reused once freed
+	int getTriangleSlotCount() const;
+	bool isTriangleAlive(int triangle) const;
+	bool isRealTriangle(int triangle) const;
+	// Vertices of a triangle, counterclockwise (k = 0, 1, 2)
+	int getTriangleVertex(int triangle, int k) const;
+	int getRealTriangleCount() const;
+
+	// Triangles created since clearChanges (some may have been removed again) and the vertices of the
+	// removed ones (3 per triangle, the triangle ids themselves may be reused)
+	const std::vector<int> &getCreatedTriangles() const;
+	const std::vector<int> &getRemovedTriangles() const;
+	const std::vector<int> &getRemovedTriangleVertices() const;
+	void clearChanges();
+
+private:
+	double centerA = 0;
+	double centerB = 0;
+	double radius = 0;
+	double ghostA[3];
+	double ghostB[3];
+
+	// Per vertex id
+	std::vector<double> pointsA;
+	std::vector<double> pointsB;
+	// A triangle around each vertex (-1 if the vertex is not in the triangulation)
+	std::vector<int> vertexTriangles;
+
+	// Per triangle slot: 3 vertices counterclockwise, and the neighbour across the edge opposite each
+	std::vector<int> triangleVertices;
+	std::vector<int> triangleNeighbors;
+	std::vector<char> triangleAlive;
+	std::vector<int> freeTriangles;
+	int realTriangleCount = 0;
+	// Walks start from the last created triangle
+	int lastTriangle = -1;
+
+	// Marks of the triangles visited by the current insertion
+	std::vector<int> triangleMarks;
+	int currentMark = 0;
+
+	std::vector<int> createdTriangles;
+	std::vector<int> removedTriangles;
+	std::vector<int> removedTriangleVertices;
+
+	double pointA(int vertex) const;
+	double pointB(int vertex) const;
+	double orientation(int u, int v, double a, double b) const;
+	bool isInCircumcircle(int triangle, double a, double b) const;
+	bool isInCircumcircle(int u, int v, int w, double a, double b) const;
+	int locate(double a, double b) const;
+	int createTriangle(int u, int v, int w);
+	void freeTriangle(int triangle);
+	int vertexIndex(int triangle, int vertex) const;
+	// Sets the neighbour of triangle across its edge (u, v)
+	void setNeighborAcross(int triangle, int u, int v, int neighbor);
+};
@@ -0,0 +1,236 @@
+#include "StretchedMultiresolutionSolver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "StretchedParticleSystem.h"
+
+
+static const double *componentOf(const StretchedVectorArray &array, int axis) {
+	return axis == 0 ? array.x.data() : (axis == 1 ? array.y.data() : array.z.data());
+}
+
+// Median height along axis of the corners of the triangles (the fabric plane of a level, which a
+// single lifted particle such as the seed of StretchedGridFabricBuilder does not move)
+static double computeFabricHeight(const StretchedVectorArray &rest, const std::vector<int> &triangles, int axis, std::vector<double> &heights) {
+	const double *height = componentOf(rest, axis);
+	heights.resize(triangles.size());
+	for (int i = 0; i < (int)triangles.size(); i++) {
+		heights[i] = height[triangles[i]];
+	}
+	std::nth_element(heights.begin(), heights.begin() + heights.size() / 2, heights.end());
+	return heights[heights.size() / 2];
+}
+
+static void cross(const double a[3], const double b[3], double result[3]) {
+	result[0] = a[1] * b[2] - a[2] * b[1];
+	result[1] = a[2] * b[0] - a[0] * b[2];
+	result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+StretchedMultiresolutionSolver::StretchedMultiresolutionSolver() {
+	// Nothing to see here
+}
+
+StretchedMultiresolutionSolver::~StretchedMultiresolutionSolver() {
+	// Nothing to see here
+}
+
+const std::vector<int> &StretchedMultiresolutionSolver::getLevelIterations() const {
+	return levelIterations;
+}
+
+int StretchedMultiresolutionSolver::solve(const std::vector<StretchedParticleSystem *> &levels) {
+	int levelCount = (int)levels.size();
+	levelIterations.assign(levelCount, 0);
+	for (int l = 0; l < levelCount; l++) {
+		StretchedParticleSystem &system = *levels[l];
+		// The rest positions are needed to prolong this level once it is solved
+		levelRest = system.positions;
+		if (l > 0) {
+			prolong(previousLevelRest, *levels[l - 1], system);
+		}
+
+		StretchedEquilibriumSolver &solver = system.equilibriumSolver;
+		double tolerance = solver.tolerance;
+		int settleSteps = solver.settleSteps;
+		if (l + 1 < levelCount) {
+			solver.tolerance = std::max(tolerance, coarseTolerance);
+		}
+		// Only the coarsest level may settle, the finer ones start from its minimum
+		if (l > 0) {
+			solver.settleSteps = 0;
+		}
+		levelIterations[l] = solver.solve(system);
+		solver.tolerance = tolerance;
+		solver.settleSteps = settleSteps;
+
+		std::swap(previousLevelRest, levelRest);
+	}
+	return levelCount > 0 ? levelIterations.back() : 0;
+}
+
+void StretchedMultiresolutionSolver::prolong(const StretchedVectorArray &coarseRest, const StretchedParticleSystem &coarse, StretchedParticleSystem &fine) {
+	const std::vector<int> &triangles = coarse.triangleIndices;
+	int triangleCount = (int)triangles.size() / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+	int up = coarse.upAxis;
+	planeAxisU = (up + 1) % 3;
+	planeAxisV = (up + 2) % 3;
+	const double *restU = componentOf(coarseRest, planeAxisU);
+	const double *restV = componentOf(coarseRest, planeAxisV);
+	double coarseFabricHeight = computeFabricHeight(coarseRest, triangles, up, heights);
+	double fineFabricHeight = fine.triangleIndices.empty() ? coarseFabricHeight : computeFabricHeight(fine.positions, fine.triangleIndices, up, heights);
+	int n = fine.getParticleCount();
+	onFabric.assign(n, 0);
+	for (int i = 0; i < (int)fine.triangleIndices.size(); i++) {
+		onFabric[fine.triangleIndices[i]] = 1;
+	}
+
+	// Bucket the triangles by their bounding boxes, about one triangle per cell
+	double minU = HUGE_VAL, minV = HUGE_VAL, maxU = -HUGE_VAL, maxV = -HUGE_VAL;
+	for (int i = 0; i < 3 * triangleCount; i++) {
+		int p = triangles[i];
+		minU = std::min(minU, restU[p]);
+		maxU = std::max(maxU, restU[p]);
+		minV = std::min(minV, restV[p]);
+		maxV = std::max(maxV, restV[p]);
+	}
+	cellsPerSide = std::max(1, std::min(1024, (int)sqrt((double)triangleCount)));
+	gridMinU = minU;
+	gridMinV = minV;
+	cellSize = std::max(std::max(maxU - minU, maxV - minV) / cellsPerSide, EPSILON_CHECK);
+	int cellCount = cellsPerSide * cellsPerSide;
+	cellStarts.assign(cellCount + 1, 0);
+	for (int pass = 0; pass < 2; pass++) {
+		for (int t = 0; t < triangleCount; t++) {
+			int a = triangles[3 * t], b = triangles[3 * t + 1], c = triangles[3 * t + 2];
+			int cu0 = std::max(0, std::min(cellsPerSide - 1, (int)((std::min(restU[a], std::min(restU[b], restU[c])) - gridMinU) / cellSize)));
+			int cu1 = std::max(0, std::min(cellsPerSide - 1, (int)((std::max(restU[a], std::max(restU[b], restU[c])) - gridMinU) / cellSize)));
+			int cv0 = std::max(0, std::min(cellsPerSide - 1, (int)((std::min(restV[a], std::min(restV[b], restV[c])) - gridMinV) / cellSize)));
+			int cv1 = std::max(0, std::min(cellsPerSide - 1, (int)((std::max(restV[a], std::max(restV[b], restV[c])) - gridMinV) / cellSize)));
+			for (int cu = cu0; cu <= cu1; cu++) {
+				for (int cv = cv0; cv <= cv1; cv++) {
+					int cell = cu * cellsPerSide + cv;
+					if (pass == 0) {
+						cellStarts[cell + 1]++;
+					} else {
+						cellTriangles[cellStarts[cell]++] = t;
+					}
+				}
+			}
+		}
+		if (pass == 0) {
+			for (int cell = 0; cell < cellCount; cell++) {
+				cellStarts[cell + 1] += cellStarts[cell];
+			}
+			cellTriangles.resize(cellStarts[cellCount]);
+		} else {
+			// The second pass advanced every start to the end of its cell, shift them back
+			for (int cell = cellCount; cell > 0; cell--) {
+				cellStarts[cell] = cellStarts[cell - 1];
+			}
+			cellStarts[0] = 0;
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		if (fine.inverseMasses[i] == 0) {
+			continue;
+		}
+		P3D rest = fine.positions.getPoint(i);
+		double barycentric[3];
+		int t = locate(coarseRest, triangles, rest[planeAxisU], rest[planeAxisV], barycentric);
+		if (t < 0) {
+			continue;
+		}
+		int corners[3] = { triangles[3 * t], triangles[3 * t + 1], triangles[3 * t + 2] };
+		double restCorners[3][3], solvedCorners[3][3];
+		double point[3] = { 0, 0, 0 };
+		for (int k = 0; k < 3; k++) {
+			P3D restCorner = coarseRest.getPoint(corners[k]);
+			P3D solvedCorner = coarse.positions.getPoint(corners[k]);
+			for (int c = 0; c < 3; c++) {
+				restCorners[k][c] = restCorner[c];
+				solvedCorners[k][c] = solvedCorner[c];
+				point[c] += solvedCorner[c] * barycentric[k];
+			}
+		}
+
+		// The fabric lies on the solved coarse fabric, the rest (the hydrogel) is offset along its normal,
+		// oriented like the rest normal is along the up axis, by its rest height above the fabric plane
+		double height = onFabric[i] ? 0 : rest[up] - fineFabricHeight;
+		if (height != 0) {
+			double e1[3], e2[3], restNormal[3], normal[3];
+			for (int c = 0; c < 3; c++) {
+				e1[c] = restCorners[1][c] - restCorners[0][c];
+				e2[c] = restCorners[2][c] - restCorners[0][c];
+			}
+			cross(e1, e2, restNormal);
+			for (int c = 0; c < 3; c++) {
+				e1[c] = solvedCorners[1][c] - solvedCorners[0][c];
+				e2[c] = solvedCorners[2][c] - solvedCorners[0][c];
+			}
+			cross(e1, e2, normal);
+			double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			if (length > EPSILON_CHECK) {
+				double scale = (restNormal[up] < 0 ? -height : height) / length;
+				for (int c = 0; c < 3; c++) {
+					point[c] += normal[c] * scale;
+				}
+			} else {
+				point[up] += height;
+			}
+		}
+		fine.positions.set(i, P3D(point[0], point[1], point[2]));
+		fine.previousPositions.set(i, P3D(point[0], point[1], point[2]));
+	}
+	fine.velocities.setZero();
+}
+
+int StretchedMultiresolutionSolver::locate(const StretchedVectorArray &rest, const std::vector<int> &triangles, double u, double v, double barycentric[3]) const {
+	const double *restU = componentOf(rest, planeAxisU);
+	const double *restV = componentOf(rest, planeAxisV);
+	int best = -1;
+	double bestInside = -HUGE_VAL;
+	// Test one triangle, keeping it if the point is further inside it (least negative barycentric) than the best so far
+	auto test = [&](int t) {
+		int a = triangles[3 * t], b = triangles[3 * t + 1], c = triangles[3 * t + 2];
+		double e1u = restU[b] - restU[a], e1v = restV[b] - restV[a];
+		double e2u = restU[c] - restU[a], e2v = restV[c] - restV[a];
+		double det = e1u * e2v - e2u * e1v;
+		if (fabs(det) < EPSILON_CHECK) {
+			return;
+		}
+		double pu = u - restU[a], pv = v - restV[a];
+		double w1 = (pu * e2v - e2u * pv) / det;
+		double w2 = (e1u * pv - pu * e1v) / det;
+		double w0 = 1 - w1 - w2;
+		double inside = std::min(w0, std::min(w1, w2));
+		if (inside > bestInside) {
+			bestInside = inside;
+			best = t;
+			barycentric[0] = w0;
+			barycentric[1] = w1;
+			barycentric[2] = w2;
+		}
+	};
+
+	int cu = std::max(0, std::min(cellsPerSide - 1, (int)((u - gridMinU) / cellSize)));
+	int cv = std::max(0, std::min(cellsPerSide - 1, (int)((v - gridMinV) / cellSize)));
+	int cell = cu * cellsPerSide + cv;
+	for (int k = cellStarts[cell]; k < cellStarts[cell + 1]; k++) {
+		test(cellTriangles[k]);
+	}
+	if (bestInside < -EPSILON_CHECK) {
+		// Outside every triangle of the cell (a Steiner point on the boundary or past the coarse hull),
+		// extrapolate from the triangle it is least outside of
+		int triangleCount = (int)triangles.size() / 3;
+		for (int t = 0; t < triangleCount; t++) {
+			test(t);
+		}
+	}
+	return best;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedVectorArray.h"
+
+class StretchedParticleSystem;
+
+// Coarse-to-fine rest shape solve over a hierarchy of fabrics built from the same design at
+// increasing densities (e.g. the levels of DelaunayTriangulator::triangulateHierarchy, each turned
+// into a particle system with its own springs and hydrogel). The coarsest level is solved with its
+// equilibrium solver, its shape is prolonged to the next level as the starting point, and so on
+// until the finest level, which then only has to settle the local detail. The long range bending
+// that takes most of the iterations on a fine mesh is resolved on the cheap coarse levels.
+// With settleSteps set, only the coarsest level is time stepped to settle first (see StretchedEquilibriumSolver).
+//
+// Prolongation works in the design plane: every particle of the finer level is located in a rest
+// triangle of the coarser level and moved to the same barycentric point of the solved triangle. The
+// particles off the fabric (the hydrogel layer, which are not triangle corners) are offset along its
+// normal by their rest height above the fabric plane, the median height of the fabric. Heights of single
+// fabric particles, like the lifted seed of StretchedGridFabricBuilder, are not carried over. The levels
+// do not need to be nested, only to cover the same region.
+class StretchedMultiresolutionSolver {
+
+public:
+	StretchedMultiresolutionSolver();
+	~StretchedMultiresolutionSolver();
+
+	// Every level but the finest is solved only to this tolerance (a fraction of the mean rest length,
+	// the finest level uses the tolerance of its own equilibrium solver). Much looser leaves the long range
+	// bending to the finest level again.
+	double coarseTolerance = 1e-5;
+
+	// Solves levels[0] (coarsest) to levels.back() (finest) in order. Each level must still be in its
+	// rest (as built) configuration. Returns the number of iterations taken on the finest level.
+	int solve(const std::vector<StretchedParticleSystem *> &levels);
+
+	// Moves the particles of fine (in its rest configuration) to the shape of coarse, whose rest
+	// positions are coarseRest. Fixed particles are left where they are.
+	void prolong(const StretchedVectorArray &coarseRest, const StretchedParticleSystem &coarse, StretchedParticleSystem &fine);
+
+	// Iterations taken on each level by the last solve
+	const std::vector<int> &getLevelIterations() const;
+
+private:
+	std::vector<int> levelIterations;
+	// Rest positions of the level being solved and of the one before it
+	StretchedVectorArray levelRest;
+	StretchedVectorArray previousLevelRest;
+
+	// Rest heights of the triangle corners and whether each fine particle is one
+	std::vector<double> heights;
+	std::vector<char> onFabric;
+
+	// Uniform grid over the rest triangles of the coarse level in the design plane, bucketed CSR style
+	std::vector<int> cellStarts;
+	std::vector<int> cellTriangles;
+	// Finds the rest triangle of coarse containing (u, v) (or the one it is least outside of) along with
+	// its barycentric coordinates. Returns -1 if coarse has no triangles.
+	int locate(const StretchedVectorArray &rest, const std::vector<int> &triangles, double u, double v, double barycentric[3]) const;
+
+	int cellsPerSide = 0;
+	int planeAxisU = 0;
+	int planeAxisV = 2;
+	double gridMinU = 0;
+	double gridMinV = 0;
+	double cellSize = 1;
+};
@@ -0,0 +1,221 @@
+#include "StretchedParticleReordering.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "StretchedParticleSystem.h"
+
+// values[k] = old values[order[k]]
+template <class T>
+static void permuteValues(std::vector<T> &values, const std::vector<int> &order) {
+	std::vector<T> permuted(values.size());
+	for (int k = 0; k < (int)order.size(); k++) {
+		permuted[k] = values[order[k]];
+	}
+	values.swap(permuted);
+}
+
+static void permuteValues(StretchedVectorArray &values, const std::vector<int> &order) {
+	permuteValues(values.x, order);
+	permuteValues(values.y, order);
+	permuteValues(values.z, order);
+}
+
+StretchedParticleReordering::StretchedParticleReordering() {
+	// Nothing to see here
+}
+
+StretchedParticleReordering::~StretchedParticleReordering() {
+	// Nothing to see here
+}
+
+void StretchedParticleReordering::apply(StretchedParticleSystem &system) {
+	int n = system.getParticleCount();
+	bandwidthBefore = computeBandwidth(system);
+
+	// order[k] is the particle that becomes particle k
+	std::vector<int> order;
+	computeReverseCuthillMcKee(system, order);
+	std::vector<int> remap(n);
+	for (int k = 0; k < n; k++) {
+		remap[order[k]] = k;
+	}
+
+	permuteValues(system.positions, order);
+	permuteValues(system.previousPositions, order);
+	permuteValues(system.velocities, order);
+	permuteValues(system.forces, order);
+	permuteValues(system.masses, order);
+	permuteValues(system.inverseMasses, order);
+	for (int i = 0; i < (int)system.triangleIndices.size(); i++) {
+		system.triangleIndices[i] = remap[system.triangleIndices[i]];
+	}
+	system.springs.remapParticles(remap);
+	system.zeroLengthSprings.remapParticles(remap);
+	system.constraintSolver.remapParticles(remap);
+	system.topologyChanged();
+
+	// Compose with the mapping of earlier calls (particles it does not cover were never moved)
+	std::vector<int> previousOriginals(n);
+	for (int i = 0; i < n; i++) {
+		previousOriginals[i] = getOriginalIndex(i);
+	}
+	originalIndices.resize(n);
+	newIndices.assign(n, -1);
+	for (int k = 0; k < n; k++) {
+		originalIndices[k] = previousOriginals[order[k]];
+		newIndices[originalIndices[k]] = k;
+	}
+	bandwidthAfter = computeBandwidth(system);
+}
+
+void StretchedParticleReordering::clear() {
+	originalIndices.clear();
+	newIndices.clear();
+	bandwidthBefore = 0;
+	bandwidthAfter = 0;
+}
+
+int StretchedParticleReordering::getNewIndex(int original) const {
+	return original < (int)newIndices.size() ? newIndices[original] : original;
+}
+
+int StretchedParticleReordering::getOriginalIndex(int particle) const {
+	return particle < (int)originalIndices.size() ? originalIndices[particle] : particle;
+}
+
+void StretchedParticleReordering::toOriginalOrder(const StretchedVectorArray &values, StretchedVectorArray &originalValues) const {
+	int n = values.size();
+	originalValues.resize(n);
+	for (int i = 0; i < n; i++) {
+		int original = getOriginalIndex(i);
+		originalValues.x[original] = values.x[i];
+		originalValues.y[original] = values.y[i];
+		originalValues.z[original] = values.z[i];
+	}
+}
+
+int StretchedParticleReordering::getBandwidthBefore() const {
+	return bandwidthBefore;
+}
+
+int StretchedParticleReordering::getBandwidthAfter() const {
+	return bandwidthAfter;
+}
+
+void StretchedParticleReordering::computeReverseCuthillMcKee(const StretchedParticleSystem &system, std::vector<int> &order) {
+	int n = system.getParticleCount();
+	const StretchedSpringTable &springs = system.springs;
+	int springCount = springs.size();
+
+	// Neighbours of each particle along the springs, sorted and without repeats
+	std::vector<int> starts(n + 1, 0);
+	for (int s = 0; s < springCount; s++) {
+		if (springs.indicesA[s] != springs.indicesB[s]) {
+			starts[springs.indicesA[s] + 1]++;
+			starts[springs.indicesB[s] + 1]++;
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		starts[i + 1] += starts[i];
+	}
+	std::vector<int> neighbors(starts[n]);
+	std::vector<int> next(starts.begin(), starts.end() - 1);
+	for (int s = 0; s < springCount; s++) {
+		int a = springs.indicesA[s], b = springs.indicesB[s];
+		if (a != b) {
+			neighbors[next[a]++] = b;
+			neighbors[next[b]++] = a;
+		}
+	}
+	std::vector<int> degrees(n);
+	for (int i = 0; i < n; i++) {
+		int *begin = neighbors.data() + starts[i];
+		int *end = neighbors.data() + starts[i + 1];
+		std::sort(begin, end);
+		degrees[i] = (int)(std::unique(begin, end) - begin);
+	}
+
+	// Breadth first search from root over the unplaced particles; returns the depth reached and leaves the
+	// particles of the last level in lastLevel
+	std::vector<int> depths(n, -1);
+	std::vector<char> placed(n, 0);
+	std::vector<int> queue;
+	std::vector<int> lastLevel;
+	auto breadthFirst = [&](int root) {
+		queue.clear();
+		queue.push_back(root);
+		depths[root] = 0;
+		for (int head = 0; head < (int)queue.size(); head++) {
+			int i = queue[head];
+			for (int k = starts[i]; k < starts[i] + degrees[i]; k++) {
+				int j = neighbors[k];
+				if (depths[j] < 0 && !placed[j]) {
+					depths[j] = depths[i] + 1;
+					queue.push_back(j);
+				}
+			}
+		}
+		int depth = depths[queue.back()];
+		lastLevel.clear();
+		for (int k = 0; k < (int)queue.size(); k++) {
+			if (depths[queue[k]] == depth) {
+				lastLevel.push_back(queue[k]);
+			}
+			depths[queue[k]] = -1;
+		}
+		return depth;
+	};
+	auto byDegree = [&](int i, int j) {
+		return degrees[i] < degrees[j] || (degrees[i] == degrees[j] && i < j);
+	};
+
+	order.clear();
+	order.reserve(n);
+	for (int start = 0; start < n; start++) {
+		if (placed[start]) {
+			continue;
+		}
+		// Pseudo-peripheral root (George and Liu): restart from the lowest degree particle of the last
+		// level for as long as that makes the search deeper
+		breadthFirst(start);
+		int root = *std::min_element(queue.begin(), queue.end(), byDegree);
+		int depth = breadthFirst(root);
+		while (true) {
+			int candidate = *std::min_element(lastLevel.begin(), lastLevel.end(), byDegree);
+			int candidateDepth = breadthFirst(candidate);
+			if (candidateDepth <= depth) {
+				break;
+			}
+			root = candidate;
+			depth = candidateDepth;
+		}
+
+		// Cuthill-McKee: place the neighbours of each placed particle by increasing degree
+		int first = (int)order.size();
+		order.push_back(root);
+		placed[root] = 1;
+		for (int head = first; head < (int)order.size(); head++) {
+			int i = order[head];
+			int levelStart = (int)order.size();
+			for (int k = starts[i]; k < starts[i] + degrees[i]; k++) {
+				int j = neighbors[k];
+				if (!placed[j]) {
+					placed[j] = 1;
+					order.push_back(j);
+				}
+			}
+			std::sort(order.begin() + levelStart, order.end(), byDegree);
+		}
+	}
+	std::reverse(order.begin(), order.end());
+}
+
+int StretchedParticleReordering::computeBandwidth(const StretchedParticleSystem &system) {
+	const StretchedSpringTable &springs = system.springs;
+	int bandwidth = 0;
+	for (int s = 0; s < springs.size(); s++) {
+		bandwidth = std::max(bandwidth, abs(springs.indicesA[s] - springs.indicesB[s]));
+	}
+	return bandwidth;
+}
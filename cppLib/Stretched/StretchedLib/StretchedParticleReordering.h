@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedVectorArray.h"
+
+class StretchedParticleSystem;
+
+// Renumbers the particles of a fabric for cache locality. Triangulated fabrics come with their particles in
+// the order the triangulator emitted the points, so the two ends of a spring can be far apart in memory and
+// the force loops jump around the particle arrays. apply orders the particles by reverse Cuthill-McKee on
+// the spring graph (a breadth first sweep from a peripheral particle, so neighbours get nearby indices and
+// the Hessians of the implicit solvers get a narrow band), then renames the particles of the springs, pins,
+// triangles and constraints and sorts those tables by their first particle.
+// The mapping to the original numbering is kept, so results can be reported in the order of the
+// triangulation. Springs and pins give the same results up to the order the forces are summed in; bend and
+// area constraints are colored again from their new order, and projecting them in another order changes
+// the results by more than rounding. Meant to run once after building a system and before simulating it; not for systems
+// whose particle indices are tracked elsewhere (like one attached to a StretchedDesignFabric).
+class StretchedParticleReordering {
+
+public:
+	StretchedParticleReordering();
+	~StretchedParticleReordering();
+
+	// Renumbers the particles of system (composed with any earlier apply)
+	void apply(StretchedParticleSystem &system);
+	// Forgets the mapping (every particle keeps its index)
+	void clear();
+
+	// Index of original particle i, and the original index of particle i. Particles past the mapping
+	// (added after apply) keep their index.
+	int getNewIndex(int original) const;
+	int getOriginalIndex(int particle) const;
+
+	// Copies per particle values to the original order
+	void toOriginalOrder(const StretchedVectorArray &values, StretchedVectorArray &originalValues) const;
+
+	// Largest index difference between the ends of a spring before and after the last apply
+	int getBandwidthBefore() const;
+	int getBandwidthAfter() const;
+
+private:
+	// Per particle: original index, and per original particle: current index
+	std::vector<int> originalIndices;
+	std::vector<int> newIndices;
+	int bandwidthBefore = 0;
+	int bandwidthAfter = 0;
+
+	static void computeReverseCuthillMcKee(const StretchedParticleSystem &system, std::vector<int> &order);
+	static int computeBandwidth(const StretchedParticleSystem &system);
+};
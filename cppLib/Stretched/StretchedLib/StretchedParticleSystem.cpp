@@ -0,0 +1,490 @@
+#include "StretchedParticleSystem.h"
+
+#include <algorithm>
+
+#include "GUILib/GLUtils.h"
+#include "Utils/Logger.h"
+
+#include "StretchedColor.h"
+#include "StretchedStepPolicies.h"
+#include "StretchedTriangle.h"
+
+
+static const GLfloat STRETCHED_PARTICLE_SYSTEM_LINE_WIDTH = 2;
+
+// One side of a triangle, used to find shared edges when building springs
+struct StretchedTriangleEdge {
+	int lo;
+	int hi;
+	int opposite;
+	bool isLongest;
+
+	bool operator<(const StretchedTriangleEdge &other) const {
+		if (lo != other.lo) {
+			return lo < other.lo;
+		}
+		return hi < other.hi;
+	}
+};
+
+// State of the system for the shared step loops
+static StretchedParticleArrays<double> getParticleArrays(StretchedParticleSystem &system) {
+	StretchedParticleArrays<double> arrays = { system.positions.x.data(), system.positions.y.data(), system.positions.z.data(),
+		system.previousPositions.x.data(), system.previousPositions.y.data(), system.previousPositions.z.data(),
+		system.velocities.x.data(), system.velocities.y.data(), system.velocities.z.data(),
+		system.forces.x.data(), system.forces.y.data(), system.forces.z.data(), system.masses.data(), system.inverseMasses.data() };
+	return arrays;
+}
+
+static StretchedListedParticles getAwakeParticles(const StretchedSleepTracker &sleepTracker) {
+	const std::vector<int> &active = sleepTracker.getActiveParticles();
+	return StretchedListedParticles(active.data(), (int)active.size());
+}
+
+static StretchedColor colorForSpringType(StretchedSpringType type) {
+	switch (type) {
+		case FABRIC_SPRING_BEND:
+			return StretchedColor::RED;
+		case FABRIC_SPRING_SHEAR:
+			return StretchedColor::GREEN;
+		case HYDROGEL_TO_FABRIC_SPRING:
+			return StretchedColor::BLUE;
+		case HYDROGEL_TO_HYDROGEL_SPRING:
+			return StretchedColor::YELLOW;
+		case FABRIC_SPRING_STRUCTURAL:
+			return StretchedColor::MAGENTA;
+		default:
+			return StretchedColor();
+	}
+}
+
+StretchedParticleSystem::StretchedParticleSystem() {
+	// Nothing to see here
+}
+
+StretchedParticleSystem::StretchedParticleSystem(DelaunayTriangulation triangulation) {
+	makeParticles(triangulation.getTriangulationPts(), triangulation.getTriangulationIndices());
+	createFabricSprings();
+}
+
+StretchedParticleSystem::~StretchedParticleSystem() {
+	// Nothing to see here
+}
+
+void StretchedParticleSystem::makeParticles(std::vector<P3D> pts, std::vector<int> indices, double mass) {
+	int firstIndex = getParticleCount();
+	int ptsSize = (int)pts.size();
+	positions.reserve(firstIndex + ptsSize);
+	for (int i = 0; i < ptsSize; i++) {
+		addParticle(pts[i], mass);
+	}
+	triangleIndices.reserve(triangleIndices.size() + indices.size());
+	for (int i = 0; i < (int)indices.size() - 2; i += 3) {
+		int a = indices[i];
+		int b = indices[i + 1];
+		int c = indices[i + 2];
+		if (a >= ptsSize || b >= ptsSize || c >= ptsSize) {
+			Logger::consolePrint("Skipping triangle with an out of range point index...");
+			continue;
+		}
+		triangleIndices.push_back(firstIndex + a);
+		triangleIndices.push_back(firstIndex + b);
+		triangleIndices.push_back(firstIndex + c);
+	}
+}
+
+int StretchedParticleSystem::addParticle(P3D pt, double mass) {
+	positions.push_back(pt);
+	previousPositions.push_back(pt);
+	velocities.push_back(P3D());
+	forces.push_back(P3D());
+	masses.push_back(mass);
+	inverseMasses.push_back(mass > 0 ? 1.0 / mass : 0.0);
+	return getParticleCount() - 1;
+}
+
+void StretchedParticleSystem::topologyChanged() {
+	springForceKernel.invalidate();
+	collisionSolver.invalidate();
+	sleepTracker.invalidate();
+	implicitIntegrator.invalidate();
+	projectiveDynamicsSolver.invalidate();
+}
+
+void StretchedParticleSystem::pinParticle(int index) {
+	inverseMasses[index] = 0;
+	velocities.set(index, P3D());
+	// The projective dynamics matrix has an identity row for each fixed particle
+	projectiveDynamicsSolver.invalidate();
+}
+
+void StretchedParticleSystem::createFabricSprings(double structuralStiffness, double shearStiffness, double bendStiffness) {
+	// Collect all triangle sides, then sort them so that shared sides end up next to each other
+	int triangleCount = (int)triangleIndices.size() / 3;
+	std::vector<StretchedTriangleEdge> edges;
+	edges.reserve(triangleCount * 3);
+	for (int t = 0; t < triangleCount; t++) {
+		int v[3] = { triangleIndices[3 * t], triangleIndices[3 * t + 1], triangleIndices[3 * t + 2] };
+		double lengths[3];
+		for (int e = 0; e < 3; e++) {
+			lengths[e] = (positions.getPoint(v[(e + 1) % 3]) - positions.getPoint(v[e])).length();
+		}
+		for (int e = 0; e < 3; e++) {
+			int a = v[e];
+			int b = v[(e + 1) % 3];
+			if (a == b) {
+				continue;
+			}
+			StretchedTriangleEdge edge;
+			edge.lo = std::min(a, b);
+			edge.hi = std::max(a, b);
+			edge.opposite = v[(e + 2) % 3];
+			edge.isLongest = lengths[e] > (1 + SHEAR_EDGE_LENGTH_TOLERANCE) * lengths[(e + 1) % 3]
+				&& lengths[e] > (1 + SHEAR_EDGE_LENGTH_TOLERANCE) * lengths[(e + 2) % 3];
+			edges.push_back(edge);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	// The springs are collected per type first so the table appends them in type order
+	springs.reserve(springs.size() + (int)edges.size());
+	std::vector<int> shearPairs;
+	std::vector<int> bendPairs;
+	int edgesSize = (int)edges.size();
+	int i = 0;
+	while (i < edgesSize) {
+		// Find all the triangles sharing this edge
+		int j = i + 1;
+		bool isShear = edges[i].isLongest;
+		while (j < edgesSize && edges[j].lo == edges[i].lo && edges[j].hi == edges[i].hi) {
+			isShear = isShear && edges[j].isLongest;
+			j++;
+		}
+		if (isShear) {
+			shearPairs.push_back(edges[i].lo);
+			shearPairs.push_back(edges[i].hi);
+		} else {
+			addSpring(edges[i].lo, edges[i].hi, structuralStiffness, FABRIC_SPRING_STRUCTURAL);
+		}
+		// Interior edge: connect the two opposite vertices to resist bending
+		if (j - i == 2 && edges[i].opposite != edges[i + 1].opposite) {
+			bendPairs.push_back(edges[i].opposite);
+			bendPairs.push_back(edges[i + 1].opposite);
+		}
+		i = j;
+	}
+	for (int k = 0; k < (int)bendPairs.size(); k += 2) {
+		addSpring(bendPairs[k], bendPairs[k + 1], bendStiffness, FABRIC_SPRING_BEND);
+	}
+	for (int k = 0; k < (int)shearPairs.size(); k += 2) {
+		addSpring(shearPairs[k], shearPairs[k + 1], shearStiffness, FABRIC_SPRING_SHEAR);
+	}
+}
+
+void StretchedParticleSystem::addSpring(int a, int b, double stiffness, StretchedSpringType type, double restLengthRatio) {
+	double restLength = (positions.getPoint(a) - positions.getPoint(b)).length();
+	springs.add(a, b, restLengthRatio * restLength, stiffness, type, restLengthRatio);
+}
+
+void StretchedParticleSystem::addSpringWithRestLength(int a, int b, double restLength, double stiffness, StretchedSpringType type) {
+	springs.add(a, b, restLength, stiffness, type);
+}
+
+void StretchedParticleSystem::addZeroLengthSpring(int index, double stiffness) {
+	zeroLengthSprings.add(index, positions.getPoint(index), stiffness);
+}
+
+void StretchedParticleSystem::addBendConstraint(int a, int b, int c, double k) {
+	V3D u = positions.getPoint(a) - positions.getPoint(b);
+	V3D v = positions.getPoint(c) - positions.getPoint(b);
+	double lengths = u.length() * v.length();
+	if (lengths < EPSILON_CHECK) {
+		Logger::consolePrint("Error: Bend constraint needs three distinct points!");
+		return;
+	}
+	StretchedBendConstraint constraint;
+	constraint.a = a;
+	constraint.b = b;
+	constraint.c = c;
+	constraint.theta = acos(MIN(1.0, MAX(-1.0, u.dot(v) / lengths)));
+	constraint.k = k;
+	constraintSolver.addBendConstraint(constraint);
+}
+
+void StretchedParticleSystem::addTriangleAreaConstraint(int a, int b, int c, double k) {
+	StretchedTriangleAreaConstraint constraint;
+	constraint.a = a;
+	constraint.b = b;
+	constraint.c = c;
+	constraint.k = k;
+	constraint.area = StretchedTriangle::calculateArea(positions.getPoint(a), positions.getPoint(b), positions.getPoint(c));
+	constraintSolver.addTriangleAreaConstraint(constraint);
+}
+
+void StretchedParticleSystem::createTriangleAreaConstraints(double k) {
+	int triangleCount = (int)triangleIndices.size() / 3;
+	for (int t = 0; t < triangleCount; t++) {
+		addTriangleAreaConstraint(triangleIndices[3 * t], triangleIndices[3 * t + 1], triangleIndices[3 * t + 2], k);
+	}
+}
+
+void StretchedParticleSystem::computeForces() {
+	accumulateExternalForces();
+	accumulateSpringForces();
+	accumulateZeroLengthSpringForces();
+}
+
+bool StretchedParticleSystem::isSleepingActive() const {
+	return useSleeping && !sleepTracker.isAllAwake() && integrationType != IMPLICIT_EULER && integrationType != PROJECTIVE_DYNAMICS;
+}
+
+void StretchedParticleSystem::accumulateExternalForces() {
+	// The forces of sleeping particles are left stale, nothing reads them
+	StretchedParticleArrays<double> particles = getParticleArrays(*this);
+	auto accumulate = [&](auto visited) {
+		typedef StretchedStepLoops<double> Loops;
+		Loops::clearForces(particles, visited);
+		if (useGravity) {
+			Loops::accumulateGravity(particles, visited, upAxis);
+		}
+		if (useDragForce) {
+			Loops::accumulateDrag(particles, visited, -coefficientOfDrag * particleArea);
+		}
+	};
+	if (isSleepingActive()) {
+		accumulate(getAwakeParticles(sleepTracker));
+	} else {
+		accumulate(StretchedAllParticles(getParticleCount()));
+	}
+}
+
+void StretchedParticleSystem::accumulateSpringForces() {
+	if (isSleepingActive()) {
+		sleepTracker.accumulateActiveSpringForces(positions, forces, springForceKernel.threadPool);
+		profiler.count(PROFILE_SPRINGS_EVALUATED, sleepTracker.getActiveSpringCount());
+	} else {
+		springForceKernel.accumulateForces(springs, positions, forces);
+		profiler.count(PROFILE_SPRINGS_EVALUATED, springs.size());
+	}
+}
+
+void StretchedParticleSystem::accumulateZeroLengthSpringForces() {
+	StretchedPinArrays<double> pins = { zeroLengthSprings.indices.data(), zeroLengthSprings.restPositions.x.data(), zeroLengthSprings.restPositions.y.data(),
+		zeroLengthSprings.restPositions.z.data(), zeroLengthSprings.stiffnesses.data(), zeroLengthSprings.size() };
+	StretchedStepLoops<double>::accumulatePinForces(getParticleArrays(*this), pins);
+}
+
+void StretchedParticleSystem::step(double timeStep) {
+	profiler.beginStep();
+	stepPhases(timeStep);
+	profiler.endStep();
+}
+
+void StretchedParticleSystem::stepPhases(double timeStep) {
+	StretchedProfileScope stepScope(profiler, PROFILE_STEP);
+	if (useSleeping) {
+		StretchedProfileScope scope(profiler, PROFILE_SLEEPING);
+		sleepTracker.beginStep(*this);
+	}
+	switch (integrationType) {
+		case IMPLICIT_EULER: {
+			StretchedProfileScope scope(profiler, PROFILE_IMPLICIT_SOLVE);
+			implicitIntegrator.step(*this, timeStep);
+			// Each Newton iteration evaluates the gradient and Hessian of every spring
+			profiler.count(PROFILE_SPRINGS_EVALUATED, (int64_t)springs.size() * implicitIntegrator.getLastNewtonIterations());
+			profiler.count(PROFILE_SOLVER_ITERATIONS, implicitIntegrator.getLastNewtonIterations());
+			profiler.count(PROFILE_LINEAR_SOLVER_ITERATIONS, implicitIntegrator.getLastLinearSolverIterations());
+			break;
+		}
+		case PROJECTIVE_DYNAMICS: {
+			StretchedProfileScope scope(profiler, PROFILE_PROJECTIVE_DYNAMICS);
+			projectiveDynamicsSolver.step(*this, timeStep);
+			// Every local step projects every spring
+			profiler.count(PROFILE_SPRINGS_EVALUATED, (int64_t)springs.size() * projectiveDynamicsSolver.iterations);
+			profiler.count(PROFILE_SOLVER_ITERATIONS, projectiveDynamicsSolver.iterations);
+			break;
+		}
+		case SYMPLECTIC_EULER: {
+			{
+				StretchedProfileScope scope(profiler, PROFILE_FORCES);
+				computeForces();
+			}
+			StretchedProfileScope scope(profiler, PROFILE_INTEGRATION);
+			integrateSymplecticEuler(timeStep);
+			break;
+		}
+		case VERLET:
+		default: {
+			{
+				StretchedProfileScope scope(profiler, PROFILE_FORCES);
+				computeForces();
+			}
+			StretchedProfileScope scope(profiler, PROFILE_INTEGRATION);
+			integrateVerlet(timeStep);
+			break;
+		}
+	}
+	if (integrationType != PROJECTIVE_DYNAMICS) {
+		StretchedProfileScope scope(profiler, PROFILE_CONSTRAINTS);
+		constraintSolver.solve(*this, timeStep);
+	}
+	if (avoidSelfIntersections) {
+		StretchedProfileScope scope(profiler, PROFILE_SELF_INTERSECTIONS);
+		resolveSelfIntersections();
+		profiler.count(PROFILE_COLLISION_PAIRS, intersectionPairsA.size());
+	}
+	if (useFloorConstraint) {
+		StretchedProfileScope scope(profiler, PROFILE_FLOOR);
+		resolveFloorConstraint();
+	}
+	if (useContinuousCollisions) {
+		StretchedProfileScope scope(profiler, PROFILE_CONTINUOUS_COLLISIONS);
+		collisionSolver.resolve(*this, timeStep);
+		profiler.count(PROFILE_COLLISION_PAIRS, collisionSolver.getLastCandidatePairCount());
+	}
+	if (useSleeping) {
+		StretchedProfileScope scope(profiler, PROFILE_SLEEPING);
+		sleepTracker.endStep(*this);
+	}
+}
+
+int StretchedParticleSystem::solveEquilibrium() {
+	int iterations = equilibriumSolver.solve(*this);
+	if (!equilibriumSolver.hasConverged()) {
+		Logger::consolePrint("Equilibrium solve stopped after %d iterations without converging (energy %lf)", iterations, equilibriumSolver.getLastEnergy());
+	}
+	return iterations;
+}
+
+void StretchedParticleSystem::integrateSymplecticEuler(double timeStep) {
+	double damping = useVelocityDamping ? velocityDampingConstant : 0;
+	if (isSleepingActive()) {
+		StretchedSymplecticEulerPolicy::integrate(getParticleArrays(*this), getAwakeParticles(sleepTracker), timeStep, damping);
+	} else {
+		StretchedSymplecticEulerPolicy::integrate(getParticleArrays(*this), StretchedAllParticles(getParticleCount()), timeStep, damping);
+	}
+}
+
+void StretchedParticleSystem::integrateVerlet(double timeStep) {
+	double damping = useVelocityDamping ? velocityDampingConstant : 0;
+	if (isSleepingActive()) {
+		StretchedVerletPolicy::integrate(getParticleArrays(*this), getAwakeParticles(sleepTracker), timeStep, damping);
+	} else {
+		StretchedVerletPolicy::integrate(getParticleArrays(*this), StretchedAllParticles(getParticleCount()), timeStep, damping);
+	}
+}
+
+void StretchedParticleSystem::resolveSelfIntersections() {
+	double minDistance = selfIntersectionMinDistance;
+	if (minDistance <= 0) {
+		return;
+	}
+	// Only the fabric (the triangle corners) pushes itself apart, as gridParticles in the JS particle system:
+	// the hydrogel sits a layer height above its fabric, well within the min distance
+	int n = getParticleCount();
+	std::vector<char> &isFabric = selfIntersectionMarks;
+	isFabric.assign(n, 0);
+	for (int i = 0; i < (int)triangleIndices.size(); i++) {
+		isFabric[triangleIndices[i]] = 1;
+	}
+	selfIntersectionParticles.clear();
+	for (int i = 0; i < n; i++) {
+		if (isFabric[i]) {
+			selfIntersectionParticles.push_back(i);
+		}
+	}
+	int fabricCount = (int)selfIntersectionParticles.size();
+	selfIntersectionPositions.resize(fabricCount);
+	for (int k = 0; k < fabricCount; k++) {
+		int i = selfIntersectionParticles[k];
+		selfIntersectionPositions.x[k] = positions.x[i];
+		selfIntersectionPositions.y[k] = positions.y[i];
+		selfIntersectionPositions.z[k] = positions.z[i];
+	}
+
+	// Cells twice the min distance: each particle checks the 8 cells around its corner of the cell
+	spatialHash.build(selfIntersectionPositions, 2 * minDistance);
+	intersectionPairsA.clear();
+	intersectionPairsB.clear();
+	spatialHash.findPairs(selfIntersectionPositions, minDistance, intersectionPairsA, intersectionPairsB);
+	// Back to particle indices (the fabric list is ascending, so the pairs stay sorted)
+	for (int k = 0; k < (int)intersectionPairsA.size(); k++) {
+		intersectionPairsA[k] = selfIntersectionParticles[intersectionPairsA[k]];
+		intersectionPairsB[k] = selfIntersectionParticles[intersectionPairsB[k]];
+	}
+
+	// Push each pair apart to the min distance (split by inverse mass, as in the JS particle system)
+	double *px = positions.x.data(), *py = positions.y.data(), *pz = positions.z.data();
+	int pairCount = (int)intersectionPairsA.size();
+	for (int k = 0; k < pairCount; k++) {
+		int a = intersectionPairsA[k];
+		int b = intersectionPairsB[k];
+		double wSum = inverseMasses[a] + inverseMasses[b];
+		if (wSum == 0) {
+			continue;
+		}
+		double dx = px[b] - px[a], dy = py[b] - py[a], dz = pz[b] - pz[a];
+		double distance = sqrt(dx * dx + dy * dy + dz * dz);
+		if (distance < EPSILON_CHECK || distance >= minDistance) {
+			continue;
+		}
+		double correction = (distance - minDistance) / (distance * wSum);
+		double ca = correction * inverseMasses[a], cb = correction * inverseMasses[b];
+		px[a] += ca * dx; py[a] += ca * dy; pz[a] += ca * dz;
+		px[b] -= cb * dx; py[b] -= cb * dy; pz[b] -= cb * dz;
+	}
+}
+
+void StretchedParticleSystem::resolveFloorConstraint() {
+	StretchedStepLoops<double>::resolveFloorConstraint(getParticleArrays(*this), StretchedAllParticles(getParticleCount()), upAxis, floorHeight);
+}
+
+int StretchedParticleSystem::getParticleCount() const {
+	return positions.size();
+}
+
+int StretchedParticleSystem::getSpringCount() const {
+	return springs.size() + zeroLengthSprings.size();
+}
+
+P3D StretchedParticleSystem::getParticlePosition(int i) const {
+	return positions.getPoint(i);
+}
+
+std::vector<P3D> StretchedParticleSystem::getParticlePositions() const {
+	int n = getParticleCount();
+	std::vector<P3D> pts = std::vector<P3D>();
+	pts.reserve(n);
+	for (int i = 0; i < n; i++) {
+		pts.push_back(positions.getPoint(i));
+	}
+	return pts;
+}
+
+void StretchedParticleSystem::setParticlePositions(const std::vector<P3D> &pts) {
+	int n = std::min(getParticleCount(), (int)pts.size());
+	for (int i = 0; i < n; i++) {
+		positions.set(i, pts[i]);
+		previousPositions.set(i, pts[i]);
+	}
+}
+
+void StretchedParticleSystem::draw() {
+	glLineWidth(STRETCHED_PARTICLE_SYSTEM_LINE_WIDTH);
+	glBegin(GL_LINES);
+	// One color per type table
+	for (int t = 0; t < SPRING_TABLE_TYPE_COUNT; t++) {
+		StretchedSpringType type = (StretchedSpringType)(FABRIC_SPRING_STRUCTURAL + t);
+		StretchedColor color = colorForSpringType(type);
+		glColor4d(color.red, color.green, color.blue, color.alpha);
+		int end = springs.getTypeEnd(type);
+		for (int s = springs.getTypeStart(type); s < end; s++) {
+			int a = springs.indicesA[s];
+			int b = springs.indicesB[s];
+			glVertex3d(positions.x[a], positions.y[a], positions.z[a]);
+			glVertex3d(positions.x[b], positions.y[b], positions.z[b]);
+		}
+	}
+	glEnd();
+	glLineWidth(DEFAULT_GL_LINE_WIDTH);
+}
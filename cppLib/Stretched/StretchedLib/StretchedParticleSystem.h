@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+
+#include "MathLib/P3D.h"
+#include "MathLib/V3D.h"
+
+#include "DelaunayTriangulation.h"
+#include "StretchedConstants.h"
+#include "StretchedConstraintSolver.h"
+#include "StretchedContinuousCollisionSolver.h"
+#include "StretchedEquilibriumSolver.h"
+#include "StretchedImplicitIntegrator.h"
+#include "StretchedProfiler.h"
+#include "StretchedProjectiveDynamicsSolver.h"
+#include "StretchedSleepTracker.h"
+#include "StretchedSpatialHash.h"
+#include "StretchedSpringForceKernel.h"
+#include "StretchedSprings.h"
+#include "StretchedVectorArray.h"
+
+enum StretchedIntegrationType {
+	SYMPLECTIC_EULER,
+	VERLET,
+	IMPLICIT_EULER,
+	PROJECTIVE_DYNAMICS
+};
+
+// Native mass-spring particle system for the fabric (and hydrogel) simulation.
+// All per-particle state is kept in contiguous structure-of-arrays storage so that the
+// force and integration loops stream through memory instead of chasing objects.
+class StretchedParticleSystem {
+
+public:
+	StretchedParticleSystem();
+	// Builds the fabric particles + structural/shear/bend springs from the triangulation
+	StretchedParticleSystem(DelaunayTriangulation triangulation);
+	~StretchedParticleSystem();
+
+	// Particle state (one entry per particle)
+	StretchedVectorArray positions;
+	StretchedVectorArray previousPositions;
+	StretchedVectorArray velocities;
+	StretchedVectorArray forces;
+	std::vector<double> masses;
+	std::vector<double> inverseMasses;
+
+	// Constraints
+	StretchedSpringTable springs;
+	StretchedZeroLengthSpringTable zeroLengthSprings;
+
+	// Triangle indices for the fabric surface (3 per triangle)
+	std::vector<int> triangleIndices;
+
+	// Simulation options
+	StretchedIntegrationType integrationType = VERLET;
+	bool useGravity = false;
+	bool useVelocityDamping = true;
+	bool useDragForce = false;
+	bool useFloorConstraint = true;
+	bool avoidSelfIntersections = false;
+	bool useContinuousCollisions = false;
+	// Settled tiles of the fabric skip forces and integration (explicit integrators only, see StretchedSleepTracker)
+	bool useSleeping = false;
+	double velocityDampingConstant = VELOCITY_DAMPING_CONSTANT;
+	double coefficientOfDrag = COEFFICIENT_OF_DRAG;
+	double particleArea = 1.0 / (1000 * 1000);
+	double floorHeight = 0;
+	// Fabric particles closer than this are pushed apart when avoidSelfIntersections is set
+	double selfIntersectionMinDistance = FABRIC_SELF_INTERSECTIONS_MIN_DIST;
+	// Index of the axis considered up (the design plane is XZ so Y is up)
+	int upAxis = 1;
+
+	// Evaluates the spring forces for the explicit integrators (SIMD, multithreaded, scatter free)
+	StretchedSpringForceKernel springForceKernel;
+	// Used when integrationType is IMPLICIT_EULER
+	StretchedImplicitIntegrator implicitIntegrator;
+	// Used when integrationType is PROJECTIVE_DYNAMICS (the bend/area constraints are solved as part of it)
+	StretchedProjectiveDynamicsSolver projectiveDynamicsSolver;
+	// Projects the bend/triangle area constraints after each explicit or implicit integration step
+	StretchedConstraintSolver constraintSolver;
+	// Broadphase for the self intersection pairs, rebuilt every step
+	StretchedSpatialHash spatialHash;
+	// Triangle-triangle continuous collisions (BVH refit every step), run last in each step
+	StretchedContinuousCollisionSolver collisionSolver;
+	// Minimizes the spring energy directly for the rest shape (see solveEquilibrium)
+	StretchedEquilibriumSolver equilibriumSolver;
+	// Tracks which tiles of the fabric are asleep when useSleeping is set
+	StretchedSleepTracker sleepTracker;
+	// Per phase timings and solver counters of step (off until profiler.enabled is set)
+	StretchedProfiler profiler;
+
+	// Adds the points of the triangulation as fabric particles along with the triangles
+	void makeParticles(std::vector<P3D> pts, std::vector<int> indices, double mass = FABRIC_PARTICLE_MASS);
+	// Adds a single particle and returns its index
+	int addParticle(P3D pt, double mass);
+	// Fixes a particle in place (infinite mass)
+	void pinParticle(int index);
+	// Drops the caches built from the particles and springs after they were edited directly (the counts
+	// may be unchanged)
+	void topologyChanged();
+
+	// Creates structural (triangle edges), shear (edges which are the longest side of all adjacent triangles)
+	// and bend (across each interior edge) springs with rest lengths taken from the current positions
+	void createFabricSprings(
+		double structuralStiffness = FABRIC_STRUCTURAL_SPRING_STIFFNESS,
+		double shearStiffness = FABRIC_SHEAR_SPRING_STIFFNESS,
+		double bendStiffness = FABRIC_BEND_SPRING_STIFFNESS);
+
+	// Adds a spring using the current distance between the particles (scaled by restLengthRatio) as the rest length
+	void addSpring(int a, int b, double stiffness, StretchedSpringType type, double restLengthRatio = 1.0);
+	void addSpringWithRestLength(int a, int b, double restLength, double stiffness, StretchedSpringType type);
+	// Pins a particle to its current position with a zero length spring
+	void addZeroLengthSpring(int index, double stiffness = PIN_STIFFNESS);
+
+	// Position based constraints - the rest angle/area is taken from the current positions
+	void addBendConstraint(int a, int b, int c, double k);
+	void addTriangleAreaConstraint(int a, int b, int c, double k);
+	// Adds a triangle area constraint for every triangle of the fabric
+	void createTriangleAreaConstraints(double k);
+
+	// Clears and accumulates gravity, drag and spring forces
+	void computeForces();
+	// Clears the forces and accumulates only gravity and drag
+	void accumulateExternalForces();
+	// Advances the simulation by one timestep
+	void step(double timeStep = DELTA_T);
+	// Moves the particles straight to the rest shape (a minimum of the spring energy) with
+	// equilibriumSolver instead of time stepping until the motion dies out. Returns the number of solver iterations.
+	int solveEquilibrium();
+
+	int getParticleCount() const;
+	int getSpringCount() const;
+	P3D getParticlePosition(int i) const;
+	std::vector<P3D> getParticlePositions() const;
+	void setParticlePositions(const std::vector<P3D> &pts);
+
+	void draw();
+
+private:
+	// The body of step, timed as a whole by the profiler
+	void stepPhases(double timeStep);
+	void accumulateSpringForces();
+	void accumulateZeroLengthSpringForces();
+
+	// True while some tiles sleep and the explicit force and integration loops only visit the awake particles
+	bool isSleepingActive() const;
+	void integrateSymplecticEuler(double timeStep);
+	void integrateVerlet(double timeStep);
+
+	void resolveFloorConstraint();
+	void resolveSelfIntersections();
+
+	// Self intersection pairs found in the last step
+	std::vector<int> intersectionPairsA;
+	std::vector<int> intersectionPairsB;
+	// Fabric particles checked for self intersections, their positions and a mark per particle (scratch)
+	std::vector<int> selfIntersectionParticles;
+	StretchedVectorArray selfIntersectionPositions;
+	std::vector<char> selfIntersectionMarks;
+};
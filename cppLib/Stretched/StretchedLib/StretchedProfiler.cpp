@@ -0,0 +1,252 @@
+#include "StretchedProfiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "Utils/Logger.h"
+
+
+static const char *PHASE_NAMES[PROFILE_PHASE_COUNT] = {
+	"step",
+	"forces",
+	"integration",
+	"implicit_solve",
+	"projective_dynamics",
+	"constraints",
+	"self_intersections",
+	"floor",
+	"continuous_collisions",
+	"sleeping",
+};
+
+static const char *COUNTER_NAMES[PROFILE_COUNTER_COUNT] = {
+	"springs_evaluated",
+	"solver_iterations",
+	"linear_solver_iterations",
+	"collision_pairs",
+};
+
+static int histogramBucket(int64_t value) {
+	int bucket = 0;
+	while (value > 0 && bucket < PROFILE_HISTOGRAM_BUCKETS - 1) {
+		value >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+StretchedProfiler::StretchedProfiler() {
+	reset();
+}
+
+StretchedProfiler::~StretchedProfiler() {
+	// Nothing to see here
+}
+
+void StretchedProfiler::reset() {
+	stepCount = 0;
+	clearStep();
+	for (int p = 0; p < PROFILE_PHASE_COUNT; p++) {
+		lastNanoseconds[p] = 0;
+		totalNanoseconds[p] = 0;
+		minNanoseconds[p] = 0;
+		maxNanoseconds[p] = 0;
+		phaseHistograms[p].assign(PROFILE_HISTOGRAM_BUCKETS, 0);
+	}
+	for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+		lastCounts[c] = 0;
+		totalCounts[c] = 0;
+		maxCounts[c] = 0;
+		counterHistograms[c].assign(PROFILE_HISTOGRAM_BUCKETS, 0);
+	}
+	history.clear();
+	historyStart = 0;
+	historySize = 0;
+}
+
+void StretchedProfiler::clearStep() {
+	std::fill(stepNanoseconds, stepNanoseconds + PROFILE_PHASE_COUNT, 0);
+	std::fill(stepCounts, stepCounts + PROFILE_COUNTER_COUNT, 0);
+}
+
+void StretchedProfiler::finishStep() {
+	for (int p = 0; p < PROFILE_PHASE_COUNT; p++) {
+		int64_t t = stepNanoseconds[p];
+		lastNanoseconds[p] = t;
+		totalNanoseconds[p] += t;
+		minNanoseconds[p] = stepCount == 0 ? t : std::min(minNanoseconds[p], t);
+		maxNanoseconds[p] = std::max(maxNanoseconds[p], t);
+		phaseHistograms[p][histogramBucket(t)]++;
+	}
+	for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+		int64_t count = stepCounts[c];
+		lastCounts[c] = count;
+		totalCounts[c] += count;
+		maxCounts[c] = std::max(maxCounts[c], count);
+		counterHistograms[c][histogramBucket(count)]++;
+	}
+	stepCount++;
+
+	if (historyLength <= 0) {
+		return;
+	}
+	const int stride = PROFILE_PHASE_COUNT + PROFILE_COUNTER_COUNT;
+	if ((int)history.size() != historyLength * stride) {
+		// Length changed: start over
+		history.assign((size_t)historyLength * stride, 0);
+		historyStart = 0;
+		historySize = 0;
+	}
+	int slot = (historyStart + historySize) % historyLength;
+	if (historySize == historyLength) {
+		historyStart = (historyStart + 1) % historyLength;
+	} else {
+		historySize++;
+	}
+	int64_t *row = &history[(size_t)slot * stride];
+	std::copy(stepNanoseconds, stepNanoseconds + PROFILE_PHASE_COUNT, row);
+	std::copy(stepCounts, stepCounts + PROFILE_COUNTER_COUNT, row + PROFILE_PHASE_COUNT);
+}
+
+int StretchedProfiler::getStepCount() const {
+	return stepCount;
+}
+
+double StretchedProfiler::getTotalSeconds(StretchedProfilePhase phase) const {
+	return totalNanoseconds[phase] * 1e-9;
+}
+
+double StretchedProfiler::getMeanSeconds(StretchedProfilePhase phase) const {
+	return stepCount > 0 ? totalNanoseconds[phase] * 1e-9 / stepCount : 0;
+}
+
+double StretchedProfiler::getMinSeconds(StretchedProfilePhase phase) const {
+	return minNanoseconds[phase] * 1e-9;
+}
+
+double StretchedProfiler::getMaxSeconds(StretchedProfilePhase phase) const {
+	return maxNanoseconds[phase] * 1e-9;
+}
+
+double StretchedProfiler::getPercentileSeconds(StretchedProfilePhase phase, double fraction) const {
+	if (historySize == 0) {
+		return 0;
+	}
+	const int stride = PROFILE_PHASE_COUNT + PROFILE_COUNTER_COUNT;
+	std::vector<int64_t> times(historySize);
+	for (int k = 0; k < historySize; k++) {
+		times[k] = history[(size_t)((historyStart + k) % historyLength) * stride + phase];
+	}
+	// The smallest time at least that fraction of the steps do not exceed
+	int rank = (int)ceil(std::max(0.0, std::min(1.0, fraction)) * historySize) - 1;
+	rank = std::max(0, std::min(historySize - 1, rank));
+	std::nth_element(times.begin(), times.begin() + rank, times.end());
+	return times[rank] * 1e-9;
+}
+
+double StretchedProfiler::getLastSeconds(StretchedProfilePhase phase) const {
+	return lastNanoseconds[phase] * 1e-9;
+}
+
+const std::vector<int64_t> &StretchedProfiler::getHistogram(StretchedProfilePhase phase) const {
+	return phaseHistograms[phase];
+}
+
+int64_t StretchedProfiler::getTotalCount(StretchedProfileCounter counter) const {
+	return totalCounts[counter];
+}
+
+int64_t StretchedProfiler::getLastCount(StretchedProfileCounter counter) const {
+	return lastCounts[counter];
+}
+
+int64_t StretchedProfiler::getMaxCount(StretchedProfileCounter counter) const {
+	return maxCounts[counter];
+}
+
+const std::vector<int64_t> &StretchedProfiler::getHistogram(StretchedProfileCounter counter) const {
+	return counterHistograms[counter];
+}
+
+const char *StretchedProfiler::getPhaseName(StretchedProfilePhase phase) {
+	return PHASE_NAMES[phase];
+}
+
+const char *StretchedProfiler::getCounterName(StretchedProfileCounter counter) {
+	return COUNTER_NAMES[counter];
+}
+
+bool StretchedProfiler::writeCsv(const char *fileName) const {
+	FILE *file = fopen(fileName, "w");
+	if (file == NULL) {
+		Logger::consolePrint("Could not open '%s' for writing", fileName);
+		return false;
+	}
+	fprintf(file, "step");
+	for (int p = 0; p < PROFILE_PHASE_COUNT; p++) {
+		fprintf(file, ",%s_ms", PHASE_NAMES[p]);
+	}
+	for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+		fprintf(file, ",%s", COUNTER_NAMES[c]);
+	}
+	fprintf(file, "\n");
+	const int stride = PROFILE_PHASE_COUNT + PROFILE_COUNTER_COUNT;
+	int firstStep = stepCount - historySize;
+	for (int k = 0; k < historySize; k++) {
+		const int64_t *row = &history[(size_t)((historyStart + k) % historyLength) * stride];
+		fprintf(file, "%d", firstStep + k);
+		for (int p = 0; p < PROFILE_PHASE_COUNT; p++) {
+			fprintf(file, ",%.6f", row[p] * 1e-6);
+		}
+		for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+			fprintf(file, ",%lld", (long long)row[PROFILE_PHASE_COUNT + c]);
+		}
+		fprintf(file, "\n");
+	}
+	bool succeeded = ferror(file) == 0;
+	fclose(file);
+	return succeeded;
+}
+
+static void writeHistogramJson(FILE *file, const std::vector<int64_t> &histogram) {
+	// Trailing empty buckets are left out
+	int used = PROFILE_HISTOGRAM_BUCKETS;
+	while (used > 0 && histogram[used - 1] == 0) {
+		used--;
+	}
+	fprintf(file, "[");
+	for (int b = 0; b < used; b++) {
+		fprintf(file, b == 0 ? "%lld" : ",%lld", (long long)histogram[b]);
+	}
+	fprintf(file, "]");
+}
+
+bool StretchedProfiler::writeJson(const char *fileName) const {
+	FILE *file = fopen(fileName, "w");
+	if (file == NULL) {
+		Logger::consolePrint("Could not open '%s' for writing", fileName);
+		return false;
+	}
+	fprintf(file, "{\n  \"steps\": %d,\n  \"percentileSteps\": %d,\n  \"histogramBuckets\": \"bucket b counts values in [2^(b-1), 2^b), nanoseconds for phases\",\n  \"phases\": {\n",
+		stepCount, historySize);
+	for (int p = 0; p < PROFILE_PHASE_COUNT; p++) {
+		StretchedProfilePhase phase = (StretchedProfilePhase)p;
+		fprintf(file, "    \"%s\": { \"total_ms\": %.6f, \"mean_ms\": %.6f, \"min_ms\": %.6f, \"max_ms\": %.6f, \"p50_ms\": %.6f, \"p99_ms\": %.6f, \"histogram\": ",
+			PHASE_NAMES[p], getTotalSeconds(phase) * 1e3, getMeanSeconds(phase) * 1e3, getMinSeconds(phase) * 1e3, getMaxSeconds(phase) * 1e3,
+			getPercentileSeconds(phase, 0.5) * 1e3, getPercentileSeconds(phase, 0.99) * 1e3);
+		writeHistogramJson(file, phaseHistograms[p]);
+		fprintf(file, p + 1 < PROFILE_PHASE_COUNT ? " },\n" : " }\n");
+	}
+	fprintf(file, "  },\n  \"counters\": {\n");
+	for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+		fprintf(file, "    \"%s\": { \"total\": %lld, \"mean\": %.3f, \"max\": %lld, \"histogram\": ", COUNTER_NAMES[c], (long long)totalCounts[c],
+			stepCount > 0 ? (double)totalCounts[c] / stepCount : 0.0, (long long)maxCounts[c]);
+		writeHistogramJson(file, counterHistograms[c]);
+		fprintf(file, c + 1 < PROFILE_COUNTER_COUNT ? " },\n" : " }\n");
+	}
+	fprintf(file, "  }\n}\n");
+	bool succeeded = ferror(file) == 0;
+	fclose(file);
+	return succeeded;
+}
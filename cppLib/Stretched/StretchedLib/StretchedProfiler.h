@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+// Phases of StretchedParticleSystem::step timed by the profiler
+enum StretchedProfilePhase {
+	// The whole step
+	PROFILE_STEP,
+	// Forces and integration of the explicit integrators
+	PROFILE_FORCES,
+	PROFILE_INTEGRATION,
+	// Whole solves of the implicit integrators (forces included)
+	PROFILE_IMPLICIT_SOLVE,
+	PROFILE_PROJECTIVE_DYNAMICS,
+	PROFILE_CONSTRAINTS,
+	PROFILE_SELF_INTERSECTIONS,
+	PROFILE_FLOOR,
+	PROFILE_CONTINUOUS_COLLISIONS,
+	// Sleep tracker bookkeeping before and after the step
+	PROFILE_SLEEPING,
+	PROFILE_PHASE_COUNT
+};
+
+enum StretchedProfileCounter {
+	// Springs whose force was evaluated (per gradient evaluation for the implicit solves)
+	PROFILE_SPRINGS_EVALUATED,
+	// Newton iterations of the implicit integrator, local/global iterations of projective dynamics
+	PROFILE_SOLVER_ITERATIONS,
+	// Conjugate gradient iterations of the implicit integrator
+	PROFILE_LINEAR_SOLVER_ITERATIONS,
+	// Particle pairs found for the self intersections plus triangle pairs tested for continuous collisions
+	PROFILE_COLLISION_PAIRS,
+	PROFILE_COUNTER_COUNT
+};
+
+// Power of two buckets: bucket b counts the steps whose value v has 2^(b-1) <= v < 2^b (bucket 0 is v = 0),
+// in nanoseconds for the phases
+static const int PROFILE_HISTOGRAM_BUCKETS = 48;
+
+// Per phase timings and per step counters of the simulation loop. Each step the phases add their time
+// and the solvers their counts to the step being measured; endStep folds the step into totals, min/max
+// and histograms, and keeps the last historyLength steps for a per step CSV dump and the percentiles.
+// Everything is off until enabled is set: every timer and counter then costs one predictable branch, and
+// there are only a handful per step (no per particle or per spring instrumentation).
+class StretchedProfiler {
+
+public:
+	StretchedProfiler();
+	~StretchedProfiler();
+
+	bool enabled = false;
+	// Steps kept for writeCsv and the percentiles (the most recent ones)
+	int historyLength = 1000;
+
+	static int64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void beginStep() {
+		if (enabled) {
+			clearStep();
+		}
+	}
+	void endStep() {
+		if (enabled) {
+			finishStep();
+		}
+	}
+	void addTime(StretchedProfilePhase phase, int64_t nanoseconds) {
+		if (enabled) {
+			stepNanoseconds[phase] += nanoseconds;
+		}
+	}
+	void count(StretchedProfileCounter counter, int64_t amount) {
+		if (enabled) {
+			stepCounts[counter] += amount;
+		}
+	}
+
+	// Drops everything measured so far
+	void reset();
+
+	int getStepCount() const;
+	double getTotalSeconds(StretchedProfilePhase phase) const;
+	double getMeanSeconds(StretchedProfilePhase phase) const;
+	double getMinSeconds(StretchedProfilePhase phase) const;
+	double getMaxSeconds(StretchedProfilePhase phase) const;
+	// Time the given fraction of the kept steps (the last historyLength, e.g. 0.99) took at most, by
+	// nearest rank; 0 if no step is kept
+	double getPercentileSeconds(StretchedProfilePhase phase, double fraction) const;
+	// Time of the phase in the last step
+	double getLastSeconds(StretchedProfilePhase phase) const;
+	const std::vector<int64_t> &getHistogram(StretchedProfilePhase phase) const;
+
+	int64_t getTotalCount(StretchedProfileCounter counter) const;
+	int64_t getLastCount(StretchedProfileCounter counter) const;
+	int64_t getMaxCount(StretchedProfileCounter counter) const;
+	const std::vector<int64_t> &getHistogram(StretchedProfileCounter counter) const;
+
+	static const char *getPhaseName(StretchedProfilePhase phase);
+	static const char *getCounterName(StretchedProfileCounter counter);
+
+	// One row per kept step with the time of each phase (ms) and each counter
+	bool writeCsv(const char *fileName) const;
+	// Totals, statistics and histograms of every phase and counter
+	bool writeJson(const char *fileName) const;
+
+private:
+	int stepCount = 0;
+	int64_t stepNanoseconds[PROFILE_PHASE_COUNT];
+	int64_t stepCounts[PROFILE_COUNTER_COUNT];
+
+	int64_t lastNanoseconds[PROFILE_PHASE_COUNT];
+	int64_t totalNanoseconds[PROFILE_PHASE_COUNT];
+	int64_t minNanoseconds[PROFILE_PHASE_COUNT];
+	int64_t maxNanoseconds[PROFILE_PHASE_COUNT];
+	std::vector<int64_t> phaseHistograms[PROFILE_PHASE_COUNT];
+
+	int64_t lastCounts[PROFILE_COUNTER_COUNT];
+	int64_t totalCounts[PROFILE_COUNTER_COUNT];
+	int64_t maxCounts[PROFILE_COUNTER_COUNT];
+	std::vector<int64_t> counterHistograms[PROFILE_COUNTER_COUNT];
+
+	// Ring buffer of the last steps, PROFILE_PHASE_COUNT times then PROFILE_COUNTER_COUNT counts per step
+	std::vector<int64_t> history;
+	int historyStart = 0;
+	int historySize = 0;
+
+	void clearStep();
+	void finishStep();
+};
+
+// Adds the time until the end of the scope to a phase of the profiler (nothing when it is disabled)
+class StretchedProfileScope {
+
+public:
+	StretchedProfileScope(StretchedProfiler &profiler, StretchedProfilePhase phase) : profiler(profiler.enabled ? &profiler : NULL), phase(phase) {
+		if (this->profiler != NULL) {
+			start = StretchedProfiler::now();
+		}
+	}
+	~StretchedProfileScope() {
+		if (profiler != NULL) {
+			profiler->addTime(phase, StretchedProfiler::now() - start);
+		}
+	}
+
+	StretchedProfileScope(const StretchedProfileScope &) = delete;
+	StretchedProfileScope &operator=(const StretchedProfileScope &) = delete;
+
+private:
+	StretchedProfiler *profiler;
+	StretchedProfilePhase phase;
+	int64_t start = 0;
+};
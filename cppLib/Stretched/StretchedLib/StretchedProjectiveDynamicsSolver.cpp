@@ -0,0 +1,262 @@
+#include "StretchedProjectiveDynamicsSolver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "StretchedParticleSystem.h"
+#include "Utils/Logger.h"
+
+
+StretchedProjectiveDynamicsSolver::StretchedProjectiveDynamicsSolver() {
+	// Nothing to see here
+}
+
+StretchedProjectiveDynamicsSolver::~StretchedProjectiveDynamicsSolver() {
+	// Nothing to see here
+}
+
+int StretchedProjectiveDynamicsSolver::getAnalyzeCount() const {
+	return analyzeCount;
+}
+
+int StretchedProjectiveDynamicsSolver::getFactorizationCount() const {
+	return factorizationCount;
+}
+
+void StretchedProjectiveDynamicsSolver::addEntry(const StretchedParticleSystem &system, int row, int col, double value) {
+	// Rows of fixed particles are identity rows; their columns move to the right hand side
+	if (system.inverseMasses[row] == 0) {
+		return;
+	}
+	if (system.inverseMasses[col] == 0) {
+		fixedCouplingRows.push_back(row);
+		fixedCouplingIndices.push_back(col);
+		fixedCouplingValues.push_back(value);
+		return;
+	}
+	triplets.push_back(StretchedSparseTriplet(row, col, value));
+}
+
+// w (e_a - e_b)(e_a - e_b)^T
+void StretchedProjectiveDynamicsSolver::addConstraintTerm(const StretchedParticleSystem &system, int a, int b, double w) {
+	addEntry(system, a, a, w);
+	addEntry(system, b, b, w);
+	addEntry(system, a, b, -w);
+	addEntry(system, b, a, -w);
+}
+
+// w times the centering matrix (I - 1/3 1 1^T) of the triangle
+void StretchedProjectiveDynamicsSolver::addTriangleTerm(const StretchedParticleSystem &system, int a, int b, int c, double w) {
+	int indices[3] = { a, b, c };
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			addEntry(system, indices[i], indices[j], w * ((i == j ? 1.0 : 0.0) - 1.0 / 3.0));
+		}
+	}
+}
+
+void StretchedProjectiveDynamicsSolver::assembleSystemMatrix(const StretchedParticleSystem &system, double timeStep) {
+	int n = system.getParticleCount();
+	double inverseSqTimeStep = 1.0 / (timeStep * timeStep);
+	triplets.clear();
+	fixedCouplingRows.clear();
+	fixedCouplingIndices.clear();
+	fixedCouplingValues.clear();
+	inertiaWeights.assign(n, 0.0);
+
+	for (int i = 0; i < n; i++) {
+		if (system.inverseMasses[i] == 0) {
+			triplets.push_back(StretchedSparseTriplet(i, i, 1.0));
+		} else {
+			inertiaWeights[i] = system.masses[i] * inverseSqTimeStep;
+			triplets.push_back(StretchedSparseTriplet(i, i, inertiaWeights[i]));
+		}
+	}
+	const StretchedSpringTable &springs = system.springs;
+	for (int s = 0; s < springs.size(); s++) {
+		addConstraintTerm(system, springs.indicesA[s], springs.indicesB[s], springs.stiffnesses[s]);
+	}
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	for (int s = 0; s < pins.size(); s++) {
+		addEntry(system, pins.indices[s], pins.indices[s], pins.stiffnesses[s]);
+	}
+	const std::vector<StretchedBendConstraint> &bends = system.constraintSolver.getBendConstraints();
+	for (int i = 0; i < (int)bends.size(); i++) {
+		addConstraintTerm(system, bends[i].a, bends[i].c, bends[i].k * constraintWeight);
+	}
+	const std::vector<StretchedTriangleAreaConstraint> &areas = system.constraintSolver.getTriangleAreaConstraints();
+	for (int i = 0; i < (int)areas.size(); i++) {
+		addTriangleTerm(system, areas[i].a, areas[i].b, areas[i].c, areas[i].k * constraintWeight);
+	}
+	systemMatrix.setFromTriplets(n, n, triplets);
+}
+
+void StretchedProjectiveDynamicsSolver::invalidate() {
+	builtParticleCount = -1;
+}
+
+void StretchedProjectiveDynamicsSolver::updateFactorization(const StretchedParticleSystem &system, double timeStep) {
+	int bendCount = (int)system.constraintSolver.getBendConstraints().size();
+	int areaCount = (int)system.constraintSolver.getTriangleAreaConstraints().size();
+	bool topologyChanged = system.getParticleCount() != builtParticleCount || system.springs.size() != builtSpringCount
+		|| system.zeroLengthSprings.size() != builtPinCount || bendCount != builtBendCount || areaCount != builtAreaCount;
+	if (!topologyChanged && timeStep == builtTimeStep && constraintWeight == builtConstraintWeight) {
+		return;
+	}
+	assembleSystemMatrix(system, timeStep);
+	if (topologyChanged) {
+		cholesky.analyze(systemMatrix, StretchedSparseCholesky::computeNestedDissectionOrdering(systemMatrix, system.positions));
+		analyzeCount++;
+	}
+	hasFactorization = cholesky.factorize(systemMatrix);
+	factorizationCount++;
+	builtParticleCount = system.getParticleCount();
+	builtSpringCount = system.springs.size();
+	builtPinCount = system.zeroLengthSprings.size();
+	builtBendCount = bendCount;
+	builtAreaCount = areaCount;
+	builtTimeStep = timeStep;
+	builtConstraintWeight = constraintWeight;
+}
+
+// rhs = sum w A^T p over the constraints, p being the projection of the current positions
+void StretchedProjectiveDynamicsSolver::accumulateProjections(const StretchedParticleSystem &system) {
+	const double *px = system.positions.x.data();
+	const double *py = system.positions.y.data();
+	const double *pz = system.positions.z.data();
+	double *rx = rhs.x.data(), *ry = rhs.y.data(), *rz = rhs.z.data();
+
+	// Springs: p = L (x_a - x_b) / |x_a - x_b|
+	const StretchedSpringTable &springs = system.springs;
+	for (int s = 0; s < springs.size(); s++) {
+		int a = springs.indicesA[s], b = springs.indicesB[s];
+		double dx = px[a] - px[b], dy = py[a] - py[b], dz = pz[a] - pz[b];
+		double length = sqrt(dx * dx + dy * dy + dz * dz);
+		double scale = length > EPSILON_CHECK ? springs.restLengths[s] / length : 1;
+		double w = springs.stiffnesses[s] * scale;
+		rx[a] += w * dx; ry[a] += w * dy; rz[a] += w * dz;
+		rx[b] -= w * dx; ry[b] -= w * dy; rz[b] -= w * dz;
+	}
+
+	// Zero length springs: p = rest position
+	const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+	for (int s = 0; s < pins.size(); s++) {
+		int i = pins.indices[s];
+		double w = pins.stiffnesses[s];
+		rx[i] += w * pins.restPositions.x[s];
+		ry[i] += w * pins.restPositions.y[s];
+		rz[i] += w * pins.restPositions.z[s];
+	}
+
+	// Bend: keep |x_a - x_c| at the distance giving the rest angle at b for the current arm lengths
+	const std::vector<StretchedBendConstraint> &bends = system.constraintSolver.getBendConstraints();
+	for (int i = 0; i < (int)bends.size(); i++) {
+		const StretchedBendConstraint &bend = bends[i];
+		int a = bend.a, b = bend.b, c = bend.c;
+		double ux = px[a] - px[b], uy = py[a] - py[b], uz = pz[a] - pz[b];
+		double vx = px[c] - px[b], vy = py[c] - py[b], vz = pz[c] - pz[b];
+		double uLength = sqrt(ux * ux + uy * uy + uz * uz);
+		double vLength = sqrt(vx * vx + vy * vy + vz * vz);
+		double dx = ux - vx, dy = uy - vy, dz = uz - vz;
+		double length = sqrt(dx * dx + dy * dy + dz * dz);
+		double restLength = sqrt(std::max(0.0, uLength * uLength + vLength * vLength - 2 * uLength * vLength * cos(bend.theta)));
+		double scale = length > EPSILON_CHECK ? restLength / length : 1;
+		double w = bend.k * constraintWeight * scale;
+		rx[a] += w * dx; ry[a] += w * dy; rz[a] += w * dz;
+		rx[c] -= w * dx; ry[c] -= w * dy; rz[c] -= w * dz;
+	}
+
+	// Triangle area: scale the triangle about its centroid to the rest area
+	const std::vector<StretchedTriangleAreaConstraint> &areas = system.constraintSolver.getTriangleAreaConstraints();
+	for (int i = 0; i < (int)areas.size(); i++) {
+		const StretchedTriangleAreaConstraint &area = areas[i];
+		int indices[3] = { area.a, area.b, area.c };
+		double cx = (px[area.a] + px[area.b] + px[area.c]) / 3;
+		double cy = (py[area.a] + py[area.b] + py[area.c]) / 3;
+		double cz = (pz[area.a] + pz[area.b] + pz[area.c]) / 3;
+		double e1x = px[area.b] - px[area.a], e1y = py[area.b] - py[area.a], e1z = pz[area.b] - pz[area.a];
+		double e2x = px[area.c] - px[area.a], e2y = py[area.c] - py[area.a], e2z = pz[area.c] - pz[area.a];
+		double nx = e1y * e2z - e1z * e2y, ny = e1z * e2x - e1x * e2z, nz = e1x * e2y - e1y * e2x;
+		double currentArea = 0.5 * sqrt(nx * nx + ny * ny + nz * nz);
+		double scale = currentArea > EPSILON_CHECK ? sqrt(area.area / currentArea) : 1;
+		double w = area.k * constraintWeight * scale;
+		for (int j = 0; j < 3; j++) {
+			int v = indices[j];
+			rx[v] += w * (px[v] - cx);
+			ry[v] += w * (py[v] - cy);
+			rz[v] += w * (pz[v] - cz);
+		}
+	}
+}
+
+void StretchedProjectiveDynamicsSolver::step(StretchedParticleSystem &system, double timeStep) {
+	int n = system.getParticleCount();
+	double h = timeStep;
+	updateFactorization(system, h);
+	if (!hasFactorization) {
+		Logger::consolePrint("Projective dynamics: no valid factorization, skipping step");
+		return;
+	}
+
+	// Inertial target y = x + h v + h^2 M^-1 f_ext, also the initial guess
+	system.accumulateExternalForces();
+	startPositions = system.positions;
+	inertialPositions.resize(n);
+	rhs.resize(n);
+	StretchedVectorArray &p = system.positions;
+	const StretchedVectorArray &v = system.velocities;
+	const StretchedVectorArray &f = system.forces;
+	for (int i = 0; i < n; i++) {
+		double w = system.inverseMasses[i];
+		if (w == 0) {
+			inertialPositions.x[i] = p.x[i];
+			inertialPositions.y[i] = p.y[i];
+			inertialPositions.z[i] = p.z[i];
+			continue;
+		}
+		inertialPositions.x[i] = p.x[i] + h * v.x[i] + h * h * w * f.x[i];
+		inertialPositions.y[i] = p.y[i] + h * v.y[i] + h * h * w * f.y[i];
+		inertialPositions.z[i] = p.z[i] + h * v.z[i] + h * h * w * f.z[i];
+	}
+	p = inertialPositions;
+
+	int couplingCount = (int)fixedCouplingRows.size();
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		// Local step
+		rhs.setZero();
+		accumulateProjections(system);
+
+		// Global step: (M/h^2 + sum w A^T A) x = M/h^2 y + sum w A^T p
+		for (int i = 0; i < n; i++) {
+			rhs.x[i] += inertiaWeights[i] * inertialPositions.x[i];
+			rhs.y[i] += inertiaWeights[i] * inertialPositions.y[i];
+			rhs.z[i] += inertiaWeights[i] * inertialPositions.z[i];
+		}
+		for (int k = 0; k < couplingCount; k++) {
+			int row = fixedCouplingRows[k], fixed = fixedCouplingIndices[k];
+			rhs.x[row] -= fixedCouplingValues[k] * p.x[fixed];
+			rhs.y[row] -= fixedCouplingValues[k] * p.y[fixed];
+			rhs.z[row] -= fixedCouplingValues[k] * p.z[fixed];
+		}
+		for (int i = 0; i < n; i++) {
+			if (system.inverseMasses[i] == 0) {
+				rhs.x[i] = p.x[i];
+				rhs.y[i] = p.y[i];
+				rhs.z[i] = p.z[i];
+			}
+		}
+		cholesky.solve(rhs);
+		p.x.swap(rhs.x);
+		p.y.swap(rhs.y);
+		p.z.swap(rhs.z);
+	}
+
+	// v = (x_new - x_n) / h, with the same velocity damping as the other integrators
+	double damping = system.useVelocityDamping ? 1 - system.velocityDampingConstant : 1;
+	for (int i = 0; i < n; i++) {
+		system.velocities.x[i] = damping * (p.x[i] - startPositions.x[i]) / h;
+		system.velocities.y[i] = damping * (p.y[i] - startPositions.y[i]) / h;
+		system.velocities.z[i] = damping * (p.z[i] - startPositions.z[i]) / h;
+	}
+	system.previousPositions = startPositions;
+}
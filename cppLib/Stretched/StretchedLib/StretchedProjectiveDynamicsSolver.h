@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedConstants.h"
+#include "StretchedSparseCholesky.h"
+#include "StretchedSparseMatrix.h"
+#include "StretchedVectorArray.h"
+
+class StretchedParticleSystem;
+
+// Projective dynamics for the particle system. Every constraint (spring, zero length spring,
+// bend and triangle area constraint) contributes w/2 |A x - p|^2 where p is the projection of
+// the current positions onto the constraint. The global matrix M/h^2 + sum w A^T A only depends
+// on the topology, stiffnesses, masses and timestep - not on the rest lengths - so it is factored
+// once with a sparse Cholesky and reused every step; each iteration only runs the local
+// projections and one triangular solve pass (x, y and z share the matrix).
+// The matrix is refactored only when the number of particles or constraints, the timestep or the
+// constraint weight changes, or after invalidate (for edits that keep the counts).
+class StretchedProjectiveDynamicsSolver {
+
+public:
+	StretchedProjectiveDynamicsSolver();
+	~StretchedProjectiveDynamicsSolver();
+
+	// Local/global iterations per step
+	int iterations = 10;
+	// Bend and triangle area constraints use their PBD stiffness k in [0, 1] times this weight
+	double constraintWeight = FABRIC_BEND_SPRING_STIFFNESS;
+
+	// Advances the system by one timestep
+	void step(StretchedParticleSystem &system, double timeStep);
+
+	// Forces the matrix to be analyzed and factored again (needed after editing masses, fixed particles,
+	// stiffnesses or constraint indices in place)
+	void invalidate();
+
+	// Number of symbolic (pattern) and numeric factorizations done so far
+	int getAnalyzeCount() const;
+	int getFactorizationCount() const;
+
+private:
+	StretchedSparseCholesky cholesky;
+	StretchedSparseMatrix systemMatrix;
+	std::vector<StretchedSparseTriplet> triplets;
+	bool hasFactorization = false;
+	int analyzeCount = 0;
+	int factorizationCount = 0;
+
+	// What the factorization was built for
+	int builtParticleCount = -1;
+	int builtSpringCount = -1;
+	int builtPinCount = -1;
+	int builtBendCount = -1;
+	int builtAreaCount = -1;
+	double builtTimeStep = 0;
+	double builtConstraintWeight = 0;
+
+	// Entries coupling free particles to fixed ones, moved to the right hand side
+	std::vector<int> fixedCouplingRows;
+	std::vector<int> fixedCouplingIndices;
+	std::vector<double> fixedCouplingValues;
+	// M / h^2 (0 for fixed particles)
+	std::vector<double> inertiaWeights;
+
+	// Solver state reused between steps
+	StretchedVectorArray startPositions;
+	StretchedVectorArray inertialPositions;
+	StretchedVectorArray rhs;
+
+	void updateFactorization(const StretchedParticleSystem &system, double timeStep);
+	void assembleSystemMatrix(const StretchedParticleSystem &system, double timeStep);
+	void addConstraintTerm(const StretchedParticleSystem &system, int a, int b, double w);
+	void addTriangleTerm(const StretchedParticleSystem &system, int a, int b, int c, double w);
+	void addEntry(const StretchedParticleSystem &system, int row, int col, double value);
+	void accumulateProjections(const StretchedParticleSystem &system);
+};
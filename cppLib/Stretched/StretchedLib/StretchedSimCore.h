@@ -0,0 +1,469 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define STRETCHED_SIM_CORE_FLUSH_DENORMALS
+#endif
+
+#include "Utils/Logger.h"
+
+#include "StretchedConstants.h"
+#include "StretchedParticleSystem.h"
+#include "StretchedStepPolicies.h"
+
+// Flushes denormals to zero (FTZ and DAZ) for the lifetime of the guard when Scalar is float: decaying
+// velocities and nearly relaxed springs underflow single precision quickly, and every denormal operand costs
+// the SSE units a microcode assist (about 3x slower steps on a relaxing grid). Double has the range to
+// never get there, and keeps its bit-for-bit match with StretchedParticleSystem.
+template <class Scalar>
+class StretchedDenormalGuard {
+
+public:
+	StretchedDenormalGuard() {
+#ifdef STRETCHED_SIM_CORE_FLUSH_DENORMALS
+		if (sizeof(Scalar) < sizeof(double)) {
+			savedControl = _mm_getcsr();
+			_mm_setcsr(savedControl | 0x8040);
+		}
+#endif
+	}
+	~StretchedDenormalGuard() {
+#ifdef STRETCHED_SIM_CORE_FLUSH_DENORMALS
+		if (sizeof(Scalar) < sizeof(double)) {
+			_mm_setcsr(savedControl);
+		}
+#endif
+	}
+
+	StretchedDenormalGuard(const StretchedDenormalGuard &) = delete;
+	StretchedDenormalGuard &operator=(const StretchedDenormalGuard &) = delete;
+
+private:
+	unsigned int savedControl = 0;
+};
+
+// Integrator policies of StretchedSimCore: StretchedSymplecticEulerPolicy and StretchedVerletPolicy (the
+// loops StretchedParticleSystem steps with), or this one, which only the core has.
+// One linearized backward Euler solve per step (Baraff & Witkin 98): (M - h^2 K) dv = h (f + h K v), with
+// K the spring stiffness matrix (compression clamped so it stays definite) and a matrix free, Jacobi
+// preconditioned conjugate gradient. Cheaper per step than the Newton iterations of StretchedImplicitIntegrator
+// and just as stable at large time steps, though less accurate.
+struct StretchedLinearImplicitEulerPolicy {};
+
+// Explicit part of the simulation templated on the scalar type and the integrator, for runs that need the
+// throughput more than the features: gravity, drag, velocity damping, the springs, the pins and the floor.
+// It is not a templated StretchedParticleSystem: that one stays in double with its runtime integrationType
+// switch, because its bend/area constraints, projective dynamics and Newton implicit solvers, collisions and
+// sleeping are all written against double state. The core leaves out exactly those: load refuses a system
+// with constraints or collisions, the integrator is the policy (integrationType is ignored, so a projective
+// dynamics system is stepped as a mass spring one), and sleeping tiles are stepped like the others.
+// The force, integration and floor loops are the ones of StretchedStepPolicies.h that StretchedParticleSystem
+// runs too. Each Scalar x Integrator combination compiles to its own step with them inlined and no branch on
+// the integration type inside them; float halves the memory traffic of the state and spring tables. load copies a particle system in (converting to Scalar),
+// store copies the state back, so a float preview can be refined by a double run of the same system.
+// With double and the explicit policies the steps are bit-identical to StretchedParticleSystem::step.
+template <class Scalar, class Integrator>
+class StretchedSimCore {
+
+public:
+	typedef Scalar ScalarType;
+
+	// Implicit policy: conjugate gradient iterations per step and relative residual tolerance
+	int maxLinearIterations = 100;
+	Scalar linearTolerance = sizeof(Scalar) < sizeof(double) ? (Scalar)1e-4 : (Scalar)1e-6;
+
+	// Copies the particles, springs, pins and options of the system. Returns false (and logs why) if the
+	// system uses a feature the core does not simulate.
+	bool load(const StretchedParticleSystem &system) {
+		if (system.constraintSolver.hasConstraints() || system.avoidSelfIntersections || system.useContinuousCollisions) {
+			Logger::consolePrint("The templated simulation core has no position based constraints or collisions");
+			return false;
+		}
+		int n = system.getParticleCount();
+		copyIn(system.positions.x, px, n);
+		copyIn(system.positions.y, py, n);
+		copyIn(system.positions.z, pz, n);
+		copyIn(system.previousPositions.x, ox, n);
+		copyIn(system.previousPositions.y, oy, n);
+		copyIn(system.previousPositions.z, oz, n);
+		copyIn(system.velocities.x, vx, n);
+		copyIn(system.velocities.y, vy, n);
+		copyIn(system.velocities.z, vz, n);
+		copyIn(system.masses, masses, n);
+		copyIn(system.inverseMasses, inverseMasses, n);
+		fx.assign(n, 0);
+		fy.assign(n, 0);
+		fz.assign(n, 0);
+
+		const StretchedSpringTable &springs = system.springs;
+		int springCount = springs.size();
+		indicesA = springs.indicesA;
+		indicesB = springs.indicesB;
+		copyIn(springs.restLengths, restLengths, springCount);
+		copyIn(springs.stiffnesses, stiffnesses, springCount);
+		springValues.assign(3 * springCount, 0);
+		buildIncidence(n);
+
+		const StretchedZeroLengthSpringTable &pins = system.zeroLengthSprings;
+		pinIndices = pins.indices;
+		copyIn(pins.restPositions.x, pinX, pins.size());
+		copyIn(pins.restPositions.y, pinY, pins.size());
+		copyIn(pins.restPositions.z, pinZ, pins.size());
+		copyIn(pins.stiffnesses, pinStiffnesses, pins.size());
+
+		upAxis = system.upAxis;
+		useGravity = system.useGravity;
+		useDragForce = system.useDragForce;
+		useFloorConstraint = system.useFloorConstraint;
+		velocityDamping = system.useVelocityDamping ? (Scalar)system.velocityDampingConstant : 0;
+		dragScale = (Scalar)(-system.coefficientOfDrag * system.particleArea);
+		floorHeight = (Scalar)system.floorHeight;
+		return true;
+	}
+
+	// Writes the positions, previous positions and velocities back (the system must be the one loaded)
+	void store(StretchedParticleSystem &system) const {
+		copyOut(px, system.positions.x);
+		copyOut(py, system.positions.y);
+		copyOut(pz, system.positions.z);
+		copyOut(ox, system.previousPositions.x);
+		copyOut(oy, system.previousPositions.y);
+		copyOut(oz, system.previousPositions.z);
+		copyOut(vx, system.velocities.x);
+		copyOut(vy, system.velocities.y);
+		copyOut(vz, system.velocities.z);
+	}
+
+	void step(Scalar timeStep) {
+		StretchedDenormalGuard<Scalar> guard;
+		stepUnguarded(timeStep);
+	}
+
+	void steps(int count, Scalar timeStep) {
+		StretchedDenormalGuard<Scalar> guard;
+		for (int i = 0; i < count; i++) {
+			stepUnguarded(timeStep);
+		}
+	}
+
+	int getParticleCount() const {
+		return (int)px.size();
+	}
+
+	// Conjugate gradient iterations of the last step (implicit policy only)
+	int getLastLinearIterations() const {
+		return lastLinearIterations;
+	}
+
+private:
+	std::vector<Scalar> px, py, pz;
+	std::vector<Scalar> ox, oy, oz;
+	std::vector<Scalar> vx, vy, vz;
+	std::vector<Scalar> fx, fy, fz;
+	std::vector<Scalar> masses;
+	std::vector<Scalar> inverseMasses;
+
+	std::vector<int> indicesA;
+	std::vector<int> indicesB;
+	std::vector<Scalar> restLengths;
+	std::vector<Scalar> stiffnesses;
+	// Per spring values (the force on end A, or a Hessian product), interleaved (x, y, z) and gathered per
+	// particle through the incidence list, as in StretchedSpringForceKernel
+	std::vector<Scalar> springValues;
+	std::vector<int> incidenceStarts;
+	std::vector<int> incidenceSprings;
+	std::vector<Scalar> incidenceSigns;
+
+	std::vector<int> pinIndices;
+	std::vector<Scalar> pinX, pinY, pinZ;
+	std::vector<Scalar> pinStiffnesses;
+
+	int upAxis = 1;
+	bool useGravity = false;
+	bool useDragForce = false;
+	bool useFloorConstraint = true;
+	Scalar velocityDamping = 0;
+	Scalar dragScale = 0;
+	Scalar floorHeight = 0;
+
+	// Implicit policy: spring directions and stiffness coefficients of the step, and the CG vectors
+	std::vector<Scalar> directionX, directionY, directionZ;
+	std::vector<Scalar> transverseStiffnesses, axialStiffnesses;
+	std::vector<Scalar> rhsX, rhsY, rhsZ;
+	std::vector<Scalar> dvX, dvY, dvZ;
+	std::vector<Scalar> residualX, residualY, residualZ;
+	std::vector<Scalar> preconditionedX, preconditionedY, preconditionedZ;
+	std::vector<Scalar> searchX, searchY, searchZ;
+	std::vector<Scalar> productX, productY, productZ;
+	std::vector<Scalar> diagonalX, diagonalY, diagonalZ;
+	int lastLinearIterations = 0;
+
+	STRETCHED_FORCE_INLINE void stepUnguarded(Scalar timeStep) {
+		advance(timeStep, Integrator());
+		if (useFloorConstraint) {
+			StretchedStepLoops<Scalar>::resolveFloorConstraint(getParticleArrays(), StretchedAllParticles(getParticleCount()), upAxis, floorHeight);
+		}
+	}
+
+	StretchedParticleArrays<Scalar> getParticleArrays() {
+		StretchedParticleArrays<Scalar> arrays = { px.data(), py.data(), pz.data(), ox.data(), oy.data(), oz.data(),
+			vx.data(), vy.data(), vz.data(), fx.data(), fy.data(), fz.data(), masses.data(), inverseMasses.data() };
+		return arrays;
+	}
+
+	StretchedIncidenceArrays<Scalar> getIncidenceArrays() const {
+		StretchedIncidenceArrays<Scalar> arrays = { incidenceStarts.data(), incidenceSprings.data(), incidenceSigns.data() };
+		return arrays;
+	}
+
+	template <class Source>
+	static void copyIn(const std::vector<Source> &source, std::vector<Scalar> &target, int count) {
+		target.resize(count);
+		for (int i = 0; i < count; i++) {
+			target[i] = (Scalar)source[i];
+		}
+	}
+
+	static void copyOut(const std::vector<Scalar> &source, std::vector<double> &target) {
+		target.resize(source.size());
+		for (int i = 0; i < (int)source.size(); i++) {
+			target[i] = (double)source[i];
+		}
+	}
+
+	void buildIncidence(int particleCount) {
+		int springCount = (int)indicesA.size();
+		incidenceStarts.assign(particleCount + 1, 0);
+		for (int s = 0; s < springCount; s++) {
+			incidenceStarts[indicesA[s] + 1]++;
+			incidenceStarts[indicesB[s] + 1]++;
+		}
+		for (int i = 0; i < particleCount; i++) {
+			incidenceStarts[i + 1] += incidenceStarts[i];
+		}
+		std::vector<int> next(incidenceStarts.begin(), incidenceStarts.end() - 1);
+		incidenceSprings.resize(2 * springCount);
+		incidenceSigns.resize(2 * springCount);
+		for (int s = 0; s < springCount; s++) {
+			int slotA = next[indicesA[s]]++;
+			incidenceSprings[slotA] = s;
+			incidenceSigns[slotA] = 1;
+			int slotB = next[indicesB[s]]++;
+			incidenceSprings[slotB] = s;
+			incidenceSigns[slotB] = -1;
+		}
+	}
+
+	// Gravity, drag, springs and pins, in the order of StretchedParticleSystem::computeForces
+	STRETCHED_FORCE_INLINE void computeForces() {
+		typedef StretchedStepLoops<Scalar> Loops;
+		int n = getParticleCount();
+		StretchedParticleArrays<Scalar> particles = getParticleArrays();
+		Loops::clearForces(particles, StretchedAllParticles(n));
+		if (useGravity) {
+			Loops::accumulateGravity(particles, StretchedAllParticles(n), upAxis);
+		}
+		if (useDragForce) {
+			Loops::accumulateDrag(particles, StretchedAllParticles(n), dragScale);
+		}
+		StretchedSpringArrays<Scalar> springs = { indicesA.data(), indicesB.data(), restLengths.data(), stiffnesses.data() };
+		Loops::computeSpringForces(springs, px.data(), py.data(), pz.data(), springValues.data(), 0, (int)indicesA.size());
+		Loops::gatherSprings(getIncidenceArrays(), springValues.data(), fx.data(), fy.data(), fz.data(), 0, n);
+		StretchedPinArrays<Scalar> pins = { pinIndices.data(), pinX.data(), pinY.data(), pinZ.data(), pinStiffnesses.data(), (int)pinIndices.size() };
+		Loops::accumulatePinForces(particles, pins);
+	}
+
+	// Explicit policies
+	template <class Policy>
+	STRETCHED_FORCE_INLINE void advance(Scalar timeStep, Policy) {
+		computeForces();
+		Policy::integrate(getParticleArrays(), StretchedAllParticles(getParticleCount()), timeStep, velocityDamping);
+	}
+
+	// product = (M - h^2 K) u for the particles that are not fixed (0 for the fixed ones)
+	STRETCHED_FORCE_INLINE void multiplySystem(Scalar sqTimeStep, const std::vector<Scalar> &ux, const std::vector<Scalar> &uy, const std::vector<Scalar> &uz) {
+		int n = getParticleCount();
+		int springCount = (int)indicesA.size();
+		const int *a = indicesA.data(), *b = indicesB.data();
+		// -K_s (u_a - u_b) = alpha (u_a - u_b) + (beta - alpha) d (d . (u_a - u_b)) for end A, opposite for B
+		for (int s = 0; s < springCount; s++) {
+			Scalar du = ux[a[s]] - ux[b[s]], dv = uy[a[s]] - uy[b[s]], dw = uz[a[s]] - uz[b[s]];
+			Scalar along = axialStiffnesses[s] * (directionX[s] * du + directionY[s] * dv + directionZ[s] * dw);
+			springValues[3 * s] = sqTimeStep * (transverseStiffnesses[s] * du + along * directionX[s]);
+			springValues[3 * s + 1] = sqTimeStep * (transverseStiffnesses[s] * dv + along * directionY[s]);
+			springValues[3 * s + 2] = sqTimeStep * (transverseStiffnesses[s] * dw + along * directionZ[s]);
+		}
+		for (int i = 0; i < n; i++) {
+			productX[i] = masses[i] * ux[i];
+			productY[i] = masses[i] * uy[i];
+			productZ[i] = masses[i] * uz[i];
+		}
+		StretchedStepLoops<Scalar>::gatherSprings(getIncidenceArrays(), springValues.data(), productX.data(), productY.data(), productZ.data(), 0, n);
+		for (int p = 0; p < (int)pinIndices.size(); p++) {
+			int i = pinIndices[p];
+			productX[i] += sqTimeStep * pinStiffnesses[p] * ux[i];
+			productY[i] += sqTimeStep * pinStiffnesses[p] * uy[i];
+			productZ[i] += sqTimeStep * pinStiffnesses[p] * uz[i];
+		}
+		for (int i = 0; i < n; i++) {
+			if (inverseMasses[i] == 0) {
+				productX[i] = productY[i] = productZ[i] = 0;
+			}
+		}
+	}
+
+	static Scalar dot(const std::vector<Scalar> &ax, const std::vector<Scalar> &ay, const std::vector<Scalar> &az,
+		const std::vector<Scalar> &bx, const std::vector<Scalar> &by, const std::vector<Scalar> &bz) {
+		// Accumulated in double so the float build converges as far as its precision allows
+		double sum = 0;
+		for (int i = 0; i < (int)ax.size(); i++) {
+			sum += (double)ax[i] * bx[i] + (double)ay[i] * by[i] + (double)az[i] * bz[i];
+		}
+		return (Scalar)sum;
+	}
+
+	void advance(Scalar timeStep, StretchedLinearImplicitEulerPolicy) {
+		computeForces();
+		int n = getParticleCount();
+		int springCount = (int)indicesA.size();
+		Scalar h = timeStep, sqTimeStep = timeStep * timeStep;
+		directionX.resize(springCount);
+		directionY.resize(springCount);
+		directionZ.resize(springCount);
+		transverseStiffnesses.resize(springCount);
+		axialStiffnesses.resize(springCount);
+		for (int s = 0; s < springCount; s++) {
+			Scalar dx = px[indicesA[s]] - px[indicesB[s]];
+			Scalar dy = py[indicesA[s]] - py[indicesB[s]];
+			Scalar dz = pz[indicesA[s]] - pz[indicesB[s]];
+			Scalar length = std::sqrt(dx * dx + dy * dy + dz * dz);
+			Scalar inverseLength = length >= (Scalar)EPSILON_CHECK ? 1 / length : (Scalar)0;
+			directionX[s] = dx * inverseLength;
+			directionY[s] = dy * inverseLength;
+			directionZ[s] = dz * inverseLength;
+			// Compressed springs keep only their axial stiffness
+			Scalar transverse = length >= (Scalar)EPSILON_CHECK ? stiffnesses[s] * std::max((Scalar)0, 1 - restLengths[s] / length) : (Scalar)0;
+			transverseStiffnesses[s] = transverse;
+			axialStiffnesses[s] = stiffnesses[s] - transverse;
+		}
+
+		std::vector<Scalar> *vectors[] = { &rhsX, &rhsY, &rhsZ, &dvX, &dvY, &dvZ, &residualX, &residualY, &residualZ,
+			&preconditionedX, &preconditionedY, &preconditionedZ, &searchX, &searchY, &searchZ, &productX, &productY, &productZ, &diagonalX, &diagonalY, &diagonalZ };
+		for (int v = 0; v < (int)(sizeof(vectors) / sizeof(vectors[0])); v++) {
+			vectors[v]->assign(n, 0);
+		}
+
+		// rhs = h (f + h K v) = h f - h (M - h^2 K) v + h M v, through the system product
+		multiplySystem(sqTimeStep, vx, vy, vz);
+		for (int i = 0; i < n; i++) {
+			if (inverseMasses[i] == 0) {
+				continue;
+			}
+			rhsX[i] = h * (fx[i] + (masses[i] * vx[i] - productX[i]) / h);
+			rhsY[i] = h * (fy[i] + (masses[i] * vy[i] - productY[i]) / h);
+			rhsZ[i] = h * (fz[i] + (masses[i] * vz[i] - productZ[i]) / h);
+		}
+
+		// Jacobi preconditioner: inverse of the diagonal of M - h^2 K
+		for (int i = 0; i < n; i++) {
+			diagonalX[i] = diagonalY[i] = diagonalZ[i] = masses[i];
+		}
+		for (int s = 0; s < springCount; s++) {
+			Scalar t = sqTimeStep * transverseStiffnesses[s], ax = sqTimeStep * axialStiffnesses[s];
+			Scalar cx = t + ax * directionX[s] * directionX[s];
+			Scalar cy = t + ax * directionY[s] * directionY[s];
+			Scalar cz = t + ax * directionZ[s] * directionZ[s];
+			diagonalX[indicesA[s]] += cx; diagonalY[indicesA[s]] += cy; diagonalZ[indicesA[s]] += cz;
+			diagonalX[indicesB[s]] += cx; diagonalY[indicesB[s]] += cy; diagonalZ[indicesB[s]] += cz;
+		}
+		for (int p = 0; p < (int)pinIndices.size(); p++) {
+			int i = pinIndices[p];
+			diagonalX[i] += sqTimeStep * pinStiffnesses[p];
+			diagonalY[i] += sqTimeStep * pinStiffnesses[p];
+			diagonalZ[i] += sqTimeStep * pinStiffnesses[p];
+		}
+		for (int i = 0; i < n; i++) {
+			// Fixed particles have no equation (their rhs and products are 0)
+			bool fixed = inverseMasses[i] == 0;
+			diagonalX[i] = fixed ? 0 : 1 / diagonalX[i];
+			diagonalY[i] = fixed ? 0 : 1 / diagonalY[i];
+			diagonalZ[i] = fixed ? 0 : 1 / diagonalZ[i];
+		}
+
+		// Preconditioned conjugate gradient from dv = 0 (residual = rhs)
+		residualX = rhsX;
+		residualY = rhsY;
+		residualZ = rhsZ;
+		for (int i = 0; i < n; i++) {
+			preconditionedX[i] = diagonalX[i] * residualX[i];
+			preconditionedY[i] = diagonalY[i] * residualY[i];
+			preconditionedZ[i] = diagonalZ[i] * residualZ[i];
+		}
+		searchX = preconditionedX;
+		searchY = preconditionedY;
+		searchZ = preconditionedZ;
+		Scalar rz = dot(residualX, residualY, residualZ, preconditionedX, preconditionedY, preconditionedZ);
+		Scalar rhsNorm = std::sqrt(dot(rhsX, rhsY, rhsZ, rhsX, rhsY, rhsZ));
+		lastLinearIterations = 0;
+		for (int iteration = 0; iteration < maxLinearIterations && rhsNorm > 0; iteration++) {
+			if (std::sqrt(dot(residualX, residualY, residualZ, residualX, residualY, residualZ)) <= linearTolerance * rhsNorm) {
+				break;
+			}
+			multiplySystem(sqTimeStep, searchX, searchY, searchZ);
+			Scalar curvature = dot(searchX, searchY, searchZ, productX, productY, productZ);
+			if (!(curvature > 0)) {
+				break;
+			}
+			Scalar alpha = rz / curvature;
+			for (int i = 0; i < n; i++) {
+				dvX[i] += alpha * searchX[i];
+				dvY[i] += alpha * searchY[i];
+				dvZ[i] += alpha * searchZ[i];
+				residualX[i] -= alpha * productX[i];
+				residualY[i] -= alpha * productY[i];
+				residualZ[i] -= alpha * productZ[i];
+				preconditionedX[i] = diagonalX[i] * residualX[i];
+				preconditionedY[i] = diagonalY[i] * residualY[i];
+				preconditionedZ[i] = diagonalZ[i] * residualZ[i];
+			}
+			Scalar nextRz = dot(residualX, residualY, residualZ, preconditionedX, preconditionedY, preconditionedZ);
+			Scalar beta = nextRz / rz;
+			rz = nextRz;
+			for (int i = 0; i < n; i++) {
+				searchX[i] = preconditionedX[i] + beta * searchX[i];
+				searchY[i] = preconditionedY[i] + beta * searchY[i];
+				searchZ[i] = preconditionedZ[i] + beta * searchZ[i];
+			}
+			lastLinearIterations++;
+		}
+
+		Scalar damping = 1 - velocityDamping;
+		for (int i = 0; i < n; i++) {
+			ox[i] = px[i];
+			oy[i] = py[i];
+			oz[i] = pz[i];
+			if (inverseMasses[i] == 0) {
+				// Fixed particles stay where they are
+				continue;
+			}
+			vx[i] = damping * (vx[i] + dvX[i]);
+			vy[i] = damping * (vy[i] + dvY[i]);
+			vz[i] = damping * (vz[i] + dvZ[i]);
+			px[i] += h * vx[i];
+			py[i] += h * vy[i];
+			pz[i] += h * vz[i];
+		}
+	}
+};
+
+// The combinations used by the tools
+typedef StretchedSimCore<float, StretchedSymplecticEulerPolicy> StretchedSimCoreSymplecticFloat;
+typedef StretchedSimCore<double, StretchedSymplecticEulerPolicy> StretchedSimCoreSymplecticDouble;
+typedef StretchedSimCore<float, StretchedVerletPolicy> StretchedSimCoreVerletFloat;
+typedef StretchedSimCore<double, StretchedVerletPolicy> StretchedSimCoreVerletDouble;
+typedef StretchedSimCore<float, StretchedLinearImplicitEulerPolicy> StretchedSimCoreImplicitFloat;
+typedef StretchedSimCore<double, StretchedLinearImplicitEulerPolicy> StretchedSimCoreImplicitDouble;
@@ -5,10 +5,37 @@
 #include <MathLib/MathLib.h>
 #include <MathLib/Matrix.h>
 
+#include "StretchedCheckpoint.h"
+#include "StretchedDesignWindow.h"
+
 //void TW_CALL toggleSymBodyPair(void* clientData) {
 //	//((StretchedSimWindow*)clientData)->createOrRemoveSymPair();
 //}
 
+void TW_CALL loadDesignTriangulationFabric(void* clientData) {
+	((StretchedSimWindow*)clientData)->loadDesignTriangulation();
+}
+
+void TW_CALL loadDesignHydrogelFabric(void* clientData) {
+	((StretchedSimWindow*)clientData)->loadDesignWithHydrogel();
+}
+
+void TW_CALL loadDesignHierarchyFabric(void* clientData) {
+	((StretchedSimWindow*)clientData)->loadDesignHierarchy();
+}
+
+void TW_CALL followDesignFabricEdits(void* clientData) {
+	((StretchedSimWindow*)clientData)->followDesignEdits();
+}
+
+void TW_CALL solveRestShape(void* clientData) {
+	((StretchedSimWindow*)clientData)->solveEquilibrium();
+}
+
+void TW_CALL toggleTrajectoryRecording(void* clientData) {
+	((StretchedSimWindow*)clientData)->toggleRecording();
+}
+
 StretchedSimWindow::StretchedSimWindow(int x, int y, int w, int h, GLApplication* glApp) : GLWindow3D(x, y, w, h){
 	//setWindowTitle("Test AppRobotDesignerlication...");
 	this->glApp = glApp;
@@ -17,6 +44,15 @@ StretchedSimWindow::StretchedSimWindow(int x, int y, int w, int h, GLApplication
 	TwAddVarRW(glApp->mainMenuBar, "Structure Features: attachment points", TW_TYPE_BOOLCPP,  &StructureFeature::showAttachmentPoints, "");
 	TwAddVarRW(glApp->mainMenuBar, "Structure Features: convex hull", TW_TYPE_BOOLCPP, &StructureFeature::showConvexHull, "");
 	TwAddVarRW(glApp->mainMenuBar, "Structure Features: wire frame", TW_TYPE_BOOLCPP, &StructureFeature::showWireFrameConvexHull, "");
+	TwAddButton(glApp->mainMenuBar, "Load Design Triangulation", loadDesignTriangulationFabric, this, " group='Simulation Options' ");
+	TwAddButton(glApp->mainMenuBar, "Load Design With Hydrogel", loadDesignHydrogelFabric, this, " group='Simulation Options' ");
+	TwAddVarRW(glApp->mainMenuBar, "Hierarchy Levels", TW_TYPE_INT32, &hierarchyLevels, " group='Simulation Options' min=1 max=6 ");
+	TwAddVarRW(glApp->mainMenuBar, "Hierarchy Triangle Area", TW_TYPE_DOUBLE, &hierarchyTriangleArea, " group='Simulation Options' min=0.01 step=0.1 ");
+	TwAddButton(glApp->mainMenuBar, "Load Design Hierarchy", loadDesignHierarchyFabric, this, " group='Simulation Options' ");
+	TwAddButton(glApp->mainMenuBar, "Follow Design Edits", followDesignFabricEdits, this, " group='Simulation Options' ");
+	TwAddVarRW(glApp->mainMenuBar, "Run Simulation", TW_TYPE_BOOLCPP, &runSimulation, " group='Simulation Options' ");
+	TwAddButton(glApp->mainMenuBar, "Solve Rest Shape", solveRestShape, this, " group='Simulation Options' ");
+	TwAddButton(glApp->mainMenuBar, "Start/Stop Recording", toggleTrajectoryRecording, this, " group='Simulation Options' ");
 	
 	//TwAddButton(glApp->mainMenuBar, "Toggle Symmetric Body Pairs ", toggleSymBodyPair, this, " label='Symmetric Body Pairs' group='Operation' key='s' ");
 
@@ -26,6 +62,178 @@ StretchedSimWindow::StretchedSimWindow(int x, int y, int w, int h, GLApplication
 }
 
 StretchedSimWindow::~StretchedSimWindow(void) {
+	trajectoryRecorder.end();
+	detachDesignFabric();
+	delete particleSystem;
+	for (int i = 0; i < (int)coarseParticleSystems.size(); i++) {
+		delete coarseParticleSystems[i];
+	}
+}
+
+void StretchedSimWindow::loadTriangulation(DelaunayTriangulation triangulation) {
+	// A recording only holds one fabric
+	trajectoryRecorder.end();
+	simulationTime = 0;
+	for (int i = 0; i < (int)coarseParticleSystems.size(); i++) {
+		delete coarseParticleSystems[i];
+	}
+	coarseParticleSystems.clear();
+	triangulationLevels.clear();
+	levelExtrusions.clear();
+	detachDesignFabric();
+	delete particleSystem;
+	particleSystem = new StretchedParticleSystem(triangulation);
+	particleReordering.clear();
+	particleReordering.apply(*particleSystem);
+	Logger::consolePrint("Created particle system with %d particles and %d springs (spring bandwidth %d, %d in triangulation order)", particleSystem->getParticleCount(),
+		particleSystem->getSpringCount(), particleReordering.getBandwidthAfter(), particleReordering.getBandwidthBefore());
+}
+
+bool StretchedSimWindow::getDesignTriangulation(DelaunayTriangulation& triangulation) {
+	if (designWindow == NULL) {
+		Logger::consolePrint("No design window to load the fabric from");
+		return false;
+	}
+	triangulation = designWindow->getDelaunayTriangulation();
+	if (triangulation.getTriangulationIndices().empty()) {
+		Logger::consolePrint("The design has not been triangulated yet (press W in the design window)");
+		return false;
+	}
+	return true;
+}
+
+void StretchedSimWindow::loadDesignTriangulation() {
+	DelaunayTriangulation triangulation;
+	if (getDesignTriangulation(triangulation)) {
+		loadTriangulation(triangulation);
+	}
+}
+
+void StretchedSimWindow::loadDesignWithHydrogel() {
+	DelaunayTriangulation triangulation;
+	if (getDesignTriangulation(triangulation)) {
+		loadDesign(triangulation, designWindow->getExtrusions());
+	}
+}
+
+void StretchedSimWindow::loadDesignHierarchy() {
+	if (designWindow == NULL || designWindow->getExtrusions().empty()) {
+		Logger::consolePrint("No design to load the fabric from");
+		return;
+	}
+	std::vector<double> maxTriangleAreas(std::max(1, hierarchyLevels));
+	for (int i = (int)maxTriangleAreas.size() - 1; i >= 0; i--) {
+		maxTriangleAreas[i] = i + 1 == (int)maxTriangleAreas.size() ? hierarchyTriangleArea : 4 * maxTriangleAreas[i + 1];
+	}
+	loadTriangulationHierarchy(designWindow->getTriangulationHierarchy(maxTriangleAreas), designWindow->getExtrusions());
+}
+
+void StretchedSimWindow::followDesignEdits() {
+	if (designWindow == NULL) {
+		Logger::consolePrint("No design window to follow");
+		return;
+	}
+	attachDesignFabric(&designWindow->getDesignFabric());
+}
+
+void StretchedSimWindow::loadDesign(DelaunayTriangulation triangulation, const std::vector<StretchedExtrusion*>& extrusions) {
+	loadTriangulation(DelaunayTriangulation());
+	int hydrogelCount = hydrogelLayerBuilder.build(triangulation, extrusions, *particleSystem);
+	particleReordering.apply(*particleSystem);
+	Logger::consolePrint("Created particle system with %d particles (%d hydrogel) and %d springs", particleSystem->getParticleCount(), hydrogelCount, particleSystem->getSpringCount());
+}
+
+void StretchedSimWindow::attachDesignFabric(StretchedDesignFabric* fabric) {
+	loadTriangulation(DelaunayTriangulation());
+	fabric->attach(particleSystem);
+	attachedDesignFabric = fabric;
+	Logger::consolePrint("Attached design fabric with %d particles and %d springs", particleSystem->getParticleCount(), particleSystem->getSpringCount());
+}
+
+void StretchedSimWindow::detachDesignFabric() {
+	if (attachedDesignFabric != NULL && attachedDesignFabric->getAttachedSystem() == particleSystem) {
+		attachedDesignFabric->detach();
+	}
+	attachedDesignFabric = NULL;
+}
+
+void StretchedSimWindow::loadTriangulationHierarchy(std::vector<DelaunayTriangulation> levels, const std::vector<StretchedExtrusion*>& extrusions) {
+	if (levels.empty()) {
+		return;
+	}
+	// Copied before loading clears the previous copies, which extrusions may point into
+	std::vector<StretchedExtrusion> copies;
+	for (int i = 0; i < (int)extrusions.size(); i++) {
+		copies.push_back(*extrusions[i]);
+	}
+	std::vector<StretchedExtrusion*> copyPointers;
+	for (int i = 0; i < (int)copies.size(); i++) {
+		copyPointers.push_back(&copies[i]);
+	}
+	loadDesign(levels.back(), copyPointers);
+	triangulationLevels = levels;
+	levelExtrusions.swap(copies);
+	for (int i = 0; i + 1 < (int)levels.size(); i++) {
+		StretchedParticleSystem* level = new StretchedParticleSystem();
+		int hydrogelCount = hydrogelLayerBuilder.build(levels[i], copyPointers, *level);
+		coarseParticleSystems.push_back(level);
+		Logger::consolePrint("Created coarse level %d with %d particles (%d hydrogel)", i, level->getParticleCount(), hydrogelCount);
+	}
+}
+
+void StretchedSimWindow::advanceSimulation() {
+	if (particleSystem == NULL || !runSimulation) {
+		return;
+	}
+	particleSystem->step(DELTA_T);
+	simulationTime += DELTA_T;
+	if (trajectoryRecorder.isRecording()) {
+		trajectoryRecorder.record(getPositionsInOriginalOrder(), simulationTime);
+	}
+}
+
+const StretchedVectorArray& StretchedSimWindow::getPositionsInOriginalOrder() {
+	particleReordering.toOriginalOrder(particleSystem->positions, originalOrderPositions);
+	return originalOrderPositions;
+}
+
+void StretchedSimWindow::solveEquilibrium() {
+	if (particleSystem == NULL) {
+		return;
+	}
+	int iterations = 0;
+	if (coarseParticleSystems.empty()) {
+		iterations = particleSystem->solveEquilibrium();
+	} else {
+		// Prolongation needs every level in its rest shape, so the levels are rebuilt first
+		std::vector<StretchedExtrusion*> extrusions;
+		for (int i = 0; i < (int)levelExtrusions.size(); i++) {
+			extrusions.push_back(&levelExtrusions[i]);
+		}
+		loadTriangulationHierarchy(triangulationLevels, extrusions);
+		std::vector<StretchedParticleSystem*> levels = coarseParticleSystems;
+		levels.push_back(particleSystem);
+		iterations = multiresolutionSolver.solve(levels);
+	}
+	Logger::consolePrint("Rest shape solve took %d iterations (energy %lf)", iterations, particleSystem->equilibriumSolver.getLastEnergy());
+}
+
+void StretchedSimWindow::toggleRecording() {
+	if (trajectoryRecorder.isRecording()) {
+		int frames = trajectoryRecorder.getRecordedFrameCount();
+		uint64_t rawBytes = trajectoryRecorder.getRawBytes();
+		trajectoryRecorder.end();
+		Logger::consolePrint("Recorded %d frames (%d dropped) in %.1f KB, %.1fx smaller than raw positions", frames, trajectoryRecorder.getDroppedFrameCount(),
+			trajectoryRecorder.getWrittenBytes() / 1024.0, (double)rawBytes / std::max<uint64_t>(1, trajectoryRecorder.getWrittenBytes()));
+		return;
+	}
+	if (particleSystem == NULL) {
+		return;
+	}
+	if (trajectoryRecorder.begin("trajectory.sttr", getPositionsInOriginalOrder())) {
+		trajectoryRecorder.record(getPositionsInOriginalOrder(), simulationTime);
+		Logger::consolePrint("Recording trajectory.sttr");
+	}
 }
 
 void StretchedSimWindow::setupLights() {
@@ -258,6 +466,29 @@ void StretchedSimWindow::loadFile(const char* fName) {
 	std::string fileName;
 	fileName.assign(fName);
 	std::string fNameExt = fileName.substr(fileName.find_last_of('.') + 1);
+	if (fNameExt == STRETCHED_CHECKPOINT_EXTENSION) {
+		// Resume a simulation from a checkpoint written by saveFile
+		StretchedCheckpoint checkpoint;
+		StretchedParticleSystem *restored = new StretchedParticleSystem();
+		if (!checkpoint.open(fName) || !checkpoint.restore(*restored)) {
+			delete restored;
+			return;
+		}
+		for (int i = 0; i < (int)coarseParticleSystems.size(); i++) {
+			delete coarseParticleSystems[i];
+		}
+		coarseParticleSystems.clear();
+		triangulationLevels.clear();
+		detachDesignFabric();
+		delete particleSystem;
+		particleSystem = restored;
+		// Checkpoints hold the particles in simulation order
+		particleReordering.clear();
+		trajectoryRecorder.end();
+		simulationTime = checkpoint.getHeader().time;
+		Logger::consolePrint("Restored particle system with %d particles and %d springs", particleSystem->getParticleCount(), particleSystem->getSpringCount());
+		return;
+	}
 	delete robot;
 	robot = new RobotDesign();
 	robot->readRobotFromFile(fName);
@@ -265,10 +496,19 @@ void StretchedSimWindow::loadFile(const char* fName) {
 
 void StretchedSimWindow::saveFile(const char* fName) {
 	//robot->saveRobotToFile(fName);
+	if (particleSystem == NULL) {
+		return;
+	}
+	// The simulation state goes to a checkpoint, whatever the extension
+	if (StretchedCheckpoint::write(*particleSystem, fName, simulationTime)) {
+		Logger::consolePrint("Saved checkpoint of %d particles to \'%s\'", particleSystem->getParticleCount(), fName);
+	}
 }
 
 // Draw the AppRobotDesigner scene - camera transformations, lighting, shadows, reflections, etc AppRobotDesignerly to everything drawn by this method
 void StretchedSimWindow::drawScene() {
+	advanceSimulation();
+
 	glColor3d(1, 1, 1);
 	glDisable(GL_LIGHTING);
 	glPushMatrix();
@@ -277,6 +517,10 @@ void StretchedSimWindow::drawScene() {
 	glPopMatrix();
 
 	robot->draw();
+
+	if (particleSystem != NULL) {
+		particleSystem->draw();
+	}
 }
 
 // This is the wild west of drawing - things that want to ignore depth buffer, camera transformations, etc. Not pretty, quite hacky, but flexible. Individual apps should be careful with implementing this method. It always gets called right at the end of the draw function
@@ -9,6 +9,17 @@
 #include <GUILib/RotateWidgetV2.h>
 #include <GUILib/GLWindow3D.h>
 
+#include "DelaunayTriangulation.h"
+#include "StretchedDesignFabric.h"
+#include "StretchedExtrusion.h"
+#include "StretchedHydrogelLayerBuilder.h"
+#include "StretchedMultiresolutionSolver.h"
+#include "StretchedParticleReordering.h"
+#include "StretchedParticleSystem.h"
+#include "StretchedTrajectoryRecorder.h"
+
+class StretchedDesignWindow;
+
 /**
  * StretchedSimWindow
  */
@@ -24,6 +35,33 @@ private:
 public:
 
 	RobotDesign* robot;
+	// Window whose design the Load buttons build the fabric from (set by the application, may be NULL)
+	StretchedDesignWindow* designWindow = NULL;
+	// Native fabric simulation (NULL until a triangulation is loaded)
+	StretchedParticleSystem* particleSystem = NULL;
+	// Design whose edits are patched into particleSystem as they happen (NULL if none, see attachDesignFabric)
+	StretchedDesignFabric* attachedDesignFabric = NULL;
+	// Coarser versions of the same fabric (coarsest first) used to warm start the rest shape solve, may be empty
+	std::vector<StretchedParticleSystem*> coarseParticleSystems;
+	std::vector<DelaunayTriangulation> triangulationLevels;
+	// Copies of the extrusions whose hydrogel the levels were built with
+	std::vector<StretchedExtrusion> levelExtrusions;
+	StretchedMultiresolutionSolver multiresolutionSolver;
+	// Levels loaded by Load Design Hierarchy: the finest has triangles up to hierarchyTriangleArea, each
+	// coarser one up to four times the area of the next
+	int hierarchyLevels = 3;
+	double hierarchyTriangleArea = 1;
+	bool runSimulation = false;
+	// Time simulated since the fabric was loaded
+	double simulationTime = 0;
+	// Records every simulated step while running (see toggleRecording)
+	StretchedTrajectoryRecorder trajectoryRecorder;
+	// Renumbering of the particles of a loaded triangulation for cache locality (recordings keep the
+	// order of the triangulation)
+	StretchedParticleReordering particleReordering;
+	StretchedVectorArray originalOrderPositions;
+	// Settings of the hydrogel printed along the extrusions of designs loaded with loadDesign
+	StretchedHydrogelLayerBuilder hydrogelLayerBuilder;
 	// constructor
 	StretchedSimWindow(int x, int y, int w, int h, GLApplication* glApp);
 	// destructor
@@ -59,6 +97,37 @@ public:
 
 	void setupLights();
 
+	// Builds the particle system for the given triangulated fabric
+	void loadTriangulation(DelaunayTriangulation triangulation);
+	// Builds the particle system for the current triangulation of the design window
+	void loadDesignTriangulation();
+	// Same with hydrogel printed along the extrusions of the design window (see loadDesign)
+	void loadDesignWithHydrogel();
+	// Loads the design window's extrusion points triangulated at hierarchyLevels densities
+	void loadDesignHierarchy();
+	// Attaches the design window's incrementally triangulated fabric (see attachDesignFabric)
+	void followDesignEdits();
+	// The current triangulation of the design window, false (and logged why) if there is none
+	bool getDesignTriangulation(DelaunayTriangulation& triangulation);
+	// Builds the particle system for a design: the triangulated fabric plus hydrogel along its extrusions
+	void loadDesign(DelaunayTriangulation triangulation, const std::vector<StretchedExtrusion*>& extrusions);
+	// Builds one particle system per level (coarsest first) with hydrogel along the extrusions like
+	// loadDesign, the last one being the simulated fabric. Solving the rest shape then rebuilds the levels
+	// and goes coarse to fine.
+	void loadTriangulationHierarchy(std::vector<DelaunayTriangulation> levels, const std::vector<StretchedExtrusion*>& extrusions);
+	// Builds the particle system from the design fabric and keeps it following the edits of the design
+	// until another fabric is loaded
+	void attachDesignFabric(StretchedDesignFabric* fabric);
+	void detachDesignFabric();
+	// Advances the simulation by one timestep (DELTA_T) if it is running (once per frame, from drawScene)
+	void advanceSimulation();
+	// Moves the fabric straight to its rest shape (no time stepping)
+	void solveEquilibrium();
+	// Starts recording the fabric to trajectory.sttr, or stops the recording in progress
+	void toggleRecording();
+	// Particle positions in the order of the loaded triangulation
+	const StretchedVectorArray& getPositionsInOriginalOrder();
+
 	virtual void saveFile(const char* fName);
 	virtual void loadFile(const char* fName);
 
@@ -0,0 +1,233 @@
+#include "StretchedSleepTracker.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "StretchedParticleSystem.h"
+
+
+StretchedSleepTracker::StretchedSleepTracker() {
+	// Nothing to see here
+}
+
+StretchedSleepTracker::~StretchedSleepTracker() {
+	// Nothing to see here
+}
+
+void StretchedSleepTracker::invalidate() {
+	builtParticleCount = -1;
+	builtSpringCount = -1;
+}
+
+void StretchedSleepTracker::wakeAll() {
+	std::fill(tileAwake.begin(), tileAwake.end(), 1);
+	std::fill(quietSteps.begin(), quietSteps.end(), 0);
+	if (sleepingTileCount > 0) {
+		activeListsDirty = true;
+	}
+	sleepingTileCount = 0;
+}
+
+bool StretchedSleepTracker::isAllAwake() const {
+	return sleepingTileCount == 0;
+}
+
+const std::vector<int> &StretchedSleepTracker::getActiveParticles() const {
+	return activeParticles;
+}
+
+int StretchedSleepTracker::getTileCount() const {
+	return (int)tileAwake.size();
+}
+
+int StretchedSleepTracker::getSleepingTileCount() const {
+	return sleepingTileCount;
+}
+
+int StretchedSleepTracker::getActiveSpringCount() const {
+	return activeSprings.size();
+}
+
+void StretchedSleepTracker::beginStep(const StretchedParticleSystem &system) {
+	if (system.getParticleCount() != builtParticleCount || system.springs.size() != builtSpringCount) {
+		buildTiles(system);
+	}
+	if (activeListsDirty) {
+		buildActiveLists(system);
+	}
+}
+
+void StretchedSleepTracker::buildTiles(const StretchedParticleSystem &system) {
+	int n = system.getParticleCount();
+	builtParticleCount = n;
+	builtSpringCount = system.springs.size();
+	sleepingTileCount = 0;
+	activeListsDirty = true;
+
+	// Square tiles in the design plane, sized from the bounding box so each holds about particlesPerTile particles
+	int up = system.upAxis;
+	const std::vector<double> &u = (up + 1) % 3 == 0 ? system.positions.x : ((up + 1) % 3 == 1 ? system.positions.y : system.positions.z);
+	const std::vector<double> &v = (up + 2) % 3 == 0 ? system.positions.x : ((up + 2) % 3 == 1 ? system.positions.y : system.positions.z);
+	double minU = HUGE_VAL, minV = HUGE_VAL, maxU = -HUGE_VAL, maxV = -HUGE_VAL;
+	for (int i = 0; i < n; i++) {
+		minU = std::min(minU, u[i]);
+		maxU = std::max(maxU, u[i]);
+		minV = std::min(minV, v[i]);
+		maxV = std::max(maxV, v[i]);
+	}
+	double area = n > 0 ? std::max((maxU - minU) * (maxV - minV), EPSILON_CHECK) : 1;
+	double tileSize = std::max(sqrt(area * std::max(1, particlesPerTile) / std::max(1, n)), EPSILON_CHECK);
+	int columns = n > 0 ? std::max(1, (int)((maxU - minU) / tileSize) + 1) : 1;
+	int rows = n > 0 ? std::max(1, (int)((maxV - minV) / tileSize) + 1) : 1;
+
+	// Number the non-empty grid cells in order, then bucket the particles
+	std::vector<int> cellTiles((size_t)columns * rows, -1);
+	particleTiles.resize(n);
+	for (int i = 0; i < n; i++) {
+		int cu = std::min(columns - 1, (int)((u[i] - minU) / tileSize));
+		int cv = std::min(rows - 1, (int)((v[i] - minV) / tileSize));
+		particleTiles[i] = cu * rows + cv;
+		cellTiles[particleTiles[i]] = 0;
+	}
+	int tileCount = 0;
+	for (int c = 0; c < (int)cellTiles.size(); c++) {
+		if (cellTiles[c] == 0) {
+			cellTiles[c] = tileCount++;
+		}
+	}
+	tileStarts.assign(tileCount + 1, 0);
+	for (int i = 0; i < n; i++) {
+		particleTiles[i] = cellTiles[particleTiles[i]];
+		tileStarts[particleTiles[i] + 1]++;
+	}
+	for (int t = 0; t < tileCount; t++) {
+		tileStarts[t + 1] += tileStarts[t];
+	}
+	tileParticles.resize(n);
+	std::vector<int> next(tileStarts.begin(), tileStarts.end() - 1);
+	for (int i = 0; i < n; i++) {
+		tileParticles[next[particleTiles[i]]++] = i;
+	}
+
+	// Tiles connected by a spring are neighbours
+	std::vector<std::pair<int, int> > links;
+	const StretchedSpringTable &springs = system.springs;
+	for (int s = 0; s < springs.size(); s++) {
+		int ta = particleTiles[springs.indicesA[s]];
+		int tb = particleTiles[springs.indicesB[s]];
+		if (ta != tb) {
+			links.push_back(std::make_pair(ta, tb));
+			links.push_back(std::make_pair(tb, ta));
+		}
+	}
+	std::sort(links.begin(), links.end());
+	links.erase(std::unique(links.begin(), links.end()), links.end());
+	neighborStarts.assign(tileCount + 1, 0);
+	tileNeighbors.resize(links.size());
+	for (int k = 0; k < (int)links.size(); k++) {
+		neighborStarts[links[k].first + 1]++;
+		tileNeighbors[k] = links[k].second;
+	}
+	for (int t = 0; t < tileCount; t++) {
+		neighborStarts[t + 1] += neighborStarts[t];
+	}
+
+	tileAwake.assign(tileCount, 1);
+	quietSteps.assign(tileCount, 0);
+	tileMotion.assign(tileCount, 0.0);
+}
+
+void StretchedSleepTracker::buildActiveLists(const StretchedParticleSystem &system) {
+	activeListsDirty = false;
+	activeParticles.clear();
+	activeSprings.clear();
+	if (sleepingTileCount == 0) {
+		return;
+	}
+	int n = system.getParticleCount();
+	for (int i = 0; i < n; i++) {
+		if (tileAwake[particleTiles[i]]) {
+			activeParticles.push_back(i);
+		}
+	}
+	const StretchedSpringTable &springs = system.springs;
+	for (int s = 0; s < springs.size(); s++) {
+		int a = springs.indicesA[s];
+		int b = springs.indicesB[s];
+		if (tileAwake[particleTiles[a]] || tileAwake[particleTiles[b]]) {
+			activeSprings.add(a, b, springs.restLengths[s], springs.stiffnesses[s], springs.types[s], springs.restLengthRatios[s]);
+		}
+	}
+	// Same spring count with different springs would otherwise keep the old incidence list
+	activeSpringKernel.invalidate();
+}
+
+void StretchedSleepTracker::accumulateActiveSpringForces(const StretchedVectorArray &positions, StretchedVectorArray &forces, StretchedThreadPool *threadPool) {
+	activeSpringKernel.threadPool = threadPool;
+	activeSpringKernel.accumulateForces(activeSprings, positions, forces);
+}
+
+void StretchedSleepTracker::endStep(StretchedParticleSystem &system) {
+	int tileCount = (int)tileAwake.size();
+	if (builtParticleCount != system.getParticleCount()) {
+		return;
+	}
+	const double *px = system.positions.x.data(), *py = system.positions.y.data(), *pz = system.positions.z.data();
+	const double *ox = system.previousPositions.x.data(), *oy = system.previousPositions.y.data(), *oz = system.previousPositions.z.data();
+	const double *vx = system.velocities.x.data(), *vy = system.velocities.y.data(), *vz = system.velocities.z.data();
+	for (int t = 0; t < tileCount; t++) {
+		tileMotion[t] = 0;
+		if (!tileAwake[t]) {
+			continue;
+		}
+		double kineticEnergy = 0;
+		double maxSquaredDisplacement = 0;
+		int count = 0;
+		for (int k = tileStarts[t]; k < tileStarts[t + 1]; k++) {
+			int i = tileParticles[k];
+			if (system.inverseMasses[i] == 0) {
+				continue;
+			}
+			kineticEnergy += 0.5 * system.masses[i] * (vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i]);
+			double dx = px[i] - ox[i], dy = py[i] - oy[i], dz = pz[i] - oz[i];
+			maxSquaredDisplacement = std::max(maxSquaredDisplacement, dx * dx + dy * dy + dz * dz);
+			count++;
+		}
+		tileMotion[t] = sqrt(maxSquaredDisplacement);
+		bool quiet = kineticEnergy <= sleepKineticEnergy * std::max(1, count) && tileMotion[t] <= sleepDisplacement;
+		quietSteps[t] = quiet ? quietSteps[t] + 1 : 0;
+	}
+
+	// Tiles next to one that moves are woken (or kept awake), then the tiles that stayed quiet long enough sleep
+	for (int t = 0; t < tileCount; t++) {
+		if (!tileAwake[t] || tileMotion[t] <= wakeDisplacement) {
+			continue;
+		}
+		for (int k = neighborStarts[t]; k < neighborStarts[t + 1]; k++) {
+			int neighbor = tileNeighbors[k];
+			quietSteps[neighbor] = 0;
+			if (!tileAwake[neighbor]) {
+				tileAwake[neighbor] = 1;
+				sleepingTileCount--;
+				activeListsDirty = true;
+			}
+		}
+	}
+	double *mx = system.velocities.x.data(), *my = system.velocities.y.data(), *mz = system.velocities.z.data();
+	double *qx = system.previousPositions.x.data(), *qy = system.previousPositions.y.data(), *qz = system.previousPositions.z.data();
+	for (int t = 0; t < tileCount; t++) {
+		if (!tileAwake[t] || quietSteps[t] < stepsToSleep) {
+			continue;
+		}
+		tileAwake[t] = 0;
+		sleepingTileCount++;
+		activeListsDirty = true;
+		for (int k = tileStarts[t]; k < tileStarts[t + 1]; k++) {
+			int i = tileParticles[k];
+			mx[i] = my[i] = mz[i] = 0;
+			qx[i] = px[i];
+			qy[i] = py[i];
+			qz[i] = pz[i];
+		}
+	}
+}
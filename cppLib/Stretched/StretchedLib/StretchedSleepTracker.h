@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedSpringForceKernel.h"
+#include "StretchedSprings.h"
+
+class StretchedParticleSystem;
+
+// Per-tile sleeping for the explicit integrators. The particles are split into tiles of about
+// particlesPerTile particles by a grid over their positions in the design plane (taken when the tiles
+// are built), and tiles are neighbours when a spring connects them. After each step every awake tile
+// measures its mean kinetic energy and the largest distance one of its particles moved; a tile that
+// stays below both thresholds for stepsToSleep steps goes to sleep (velocities cleared, previous
+// positions set to the current ones). Sleeping tiles are woken as soon as a neighbouring tile moves
+// more than wakeDisplacement in a step, or by wakeAll.
+// While any tile sleeps, the system only clears and accumulates forces on and integrates the particles
+// of awake tiles, and only evaluates the springs with an awake end, so a settled fabric costs in
+// proportion to the region still moving. The position based constraints, collisions and the floor still
+// see every particle. The implicit and projective dynamics solves are global and ignore the tiles.
+class StretchedSleepTracker {
+
+public:
+	StretchedSleepTracker();
+	~StretchedSleepTracker();
+
+	int particlesPerTile = 64;
+	// Thresholds in the units of the simulation: mean 1/2 m v^2 per particle, and distance per step
+	double sleepKineticEnergy = 1e-7;
+	double sleepDisplacement = 1e-5;
+	// Should be above sleepDisplacement so tiles at the edge of a settling region do not flicker
+	double wakeDisplacement = 1e-4;
+	int stepsToSleep = 20;
+
+	// Builds the tiles if the particles or springs changed, and the active particle and spring lists
+	// if tiles fell asleep or woke up in the last step
+	void beginStep(const StretchedParticleSystem &system);
+	// Measures the motion of the awake tiles after a step, then wakes and puts tiles to sleep
+	void endStep(StretchedParticleSystem &system);
+	// Wakes every tile (call after moving particles by hand)
+	void wakeAll();
+	// Drops the tiles so they are rebuilt from the current positions on the next step
+	void invalidate();
+
+	bool isAllAwake() const;
+	// Particles of the awake tiles in ascending order (only meaningful when not all awake)
+	const std::vector<int> &getActiveParticles() const;
+	// forces += forces of the springs with at least one awake end, split over threadPool
+	void accumulateActiveSpringForces(const StretchedVectorArray &positions, StretchedVectorArray &forces, StretchedThreadPool *threadPool);
+
+	int getTileCount() const;
+	int getSleepingTileCount() const;
+	// Springs evaluated by accumulateActiveSpringForces
+	int getActiveSpringCount() const;
+
+private:
+	int builtParticleCount = -1;
+	int builtSpringCount = -1;
+	bool activeListsDirty = true;
+	int sleepingTileCount = 0;
+
+	std::vector<int> particleTiles;
+	// Particles of tile t are tileParticles[tileStarts[t], tileStarts[t + 1]), neighbours likewise
+	std::vector<int> tileStarts;
+	std::vector<int> tileParticles;
+	std::vector<int> neighborStarts;
+	std::vector<int> tileNeighbors;
+	std::vector<char> tileAwake;
+	std::vector<int> quietSteps;
+	std::vector<double> tileMotion;
+
+	std::vector<int> activeParticles;
+	// Copy of the springs with an awake end, with its own kernel so the full table's incidence stays valid
+	StretchedSpringTable activeSprings;
+	StretchedSpringForceKernel activeSpringKernel;
+
+	void buildTiles(const StretchedParticleSystem &system);
+	void buildActiveLists(const StretchedParticleSystem &system);
+};
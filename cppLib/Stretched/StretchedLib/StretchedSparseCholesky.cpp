@@ -0,0 +1,312 @@
+#include "StretchedSparseCholesky.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Utils/Logger.h"
+
+
+// Nested dissection stops splitting below this many particles
+static const int NESTED_DISSECTION_LEAF_SIZE = 64;
+
+// Orders vertices[begin, end) into ordering: both halves first, then the separator between them
+static void nestedDissection(std::vector<int> &vertices, int begin, int end, const StretchedSparseMatrix &A, const StretchedVectorArray &coordinates,
+	std::vector<int> &labels, int &nextLabel, std::vector<int> &ordering) {
+	int count = end - begin;
+	if (count <= NESTED_DISSECTION_LEAF_SIZE) {
+		ordering.insert(ordering.end(), vertices.begin() + begin, vertices.begin() + end);
+		return;
+	}
+
+	// Split at the median of the widest axis
+	const std::vector<double> *axes[3] = { &coordinates.x, &coordinates.y, &coordinates.z };
+	int axis = 0;
+	double widestExtent = -1;
+	for (int a = 0; a < 3; a++) {
+		const std::vector<double> &values = *axes[a];
+		double minValue = values[vertices[begin]], maxValue = minValue;
+		for (int i = begin + 1; i < end; i++) {
+			minValue = std::min(minValue, values[vertices[i]]);
+			maxValue = std::max(maxValue, values[vertices[i]]);
+		}
+		if (maxValue - minValue > widestExtent) {
+			widestExtent = maxValue - minValue;
+			axis = a;
+		}
+	}
+	const std::vector<double> &values = *axes[axis];
+	int middle = begin + count / 2;
+	std::nth_element(vertices.begin() + begin, vertices.begin() + middle, vertices.begin() + end, [&](int a, int b) {
+		return values[a] < values[b];
+	});
+
+	// The separator is every vertex of the second half with a neighbor in the first half
+	int leftLabel = ++nextLabel;
+	for (int i = begin; i < middle; i++) {
+		labels[vertices[i]] = leftLabel;
+	}
+	const int *starts = A.rowStarts.data();
+	const int *cols = A.columnIndices.data();
+	int separatorStart = (int)(std::partition(vertices.begin() + middle, vertices.begin() + end, [&](int v) {
+		for (int k = starts[v]; k < starts[v + 1]; k++) {
+			if (labels[cols[k]] == leftLabel) {
+				return false;
+			}
+		}
+		return true;
+	}) - vertices.begin());
+
+	nestedDissection(vertices, begin, middle, A, coordinates, labels, nextLabel, ordering);
+	nestedDissection(vertices, middle, separatorStart, A, coordinates, labels, nextLabel, ordering);
+	ordering.insert(ordering.end(), vertices.begin() + separatorStart, vertices.begin() + end);
+}
+
+StretchedSparseCholesky::StretchedSparseCholesky() {
+	// Nothing to see here
+}
+
+StretchedSparseCholesky::~StretchedSparseCholesky() {
+	// Nothing to see here
+}
+
+std::vector<int> StretchedSparseCholesky::computeNestedDissectionOrdering(const StretchedSparseMatrix &A, const StretchedVectorArray &coordinates) {
+	int rows = A.getRowCount();
+	std::vector<int> vertices(rows);
+	for (int i = 0; i < rows; i++) {
+		vertices[i] = i;
+	}
+	std::vector<int> labels(rows, 0);
+	std::vector<int> ordering;
+	ordering.reserve(rows);
+	int nextLabel = 0;
+	nestedDissection(vertices, 0, rows, A, coordinates, labels, nextLabel, ordering);
+	return ordering;
+}
+
+void StretchedSparseCholesky::analyze(const StretchedSparseMatrix &A, const std::vector<int> &ordering) {
+	n = A.getRowCount();
+	permutation.resize(n);
+	inversePermutation.resize(n);
+	for (int k = 0; k < n; k++) {
+		permutation[k] = ordering.empty() ? k : ordering[k];
+		inversePermutation[permutation[k]] = k;
+	}
+
+	// Column k of the permuted matrix is row permutation[k] of A (A is symmetric)
+	upperStarts.assign(n + 1, 0);
+	upperRows.clear();
+	upperSources.clear();
+	upperRows.reserve(A.getNonZeroCount() / 2 + n);
+	upperSources.reserve(A.getNonZeroCount() / 2 + n);
+	for (int k = 0; k < n; k++) {
+		int row = permutation[k];
+		for (int p = A.rowStarts[row]; p < A.rowStarts[row + 1]; p++) {
+			int i = inversePermutation[A.columnIndices[p]];
+			if (i <= k) {
+				upperRows.push_back(i);
+				upperSources.push_back(p);
+			}
+		}
+		upperStarts[k + 1] = (int)upperRows.size();
+	}
+
+	// Elimination tree (with path compression through the ancestors)
+	parent.assign(n, -1);
+	std::vector<int> ancestors(n, -1);
+	for (int k = 0; k < n; k++) {
+		for (int p = upperStarts[k]; p < upperStarts[k + 1]; p++) {
+			int i = upperRows[p];
+			while (i != -1 && i < k) {
+				int next = ancestors[i];
+				ancestors[i] = k;
+				if (next == -1) {
+					parent[i] = k;
+				}
+				i = next;
+			}
+		}
+	}
+
+	// Column counts of L from the row patterns
+	stack.resize(n);
+	flags.assign(n, -1);
+	std::vector<int> counts(n, 1);
+	for (int k = 0; k < n; k++) {
+		int top = reachRow(k);
+		for (int p = top; p < n; p++) {
+			counts[stack[p]]++;
+		}
+	}
+	columnStarts.assign(n + 1, 0);
+	for (int k = 0; k < n; k++) {
+		columnStarts[k + 1] = columnStarts[k] + counts[k];
+	}
+	rowIndices.resize(columnStarts[n]);
+	factorValues.resize(columnStarts[n]);
+	work.assign(n, 0.0);
+	nextEntry.resize(n);
+
+	analyzed = true;
+	factorized = false;
+}
+
+// Pattern of row k of L (the nodes reached from the entries of column k in the elimination tree),
+// written to stack[top, n) in topological order. Returns top.
+int StretchedSparseCholesky::reachRow(int k) {
+	int top = n;
+	flags[k] = k;
+	for (int p = upperStarts[k]; p < upperStarts[k + 1]; p++) {
+		int i = upperRows[p];
+		if (i >= k) {
+			continue;
+		}
+		int length = 0;
+		while (flags[i] != k) {
+			stack[length++] = i;
+			flags[i] = k;
+			i = parent[i];
+		}
+		// Move the path found to the top of the stack (it is above any path found before)
+		while (length > 0) {
+			stack[--top] = stack[--length];
+		}
+	}
+	return top;
+}
+
+bool StretchedSparseCholesky::factorize(const StretchedSparseMatrix &A) {
+	if (!analyzed || A.getRowCount() != n) {
+		Logger::consolePrint("Sparse Cholesky factorize called without a matching analyze\n");
+		factorized = false;
+		return false;
+	}
+	flags.assign(n, -1);
+	std::fill(work.begin(), work.end(), 0.0);
+	for (int k = 0; k < n; k++) {
+		nextEntry[k] = columnStarts[k];
+	}
+	const double *a = A.values.data();
+	for (int k = 0; k < n; k++) {
+		int top = reachRow(k);
+		for (int p = upperStarts[k]; p < upperStarts[k + 1]; p++) {
+			work[upperRows[p]] = a[upperSources[p]];
+		}
+		double d = work[k];
+		work[k] = 0;
+		// Sparse triangular solve for row k of L
+		for (int p = top; p < n; p++) {
+			int i = stack[p];
+			double lki = work[i] / factorValues[columnStarts[i]];
+			work[i] = 0;
+			for (int q = columnStarts[i] + 1; q < nextEntry[i]; q++) {
+				work[rowIndices[q]] -= factorValues[q] * lki;
+			}
+			d -= lki * lki;
+			int q = nextEntry[i]++;
+			rowIndices[q] = k;
+			factorValues[q] = lki;
+		}
+		if (d <= 0) {
+			if (logIndefinite) {
+				Logger::consolePrint("Sparse Cholesky: matrix is not positive definite\n");
+			}
+			factorized = false;
+			return false;
+		}
+		int q = nextEntry[k]++;
+		rowIndices[q] = k;
+		factorValues[q] = sqrt(d);
+	}
+	factorized = true;
+	return true;
+}
+
+void StretchedSparseCholesky::solve(double *b) {
+	for (int k = 0; k < n; k++) {
+		work[k] = b[permutation[k]];
+	}
+	// L y = P b
+	for (int j = 0; j < n; j++) {
+		work[j] /= factorValues[columnStarts[j]];
+		double xj = work[j];
+		for (int p = columnStarts[j] + 1; p < columnStarts[j + 1]; p++) {
+			work[rowIndices[p]] -= factorValues[p] * xj;
+		}
+	}
+	// L^T z = y
+	for (int j = n - 1; j >= 0; j--) {
+		double xj = work[j];
+		for (int p = columnStarts[j] + 1; p < columnStarts[j + 1]; p++) {
+			xj -= factorValues[p] * work[rowIndices[p]];
+		}
+		work[j] = xj / factorValues[columnStarts[j]];
+	}
+	for (int k = 0; k < n; k++) {
+		b[permutation[k]] = work[k];
+	}
+}
+
+void StretchedSparseCholesky::solve(std::vector<double> &b) {
+	solve(b.data());
+}
+
+void StretchedSparseCholesky::solve(StretchedVectorArray &b) {
+	// Interleaved (x, y, z) so each entry of L is loaded once for the three solves
+	work3.resize(3 * n);
+	double *w = work3.data();
+	for (int k = 0; k < n; k++) {
+		int i = permutation[k];
+		w[3 * k] = b.x[i];
+		w[3 * k + 1] = b.y[i];
+		w[3 * k + 2] = b.z[i];
+	}
+	for (int j = 0; j < n; j++) {
+		double inverseDiagonal = 1.0 / factorValues[columnStarts[j]];
+		double xj = w[3 * j] *= inverseDiagonal;
+		double yj = w[3 * j + 1] *= inverseDiagonal;
+		double zj = w[3 * j + 2] *= inverseDiagonal;
+		for (int p = columnStarts[j] + 1; p < columnStarts[j + 1]; p++) {
+			double l = factorValues[p];
+			double *wi = w + 3 * rowIndices[p];
+			wi[0] -= l * xj;
+			wi[1] -= l * yj;
+			wi[2] -= l * zj;
+		}
+	}
+	for (int j = n - 1; j >= 0; j--) {
+		double xj = w[3 * j], yj = w[3 * j + 1], zj = w[3 * j + 2];
+		for (int p = columnStarts[j] + 1; p < columnStarts[j + 1]; p++) {
+			double l = factorValues[p];
+			const double *wi = w + 3 * rowIndices[p];
+			xj -= l * wi[0];
+			yj -= l * wi[1];
+			zj -= l * wi[2];
+		}
+		double inverseDiagonal = 1.0 / factorValues[columnStarts[j]];
+		w[3 * j] = xj * inverseDiagonal;
+		w[3 * j + 1] = yj * inverseDiagonal;
+		w[3 * j + 2] = zj * inverseDiagonal;
+	}
+	for (int k = 0; k < n; k++) {
+		int i = permutation[k];
+		b.x[i] = w[3 * k];
+		b.y[i] = w[3 * k + 1];
+		b.z[i] = w[3 * k + 2];
+	}
+}
+
+bool StretchedSparseCholesky::isAnalyzed() const {
+	return analyzed;
+}
+
+bool StretchedSparseCholesky::isFactorized() const {
+	return factorized;
+}
+
+int StretchedSparseCholesky::getSize() const {
+	return n;
+}
+
+int StretchedSparseCholesky::getFactorNonZeroCount() const {
+	return columnStarts.empty() ? 0 : columnStarts[n];
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedSparseMatrix.h"
+#include "StretchedVectorArray.h"
+
+// Sparse Cholesky (L L^T) factorization of a symmetric positive definite matrix.
+// analyze() computes the elimination tree and the pattern of L for a fill reducing ordering,
+// factorize() computes the values (up-looking, row by row) and can be called again as long
+// as the sparsity pattern of the matrix is unchanged. The matrix is given with both triangles stored.
+class StretchedSparseCholesky {
+
+public:
+	StretchedSparseCholesky();
+	~StretchedSparseCholesky();
+
+	// Symbolic factorization. ordering[k] is the row of A eliminated k-th (empty keeps the natural order).
+	void analyze(const StretchedSparseMatrix &A, const std::vector<int> &ordering);
+	// Numeric factorization. Returns false if the matrix is not positive definite.
+	bool factorize(const StretchedSparseMatrix &A);
+
+	// Logs the matrices that are not positive definite (off for callers that expect it and shift the matrix)
+	bool logIndefinite = true;
+
+	// Solves A x = b in place (b holds x on return)
+	void solve(double *b);
+	void solve(std::vector<double> &b);
+	// Solves the x, y and z right hand sides together (one pass over L for all three)
+	void solve(StretchedVectorArray &b);
+
+	bool isAnalyzed() const;
+	bool isFactorized() const;
+	int getSize() const;
+	int getFactorNonZeroCount() const;
+
+	// Geometric nested dissection: recursively splits the particles at the median of their widest axis and
+	// eliminates the separating particles last. Keeps the fill of mesh-like matrices at O(n log n).
+	static std::vector<int> computeNestedDissectionOrdering(const StretchedSparseMatrix &A, const StretchedVectorArray &coordinates);
+
+private:
+	int n = 0;
+	bool analyzed = false;
+	bool factorized = false;
+
+	// ordering (new -> old) and its inverse (old -> new)
+	std::vector<int> permutation;
+	std::vector<int> inversePermutation;
+
+	// Upper triangle of the permuted matrix by column, with the index of each entry in A.values
+	std::vector<int> upperStarts;
+	std::vector<int> upperRows;
+	std::vector<int> upperSources;
+
+	// Elimination tree
+	std::vector<int> parent;
+
+	// L by column (compressed sparse column), the diagonal entry first in each column
+	std::vector<int> columnStarts;
+	std::vector<int> rowIndices;
+	std::vector<double> factorValues;
+
+	// Scratch buffers
+	std::vector<double> work;
+	std::vector<double> work3;
+	std::vector<int> stack;
+	std::vector<int> flags;
+	std::vector<int> nextEntry;
+
+	int reachRow(int k);
+};
@@ -0,0 +1,119 @@
+#include "StretchedSparseMatrix.h"
+
+#include <algorithm>
+#include <utility>
+
+
+StretchedSparseMatrix::StretchedSparseMatrix() : StretchedSparseMatrix(0, 0) {
+	// Nothing to see here
+}
+
+StretchedSparseMatrix::StretchedSparseMatrix(int rows, int cols) {
+	this->rows = rows;
+	this->cols = cols;
+	rowStarts.assign(rows + 1, 0);
+}
+
+StretchedSparseMatrix::~StretchedSparseMatrix() {
+	// Nothing to see here
+}
+
+void StretchedSparseMatrix::setFromTriplets(int rows, int cols, std::vector<StretchedSparseTriplet> &triplets) {
+	this->rows = rows;
+	this->cols = cols;
+	int tripletsSize = (int)triplets.size();
+
+	// Bucket the triplets by row (counting sort), then sort + merge the columns of each row
+	std::vector<int> bucketStarts(rows + 1, 0);
+	for (int i = 0; i < tripletsSize; i++) {
+		bucketStarts[triplets[i].row + 1]++;
+	}
+	for (int r = 0; r < rows; r++) {
+		bucketStarts[r + 1] += bucketStarts[r];
+	}
+	std::vector<int> next(bucketStarts.begin(), bucketStarts.end() - 1);
+	std::vector<int> bucketColumns(tripletsSize);
+	std::vector<double> bucketValues(tripletsSize);
+	for (int i = 0; i < tripletsSize; i++) {
+		int slot = next[triplets[i].row]++;
+		bucketColumns[slot] = triplets[i].col;
+		bucketValues[slot] = triplets[i].value;
+	}
+
+	rowStarts.assign(rows + 1, 0);
+	columnIndices.clear();
+	values.clear();
+	columnIndices.reserve(tripletsSize);
+	values.reserve(tripletsSize);
+	std::vector<std::pair<int, double> > rowEntries;
+	for (int r = 0; r < rows; r++) {
+		rowEntries.clear();
+		for (int k = bucketStarts[r]; k < bucketStarts[r + 1]; k++) {
+			rowEntries.push_back(std::make_pair(bucketColumns[k], bucketValues[k]));
+		}
+		std::sort(rowEntries.begin(), rowEntries.end(), [](const std::pair<int, double> &a, const std::pair<int, double> &b) {
+			return a.first < b.first;
+		});
+		int entriesSize = (int)rowEntries.size();
+		int k = 0;
+		while (k < entriesSize) {
+			int col = rowEntries[k].first;
+			double sum = 0;
+			while (k < entriesSize && rowEntries[k].first == col) {
+				sum += rowEntries[k].second;
+				k++;
+			}
+			columnIndices.push_back(col);
+			values.push_back(sum);
+		}
+		rowStarts[r + 1] = (int)columnIndices.size();
+	}
+}
+
+void StretchedSparseMatrix::multiply(const double *x, double *y) const {
+	const int *starts = rowStarts.data();
+	const int *cols = columnIndices.data();
+	const double *vals = values.data();
+	for (int r = 0; r < rows; r++) {
+		double sum = 0;
+		for (int k = starts[r]; k < starts[r + 1]; k++) {
+			sum += vals[k] * x[cols[k]];
+		}
+		y[r] = sum;
+	}
+}
+
+void StretchedSparseMatrix::multiply(const std::vector<double> &x, std::vector<double> &y) const {
+	y.resize(rows);
+	multiply(x.data(), y.data());
+}
+
+std::vector<double> StretchedSparseMatrix::getDiagonal() const {
+	std::vector<double> diagonal(rows, 0.0);
+	for (int r = 0; r < rows; r++) {
+		diagonal[r] = getValue(r, r);
+	}
+	return diagonal;
+}
+
+double StretchedSparseMatrix::getValue(int row, int col) const {
+	const int *begin = columnIndices.data() + rowStarts[row];
+	const int *end = columnIndices.data() + rowStarts[row + 1];
+	const int *it = std::lower_bound(begin, end, col);
+	if (it == end || *it != col) {
+		return 0.0;
+	}
+	return values[it - columnIndices.data()];
+}
+
+int StretchedSparseMatrix::getRowCount() const {
+	return rows;
+}
+
+int StretchedSparseMatrix::getColumnCount() const {
+	return cols;
+}
+
+int StretchedSparseMatrix::getNonZeroCount() const {
+	return (int)values.size();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+// Single (row, col, value) entry used to assemble a sparse matrix.
+// Duplicate entries are summed when the matrix is built.
+struct StretchedSparseTriplet {
+	int row;
+	int col;
+	double value;
+
+	StretchedSparseTriplet(int row, int col, double value) : row(row), col(col), value(value) {
+		// Nothing to see here
+	}
+};
+
+// Compressed sparse row (CSR) matrix used by the implicit solvers
+class StretchedSparseMatrix {
+
+public:
+	StretchedSparseMatrix();
+	StretchedSparseMatrix(int rows, int cols);
+	~StretchedSparseMatrix();
+
+	// Row i occupies [rowStarts[i], rowStarts[i + 1]) of columnIndices/values, columns sorted ascending
+	std::vector<int> rowStarts;
+	std::vector<int> columnIndices;
+	std::vector<double> values;
+
+	// Builds the matrix from (unsorted) triplets, summing duplicates
+	void setFromTriplets(int rows, int cols, std::vector<StretchedSparseTriplet> &triplets);
+
+	// y = A * x
+	void multiply(const double *x, double *y) const;
+	void multiply(const std::vector<double> &x, std::vector<double> &y) const;
+
+	// Returns the diagonal entries (0 where a row has no diagonal entry)
+	std::vector<double> getDiagonal() const;
+	// Returns the value at (row, col) or 0 if the entry is not stored
+	double getValue(int row, int col) const;
+
+	int getRowCount() const;
+	int getColumnCount() const;
+	int getNonZeroCount() const;
+
+private:
+	int rows;
+	int cols;
+};
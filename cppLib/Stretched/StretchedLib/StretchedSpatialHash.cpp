@@ -0,0 +1,162 @@
+#include "StretchedSpatialHash.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Cell coordinates are clamped to +-2^30 so neighbor cell ranges stay inside the int range
+static const double MAX_CELL_COORDINATE = 1 << 30;
+
+StretchedSpatialHash::StretchedSpatialHash() {
+	// Nothing to see here
+}
+
+StretchedSpatialHash::~StretchedSpatialHash() {
+	// Nothing to see here
+}
+
+double StretchedSpatialHash::getCellSize() const {
+	return cellSize;
+}
+
+int StretchedSpatialHash::getBucketCount() const {
+	return std::max(0, (int)bucketStarts.size() - 1);
+}
+
+int StretchedSpatialHash::getCellCoordinate(double value) const {
+	// Converting NaN or a value out of the int range is undefined - a diverged particle goes to the
+	// outermost cell (NaN to cell 0) and never comes within the radius of anything
+	double cell = floor(value * inverseCellSize);
+	if (!(cell == cell)) {
+		return 0;
+	}
+	return (int)std::max(-MAX_CELL_COORDINATE, std::min(MAX_CELL_COORDINATE, cell));
+}
+
+int StretchedSpatialHash::getBucket(int cx, int cy, int cz) const {
+	// Large primes hashing (Teschner et al.) - the bucket count is a power of two
+	unsigned int hash = ((unsigned int)cx * 73856093u) ^ ((unsigned int)cy * 19349663u) ^ ((unsigned int)cz * 83492791u);
+	return (int)(hash & (unsigned int)(bucketStarts.size() - 2));
+}
+
+int StretchedSpatialHash::getNeighborBuckets(double x, double y, double z, double radius, int buckets[27]) const {
+	// Cells overlapping the box [p - radius, p + radius]: 1 or 2 per axis when radius <= cellSize / 2
+	int minX = getCellCoordinate(x - radius), maxX = getCellCoordinate(x + radius);
+	int minY = getCellCoordinate(y - radius), maxY = getCellCoordinate(y + radius);
+	int minZ = getCellCoordinate(z - radius), maxZ = getCellCoordinate(z + radius);
+	int count = 0;
+	for (int cx = minX; cx <= maxX; cx++) {
+		for (int cy = minY; cy <= maxY; cy++) {
+			for (int cz = minZ; cz <= maxZ; cz++) {
+				buckets[count++] = getBucket(cx, cy, cz);
+			}
+		}
+	}
+	// Different cells can share a bucket - visit each bucket once
+	std::sort(buckets, buckets + count);
+	return (int)(std::unique(buckets, buckets + count) - buckets);
+}
+
+void StretchedSpatialHash::build(const StretchedVectorArray &points, double cellSize) {
+	this->cellSize = cellSize;
+	inverseCellSize = 1.0 / cellSize;
+	int n = points.size();
+
+	// Power of two bucket count of at least twice the number of points
+	int bucketCount = 1;
+	while (bucketCount < 2 * n) {
+		bucketCount *= 2;
+	}
+
+	// Counting sort of the points by bucket
+	bucketStarts.assign(bucketCount + 1, 0);
+	pointBuckets.resize(n);
+	for (int i = 0; i < n; i++) {
+		int bucket = getBucket(getCellCoordinate(points.x[i]), getCellCoordinate(points.y[i]), getCellCoordinate(points.z[i]));
+		pointBuckets[i] = bucket;
+		bucketStarts[bucket + 1]++;
+	}
+	for (int b = 0; b < bucketCount; b++) {
+		bucketStarts[b + 1] += bucketStarts[b];
+	}
+	nextSlots.assign(bucketStarts.begin(), bucketStarts.end() - 1);
+	sortedPoints.resize(n);
+	for (int i = 0; i < n; i++) {
+		sortedPoints[nextSlots[pointBuckets[i]]++] = i;
+	}
+	sortedX.resize(n);
+	sortedY.resize(n);
+	sortedZ.resize(n);
+	for (int p = 0; p < n; p++) {
+		int i = sortedPoints[p];
+		sortedX[p] = points.x[i];
+		sortedY[p] = points.y[i];
+		sortedZ[p] = points.z[i];
+	}
+}
+
+void StretchedSpatialHash::findPairs(const StretchedVectorArray &points, double radius, std::vector<int> &pairsA, std::vector<int> &pairsB) {
+	int n = points.size();
+	double sqRadius = radius * radius;
+	const double *px = points.x.data(), *py = points.y.data(), *pz = points.z.data();
+	const double *sx = sortedX.data(), *sy = sortedY.data(), *sz = sortedZ.data();
+	int buckets[27];
+	firstPairs.assign(n + 1, 0);
+	candidatesA.clear();
+	candidatesB.clear();
+
+	// Candidates are read from the bucket ordered copy of the positions
+	for (int i = 0; i < n; i++) {
+		int bucketCount = getNeighborBuckets(px[i], py[i], pz[i], radius, buckets);
+		for (int k = 0; k < bucketCount; k++) {
+			int bucket = buckets[k];
+			for (int p = bucketStarts[bucket]; p < bucketStarts[bucket + 1]; p++) {
+				int j = sortedPoints[p];
+				if (j <= i) {
+					continue;
+				}
+				double dx = sx[p] - px[i], dy = sy[p] - py[i], dz = sz[p] - pz[i];
+				if (dx * dx + dy * dy + dz * dz < sqRadius) {
+					candidatesA.push_back(i);
+					candidatesB.push_back(j);
+					firstPairs[i + 1]++;
+				}
+			}
+		}
+	}
+
+	// Counting sort of the pairs by a, then sort the partners of each a, so the result does not depend on the hash layout
+	for (int i = 0; i < n; i++) {
+		firstPairs[i + 1] += firstPairs[i];
+	}
+	int offset = (int)pairsA.size();
+	int pairCount = (int)candidatesA.size();
+	pairsA.resize(offset + pairCount);
+	pairsB.resize(offset + pairCount);
+	for (int k = 0; k < pairCount; k++) {
+		int slot = offset + firstPairs[candidatesA[k]]++;
+		pairsA[slot] = candidatesA[k];
+		pairsB[slot] = candidatesB[k];
+	}
+	for (int i = 0, start = offset; i < n; i++) {
+		int end = offset + firstPairs[i];
+		if (end - start > 1) {
+			std::sort(pairsB.begin() + start, pairsB.begin() + end);
+		}
+		start = end;
+	}
+}
+
+void StretchedSpatialHash::findNeighbors(const P3D &position, double radius, std::vector<int> &neighbors) {
+	double sqRadius = radius * radius;
+	int buckets[27];
+	int bucketCount = getNeighborBuckets(position[0], position[1], position[2], radius, buckets);
+	for (int k = 0; k < bucketCount; k++) {
+		int bucket = buckets[k];
+		for (int p = bucketStarts[bucket]; p < bucketStarts[bucket + 1]; p++) {
+			double dx = sortedX[p] - position[0], dy = sortedY[p] - position[1], dz = sortedZ[p] - position[2];
+			if (dx * dx + dy * dy + dz * dz < sqRadius) {
+				neighbors.push_back(sortedPoints[p]);
+			}
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedVectorArray.h"
+
+// Uniform grid spatial hash over the particles, rebuilt every step.
+// Particles are bucketed by the hash of their grid cell with a counting sort (O(n), no allocation once
+// warmed up), so finding every pair closer than a radius only visits the cells overlapping the radius
+// around each particle: 8 cells when the cell size is twice the radius.
+class StretchedSpatialHash {
+
+public:
+	StretchedSpatialHash();
+	~StretchedSpatialHash();
+
+	// Buckets the points into cells of the given size
+	void build(const StretchedVectorArray &points, double cellSize);
+
+	// Appends every pair (a < b) with |x_a - x_b| < radius, using the points given to build.
+	// radius must not be larger than the cell size. Pairs are sorted by a, then b.
+	void findPairs(const StretchedVectorArray &points, double radius, std::vector<int> &pairsA, std::vector<int> &pairsB);
+
+	// Appends the indices of the points given to build within radius of the position (radius <= cell
+	// size, any order)
+	void findNeighbors(const P3D &position, double radius, std::vector<int> &neighbors);
+
+	double getCellSize() const;
+	int getBucketCount() const;
+
+private:
+	double cellSize = 1;
+	double inverseCellSize = 1;
+
+	// Points of bucket b are sortedPoints[bucketStarts[b], bucketStarts[b + 1])
+	std::vector<int> bucketStarts;
+	std::vector<int> sortedPoints;
+	std::vector<int> pointBuckets;
+	std::vector<int> nextSlots;
+	// Positions in bucket order (sortedX[p] is the x of sortedPoints[p])
+	std::vector<double> sortedX;
+	std::vector<double> sortedY;
+	std::vector<double> sortedZ;
+	// Scratch for findPairs
+	std::vector<int> candidatesA;
+	std::vector<int> candidatesB;
+	std::vector<int> firstPairs;
+
+	int getCellCoordinate(double value) const;
+	int getBucket(int cx, int cy, int cz) const;
+	// Collects the distinct buckets of the cells within radius of a position, returns how many
+	int getNeighborBuckets(double x, double y, double z, double radius, int buckets[27]) const;
+};
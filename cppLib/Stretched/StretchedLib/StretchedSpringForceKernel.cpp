@@ -0,0 +1,231 @@
+#include "StretchedSpringForceKernel.h"
+
+#include <cmath>
+
+#include "StretchedConstants.h"
+#include "StretchedStepPolicies.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define STRETCHED_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC accepts the intrinsics of any instruction set; GCC/Clang need them enabled per function
+#if defined(STRETCHED_SIMD_X86) && defined(__GNUC__)
+#define STRETCHED_TARGET_SSE2 __attribute__((target("sse2")))
+#define STRETCHED_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define STRETCHED_TARGET_SSE2
+#define STRETCHED_TARGET_AVX2
+#endif
+
+
+// Smaller passes run on the calling thread only
+static const int MIN_SPRINGS_PER_THREAD = 2048;
+static const int MIN_PARTICLES_PER_THREAD = 2048;
+
+// Arrays read and written by the spring kernels
+struct StretchedSpringKernelArgs {
+	const double *px;
+	const double *py;
+	const double *pz;
+	const int *indicesA;
+	const int *indicesB;
+	const double *restLengths;
+	const double *stiffnesses;
+	// Interleaved (x, y, z) per spring, so the gather touches one cache line per spring
+	double *springForces;
+};
+
+// The shared loop of StretchedStepPolicies.h
+static void computeSpringForcesScalar(const StretchedSpringKernelArgs &args, int begin, int end) {
+	StretchedSpringArrays<double> springs = { args.indicesA, args.indicesB, args.restLengths, args.stiffnesses };
+	StretchedStepLoops<double>::computeSpringForces(springs, args.px, args.py, args.pz, args.springForces, begin, end);
+}
+
+#ifdef STRETCHED_SIMD_X86
+
+// Same arithmetic as the scalar kernel (no fused multiply-add) so every level gives identical forces
+STRETCHED_TARGET_SSE2 static void computeSpringForcesSSE2(const StretchedSpringKernelArgs &args, int begin, int end) {
+	const __m128d signMask = _mm_set1_pd(-0.0);
+	const __m128d epsilon = _mm_set1_pd(EPSILON_CHECK);
+	int s = begin;
+	for (; s + 2 <= end; s += 2) {
+		int a0 = args.indicesA[s], a1 = args.indicesA[s + 1];
+		int b0 = args.indicesB[s], b1 = args.indicesB[s + 1];
+		__m128d dx = _mm_sub_pd(_mm_set_pd(args.px[a1], args.px[a0]), _mm_set_pd(args.px[b1], args.px[b0]));
+		__m128d dy = _mm_sub_pd(_mm_set_pd(args.py[a1], args.py[a0]), _mm_set_pd(args.py[b1], args.py[b0]));
+		__m128d dz = _mm_sub_pd(_mm_set_pd(args.pz[a1], args.pz[a0]), _mm_set_pd(args.pz[b1], args.pz[b0]));
+		__m128d length = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz)));
+		__m128d negativeStiffness = _mm_xor_pd(_mm_loadu_pd(args.stiffnesses + s), signMask);
+		__m128d scale = _mm_div_pd(_mm_mul_pd(negativeStiffness, _mm_sub_pd(length, _mm_loadu_pd(args.restLengths + s))), length);
+		scale = _mm_and_pd(scale, _mm_cmpge_pd(length, epsilon));
+		__m128d fx = _mm_mul_pd(scale, dx), fy = _mm_mul_pd(scale, dy), fz = _mm_mul_pd(scale, dz);
+		// (x0 y0) (z0 x1) (y1 z1)
+		double *out = args.springForces + 3 * s;
+		_mm_storeu_pd(out, _mm_unpacklo_pd(fx, fy));
+		_mm_storeu_pd(out + 2, _mm_shuffle_pd(fz, fx, 2));
+		_mm_storeu_pd(out + 4, _mm_unpackhi_pd(fy, fz));
+	}
+	computeSpringForcesScalar(args, s, end);
+}
+
+STRETCHED_TARGET_AVX2 static void computeSpringForcesAVX2(const StretchedSpringKernelArgs &args, int begin, int end) {
+	const __m256d signMask = _mm256_set1_pd(-0.0);
+	const __m256d epsilon = _mm256_set1_pd(EPSILON_CHECK);
+	int s = begin;
+	for (; s + 4 <= end; s += 4) {
+		const int *ia = args.indicesA + s, *ib = args.indicesB + s;
+		__m256d dx = _mm256_sub_pd(_mm256_set_pd(args.px[ia[3]], args.px[ia[2]], args.px[ia[1]], args.px[ia[0]]), _mm256_set_pd(args.px[ib[3]], args.px[ib[2]], args.px[ib[1]], args.px[ib[0]]));
+		__m256d dy = _mm256_sub_pd(_mm256_set_pd(args.py[ia[3]], args.py[ia[2]], args.py[ia[1]], args.py[ia[0]]), _mm256_set_pd(args.py[ib[3]], args.py[ib[2]], args.py[ib[1]], args.py[ib[0]]));
+		__m256d dz = _mm256_sub_pd(_mm256_set_pd(args.pz[ia[3]], args.pz[ia[2]], args.pz[ia[1]], args.pz[ia[0]]), _mm256_set_pd(args.pz[ib[3]], args.pz[ib[2]], args.pz[ib[1]], args.pz[ib[0]]));
+		__m256d length = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz)));
+		__m256d negativeStiffness = _mm256_xor_pd(_mm256_loadu_pd(args.stiffnesses + s), signMask);
+		__m256d scale = _mm256_div_pd(_mm256_mul_pd(negativeStiffness, _mm256_sub_pd(length, _mm256_loadu_pd(args.restLengths + s))), length);
+		scale = _mm256_and_pd(scale, _mm256_cmp_pd(length, epsilon, _CMP_GE_OQ));
+		__m256d fx = _mm256_mul_pd(scale, dx), fy = _mm256_mul_pd(scale, dy), fz = _mm256_mul_pd(scale, dz);
+		// Interleave two springs per 128 bit half: (x0 y0) (z0 x1) (y1 z1)
+		double *out = args.springForces + 3 * s;
+		__m128d fxLow = _mm256_castpd256_pd128(fx), fyLow = _mm256_castpd256_pd128(fy), fzLow = _mm256_castpd256_pd128(fz);
+		__m128d fxHigh = _mm256_extractf128_pd(fx, 1), fyHigh = _mm256_extractf128_pd(fy, 1), fzHigh = _mm256_extractf128_pd(fz, 1);
+		_mm_storeu_pd(out, _mm_unpacklo_pd(fxLow, fyLow));
+		_mm_storeu_pd(out + 2, _mm_shuffle_pd(fzLow, fxLow, 2));
+		_mm_storeu_pd(out + 4, _mm_unpackhi_pd(fyLow, fzLow));
+		_mm_storeu_pd(out + 6, _mm_unpacklo_pd(fxHigh, fyHigh));
+		_mm_storeu_pd(out + 8, _mm_shuffle_pd(fzHigh, fxHigh, 2));
+		_mm_storeu_pd(out + 10, _mm_unpackhi_pd(fyHigh, fzHigh));
+	}
+	computeSpringForcesScalar(args, s, end);
+}
+
+#endif
+
+static void computeSpringForces(StretchedSimdLevel simdLevel, const StretchedSpringKernelArgs &args, int begin, int end) {
+	switch (simdLevel) {
+#ifdef STRETCHED_SIMD_X86
+		case SIMD_AVX2:
+			computeSpringForcesAVX2(args, begin, end);
+			break;
+		case SIMD_SSE2:
+			computeSpringForcesSSE2(args, begin, end);
+			break;
+#endif
+		default:
+			computeSpringForcesScalar(args, begin, end);
+			break;
+	}
+}
+
+StretchedSpringForceKernel::StretchedSpringForceKernel() {
+	// Nothing to see here
+}
+
+StretchedSpringForceKernel::~StretchedSpringForceKernel() {
+	// Nothing to see here
+}
+
+StretchedSimdLevel StretchedSpringForceKernel::detectSimdLevel() {
+#if defined(STRETCHED_SIMD_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0
+		&& (_xgetbv(0) & 6) == 6;
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osSavesAvx) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+	return avx2 ? SIMD_AVX2 : (sse2 ? SIMD_SSE2 : SIMD_SCALAR);
+#elif defined(STRETCHED_SIMD_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return SIMD_AVX2;
+	}
+	return __builtin_cpu_supports("sse2") ? SIMD_SSE2 : SIMD_SCALAR;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+const char *StretchedSpringForceKernel::getSimdLevelName(StretchedSimdLevel level) {
+	switch (level) {
+		case SIMD_AVX2:
+			return "AVX2";
+		case SIMD_SSE2:
+			return "SSE2";
+		case SIMD_SCALAR:
+		default:
+			return "scalar";
+	}
+}
+
+void StretchedSpringForceKernel::invalidate() {
+	builtSpringCount = -1;
+	builtParticleCount = -1;
+}
+
+const std::vector<double> &StretchedSpringForceKernel::getSpringForces() const {
+	return springForces;
+}
+
+void StretchedSpringForceKernel::buildIncidence(const StretchedSpringTable &springs, int particleCount) {
+	int springCount = springs.size();
+	incidenceStarts.assign(particleCount + 1, 0);
+	for (int s = 0; s < springCount; s++) {
+		incidenceStarts[springs.indicesA[s] + 1]++;
+		incidenceStarts[springs.indicesB[s] + 1]++;
+	}
+	for (int i = 0; i < particleCount; i++) {
+		incidenceStarts[i + 1] += incidenceStarts[i];
+	}
+	// Filled in spring order, so the springs of each particle end up ascending
+	std::vector<int> next(incidenceStarts.begin(), incidenceStarts.end() - 1);
+	incidenceSprings.resize(2 * springCount);
+	incidenceSigns.resize(2 * springCount);
+	for (int s = 0; s < springCount; s++) {
+		int slotA = next[springs.indicesA[s]]++;
+		incidenceSprings[slotA] = s;
+		incidenceSigns[slotA] = 1;
+		int slotB = next[springs.indicesB[s]]++;
+		incidenceSprings[slotB] = s;
+		incidenceSigns[slotB] = -1;
+	}
+	springForces.resize(3 * springCount);
+	builtSpringCount = springCount;
+	builtParticleCount = particleCount;
+}
+
+void StretchedSpringForceKernel::accumulateForces(const StretchedSpringTable &springs, const StretchedVectorArray &positions, StretchedVectorArray &forces) {
+	int springCount = springs.size();
+	int particleCount = positions.size();
+	if (springCount != builtSpringCount || particleCount != builtParticleCount) {
+		buildIncidence(springs, particleCount);
+	}
+
+	StretchedSpringKernelArgs args;
+	args.px = positions.x.data();
+	args.py = positions.y.data();
+	args.pz = positions.z.data();
+	args.indicesA = springs.indicesA.data();
+	args.indicesB = springs.indicesB.data();
+	args.restLengths = springs.restLengths.data();
+	args.stiffnesses = springs.stiffnesses.data();
+	args.springForces = springForces.data();
+	StretchedSimdLevel level = simdLevel;
+	threadPool->parallelFor(0, springCount, [&](int begin, int end) {
+		computeSpringForces(level, args, begin, end);
+	}, MIN_SPRINGS_PER_THREAD);
+
+	// Gather the spring forces of each particle
+	StretchedIncidenceArrays<double> incidence = { incidenceStarts.data(), incidenceSprings.data(), incidenceSigns.data() };
+	double *fx = forces.x.data(), *fy = forces.y.data(), *fz = forces.z.data();
+	threadPool->parallelFor(0, particleCount, [&](int begin, int end) {
+		StretchedStepLoops<double>::gatherSprings(incidence, args.springForces, fx, fy, fz, begin, end);
+	}, MIN_PARTICLES_PER_THREAD);
+}
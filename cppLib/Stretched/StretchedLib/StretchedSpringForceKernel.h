@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedSprings.h"
+#include "StretchedThreadPool.h"
+#include "StretchedVectorArray.h"
+
+// Instruction sets the spring kernel can run with
+enum StretchedSimdLevel {
+	SIMD_SCALAR,
+	SIMD_SSE2,
+	SIMD_AVX2
+};
+
+// Evaluates the Hooke forces of a StretchedSpringTable (structural, shear, bend and hydrogel springs
+// all share the same law) several springs at a time with SSE2 (2 wide) or AVX2 (4 wide), chosen at
+// runtime from the CPU, with a scalar fallback.
+// The kernel never scatters: it writes the force of every spring to its own slot of a per-spring buffer,
+// then each particle gathers the forces of its springs through a particle -> spring incidence list (CSR).
+// The gather visits the springs of a particle in ascending order, so the result is the same as the
+// plain serial loop over the springs.
+// Both passes are split over threadPool: a chunk of springs only writes its own slots of the buffer and
+// every particle is gathered by one thread, so no two threads write the same value and the sums never
+// depend on the thread count (the forces are bit-identical for any number of threads).
+class StretchedSpringForceKernel {
+
+public:
+	StretchedSpringForceKernel();
+	~StretchedSpringForceKernel();
+
+	// Best level supported by this CPU and OS
+	static StretchedSimdLevel detectSimdLevel();
+	static const char *getSimdLevelName(StretchedSimdLevel level);
+
+	// Can be lowered to compare against the fallbacks
+	StretchedSimdLevel simdLevel = detectSimdLevel();
+	StretchedThreadPool *threadPool = &StretchedThreadPool::getSharedPool();
+
+	// forces += spring forces. The incidence list is rebuilt when the spring or particle count changes.
+	void accumulateForces(const StretchedSpringTable &springs, const StretchedVectorArray &positions, StretchedVectorArray &forces);
+
+	// Forces the incidence list to be rebuilt (needed after editing spring indices in place)
+	void invalidate();
+
+	// Force on particle A of each spring from the last evaluation, interleaved (x, y, z) per spring.
+	// Particle B gets the opposite force.
+	const std::vector<double> &getSpringForces() const;
+
+private:
+	std::vector<double> springForces;
+
+	// Springs of particle i are incidenceSprings[incidenceStarts[i], incidenceStarts[i + 1]), with the
+	// sign of the force (+1 for end A, -1 for end B)
+	std::vector<int> incidenceStarts;
+	std::vector<int> incidenceSprings;
+	std::vector<double> incidenceSigns;
+	int builtSpringCount = -1;
+	int builtParticleCount = -1;
+
+	void buildIncidence(const StretchedSpringTable &springs, int particleCount);
+};
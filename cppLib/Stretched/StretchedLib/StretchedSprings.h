@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "StretchedVectorArray.h"
+
+// Spring identifiers - these match the ids used by the JS particle system
+// (see src/js/app/stretched/HydrogelParticleSystem.js)
+enum StretchedSpringType {
+	FABRIC_SPRING_STRUCTURAL = 1,
+	FABRIC_SPRING_BEND = 2,
+	FABRIC_SPRING_SHEAR = 3,
+	HYDROGEL_TO_FABRIC_SPRING = 4,
+	HYDROGEL_TO_HYDROGEL_SPRING = 5,
+	ZERO_LENGTH_SPRING = 6
+};
+
+// Types kept in a StretchedSpringTable (FABRIC_SPRING_STRUCTURAL to HYDROGEL_TO_HYDROGEL_SPRING)
+static const int SPRING_TABLE_TYPE_COUNT = 5;
+
+// Holds a list of two-particle springs as parallel arrays (one entry per spring).
+// The springs are grouped by type in the order of the enum, so every type is a contiguous table of its own
+// ([getTypeStart(type), getTypeEnd(type))) that per type loops run over without testing types. Loops that
+// treat all the springs alike (forces, Hessians) still run over the whole arrays. Adding springs in type
+// order appends; adding a spring of an earlier type makes room at the end of its range by moving the first
+// spring of each later type to the end of that type, and removing fills the hole the same way, so both
+// move at most one spring per type (reported in moves as (from, to) pairs when given).
+struct StretchedSpringTable {
+	std::vector<int> indicesA;
+	std::vector<int> indicesB;
+	std::vector<double> restLengths;
+	std::vector<double> stiffnesses;
+	std::vector<StretchedSpringType> types;
+	// Rest length over the length the spring was made at (the hydrogel shrink ratio, 1 for most springs)
+	std::vector<double> restLengthRatios;
+
+	int size() const {
+		return (int)indicesA.size();
+	}
+
+	int getTypeStart(StretchedSpringType type) const {
+		return typeStarts[type - FABRIC_SPRING_STRUCTURAL];
+	}
+
+	int getTypeEnd(StretchedSpringType type) const {
+		return typeStarts[type - FABRIC_SPRING_STRUCTURAL + 1];
+	}
+
+	int getTypeCount(StretchedSpringType type) const {
+		return getTypeEnd(type) - getTypeStart(type);
+	}
+
+	// Returns the index of the new spring
+	int add(int a, int b, double restLength, double stiffness, StretchedSpringType type, double restLengthRatio = 1.0, std::vector<int> *moves = NULL) {
+		int t = type - FABRIC_SPRING_STRUCTURAL;
+		int hole = size();
+		if (hole == typeStarts[t + 1]) {
+			indicesA.push_back(a);
+			indicesB.push_back(b);
+			restLengths.push_back(restLength);
+			stiffnesses.push_back(stiffness);
+			types.push_back(type);
+			restLengthRatios.push_back(restLengthRatio);
+		} else {
+			resize(hole + 1);
+			for (int u = SPRING_TABLE_TYPE_COUNT - 1; u > t; u--) {
+				if (typeStarts[u] == typeStarts[u + 1]) {
+					continue;
+				}
+				move(typeStarts[u], hole, moves);
+				hole = typeStarts[u];
+			}
+			indicesA[hole] = a;
+			indicesB[hole] = b;
+			restLengths[hole] = restLength;
+			stiffnesses[hole] = stiffness;
+			types[hole] = type;
+			restLengthRatios[hole] = restLengthRatio;
+		}
+		for (int u = t + 1; u <= SPRING_TABLE_TYPE_COUNT; u++) {
+			typeStarts[u]++;
+		}
+		return hole;
+	}
+
+	void remove(int s, std::vector<int> *moves = NULL) {
+		int t = types[s] - FABRIC_SPRING_STRUCTURAL;
+		int hole = s;
+		for (int u = t; u < SPRING_TABLE_TYPE_COUNT; u++) {
+			if (u > t && typeStarts[u] == typeStarts[u + 1]) {
+				continue;
+			}
+			int last = typeStarts[u + 1] - 1;
+			if (last != hole) {
+				move(last, hole, moves);
+			}
+			hole = last;
+		}
+		resize(size() - 1);
+		for (int u = t + 1; u <= SPRING_TABLE_TYPE_COUNT; u++) {
+			typeStarts[u]--;
+		}
+	}
+
+	// Regroups springs whose arrays were filled directly (e.g. read from a checkpoint) by type, keeping
+	// the order within each type
+	void groupByType() {
+		int n = size();
+		int counts[SPRING_TABLE_TYPE_COUNT + 1] = {};
+		for (int s = 0; s < n; s++) {
+			counts[types[s] - FABRIC_SPRING_STRUCTURAL + 1]++;
+		}
+		typeStarts[0] = 0;
+		for (int t = 0; t < SPRING_TABLE_TYPE_COUNT; t++) {
+			typeStarts[t + 1] = typeStarts[t] + counts[t + 1];
+		}
+		bool grouped = true;
+		for (int s = 1; s < n && grouped; s++) {
+			grouped = types[s - 1] <= types[s];
+		}
+		if (grouped) {
+			return;
+		}
+		std::vector<int> order(n);
+		int next[SPRING_TABLE_TYPE_COUNT];
+		std::copy(typeStarts, typeStarts + SPRING_TABLE_TYPE_COUNT, next);
+		for (int s = 0; s < n; s++) {
+			order[next[types[s] - FABRIC_SPRING_STRUCTURAL]++] = s;
+		}
+		permute(indicesA, order);
+		permute(indicesB, order);
+		permute(restLengths, order);
+		permute(stiffnesses, order);
+		permute(types, order);
+		permute(restLengthRatios, order);
+	}
+
+	// Renames the particles (particle i becomes newIndices[i]) and sorts the springs of each type by their
+	// lower, then higher particle, so the force loops walk the particle arrays forward. The order of
+	// springs joining the same particles is kept.
+	void remapParticles(const std::vector<int> &newIndices) {
+		int n = size();
+		for (int s = 0; s < n; s++) {
+			indicesA[s] = newIndices[indicesA[s]];
+			indicesB[s] = newIndices[indicesB[s]];
+		}
+		std::vector<int> order(n);
+		for (int s = 0; s < n; s++) {
+			order[s] = s;
+		}
+		for (int t = 0; t < SPRING_TABLE_TYPE_COUNT; t++) {
+			std::stable_sort(order.begin() + typeStarts[t], order.begin() + typeStarts[t + 1], [&](int r, int s) {
+				int lowR = std::min(indicesA[r], indicesB[r]), lowS = std::min(indicesA[s], indicesB[s]);
+				if (lowR != lowS) {
+					return lowR < lowS;
+				}
+				return std::max(indicesA[r], indicesB[r]) < std::max(indicesA[s], indicesB[s]);
+			});
+		}
+		permute(indicesA, order);
+		permute(indicesB, order);
+		permute(restLengths, order);
+		permute(stiffnesses, order);
+		permute(types, order);
+		permute(restLengthRatios, order);
+	}
+
+	void reserve(int n) {
+		indicesA.reserve(n);
+		indicesB.reserve(n);
+		restLengths.reserve(n);
+		stiffnesses.reserve(n);
+		types.reserve(n);
+		restLengthRatios.reserve(n);
+	}
+
+	void clear() {
+		indicesA.clear();
+		indicesB.clear();
+		restLengths.clear();
+		stiffnesses.clear();
+		types.clear();
+		restLengthRatios.clear();
+		std::fill(typeStarts, typeStarts + SPRING_TABLE_TYPE_COUNT + 1, 0);
+	}
+
+private:
+	// Type t - FABRIC_SPRING_STRUCTURAL occupies [typeStarts[t], typeStarts[t + 1])
+	int typeStarts[SPRING_TABLE_TYPE_COUNT + 1] = {};
+
+	void resize(int n) {
+		indicesA.resize(n);
+		indicesB.resize(n);
+		restLengths.resize(n);
+		stiffnesses.resize(n);
+		types.resize(n);
+		restLengthRatios.resize(n);
+	}
+
+	void move(int from, int to, std::vector<int> *moves) {
+		indicesA[to] = indicesA[from];
+		indicesB[to] = indicesB[from];
+		restLengths[to] = restLengths[from];
+		stiffnesses[to] = stiffnesses[from];
+		types[to] = types[from];
+		restLengthRatios[to] = restLengthRatios[from];
+		if (moves != NULL) {
+			moves->push_back(from);
+			moves->push_back(to);
+		}
+	}
+
+	template <class T>
+	static void permute(std::vector<T> &values, const std::vector<int> &order) {
+		std::vector<T> permuted(values.size());
+		for (int s = 0; s < (int)order.size(); s++) {
+			permuted[s] = values[order[s]];
+		}
+		values.swap(permuted);
+	}
+};
+
+// Holds springs that pin a particle to a fixed rest position (rest length is always 0)
+struct StretchedZeroLengthSpringTable {
+	std::vector<int> indices;
+	StretchedVectorArray restPositions;
+	std::vector<double> stiffnesses;
+
+	int size() const {
+		return (int)indices.size();
+	}
+
+	void add(int index, const P3D &restPosition, double stiffness) {
+		indices.push_back(index);
+		restPositions.push_back(restPosition);
+		stiffnesses.push_back(stiffness);
+	}
+
+	// Renames the particles (particle i becomes newIndices[i]) and sorts the pins by particle, keeping the
+	// order of the pins of each particle
+	void remapParticles(const std::vector<int> &newIndices) {
+		int n = size();
+		std::vector<int> order(n);
+		for (int s = 0; s < n; s++) {
+			indices[s] = newIndices[indices[s]];
+			order[s] = s;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](int r, int s) {
+			return indices[r] < indices[s];
+		});
+		StretchedZeroLengthSpringTable sorted;
+		for (int k = 0; k < n; k++) {
+			sorted.add(indices[order[k]], restPositions.getPoint(order[k]), stiffnesses[order[k]]);
+		}
+		*this = sorted;
+	}
+
+	void clear() {
+		indices.clear();
+		restPositions.clear();
+		stiffnesses.clear();
+	}
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cmath>
+
+#include "StretchedConstants.h"
+
+#if defined(_MSC_VER)
+#define STRETCHED_FORCE_INLINE __forceinline
+#elif defined(__GNUC__)
+#define STRETCHED_FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define STRETCHED_FORCE_INLINE inline
+#endif
+
+// The force, integration and floor loops of an explicit step, shared by StretchedParticleSystem,
+// StretchedSimCore, StretchedDomainDecomposition and the scalar path of StretchedSpringForceKernel so there
+// is one copy of the physics. Everything is templated on the scalar type and on which particles a loop
+// visits, and inlined into the caller: each caller compiles to the loops it had before, with no branch on
+// options or particle lists inside them, and the same arithmetic in the same order (double runs stay
+// bit-identical across the callers).
+
+// Index policies of the particle loops: particle k of count, or the listed ones (the awake particles of a
+// sleeping system)
+struct StretchedAllParticles {
+	int count;
+
+	explicit StretchedAllParticles(int count) : count(count) {}
+	STRETCHED_FORCE_INLINE int operator[](int k) const {
+		return k;
+	}
+};
+
+struct StretchedListedParticles {
+	const int *order;
+	int count;
+
+	StretchedListedParticles(const int *order, int count) : order(order), count(count) {}
+	STRETCHED_FORCE_INLINE int operator[](int k) const {
+		return order[k];
+	}
+};
+
+// Structure of arrays of the particle state, indexed by particle
+template <class Scalar>
+struct StretchedParticleArrays {
+	Scalar *px, *py, *pz;
+	Scalar *ox, *oy, *oz;
+	Scalar *vx, *vy, *vz;
+	Scalar *fx, *fy, *fz;
+	const Scalar *masses;
+	const Scalar *inverseMasses;
+};
+
+// Spring table: particle indices of both ends, rest lengths and stiffnesses
+template <class Scalar>
+struct StretchedSpringArrays {
+	const int *indicesA;
+	const int *indicesB;
+	const Scalar *restLengths;
+	const Scalar *stiffnesses;
+};
+
+// Zero length springs pulling particles towards fixed positions
+template <class Scalar>
+struct StretchedPinArrays {
+	const int *indices;
+	const Scalar *restX, *restY, *restZ;
+	const Scalar *stiffnesses;
+	int count;
+};
+
+// Springs of particle i are incidenceSprings[incidenceStarts[i], incidenceStarts[i + 1]), ascending, with the
+// sign of the value on it (+1 for end A, -1 for end B)
+template <class Scalar>
+struct StretchedIncidenceArrays {
+	const int *incidenceStarts;
+	const int *incidenceSprings;
+	const Scalar *incidenceSigns;
+};
+
+template <class Scalar>
+struct StretchedStepLoops {
+
+	template <class Particles>
+	static STRETCHED_FORCE_INLINE void clearForces(const StretchedParticleArrays<Scalar> &p, Particles particles) {
+		for (int k = 0; k < particles.count; k++) {
+			int i = particles[k];
+			p.fx[i] = p.fy[i] = p.fz[i] = 0;
+		}
+	}
+
+	template <class Particles>
+	static STRETCHED_FORCE_INLINE void accumulateGravity(const StretchedParticleArrays<Scalar> &p, Particles particles, int upAxis) {
+		Scalar *fUp = upAxis == 0 ? p.fx : (upAxis == 1 ? p.fy : p.fz);
+		for (int k = 0; k < particles.count; k++) {
+			int i = particles[k];
+			fUp[i] += (Scalar)GRAVITY * p.masses[i];
+		}
+	}
+
+	// Quadratic drag opposing the direction of motion (dragScale = -coefficient of drag * particle area)
+	template <class Particles>
+	static STRETCHED_FORCE_INLINE void accumulateDrag(const StretchedParticleArrays<Scalar> &p, Particles particles, Scalar dragScale) {
+		for (int k = 0; k < particles.count; k++) {
+			int i = particles[k];
+			Scalar speed = std::sqrt(p.vx[i] * p.vx[i] + p.vy[i] * p.vy[i] + p.vz[i] * p.vz[i]);
+			p.fx[i] += dragScale * speed * p.vx[i];
+			p.fy[i] += dragScale * speed * p.vy[i];
+			p.fz[i] += dragScale * speed * p.vz[i];
+		}
+	}
+
+	// F_a = -k * (|x_a - x_b| - L) * (x_a - x_b) / |x_a - x_b|, 0 for (nearly) coincident particles.
+	// Written interleaved (x, y, z) per spring to springForces for springs [begin, end).
+	static STRETCHED_FORCE_INLINE void computeSpringForces(const StretchedSpringArrays<Scalar> &springs, const Scalar *px, const Scalar *py, const Scalar *pz,
+		Scalar *springForces, int begin, int end) {
+		for (int s = begin; s < end; s++) {
+			int a = springs.indicesA[s];
+			int b = springs.indicesB[s];
+			Scalar dx = px[a] - px[b];
+			Scalar dy = py[a] - py[b];
+			Scalar dz = pz[a] - pz[b];
+			Scalar length = std::sqrt(dx * dx + dy * dy + dz * dz);
+			Scalar scale = 0;
+			if (length >= (Scalar)EPSILON_CHECK) {
+				scale = -springs.stiffnesses[s] * (length - springs.restLengths[s]) / length;
+			}
+			springForces[3 * s] = scale * dx;
+			springForces[3 * s + 1] = scale * dy;
+			springForces[3 * s + 2] = scale * dz;
+		}
+	}
+
+	// targets += signed sum of the interleaved per spring values of each particle in [begin, end)
+	static STRETCHED_FORCE_INLINE void gatherSprings(const StretchedIncidenceArrays<Scalar> &incidence, const Scalar *springValues,
+		Scalar *targetX, Scalar *targetY, Scalar *targetZ, int begin, int end) {
+		const int *starts = incidence.incidenceStarts;
+		for (int i = begin; i < end; i++) {
+			Scalar sumX = targetX[i], sumY = targetY[i], sumZ = targetZ[i];
+			for (int k = starts[i]; k < starts[i + 1]; k++) {
+				const Scalar *value = springValues + 3 * incidence.incidenceSprings[k];
+				Scalar sign = incidence.incidenceSigns[k];
+				sumX += sign * value[0];
+				sumY += sign * value[1];
+				sumZ += sign * value[2];
+			}
+			targetX[i] = sumX;
+			targetY[i] = sumY;
+			targetZ[i] = sumZ;
+		}
+	}
+
+	static STRETCHED_FORCE_INLINE void accumulatePinForces(const StretchedParticleArrays<Scalar> &p, const StretchedPinArrays<Scalar> &pins) {
+		for (int s = 0; s < pins.count; s++) {
+			int a = pins.indices[s];
+			Scalar k = pins.stiffnesses[s];
+			p.fx[a] -= k * (p.px[a] - pins.restX[s]);
+			p.fy[a] -= k * (p.py[a] - pins.restY[s]);
+			p.fz[a] -= k * (p.pz[a] - pins.restZ[s]);
+		}
+	}
+
+	// Particles below the floor are put back on it and stop moving vertically
+	template <class Particles>
+	static STRETCHED_FORCE_INLINE void resolveFloorConstraint(const StretchedParticleArrays<Scalar> &p, Particles particles, int upAxis, Scalar floorHeight) {
+		Scalar *position = upAxis == 0 ? p.px : (upAxis == 1 ? p.py : p.pz);
+		Scalar *previous = upAxis == 0 ? p.ox : (upAxis == 1 ? p.oy : p.oz);
+		Scalar *velocity = upAxis == 0 ? p.vx : (upAxis == 1 ? p.vy : p.vz);
+		for (int k = 0; k < particles.count; k++) {
+			int i = particles[k];
+			if (position[i] < floorHeight) {
+				position[i] = floorHeight;
+				previous[i] = floorHeight;
+				velocity[i] = 0;
+			}
+		}
+	}
+};
+
+// Integrator policies: integrate advances the particles one step from the accumulated forces.
+// velocityDamping is the fraction of the velocity removed per step (0 without damping).
+
+// The new velocity updates the current position
+struct StretchedSymplecticEulerPolicy {
+	template <class Scalar, class Particles>
+	static STRETCHED_FORCE_INLINE void integrate(const StretchedParticleArrays<Scalar> &p, Particles particles, Scalar timeStep, Scalar velocityDamping) {
+		Scalar damping = 1 - velocityDamping;
+		const Scalar *w = p.inverseMasses;
+		for (int k = 0; k < particles.count; k++) {
+			int i = particles[k];
+			p.ox[i] = p.px[i];
+			p.oy[i] = p.py[i];
+			p.oz[i] = p.pz[i];
+			p.vx[i] = damping * (p.vx[i] + timeStep * w[i] * p.fx[i]);
+			p.vy[i] = damping * (p.vy[i] + timeStep * w[i] * p.fy[i]);
+			p.vz[i] = damping * (p.vz[i] + timeStep * w[i] * p.fz[i]);
+			p.px[i] += timeStep * p.vx[i];
+			p.py[i] += timeStep * p.vy[i];
+			p.pz[i] += timeStep * p.vz[i];
+		}
+	}
+};
+
+// x_new = (2 - d) * x - (1 - d) * x_prev + a * t^2, fixed particles stay where they are
+// https://en.wikipedia.org/wiki/Verlet_integration
+struct StretchedVerletPolicy {
+	template <class Scalar, class Particles>
+	static STRETCHED_FORCE_INLINE void integrate(const StretchedParticleArrays<Scalar> &p, Particles particles, Scalar timeStep, Scalar velocityDamping) {
+		Scalar d = velocityDamping;
+		Scalar sqTimeStep = timeStep * timeStep;
+		Scalar inverseTimeStep = (Scalar)1 / timeStep;
+		const Scalar *w = p.inverseMasses;
+		for (int k = 0; k < particles.count; k++) {
+			int i = particles[k];
+			if (w[i] == 0) {
+				continue;
+			}
+			Scalar nx = (2 - d) * p.px[i] - (1 - d) * p.ox[i] + sqTimeStep * w[i] * p.fx[i];
+			Scalar ny = (2 - d) * p.py[i] - (1 - d) * p.oy[i] + sqTimeStep * w[i] * p.fy[i];
+			Scalar nz = (2 - d) * p.pz[i] - (1 - d) * p.oz[i] + sqTimeStep * w[i] * p.fz[i];
+			p.vx[i] = (nx - p.px[i]) * inverseTimeStep;
+			p.vy[i] = (ny - p.py[i]) * inverseTimeStep;
+			p.vz[i] = (nz - p.pz[i]) * inverseTimeStep;
+			p.ox[i] = p.px[i];
+			p.oy[i] = p.py[i];
+			p.oz[i] = p.pz[i];
+			p.px[i] = nx;
+			p.py[i] = ny;
+			p.pz[i] = nz;
+		}
+	}
+};
@@ -0,0 +1,95 @@
+#include "StretchedThreadPool.h"
+
+#include <algorithm>
+
+
+StretchedThreadPool::StretchedThreadPool(int threadCount) {
+	if (threadCount <= 0) {
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	// The calling thread does its share of the work, so spawn one less
+	for (int i = 1; i < threadCount; i++) {
+		workers.push_back(std::thread(&StretchedThreadPool::workerLoop, this, i));
+	}
+}
+
+StretchedThreadPool::~StretchedThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	for (int i = 0; i < (int)workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+int StretchedThreadPool::getThreadCount() const {
+	return (int)workers.size() + 1;
+}
+
+StretchedThreadPool &StretchedThreadPool::getSharedPool() {
+	static StretchedThreadPool sharedPool;
+	return sharedPool;
+}
+
+void StretchedThreadPool::workerLoop(int workerIndex) {
+	unsigned long long seenGeneration = 0;
+	while (true) {
+		std::function<void(int)> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workAvailable.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+			if (stopping) {
+				return;
+			}
+			seenGeneration = generation;
+			task = currentTask;
+		}
+		task(workerIndex);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pendingWorkers--;
+			if (pendingWorkers == 0) {
+				workFinished.notify_one();
+			}
+		}
+	}
+}
+
+void StretchedThreadPool::runOnAllThreads(const std::function<void(int)> &task) {
+	if (workers.empty()) {
+		task(0);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentTask = task;
+		pendingWorkers = (int)workers.size();
+		generation++;
+	}
+	workAvailable.notify_all();
+	task(0);
+	std::unique_lock<std::mutex> lock(mutex);
+	workFinished.wait(lock, [&]() { return pendingWorkers == 0; });
+}
+
+void StretchedThreadPool::parallelFor(int begin, int end, const std::function<void(int, int)> &task, int minChunkSize) {
+	int count = end - begin;
+	if (count <= 0) {
+		return;
+	}
+	int chunks = std::min(getThreadCount(), (count + minChunkSize - 1) / std::max(1, minChunkSize));
+	if (chunks <= 1) {
+		task(begin, end);
+		return;
+	}
+	runOnAllThreads([&](int threadIndex) {
+		if (threadIndex >= chunks) {
+			return;
+		}
+		int chunkBegin = begin + (int)((long long)count * threadIndex / chunks);
+		int chunkEnd = begin + (int)((long long)count * (threadIndex + 1) / chunks);
+		task(chunkBegin, chunkEnd);
+	});
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads used to run simulation loops in parallel.
+// parallelFor splits [begin, end) into one contiguous chunk per thread (the calling thread
+// takes a chunk too) and returns once every chunk has finished.
+class StretchedThreadPool {
+
+public:
+	// threadCount <= 0 uses one thread per hardware core
+	StretchedThreadPool(int threadCount = 0);
+	~StretchedThreadPool();
+
+	// Runs task(chunkBegin, chunkEnd) over [begin, end). Ranges smaller than minChunkSize per thread run inline.
+	void parallelFor(int begin, int end, const std::function<void(int, int)> &task, int minChunkSize = 256);
+
+	// Runs task(threadIndex) once on every thread of the pool
+	void runOnAllThreads(const std::function<void(int)> &task);
+
+	// Number of threads including the calling thread
+	int getThreadCount() const;
+
+	// Pool shared by the simulation code (sized to the hardware)
+	static StretchedThreadPool &getSharedPool();
+
+private:
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workFinished;
+
+	std::function<void(int)> currentTask;
+	unsigned long long generation = 0;
+	int pendingWorkers = 0;
+	bool stopping = false;
+
+	void workerLoop(int workerIndex);
+
+	// Disallow copy and assignment
+	StretchedThreadPool(const StretchedThreadPool &);
+	void operator=(const StretchedThreadPool &);
+};
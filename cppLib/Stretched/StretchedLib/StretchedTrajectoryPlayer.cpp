@@ -0,0 +1,225 @@
+#include "StretchedTrajectoryPlayer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Utils/Logger.h"
+
+
+static const uint32_t TRAJECTORY_BYTE_ORDER_MARK = 0x01020304;
+
+static int64_t unZigZag(uint64_t value) {
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Reads the residuals packed by the recorder, returns false if the data runs short or long
+static bool unpackResiduals(const unsigned char *cursor, const unsigned char *end, std::vector<uint64_t> &residuals) {
+	for (size_t start = 0; start < residuals.size(); start += TRAJECTORY_BLOCK_SIZE) {
+		size_t blockEnd = std::min(residuals.size(), start + TRAJECTORY_BLOCK_SIZE);
+		if (cursor == end || *cursor > 64) {
+			return false;
+		}
+		int width = *cursor++;
+		size_t blockBytes = ((blockEnd - start) * width + 7) / 8;
+		if ((size_t)(end - cursor) < blockBytes) {
+			return false;
+		}
+		uint64_t bitOffset = 0;
+		for (size_t k = start; k < blockEnd; k++) {
+			uint64_t value = 0;
+			for (int bit = 0; bit < width; ) {
+				uint64_t byteBit = bitOffset & 7;
+				int taken = std::min(width - bit, 8 - (int)byteBit);
+				uint64_t bits = (cursor[bitOffset >> 3] >> byteBit) & ((1u << taken) - 1);
+				value |= bits << bit;
+				bit += taken;
+				bitOffset += taken;
+			}
+			residuals[k] = value;
+		}
+		cursor += blockBytes;
+	}
+	return cursor == end;
+}
+
+StretchedTrajectoryPlayer::StretchedTrajectoryPlayer() {
+	memset(&header, 0, sizeof(header));
+}
+
+StretchedTrajectoryPlayer::~StretchedTrajectoryPlayer() {
+	// Nothing to see here
+}
+
+bool StretchedTrajectoryPlayer::open(const char *fileName) {
+	close();
+	FILE *file = fopen(fileName, "rb");
+	if (file == NULL) {
+		Logger::consolePrint("Could not open trajectory file '%s'", fileName);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	bytes.resize(size > 0 ? (size_t)size : 0);
+	size_t read = bytes.empty() ? 0 : fread(bytes.data(), 1, bytes.size(), file);
+	fclose(file);
+	if (read != bytes.size()) {
+		Logger::consolePrint("Could not read trajectory file '%s'", fileName);
+		bytes.clear();
+		return false;
+	}
+	opened = index();
+	return opened;
+}
+
+bool StretchedTrajectoryPlayer::open(const char *data, size_t size) {
+	close();
+	bytes.assign(data, data + size);
+	opened = index();
+	return opened;
+}
+
+void StretchedTrajectoryPlayer::close() {
+	bytes.clear();
+	frameOffsets.clear();
+	frameSizes.clear();
+	frameTimes.clear();
+	frameKeyframes.clear();
+	decodedFrame = -1;
+	opened = false;
+}
+
+bool StretchedTrajectoryPlayer::isOpen() const {
+	return opened;
+}
+
+const StretchedTrajectoryHeader &StretchedTrajectoryPlayer::getHeader() const {
+	return header;
+}
+
+int StretchedTrajectoryPlayer::getParticleCount() const {
+	return header.particleCount;
+}
+
+int StretchedTrajectoryPlayer::getFrameCount() const {
+	return (int)frameOffsets.size();
+}
+
+double StretchedTrajectoryPlayer::getFrameTime(int frame) const {
+	return frameTimes[frame];
+}
+
+int StretchedTrajectoryPlayer::findFrame(double time) const {
+	int frame = (int)(std::upper_bound(frameTimes.begin(), frameTimes.end(), time) - frameTimes.begin()) - 1;
+	return std::max(frame, 0);
+}
+
+bool StretchedTrajectoryPlayer::index() {
+	if (bytes.size() < sizeof(header)) {
+		Logger::consolePrint("Trajectory file is too short");
+		return false;
+	}
+	memcpy(&header, bytes.data(), sizeof(header));
+	if (memcmp(header.magic, STRETCHED_TRAJECTORY_MAGIC, sizeof(header.magic)) != 0 || header.byteOrderMark != TRAJECTORY_BYTE_ORDER_MARK) {
+		Logger::consolePrint("Not a trajectory file (or written on a machine of the other byte order)");
+		return false;
+	}
+	if (header.version != STRETCHED_TRAJECTORY_VERSION) {
+		Logger::consolePrint("Trajectory file version %u is not supported (expected %u)", header.version, STRETCHED_TRAJECTORY_VERSION);
+		return false;
+	}
+	if (header.particleCount < 0 || !(header.step > 0)) {
+		Logger::consolePrint("Trajectory file header is corrupt");
+		return false;
+	}
+
+	// A recording cut short (e.g. by a crash) ends with a partial frame, which is ignored
+	uint64_t offset = sizeof(header);
+	int keyframe = -1;
+	while (offset + sizeof(StretchedTrajectoryFrameHeader) <= bytes.size()) {
+		StretchedTrajectoryFrameHeader frameHeader;
+		memcpy(&frameHeader, bytes.data() + offset, sizeof(frameHeader));
+		offset += sizeof(frameHeader);
+		if (offset + frameHeader.payloadSize > bytes.size()) {
+			break;
+		}
+		if (frameHeader.type == TRAJECTORY_KEYFRAME) {
+			keyframe = (int)frameOffsets.size();
+		} else if (frameHeader.type != TRAJECTORY_DELTA_FRAME || keyframe < 0) {
+			Logger::consolePrint("Trajectory frame %d is corrupt", (int)frameOffsets.size());
+			return false;
+		}
+		frameOffsets.push_back(offset);
+		frameSizes.push_back(frameHeader.payloadSize);
+		frameTimes.push_back(frameHeader.time);
+		frameKeyframes.push_back(keyframe);
+		offset += frameHeader.payloadSize;
+	}
+	return true;
+}
+
+bool StretchedTrajectoryPlayer::readFrame(int frame, StretchedVectorArray &positions) {
+	if (!opened || frame < 0 || frame >= getFrameCount()) {
+		return false;
+	}
+	// Play forward from the frame last decoded if it is in the same interval, otherwise from its keyframe
+	int first = frameKeyframes[frame];
+	if (decodedFrame >= first && decodedFrame <= frame) {
+		first = decodedFrame + 1;
+	}
+	for (int f = first; f <= frame; f++) {
+		if (!decodeFrame(f)) {
+			decodedFrame = -1;
+			return false;
+		}
+	}
+
+	int n = header.particleCount;
+	positions.resize(n);
+	std::vector<double> *components[3] = { &positions.x, &positions.y, &positions.z };
+	for (int c = 0; c < 3; c++) {
+		const int64_t *componentCodes = codes.data() + (size_t)c * n;
+		double *values = components[c]->data();
+		double origin = header.origin[c];
+		for (int i = 0; i < n; i++) {
+			values[i] = origin + componentCodes[i] * header.step;
+		}
+	}
+	return true;
+}
+
+bool StretchedTrajectoryPlayer::decodeFrame(int frame) {
+	int n = header.particleCount;
+	int framesSinceKeyframe = frame - frameKeyframes[frame];
+	olderCodes.swap(previousCodes);
+	previousCodes.swap(codes);
+	codes.resize((size_t)n * 3);
+
+	const unsigned char *cursor = (const unsigned char *)bytes.data() + frameOffsets[frame];
+	residuals.resize((size_t)n * 3);
+	if (!unpackResiduals(cursor, cursor + frameSizes[frame], residuals)) {
+		return false;
+	}
+	for (int c = 0; c < 3; c++) {
+		int64_t *current = codes.data() + (size_t)c * n;
+		const int64_t *previous = previousCodes.data() + (size_t)c * n;
+		const int64_t *older = olderCodes.data() + (size_t)c * n;
+		const uint64_t *componentResiduals = residuals.data() + (size_t)c * n;
+		int64_t last = 0;
+		for (int i = 0; i < n; i++) {
+			int64_t prediction;
+			if (framesSinceKeyframe == 0) {
+				prediction = last;
+			} else if (framesSinceKeyframe == 1) {
+				prediction = previous[i];
+			} else {
+				prediction = 2 * previous[i] - older[i];
+			}
+			current[i] = prediction + unZigZag(componentResiduals[i]);
+			last = current[i];
+		}
+	}
+	decodedFrame = frame;
+	return true;
+}
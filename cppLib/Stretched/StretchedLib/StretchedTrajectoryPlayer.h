@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "StretchedTrajectoryRecorder.h"
+#include "StretchedVectorArray.h"
+
+// Plays back a trajectory written by StretchedTrajectoryRecorder. open indexes the frames, so any frame
+// can be read: it is decoded from the nearest keyframe at or before it, or straight from the frame
+// last read when playing forward within the same keyframe interval (one frame of decoding per call).
+class StretchedTrajectoryPlayer {
+
+public:
+	StretchedTrajectoryPlayer();
+	~StretchedTrajectoryPlayer();
+
+	// Reads a trajectory file, returns false (and logs why) if it is missing or not a valid trajectory
+	bool open(const char *fileName);
+	// Same, from a trajectory in memory (copied)
+	bool open(const char *data, size_t size);
+	void close();
+	bool isOpen() const;
+
+	const StretchedTrajectoryHeader &getHeader() const;
+	int getParticleCount() const;
+	int getFrameCount() const;
+	double getFrameTime(int frame) const;
+	// Last frame recorded at or before time (the first frame if time is earlier than all of them)
+	int findFrame(double time) const;
+
+	// Decodes frame into positions (resized to the particle count), returns false if frame is out of
+	// range or its data is corrupt
+	bool readFrame(int frame, StretchedVectorArray &positions);
+
+private:
+	std::vector<char> bytes;
+	StretchedTrajectoryHeader header;
+	bool opened = false;
+
+	// Byte offset of the payload, payload size and time of every frame, and the keyframe each one decodes from
+	std::vector<uint64_t> frameOffsets;
+	std::vector<uint32_t> frameSizes;
+	std::vector<double> frameTimes;
+	std::vector<int> frameKeyframes;
+
+	// Quantized coordinates of the last decoded frame and the one before it
+	int decodedFrame = -1;
+	std::vector<int64_t> codes;
+	std::vector<int64_t> previousCodes;
+	std::vector<int64_t> olderCodes;
+	std::vector<uint64_t> residuals;
+
+	bool index();
+	bool decodeFrame(int frame);
+};
@@ -0,0 +1,288 @@
+#include "StretchedTrajectoryRecorder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Utils/Logger.h"
+
+
+static const uint32_t TRAJECTORY_BYTE_ORDER_MARK = 0x01020304;
+
+static uint64_t zigZag(int64_t value) {
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+// Appends the ZigZag residuals in blocks of TRAJECTORY_BLOCK_SIZE, each a width byte followed by every
+// residual of the block in that many bits (least significant first). A block of zeros takes one byte.
+static void packResiduals(const std::vector<uint64_t> &residuals, std::vector<char> &bytes) {
+	for (size_t start = 0; start < residuals.size(); start += TRAJECTORY_BLOCK_SIZE) {
+		size_t end = std::min(residuals.size(), start + TRAJECTORY_BLOCK_SIZE);
+		uint64_t combined = 0;
+		for (size_t k = start; k < end; k++) {
+			combined |= residuals[k];
+		}
+		int width = 0;
+		while (width < 64 && (combined >> width) != 0) {
+			width++;
+		}
+		bytes.push_back((char)width);
+		uint64_t accumulator = 0;
+		int bitCount = 0;
+		for (size_t k = start; k < end && width > 0; k++) {
+			uint64_t value = residuals[k];
+			int remaining = width;
+			while (remaining > 0) {
+				int taken = std::min(remaining, 64 - bitCount);
+				uint64_t bits = taken == 64 ? value : value & ((1ull << taken) - 1);
+				accumulator |= bitCount == 64 ? 0 : bits << bitCount;
+				bitCount += taken;
+				value = taken == 64 ? 0 : value >> taken;
+				remaining -= taken;
+				while (bitCount >= 8) {
+					bytes.push_back((char)(accumulator & 0xff));
+					accumulator >>= 8;
+					bitCount -= 8;
+				}
+			}
+		}
+		if (bitCount > 0) {
+			bytes.push_back((char)(accumulator & 0xff));
+		}
+	}
+}
+
+StretchedTrajectoryRecorder::StretchedTrajectoryRecorder() : writtenBytes(0) {
+	memset(&header, 0, sizeof(header));
+}
+
+StretchedTrajectoryRecorder::~StretchedTrajectoryRecorder() {
+	end();
+	for (int i = 0; i < (int)freeFrames.size(); i++) {
+		delete freeFrames[i];
+	}
+}
+
+bool StretchedTrajectoryRecorder::begin(const char *fileName, const StretchedVectorArray &positions) {
+	if (recording) {
+		end();
+	}
+	ownedFile = fopen(fileName, "wb");
+	if (ownedFile == NULL) {
+		Logger::consolePrint("Could not open trajectory file '%s' for writing", fileName);
+		return false;
+	}
+	ownedSink = new StretchedFileSink(ownedFile);
+	return begin(ownedSink, positions);
+}
+
+bool StretchedTrajectoryRecorder::begin(StretchedByteSink *sink, const StretchedVectorArray &positions) {
+	if (recording) {
+		end();
+	}
+	this->sink = sink;
+	int n = positions.size();
+
+	// Uniform scale over the largest extent of the first frame, as BoundsParams::FromBounds does
+	const std::vector<double> *components[3] = { &positions.x, &positions.y, &positions.z };
+	double mins[3] = { 0, 0, 0 };
+	double scale = 0;
+	for (int c = 0; c < 3; c++) {
+		if (n == 0) {
+			continue;
+		}
+		const std::vector<double> &values = *components[c];
+		mins[c] = *std::min_element(values.begin(), values.end());
+		scale = std::max(scale, *std::max_element(values.begin(), values.end()) - mins[c]);
+	}
+	int bits = std::min(std::max(quantizationBits, 1), 30);
+	if (!(scale > 0) || !std::isfinite(scale)) {
+		scale = 1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, STRETCHED_TRAJECTORY_MAGIC, sizeof(header.magic));
+	header.version = STRETCHED_TRAJECTORY_VERSION;
+	header.byteOrderMark = TRAJECTORY_BYTE_ORDER_MARK;
+	header.particleCount = n;
+	header.keyframeInterval = std::max(1, keyframeInterval);
+	header.quantizationBits = bits;
+	for (int c = 0; c < 3; c++) {
+		header.origin[c] = std::isfinite(mins[c]) ? mins[c] : 0;
+	}
+	header.step = scale / ((1 << bits) - 1);
+
+	recordedFrameCount = 0;
+	droppedFrameCount = 0;
+	writtenBytes = 0;
+	sinkFailed = false;
+	framesSinceKeyframe = 0;
+	stopping = false;
+	recording = true;
+	write(&header, sizeof(header));
+	writer = std::thread(&StretchedTrajectoryRecorder::writeFrames, this);
+	return true;
+}
+
+bool StretchedTrajectoryRecorder::record(const StretchedVectorArray &positions, double time) {
+	if (!recording || positions.size() != header.particleCount) {
+		return false;
+	}
+	Frame *frame = NULL;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if ((int)queue.size() >= std::max(1, maxQueuedFrames)) {
+			if (!blockWhenBehind) {
+				droppedFrameCount++;
+				return false;
+			}
+			frameWritten.wait(lock, [this] { return (int)queue.size() < std::max(1, maxQueuedFrames); });
+		}
+		if (!freeFrames.empty()) {
+			frame = freeFrames.back();
+			freeFrames.pop_back();
+		}
+	}
+	if (frame == NULL) {
+		frame = new Frame();
+	}
+	// The copy is all the simulation thread pays for
+	frame->positions = positions;
+	frame->time = time;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(frame);
+	}
+	frameQueued.notify_one();
+	recordedFrameCount++;
+	return true;
+}
+
+bool StretchedTrajectoryRecorder::end() {
+	if (!recording) {
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	frameQueued.notify_one();
+	writer.join();
+	recording = false;
+	sink->flush();
+	bool succeeded = !sinkFailed;
+	if (ownedFile != NULL) {
+		succeeded = ferror(ownedFile) == 0 && succeeded;
+		fclose(ownedFile);
+		ownedFile = NULL;
+		delete ownedSink;
+		ownedSink = NULL;
+	}
+	sink = NULL;
+	return succeeded;
+}
+
+bool StretchedTrajectoryRecorder::isRecording() const {
+	return recording;
+}
+
+int StretchedTrajectoryRecorder::getRecordedFrameCount() const {
+	return recordedFrameCount;
+}
+
+int StretchedTrajectoryRecorder::getDroppedFrameCount() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return droppedFrameCount;
+}
+
+uint64_t StretchedTrajectoryRecorder::getWrittenBytes() const {
+	return writtenBytes;
+}
+
+uint64_t StretchedTrajectoryRecorder::getRawBytes() const {
+	return (uint64_t)recordedFrameCount * header.particleCount * 3 * sizeof(double);
+}
+
+void StretchedTrajectoryRecorder::writeFrames() {
+	while (true) {
+		Frame *frame = NULL;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			frameQueued.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (queue.empty()) {
+				return;
+			}
+			frame = queue.front();
+		}
+		encodeFrame(*frame);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.pop_front();
+			freeFrames.push_back(frame);
+		}
+		frameWritten.notify_one();
+	}
+}
+
+void StretchedTrajectoryRecorder::encodeFrame(const Frame &frame) {
+	int n = header.particleCount;
+	codes.resize((size_t)n * 3);
+	const std::vector<double> *components[3] = { &frame.positions.x, &frame.positions.y, &frame.positions.z };
+	double inverseStep = 1 / header.step;
+	for (int c = 0; c < 3; c++) {
+		const double *values = components[c]->data();
+		int64_t *componentCodes = codes.data() + (size_t)c * n;
+		double origin = header.origin[c];
+		for (int i = 0; i < n; i++) {
+			double scaled = (values[i] - origin) * inverseStep;
+			// Non finite positions are recorded at the origin rather than poisoning the stream
+			componentCodes[i] = std::isfinite(scaled) ? (int64_t)llround(std::max(std::min(scaled, 4e18), -4e18)) : 0;
+		}
+	}
+
+	bool keyframe = framesSinceKeyframe == 0;
+	residuals.resize((size_t)n * 3);
+	for (int c = 0; c < 3; c++) {
+		const int64_t *current = codes.data() + (size_t)c * n;
+		const int64_t *previous = previousCodes.data() + (size_t)c * n;
+		const int64_t *older = olderCodes.data() + (size_t)c * n;
+		uint64_t *componentResiduals = residuals.data() + (size_t)c * n;
+		int64_t last = 0;
+		for (int i = 0; i < n; i++) {
+			int64_t prediction;
+			if (keyframe) {
+				prediction = last;
+				last = current[i];
+			} else if (framesSinceKeyframe == 1) {
+				prediction = previous[i];
+			} else {
+				prediction = 2 * previous[i] - older[i];
+			}
+			componentResiduals[i] = zigZag(current[i] - prediction);
+		}
+	}
+	payload.clear();
+	packResiduals(residuals, payload);
+
+	StretchedTrajectoryFrameHeader frameHeader;
+	frameHeader.type = keyframe ? TRAJECTORY_KEYFRAME : TRAJECTORY_DELTA_FRAME;
+	frameHeader.payloadSize = (uint32_t)payload.size();
+	frameHeader.time = frame.time;
+	write(&frameHeader, sizeof(frameHeader));
+	write(payload.data(), payload.size());
+
+	olderCodes.swap(previousCodes);
+	previousCodes.swap(codes);
+	framesSinceKeyframe = (framesSinceKeyframe + 1) % header.keyframeInterval;
+}
+
+void StretchedTrajectoryRecorder::write(const void *data, size_t length) {
+	if (length == 0) {
+		return;
+	}
+	size_t written = sink->putN((const char *)data, length);
+	if (written != length) {
+		sinkFailed = true;
+	}
+	writtenBytes += written;
+}
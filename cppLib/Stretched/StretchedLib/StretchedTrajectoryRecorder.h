@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "StretchedByteSink.h"
+#include "StretchedVectorArray.h"
+
+static const char STRETCHED_TRAJECTORY_MAGIC[8] = { 'S', 'T', 'R', 'T', 'R', 'A', 'J', '0' };
+static const uint32_t STRETCHED_TRAJECTORY_VERSION = 1;
+static const char *const STRETCHED_TRAJECTORY_EXTENSION = "sttr";
+// Residuals sharing one bit width
+static const size_t TRAJECTORY_BLOCK_SIZE = 32;
+
+enum StretchedTrajectoryFrameType {
+	TRAJECTORY_KEYFRAME = 0,
+	TRAJECTORY_DELTA_FRAME = 1
+};
+
+// Start of a trajectory file, followed by the frames
+struct StretchedTrajectoryHeader {
+	char magic[8];
+	uint32_t version;
+	// 0x01020304 as written, to reject files from a machine of the other byte order
+	uint32_t byteOrderMark;
+	int32_t particleCount;
+	int32_t keyframeInterval;
+	int32_t quantizationBits;
+	int32_t reserved;
+	// A quantized coordinate q decodes to origin[axis] + q * step (the decodeOffsets / decodeScales of the
+	// utf8 mesh converter's BoundsParams, with one uniform scale for the three axes)
+	double origin[3];
+	double step;
+};
+
+// Precedes the payload of every frame, so a reader can skip from frame to frame
+struct StretchedTrajectoryFrameHeader {
+	uint32_t type;
+	uint32_t payloadSize;
+	double time;
+};
+
+// Records particle positions over time into a compact stream. Coordinates are quantized on a uniform
+// grid fitted to the bounds of the first frame (quantizationBits per axis across the largest extent,
+// as BoundsParams::FromBounds does for mesh positions); particles that later leave those bounds are
+// still represented since the codes are not clamped. Each frame stores the three components one after
+// the other as ZigZag encoded residuals:
+// - a keyframe (every keyframeInterval frames) stores each coordinate as the difference from the
+//   previous particle, like CompressQuantizedAttribsToUtf8 does for mesh attributes;
+// - the other frames store each coordinate as the difference from a constant velocity prediction
+//   out of the two frames before (just the previous frame right after a keyframe).
+// The residuals of a smoothly moving fabric take a few bits, so rather than a varint per residual (one
+// byte at least) they are bit packed in blocks with a shared width, and regions at rest cost one byte
+// per block.
+//
+// record only copies the positions into a recycled buffer; quantization, encoding and writing happen on
+// a background thread. If the writer falls more than maxQueuedFrames behind, record drops the frame
+// instead of waiting (see getDroppedFrameCount) unless blockWhenBehind is set.
+class StretchedTrajectoryRecorder {
+
+public:
+	StretchedTrajectoryRecorder();
+	~StretchedTrajectoryRecorder();
+
+	int keyframeInterval = 60;
+	// 14 bits like the mesh positions of BoundsParams, about 1/16000 of the fabric size
+	int quantizationBits = 14;
+	int maxQueuedFrames = 8;
+	bool blockWhenBehind = false;
+
+	// Starts a recording into sink (not owned, must outlive end) with the bounds of positions
+	bool begin(StretchedByteSink *sink, const StretchedVectorArray &positions);
+	// Same, into a new file
+	bool begin(const char *fileName, const StretchedVectorArray &positions);
+	// Queues a frame, returns false if it was dropped or no recording is running
+	bool record(const StretchedVectorArray &positions, double time);
+	// Writes the queued frames and stops the recording; returns false if the sink did not take every byte
+	bool end();
+	bool isRecording() const;
+
+	int getRecordedFrameCount() const;
+	int getDroppedFrameCount() const;
+	// Bytes written so far, and the size the recorded frames have as plain doubles
+	uint64_t getWrittenBytes() const;
+	uint64_t getRawBytes() const;
+
+	StretchedTrajectoryRecorder(const StretchedTrajectoryRecorder &) = delete;
+	StretchedTrajectoryRecorder &operator=(const StretchedTrajectoryRecorder &) = delete;
+
+private:
+	struct Frame {
+		StretchedVectorArray positions;
+		double time = 0;
+	};
+
+	StretchedByteSink *sink = NULL;
+	FILE *ownedFile = NULL;
+	StretchedFileSink *ownedSink = NULL;
+	StretchedTrajectoryHeader header;
+
+	std::thread writer;
+	mutable std::mutex mutex;
+	std::condition_variable frameQueued;
+	std::condition_variable frameWritten;
+	std::deque<Frame *> queue;
+	std::vector<Frame *> freeFrames;
+	bool stopping = false;
+	bool recording = false;
+	bool sinkFailed = false;
+
+	int recordedFrameCount = 0;
+	int droppedFrameCount = 0;
+	// Updated by the writer thread
+	std::atomic<uint64_t> writtenBytes;
+
+	// Writer thread state: quantized coordinates of the last two frames and the frame being encoded
+	std::vector<int64_t> previousCodes;
+	std::vector<int64_t> olderCodes;
+	std::vector<int64_t> codes;
+	std::vector<uint64_t> residuals;
+	std::vector<char> payload;
+	int framesSinceKeyframe = 0;
+
+	void writeFrames();
+	void encodeFrame(const Frame &frame);
+	void write(const void *data, size_t length);
+};
@@ -0,0 +1,228 @@
+#include "StretchedTriangleBVH.h"
+
+#include <algorithm>
+
+
+static bool boxesOverlap(const StretchedBVHNode &a, const StretchedBVHNode &b) {
+	for (int axis = 0; axis < 3; axis++) {
+		if (a.max[axis] < b.min[axis] || b.max[axis] < a.min[axis]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void growBox(StretchedBVHNode &node, const double min[3], const double max[3]) {
+	for (int axis = 0; axis < 3; axis++) {
+		node.min[axis] = std::min(node.min[axis], min[axis]);
+		node.max[axis] = std::max(node.max[axis], max[axis]);
+	}
+}
+
+StretchedTriangleBVH::StretchedTriangleBVH() {
+	// Nothing to see here
+}
+
+StretchedTriangleBVH::~StretchedTriangleBVH() {
+	// Nothing to see here
+}
+
+bool StretchedTriangleBVH::isBuilt() const {
+	return !nodes.empty();
+}
+
+int StretchedTriangleBVH::getTriangleCount() const {
+	return (int)triangleOrder.size();
+}
+
+int StretchedTriangleBVH::getNodeCount() const {
+	return (int)nodes.size();
+}
+
+const std::vector<StretchedBVHNode> &StretchedTriangleBVH::getNodes() const {
+	return nodes;
+}
+
+void StretchedTriangleBVH::computeTriangleBox(int triangle, const StretchedVectorArray &start, const StretchedVectorArray &end, double thickness, double min[3], double max[3]) const {
+	const std::vector<double> *startAxes[3] = { &start.x, &start.y, &start.z };
+	const std::vector<double> *endAxes[3] = { &end.x, &end.y, &end.z };
+	for (int axis = 0; axis < 3; axis++) {
+		const std::vector<double> &s = *startAxes[axis];
+		const std::vector<double> &e = *endAxes[axis];
+		double low = s[triangles[3 * triangle]], high = low;
+		for (int k = 0; k < 3; k++) {
+			int v = triangles[3 * triangle + k];
+			low = std::min(low, std::min(s[v], e[v]));
+			high = std::max(high, std::max(s[v], e[v]));
+		}
+		min[axis] = low - thickness;
+		max[axis] = high + thickness;
+	}
+}
+
+void StretchedTriangleBVH::build(const std::vector<int> &triangleIndices, const StretchedVectorArray &start, const StretchedVectorArray &end, double thickness) {
+	triangles = triangleIndices;
+	int triangleCount = (int)triangles.size() / 3;
+	triangleOrder.resize(triangleCount);
+	std::vector<double> centroids(3 * triangleCount);
+	for (int t = 0; t < triangleCount; t++) {
+		triangleOrder[t] = t;
+		int a = triangles[3 * t], b = triangles[3 * t + 1], c = triangles[3 * t + 2];
+		centroids[3 * t] = (end.x[a] + end.x[b] + end.x[c]) / 3;
+		centroids[3 * t + 1] = (end.y[a] + end.y[b] + end.y[c]) / 3;
+		centroids[3 * t + 2] = (end.z[a] + end.z[b] + end.z[c]) / 3;
+	}
+	nodes.clear();
+	if (triangleCount == 0) {
+		return;
+	}
+	nodes.reserve(2 * triangleCount / std::max(1, maxLeafSize) + 1);
+	buildNode(centroids, 0, triangleCount);
+	refit(start, end, thickness);
+}
+
+// Splits triangleOrder[start, end) at the median centroid along the widest axis
+int StretchedTriangleBVH::buildNode(std::vector<double> &centroids, int start, int end) {
+	int index = (int)nodes.size();
+	nodes.push_back(StretchedBVHNode());
+	StretchedBVHNode &node = nodes[index];
+	node.left = -1;
+	node.right = -1;
+	node.start = start;
+	node.count = end - start;
+	if (end - start <= maxLeafSize) {
+		return index;
+	}
+
+	double low[3], high[3];
+	for (int axis = 0; axis < 3; axis++) {
+		low[axis] = high[axis] = centroids[3 * triangleOrder[start] + axis];
+	}
+	for (int i = start + 1; i < end; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			low[axis] = std::min(low[axis], centroids[3 * triangleOrder[i] + axis]);
+			high[axis] = std::max(high[axis], centroids[3 * triangleOrder[i] + axis]);
+		}
+	}
+	int splitAxis = 0;
+	for (int axis = 1; axis < 3; axis++) {
+		if (high[axis] - low[axis] > high[splitAxis] - low[splitAxis]) {
+			splitAxis = axis;
+		}
+	}
+	int middle = start + (end - start) / 2;
+	std::nth_element(triangleOrder.begin() + start, triangleOrder.begin() + middle, triangleOrder.begin() + end, [&](int a, int b) {
+		return centroids[3 * a + splitAxis] < centroids[3 * b + splitAxis];
+	});
+
+	// nodes may reallocate while building the children, so do not keep the reference
+	int left = buildNode(centroids, start, middle);
+	int right = buildNode(centroids, middle, end);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+void StretchedTriangleBVH::refit(const StretchedVectorArray &start, const StretchedVectorArray &end, double thickness) {
+	triangleBoxes.resize(6 * triangleOrder.size());
+	// Children come after their parent, so walking backwards visits them first
+	for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+		StretchedBVHNode &node = nodes[i];
+		if (node.count > 0) {
+			for (int k = node.start; k < node.start + node.count; k++) {
+				double *min = &triangleBoxes[6 * k];
+				double *max = min + 3;
+				computeTriangleBox(triangleOrder[k], start, end, thickness, min, max);
+				if (k == node.start) {
+					std::copy(min, min + 3, node.min);
+					std::copy(max, max + 3, node.max);
+				} else {
+					growBox(node, min, max);
+				}
+			}
+		} else {
+			const StretchedBVHNode &left = nodes[node.left];
+			const StretchedBVHNode &right = nodes[node.right];
+			for (int axis = 0; axis < 3; axis++) {
+				node.min[axis] = std::min(left.min[axis], right.min[axis]);
+				node.max[axis] = std::max(left.max[axis], right.max[axis]);
+			}
+		}
+	}
+}
+
+bool StretchedTriangleBVH::sharesVertex(int a, int b) const {
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			if (triangles[3 * a + i] == triangles[3 * b + j]) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// i and j are positions in the leaf order
+void StretchedTriangleBVH::addPair(int i, int j, std::vector<int> &pairsA, std::vector<int> &pairsB) const {
+	const double *boxI = &triangleBoxes[6 * i];
+	const double *boxJ = &triangleBoxes[6 * j];
+	for (int axis = 0; axis < 3; axis++) {
+		if (boxI[3 + axis] < boxJ[axis] || boxJ[3 + axis] < boxI[axis]) {
+			return;
+		}
+	}
+	int a = triangleOrder[i], b = triangleOrder[j];
+	if (sharesVertex(a, b)) {
+		return;
+	}
+	pairsA.push_back(std::min(a, b));
+	pairsB.push_back(std::max(a, b));
+}
+
+void StretchedTriangleBVH::findOverlappingPairs(std::vector<int> &pairsA, std::vector<int> &pairsB) const {
+	if (!nodes.empty()) {
+		collideSelf(0, pairsA, pairsB);
+	}
+}
+
+void StretchedTriangleBVH::collideSelf(int index, std::vector<int> &pairsA, std::vector<int> &pairsB) const {
+	const StretchedBVHNode &node = nodes[index];
+	if (node.count > 0) {
+		for (int i = node.start; i < node.start + node.count; i++) {
+			for (int j = i + 1; j < node.start + node.count; j++) {
+				addPair(i, j, pairsA, pairsB);
+			}
+		}
+		return;
+	}
+	collideSelf(node.left, pairsA, pairsB);
+	collideSelf(node.right, pairsA, pairsB);
+	collideNodes(node.left, node.right, pairsA, pairsB);
+}
+
+void StretchedTriangleBVH::collideNodes(int a, int b, std::vector<int> &pairsA, std::vector<int> &pairsB) const {
+	const StretchedBVHNode &nodeA = nodes[a];
+	const StretchedBVHNode &nodeB = nodes[b];
+	if (!boxesOverlap(nodeA, nodeB)) {
+		return;
+	}
+	if (nodeA.count > 0 && nodeB.count > 0) {
+		for (int i = nodeA.start; i < nodeA.start + nodeA.count; i++) {
+			for (int j = nodeB.start; j < nodeB.start + nodeB.count; j++) {
+				addPair(i, j, pairsA, pairsB);
+			}
+		}
+		return;
+	}
+	// Descend into the inner node (the larger one if both are inner nodes)
+	bool descendA = nodeB.count > 0 || (nodeA.count == 0 && nodeA.max[0] - nodeA.min[0] + nodeA.max[1] - nodeA.min[1] + nodeA.max[2] - nodeA.min[2]
+		>= nodeB.max[0] - nodeB.min[0] + nodeB.max[1] - nodeB.min[1] + nodeB.max[2] - nodeB.min[2]);
+	if (descendA) {
+		collideNodes(nodeA.left, b, pairsA, pairsB);
+		collideNodes(nodeA.right, b, pairsA, pairsB);
+	} else {
+		collideNodes(a, nodeB.left, pairsA, pairsB);
+		collideNodes(a, nodeB.right, pairsA, pairsB);
+	}
+}
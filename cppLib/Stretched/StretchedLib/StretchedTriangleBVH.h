@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include "StretchedVectorArray.h"
+
+// Axis aligned box node of the triangle hierarchy. Leaves reference triangles
+// [start, start + count) of the BVH triangle order, inner nodes have count == 0.
+struct StretchedBVHNode {
+	double min[3];
+	double max[3];
+	int left;
+	int right;
+	int start;
+	int count;
+};
+
+// Bounding volume hierarchy over the triangles of the simulated mesh.
+// The tree is built once (median split of the triangle centroids) and then only refit bottom-up
+// every step, since the mesh topology does not change while the cloth moves. The boxes bound the
+// motion of each triangle over the step (start -> end positions) so the hierarchy can be used as
+// the broadphase for continuous collision detection.
+class StretchedTriangleBVH {
+
+public:
+	StretchedTriangleBVH();
+	~StretchedTriangleBVH();
+
+	// Triangles per leaf
+	int maxLeafSize = 4;
+
+	// Builds the tree for the triangles (3 indices each) moving from start to end, boxes padded by thickness
+	void build(const std::vector<int> &triangleIndices, const StretchedVectorArray &start, const StretchedVectorArray &end, double thickness);
+	// Updates the boxes for new positions, leaves first then up to the root. The tree shape is kept.
+	void refit(const StretchedVectorArray &start, const StretchedVectorArray &end, double thickness);
+
+	// Appends the pairs of triangles (a < b) whose boxes overlap, skipping triangles which share a vertex
+	void findOverlappingPairs(std::vector<int> &pairsA, std::vector<int> &pairsB) const;
+
+	bool isBuilt() const;
+	int getTriangleCount() const;
+	int getNodeCount() const;
+	const std::vector<StretchedBVHNode> &getNodes() const;
+
+private:
+	std::vector<int> triangles;
+	// Nodes in depth first order, so children always come after their parent
+	std::vector<StretchedBVHNode> nodes;
+	// Triangles in leaf order, with their boxes (min xyz, max xyz) in the same order
+	std::vector<int> triangleOrder;
+	std::vector<double> triangleBoxes;
+
+	int buildNode(std::vector<double> &centroids, int start, int end);
+	void computeTriangleBox(int triangle, const StretchedVectorArray &start, const StretchedVectorArray &end, double thickness, double min[3], double max[3]) const;
+	bool sharesVertex(int a, int b) const;
+
+	void collideSelf(int node, std::vector<int> &pairsA, std::vector<int> &pairsB) const;
+	void collideNodes(int a, int b, std::vector<int> &pairsA, std::vector<int> &pairsB) const;
+	void addPair(int i, int j, std::vector<int> &pairsA, std::vector<int> &pairsB) const;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "MathLib/P3D.h"
+#include "MathLib/V3D.h"
+
+// Structure-of-arrays storage for a list of 3D vectors. Each component lives in
+// its own contiguous array so that simulation loops stream through memory.
+struct StretchedVectorArray {
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<double> z;
+
+	int size() const {
+		return (int)x.size();
+	}
+
+	void resize(int n, double value = 0) {
+		x.resize(n, value);
+		y.resize(n, value);
+		z.resize(n, value);
+	}
+
+	void reserve(int n) {
+		x.reserve(n);
+		y.reserve(n);
+		z.reserve(n);
+	}
+
+	void clear() {
+		x.clear();
+		y.clear();
+		z.clear();
+	}
+
+	void setZero() {
+		std::fill(x.begin(), x.end(), 0.0);
+		std::fill(y.begin(), y.end(), 0.0);
+		std::fill(z.begin(), z.end(), 0.0);
+	}
+
+	void push_back(const P3D &p) {
+		x.push_back(p[0]);
+		y.push_back(p[1]);
+		z.push_back(p[2]);
+	}
+
+	void set(int i, const P3D &p) {
+		x[i] = p[0];
+		y[i] = p[1];
+		z[i] = p[2];
+	}
+
+	P3D getPoint(int i) const {
+		return P3D(x[i], y[i], z[i]);
+	}
+
+	V3D getVector(int i) const {
+		return V3D(x[i], y[i], z[i]);
+	}
+};